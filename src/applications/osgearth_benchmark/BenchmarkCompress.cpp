@@ -0,0 +1,255 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarth/ImageUtils>
+#include <osgEarth/TextureCompressor>
+#include <osgDB/ReadFile>
+#include <osg/Image>
+#include <osg/Timer>
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    struct Quality
+    {
+        const char*                 _name;
+        TextureCompressor::Quality  _quality;
+    };
+
+    const Quality s_qualities[] =
+    {
+        { "fast",   TextureCompressor::QUALITY_FAST   },
+        { "normal", TextureCompressor::QUALITY_NORMAL },
+        { "high",   TextureCompressor::QUALITY_HIGH   }
+    };
+    const unsigned s_numQualities = sizeof(s_qualities)/sizeof(s_qualities[0]);
+
+    // Smooth color gradients with a little noise, which is roughly what aerial
+    // imagery looks like to a block compressor. The alpha channel is a radial
+    // ramp when requested, and opaque otherwise.
+    osg::Image* createImage( unsigned size, bool withAlpha )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        image->setInternalTextureFormat( GL_RGBA8 );
+
+        unsigned state = 1u;
+        for( unsigned t = 0; t < size; ++t )
+        {
+            unsigned char* p = image->data( 0, t );
+            for( unsigned s = 0; s < size; ++s, p += 4 )
+            {
+                state = state*1664525u + 1013904223u;
+                int noise = (int)((state >> 24) & 0x1f) - 16;
+
+                float u = (float)s / (float)size;
+                float v = (float)t / (float)size;
+                p[0] = (unsigned char)osg::clampBetween( (int)(255.0f*u) + noise, 0, 255 );
+                p[1] = (unsigned char)osg::clampBetween( (int)(255.0f*v) + noise, 0, 255 );
+                p[2] = (unsigned char)osg::clampBetween( (int)(128.0f + 127.0f*sinf(8.0f*u)*cosf(8.0f*v)) + noise, 0, 255 );
+
+                float du = u - 0.5f, dv = v - 0.5f;
+                p[3] = withAlpha ?
+                    (unsigned char)osg::clampBetween( (int)(255.0f*(1.0f - 2.0f*sqrtf(du*du + dv*dv))), 0, 255 ) :
+                    255;
+            }
+        }
+        return image;
+    }
+
+    // Root-mean-square error (in 8-bit units, over all four channels) of the
+    // top level of a compressed image.
+    double computeRMSE( const osg::Image* original, const osg::Image* compressed )
+    {
+        ImageUtils::PixelReader readOriginal( original );
+        ImageUtils::PixelReader readCompressed( compressed );
+
+        double sum = 0.0;
+        for( int t = 0; t < original->t(); ++t )
+        {
+            for( int s = 0; s < original->s(); ++s )
+            {
+                osg::Vec4f d = (readOriginal(s, t) - readCompressed(s, t)) * 255.0f;
+                sum += d.x()*d.x() + d.y()*d.y() + d.z()*d.z() + d.w()*d.w();
+            }
+        }
+        return sqrt( sum / (4.0 * (double)(original->s() * original->t())) );
+    }
+
+    // Size of the top level of a compressed image, in bytes.
+    unsigned getTopLevelBytes( const osg::Image* image )
+    {
+        unsigned blockBytes = image->getPixelFormat() == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8u : 16u;
+        return ((image->s()+3)/4) * ((image->t()+3)/4) * blockBytes;
+    }
+}
+
+
+int
+Benchmark::compress( osg::ArgumentParser& args )
+{
+    std::vector<unsigned> sizes;
+    unsigned size = 0u;
+    while( args.read( "--size", size ) )
+        if ( size > 0u )
+            sizes.push_back( size );
+
+    if ( sizes.empty() )
+    {
+        sizes.push_back( 256u );
+        sizes.push_back( 512u );
+        sizes.push_back( 1024u );
+    }
+
+    std::vector<std::string> qualityNames;
+    std::string qualityName;
+    while( args.read( "--quality", qualityName ) )
+        qualityNames.push_back( qualityName );
+
+    std::vector<const Quality*> qualities;
+    for( unsigned q = 0; q < s_numQualities; ++q )
+    {
+        bool wanted = qualityNames.empty();
+        for( unsigned i = 0; i < qualityNames.size() && !wanted; ++i )
+            wanted = qualityNames[i] == s_qualities[q]._name;
+        if ( wanted )
+            qualities.push_back( &s_qualities[q] );
+    }
+
+    if ( qualities.empty() )
+        return usage( "No matching --quality; choose from fast, normal, high" );
+
+    std::vector<TextureCompressor::Format> formats;
+    std::string formatName;
+    while( args.read( "--format", formatName ) )
+    {
+        if ( formatName == "dxt1" )
+            formats.push_back( TextureCompressor::FORMAT_DXT1 );
+        else if ( formatName == "dxt5" )
+            formats.push_back( TextureCompressor::FORMAT_DXT5 );
+        else
+            return usage( "Unknown --format; choose from dxt1, dxt5" );
+    }
+
+    if ( formats.empty() )
+    {
+        formats.push_back( TextureCompressor::FORMAT_DXT1 );
+        formats.push_back( TextureCompressor::FORMAT_DXT5 );
+    }
+
+    unsigned numThreads = 1u;
+    while( args.read( "--threads", numThreads ) );
+    numThreads = osg::maximum( numThreads, 1u );
+
+    unsigned iterations = 5u;
+    while( args.read( "--iterations", iterations ) );
+    iterations = osg::maximum( iterations, 1u );
+
+    // An optional real image replaces the synthetic ones.
+    osg::ref_ptr<osg::Image> fileImage;
+    std::string imageFile;
+    if ( args.read( "--image", imageFile ) )
+    {
+        osg::ref_ptr<osg::Image> image = osgDB::readImageFile( imageFile );
+        if ( image.valid() )
+            fileImage = ImageUtils::convertToRGBA8( image.get() );
+        if ( !fileImage.valid() )
+            return usage( "Failed to load an RGBA-convertible image from " + imageFile );
+
+        sizes.clear();
+        sizes.push_back( fileImage->s() );
+    }
+
+    std::cout
+        << "Compressing with mipmaps on " << numThreads << " thread(s) ("
+        << iterations << " iterations each, ms per image)" << std::endl
+        << std::endl
+        << std::left
+        << std::setw(7)  << "Format"
+        << std::setw(11) << "Size"
+        << std::setw(9)  << "Quality"
+        << std::right
+        << std::setw(11) << "Time"
+        << std::setw(12) << "Mpixels/s"
+        << std::setw(8)  << "Ratio"
+        << std::setw(9)  << "RMSE" << std::endl;
+
+    for( unsigned f = 0; f < formats.size(); ++f )
+    {
+        bool dxt5 = formats[f] == TextureCompressor::FORMAT_DXT5;
+
+        for( unsigned s = 0; s < sizes.size(); ++s )
+        {
+            osg::ref_ptr<osg::Image> source = fileImage.valid() ?
+                fileImage.get() :
+                createImage( sizes[s], dxt5 );
+
+            std::stringstream buf;
+            buf << source->s() << "x" << source->t();
+
+            for( unsigned q = 0; q < qualities.size(); ++q )
+            {
+                osg::ref_ptr<TextureCompressor> compressor = new TextureCompressor(
+                    formats[f], qualities[q]->_quality, numThreads );
+
+                osg::ref_ptr<osg::Image> result;
+                osg::Timer_t total = 0;
+                for( unsigned i = 0; i < iterations; ++i )
+                {
+                    osg::Timer_t start = osg::Timer::instance()->tick();
+                    result = compressor->compress( source.get() );
+                    total += osg::Timer::instance()->tick() - start;
+                }
+
+                if ( !result.valid() )
+                    return usage( "Compression failed" );
+
+                double ms    = 1000.0 * osg::Timer::instance()->delta_s( 0, total ) / (double)iterations;
+                double mpix  = ms > 0.0 ? (double)(source->s() * source->t()) / (1000.0 * ms) : 0.0;
+                double ratio = (double)(source->s() * source->t() * 4) / (double)getTopLevelBytes( result.get() );
+                double rmse  = computeRMSE( source.get(), result.get() );
+
+                std::cout
+                    << std::left
+                    << std::setw(7)  << (dxt5 ? "dxt5" : "dxt1")
+                    << std::setw(11) << buf.str()
+                    << std::setw(9)  << qualities[q]->_name
+                    << std::right << std::fixed
+                    << std::setw(11) << std::setprecision(3) << ms
+                    << std::setw(12) << std::setprecision(1) << mpix
+                    << std::setw(7)  << std::setprecision(1) << ratio << "x"
+                    << std::setw(9)  << std::setprecision(2) << rmse << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
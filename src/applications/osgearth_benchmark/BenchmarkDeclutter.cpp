@@ -0,0 +1,220 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarth/Decluttering>
+#include <osg/BoundingBox>
+#include <osg/Timer>
+
+#include <iomanip>
+#include <iostream>
+#include <limits.h>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // One synthetic label: a window-space box and the "geode" it belongs to.
+    // Consecutive labels share an owner in pairs, like an icon and its text.
+    struct Label
+    {
+        osg::BoundingBox _box;
+        const void*      _owner;
+    };
+
+    // Scatters labels across (and a little beyond) the viewport. Each frame
+    // jitters them a bit, as if the camera were moving.
+    void createLabels(unsigned            count,
+                      float               width,
+                      float               height,
+                      float               labelWidth,
+                      float               labelHeight,
+                      unsigned            frame,
+                      std::vector<Label>& out)
+    {
+        out.resize( count );
+        unsigned state = 12345u;
+        for( unsigned i = 0; i < count; ++i )
+        {
+            state = state*1664525u + 1013904223u;
+            float u = (float)(state >> 8) / 16777216.0f;
+            state = state*1664525u + 1013904223u;
+            float v = (float)(state >> 8) / 16777216.0f;
+            state = state*1664525u + 1013904223u;
+            float size = 0.5f + (float)(state >> 8) / 16777216.0f;
+
+            float x = -0.1f*width  + 1.2f*width*u  + (float)(frame % 16);
+            float y = -0.1f*height + 1.2f*height*v + (float)(frame % 8);
+
+            out[i]._box.set( x, y, 0.0f, x + labelWidth*size, y + labelHeight*size, 0.0f );
+            out[i]._owner = (const void*)(size_t)(1u + i/2u);
+        }
+    }
+
+    // The original all-pairs test, for comparison.
+    struct BruteForce
+    {
+        std::vector< std::pair<const void*, osg::BoundingBox> > _used;
+
+        void reset( float, float, float, float ) { _used.clear(); }
+
+        bool isClear( const osg::BoundingBox& box, const void* owner )
+        {
+            for( unsigned j = 0; j < _used.size(); ++j )
+            {
+                const osg::BoundingBox& b = _used[j].second;
+                bool isClear =
+                    box.xMin() > b.xMax() ||
+                    box.xMax() < b.xMin() ||
+                    box.yMin() > b.yMax() ||
+                    box.yMax() < b.yMin();
+                if ( !isClear && owner != _used[j].first )
+                    return false;
+            }
+            return true;
+        }
+
+        void insert( const osg::BoundingBox& box, const void* owner )
+        {
+            _used.push_back( std::make_pair(owner, box) );
+        }
+    };
+
+    // Runs the declutter pass the way DeclutterSort does and records which
+    // labels were accepted. Returns milliseconds.
+    template<typename T>
+    double runPass(T&                        occupancy,
+                   const std::vector<Label>& labels,
+                   float                     width,
+                   float                     height,
+                   unsigned                  limit,
+                   std::vector<bool>&        out_accepted)
+    {
+        out_accepted.assign( labels.size(), false );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        occupancy.reset( 0.0f, 0.0f, width, height );
+
+        unsigned passed = 0u;
+        for( unsigned i = 0; i < labels.size() && passed < limit; ++i )
+        {
+            if ( occupancy.isClear(labels[i]._box, labels[i]._owner) )
+            {
+                occupancy.insert( labels[i]._box, labels[i]._owner );
+                out_accepted[i] = true;
+                ++passed;
+            }
+        }
+
+        return 1000.0 * osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    }
+}
+
+
+int
+Benchmark::declutter( osg::ArgumentParser& args )
+{
+    std::vector<unsigned> counts;
+    unsigned count = 0u;
+    while( args.read( "--labels", count ) )
+        if ( count > 0u )
+            counts.push_back( count );
+
+    if ( counts.empty() )
+    {
+        counts.push_back( 500u );
+        counts.push_back( 2000u );
+        counts.push_back( 5000u );
+        counts.push_back( 10000u );
+    }
+
+    float width = 1920.0f, height = 1080.0f;
+    while( args.read( "--viewport", width, height ) );
+
+    float labelWidth = 120.0f, labelHeight = 24.0f;
+    while( args.read( "--label-size", labelWidth, labelHeight ) );
+
+    float cellSize = 64.0f;
+    while( args.read( "--cell-size", cellSize ) );
+
+    unsigned limit = UINT_MAX;
+    while( args.read( "--max-objects", limit ) );
+
+    unsigned frames = 20u;
+    while( args.read( "--frames", frames ) );
+    frames = osg::maximum( frames, 1u );
+
+    std::cout
+        << "Decluttering " << width << "x" << height << " viewport, "
+        << frames << " frames each (ms per frame)" << std::endl
+        << std::endl
+        << std::right
+        << std::setw(8)  << "Labels"
+        << std::setw(10) << "Accepted"
+        << std::setw(13) << "Brute force"
+        << std::setw(10) << "Grid"
+        << std::setw(10) << "Speedup" << std::endl;
+
+    // the grid is reused across frames, like the one in the render bin.
+    DeclutterGrid grid( cellSize );
+    BruteForce    brute;
+
+    for( unsigned c = 0; c < counts.size(); ++c )
+    {
+        double   bruteTime = 0.0, gridTime = 0.0;
+        unsigned accepted  = 0u;
+
+        std::vector<Label> labels;
+        std::vector<bool>  bruteAccepted, gridAccepted;
+
+        for( unsigned f = 0; f < frames; ++f )
+        {
+            createLabels( counts[c], width, height, labelWidth, labelHeight, f, labels );
+
+            bruteTime += runPass( brute, labels, width, height, limit, bruteAccepted );
+            gridTime  += runPass( grid,  labels, width, height, limit, gridAccepted );
+
+            if ( bruteAccepted != gridAccepted )
+            {
+                std::cout << "Grid results differ from brute force at " << counts[c] << " labels!" << std::endl;
+                return -1;
+            }
+
+            accepted += grid.size();
+        }
+
+        bruteTime /= (double)frames;
+        gridTime  /= (double)frames;
+
+        std::cout
+            << std::right << std::fixed
+            << std::setw(8)  << counts[c]
+            << std::setw(10) << accepted/frames
+            << std::setw(13) << std::setprecision(3) << bruteTime
+            << std::setw(10) << std::setprecision(3) << gridTime
+            << std::setw(9)  << std::setprecision(1) << (gridTime > 0.0 ? bruteTime/gridTime : 0.0) << "x" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,271 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarth/ImageUtils>
+#include <osg/Image>
+#include <osg/Timer>
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // Image formats that ImageUtils has typed kernels for.
+    struct Format
+    {
+        const char* _name;
+        GLenum      _pixelFormat;
+        GLenum      _dataType;
+        bool        _hasAlpha;
+    };
+
+    const Format s_formats[] =
+    {
+        { "rgba8",   GL_RGBA,      GL_UNSIGNED_BYTE, true  },
+        { "rgb8",    GL_RGB,       GL_UNSIGNED_BYTE, false },
+        { "l8",      GL_LUMINANCE, GL_UNSIGNED_BYTE, false },
+        { "rgba32f", GL_RGBA,      GL_FLOAT,         true  },
+        { "l32f",    GL_LUMINANCE, GL_FLOAT,         false }
+    };
+    const unsigned s_numFormats = sizeof(s_formats)/sizeof(s_formats[0]);
+
+    osg::Image* createImage( const Format& format, unsigned size )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, format._pixelFormat, format._dataType );
+        image->setInternalTextureFormat( format._pixelFormat );
+        ImageUtils::normalizeImage( image );
+        return image;
+    }
+
+    // Fills an image with repeatable noise in [0..1] so that runs are comparable.
+    void fillNoise( osg::Image* image, unsigned seed )
+    {
+        unsigned state = seed;
+        unsigned bytes = image->getTotalSizeInBytes();
+
+        if ( image->getDataType() == GL_FLOAT )
+        {
+            float* p = (float*)image->data();
+            for( unsigned i = 0; i < bytes/sizeof(float); ++i )
+            {
+                state = state*1664525u + 1013904223u;
+                p[i] = (float)(state >> 8) / 16777216.0f;
+            }
+        }
+        else
+        {
+            unsigned char* p = image->data();
+            for( unsigned i = 0; i < bytes; ++i )
+            {
+                state = state*1664525u + 1013904223u;
+                p[i] = (unsigned char)(state >> 24);
+            }
+        }
+    }
+
+    // Fills an image with a single value in every component.
+    void fillSolid( osg::Image* image, float value )
+    {
+        unsigned bytes = image->getTotalSizeInBytes();
+
+        if ( image->getDataType() == GL_FLOAT )
+        {
+            float* p = (float*)image->data();
+            for( unsigned i = 0; i < bytes/sizeof(float); ++i )
+                p[i] = value;
+        }
+        else
+        {
+            memset( image->data(), (int)(value*255.0f), bytes );
+        }
+    }
+
+    // Inputs shared by all the operations for one format/size combination.
+    struct Inputs
+    {
+        osg::ref_ptr<osg::Image> _noise;    // random pixels
+        osg::ref_ptr<osg::Image> _noise2;   // different random pixels
+        osg::ref_ptr<osg::Image> _solid;    // one color; worst case for isSingleColorImage
+        osg::ref_ptr<osg::Image> _clear;    // fully transparent; worst case for isEmptyImage
+        osg::ref_ptr<osg::Image> _work;     // scratch copy of _noise for in-place operations
+        osg::ref_ptr<osg::Image> _half;     // pre-allocated half-size output
+    };
+
+    typedef void (*OpFunc)( Inputs& );
+
+    void opResize     ( Inputs& in ) { ImageUtils::resizeImage( in._noise.get(), in._half->s(), in._half->t(), in._half ); }
+    void opBilinear   ( Inputs& in ) { ImageUtils::resampleImage( in._noise.get(), in._half->s(), in._half->t(), in._half, ImageUtils::FILTER_BILINEAR ); }
+    void opBox        ( Inputs& in ) { ImageUtils::resampleImage( in._noise.get(), in._half->s(), in._half->t(), in._half, ImageUtils::FILTER_BOX ); }
+    void opMipmaps    ( Inputs& in ) { osg::ref_ptr<osg::Image> r = ImageUtils::createMipmapBlendedImage( in._noise.get(), in._noise2.get() ); }
+    void opMix        ( Inputs& in ) { ImageUtils::mix( in._work.get(), in._noise2.get(), 0.5f ); }
+    void opSingleColor( Inputs& in ) { ImageUtils::isSingleColorImage( in._solid.get() ); }
+    void opEmpty      ( Inputs& in ) { ImageUtils::isEmptyImage( in._clear.get() ); }
+    void opPremultiply( Inputs& in ) { ImageUtils::convertToPremultipliedAlpha( in._work.get() ); }
+    void opFeather    ( Inputs& in ) { ImageUtils::featherAlphaRegions( in._work.get() ); }
+
+    struct Op
+    {
+        const char* _name;
+        OpFunc      _func;
+        bool        _needsAlpha;    // only meaningful for formats with an alpha channel
+        bool        _inPlace;       // modifies _work, which is reset (untimed) before each call
+    };
+
+    const Op s_ops[] =
+    {
+        { "resize",       opResize,      false, false },
+        { "bilinear",     opBilinear,    false, false },
+        { "box",          opBox,         false, false },
+        { "mipmaps",      opMipmaps,     false, false },
+        { "mix",          opMix,         false, true  },
+        { "single-color", opSingleColor, false, false },
+        { "empty",        opEmpty,       true,  false },
+        { "premultiply",  opPremultiply, true,  true  },
+        { "feather",      opFeather,     true,  true  }
+    };
+    const unsigned s_numOps = sizeof(s_ops)/sizeof(s_ops[0]);
+
+    // Runs one operation "iterations" times and returns the average time per call in ms.
+    double timeOp( const Op& op, Inputs& in, unsigned iterations )
+    {
+        osg::Timer_t total = 0;
+        for( unsigned i = 0; i < iterations; ++i )
+        {
+            if ( op._inPlace )
+                memcpy( in._work->data(), in._noise->data(), in._noise->getTotalSizeInBytes() );
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            op._func( in );
+            total += osg::Timer::instance()->tick() - start;
+        }
+        return 1000.0 * osg::Timer::instance()->delta_s( 0, total ) / (double)iterations;
+    }
+}
+
+
+int
+Benchmark::images( osg::ArgumentParser& args )
+{
+    std::vector<unsigned> sizes;
+    unsigned size = 0u;
+    while( args.read( "--size", size ) )
+        if ( size > 1u )
+            sizes.push_back( size );
+
+    if ( sizes.empty() )
+    {
+        sizes.push_back( 64u );
+        sizes.push_back( 256u );
+        sizes.push_back( 512u );
+        sizes.push_back( 1024u );
+    }
+
+    std::vector<std::string> formatNames;
+    std::string formatName;
+    while( args.read( "--format", formatName ) )
+        formatNames.push_back( formatName );
+
+    std::vector<const Format*> formats;
+    for( unsigned f = 0; f < s_numFormats; ++f )
+    {
+        bool wanted = formatNames.empty();
+        for( unsigned i = 0; i < formatNames.size() && !wanted; ++i )
+            wanted = formatNames[i] == s_formats[f]._name;
+        if ( wanted )
+            formats.push_back( &s_formats[f] );
+    }
+
+    if ( formats.empty() )
+        return usage( "No matching --format; choose from rgba8, rgb8, l8, rgba32f, l32f" );
+
+    unsigned iterations = 20u;
+    while( args.read( "--iterations", iterations ) );
+    iterations = osg::maximum( iterations, 1u );
+
+    std::cout
+        << "Timing ImageUtils operations (" << iterations << " iterations each, ms per call)" << std::endl
+        << std::endl
+        << std::left
+        << std::setw(9)  << "Format"
+        << std::setw(7)  << "Size"
+        << std::setw(14) << "Operation"
+        << std::right
+        << std::setw(11) << "Generic"
+        << std::setw(11) << "Typed"
+        << std::setw(10) << "Speedup"
+        << std::setw(12) << "Mpixels/s" << std::endl;
+
+    for( unsigned f = 0; f < formats.size(); ++f )
+    {
+        const Format& format = *formats[f];
+
+        for( unsigned s = 0; s < sizes.size(); ++s )
+        {
+            unsigned dim = sizes[s];
+
+            Inputs in;
+            in._noise  = createImage( format, dim );  fillNoise( in._noise.get(), 1u );
+            in._noise2 = createImage( format, dim );  fillNoise( in._noise2.get(), 2u );
+            in._solid  = createImage( format, dim );  fillSolid( in._solid.get(), 0.5f );
+            in._clear  = createImage( format, dim );  fillSolid( in._clear.get(), 0.0f );
+            in._work   = createImage( format, dim );
+            in._half   = createImage( format, dim/2 );
+
+            for( unsigned o = 0; o < s_numOps; ++o )
+            {
+                const Op& op = s_ops[o];
+                if ( op._needsAlpha && !format._hasAlpha )
+                    continue;
+
+                ImageUtils::setTypedKernelsEnabled( false );
+                double generic = timeOp( op, in, iterations );
+
+                ImageUtils::setTypedKernelsEnabled( true );
+                double typed = timeOp( op, in, iterations );
+
+                double mpix = typed > 0.0 ? (double)(dim*dim) / (1000.0 * typed) : 0.0;
+
+                std::cout
+                    << std::left
+                    << std::setw(9)  << format._name
+                    << std::setw(7)  << dim
+                    << std::setw(14) << op._name
+                    << std::right << std::fixed
+                    << std::setw(11) << std::setprecision(3) << generic
+                    << std::setw(11) << std::setprecision(3) << typed
+                    << std::setw(9)  << std::setprecision(1) << (typed > 0.0 ? generic/typed : 0.0) << "x"
+                    << std::setw(12) << std::setprecision(1) << mpix << std::endl;
+            }
+        }
+    }
+
+    ImageUtils::setTypedKernelsEnabled( true );
+
+    return 0;
+}
@@ -0,0 +1,332 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarthDrivers/engine_mp/TilePrefetcher>
+#include <osgEarthDrivers/engine_mp/TileModelFactory>
+#include <osgEarthDrivers/engine_mp/TileModelCompiler>
+#include <osgEarthDrivers/engine_mp/TileNodeRegistry>
+#include <osgEarthDrivers/engine_mp/MPTerrainEngineOptions>
+
+#include <osgEarth/MapNodeOptions>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osg/AnimationPath>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+using namespace osgEarth_engine_mp;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // State shared by the replay loop and the simulated pager threads.
+    struct Replay
+    {
+        osg::ref_ptr<TileModelFactory> _factory;
+        osg::ref_ptr<TileNodeRegistry> _liveTiles;
+        osg::ref_ptr<TilePrefetcher>   _prefetcher;
+        bool                           _usePrefetch;
+        MPTerrainEngineOptions         _options;
+        MaskLayerVector                _masks;
+        bool                           _optimizeTriOrientation;
+
+        Threading::PerThread< osg::ref_ptr<TileModelCompiler> > _compilers;
+
+        Replay() : _usePrefetch(true), _optimizeTriOrientation(true) { }
+
+        // builds a tile the way the terrain's KeyNodeFactory would, and
+        // puts it in the live registry.
+        bool load( const TileKey& key )
+        {
+            osg::ref_ptr<TileModel> model;
+            bool hasRealData = false;
+
+            if ( !_usePrefetch || !_prefetcher->take(key, model, hasRealData) )
+                _factory->createTileModel( key, model, hasRealData );
+
+            if ( !model.valid() )
+                return false;
+
+            osg::ref_ptr<TileModelCompiler>& compiler = _compilers.get();
+            if ( !compiler.valid() )
+                compiler = new TileModelCompiler( _masks, 0, _optimizeTriOrientation, _options );
+
+            osg::ref_ptr<TileNode> node = compiler->compile( model.get() );
+            if ( !node.valid() )
+                return false;
+
+            _liveTiles->add( node.get() );
+            return true;
+        }
+    };
+
+    // Stands in for a DatabasePager request.
+    struct PagerRequest : public TaskRequest
+    {
+        PagerRequest( const TileKey& key, Replay* replay, float priority )
+            : TaskRequest( priority ), _key(key), _replay(replay), _loaded(false), _doneTime(0) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            _loaded   = _replay->load( _key );
+            _doneTime = osg::Timer::instance()->tick();
+        }
+
+        TileKey      _key;
+        Replay*      _replay;
+        bool         _loaded;
+        osg::Timer_t _doneTime;
+    };
+
+    // One tile the terrain asked for during the replay.
+    struct Need
+    {
+        osg::ref_ptr<PagerRequest> _request;
+        osg::Timer_t               _firstNeeded;
+        bool                       _readyWhenNeeded;
+    };
+    typedef std::map<TileKey, Need> Needs;
+
+    bool isLoaded( const TileKey& key, const std::set<TileKey>& roots, const Needs& needs )
+    {
+        if ( roots.find(key) != roots.end() )
+            return true;
+
+        Needs::const_iterator i = needs.find( key );
+        return
+            i != needs.end() &&
+            i->second._request->isCompleted() &&
+            i->second._request->_loaded;
+    }
+}
+
+
+int
+Benchmark::prefetch( osg::ArgumentParser& args )
+{
+    std::string pathFile;
+    while( args.read( "--path", pathFile ) );
+
+    bool usePrefetch = !args.read( "--no-prefetch" );
+
+    double speed = 1.0;
+    while( args.read( "--speed", speed ) );
+
+    double fps = 60.0;
+    while( args.read( "--fps", fps ) );
+    fps = osg::maximum( fps, 1.0 );
+
+    double lookahead = -1.0;
+    while( args.read( "--lookahead", lookahead ) );
+
+    unsigned pagerThreads = 2u;
+    while( args.read( "--pager-threads", pagerThreads ) );
+    pagerThreads = osg::maximum( pagerThreads, 1u );
+
+    std::string earthFile;
+    for( int i = 1; i < args.argc(); ++i )
+    {
+        if ( !args.isOption(args[i]) )
+        {
+            earthFile = args[i];
+            break;
+        }
+    }
+
+    if ( earthFile.empty() )
+        return usage( "Missing required .earth file" );
+
+    if ( pathFile.empty() )
+        return usage( "Missing required --path file" );
+
+    // camera path, in the format written by osgViewer's RecordCameraPathHandler.
+    osg::ref_ptr<osg::AnimationPath> path = new osg::AnimationPath();
+    {
+        std::ifstream in( pathFile.c_str() );
+        if ( !in.is_open() )
+            return usage( "Cannot open the camera path file" );
+        path->read( in );
+    }
+
+    if ( path->getTimeControlPointMap().size() < 2 )
+        return usage( "Camera path needs at least two control points" );
+
+    Config options;
+    osg::ref_ptr<Map> map = loadMap( earthFile, options );
+    if ( !map.valid() )
+        return usage( "Failed to load a map from the earth file" );
+
+    const Profile* profile = map->getProfile();
+    if ( !profile )
+        return usage( "Map has no profile; are any of the layers valid?" );
+
+    Replay replay;
+    replay._usePrefetch            = usePrefetch;
+    replay._options                = MPTerrainEngineOptions( MapNodeOptions(options).getTerrainOptions() );
+    replay._optimizeTriOrientation = map->getMapOptions().elevationInterpolation() != INTERP_TRIANGULATE;
+    replay._liveTiles              = new TileNodeRegistry( "live" );
+    replay._factory                = new TileModelFactory( map.get(), replay._liveTiles.get(), replay._options );
+
+    // The prefetcher also supplies the tile selection, so it always exists;
+    // with --no-prefetch it just never sees the camera.
+    replay._prefetcher = new TilePrefetcher( profile, replay._factory.get(), replay._liveTiles.get(), replay._options );
+    if ( lookahead >= 0.0 )
+        replay._prefetcher->setLookahead( lookahead );
+
+    // The terrain always has its root tiles.
+    std::vector<TileKey> rootKeys;
+    profile->getAllKeysAtLOD( *replay._options.firstLOD(), rootKeys );
+    std::set<TileKey> roots;
+    for( unsigned i = 0; i < rootKeys.size(); ++i )
+    {
+        if ( replay.load(rootKeys[i]) )
+            roots.insert( rootKeys[i] );
+    }
+
+    osg::Matrixd proj = osg::Matrixd::perspective( 30.0, 4.0/3.0, 1.0, 1.0e8 );
+
+    osg::ref_ptr<TaskService> pager = new TaskService( "osgearth_benchmark pager", pagerThreads );
+
+    double pathStart = path->getFirstTime();
+    double pathEnd   = path->getLastTime();
+
+    std::cout
+        << "Replaying " << (pathEnd-pathStart)/speed << " s camera path, prefetch "
+        << (usePrefetch ? "ON" : "OFF") << "..." << std::endl;
+
+    Needs    needs;
+    unsigned frames = 0u;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for(;;)
+    {
+        osg::Timer_t frameStart = osg::Timer::instance()->tick();
+        double now = osg::Timer::instance()->delta_s( start, frameStart );
+        double pathTime = pathStart + now*speed;
+        if ( pathTime > pathEnd )
+            break;
+
+        osg::Matrixd camera;
+        path->getMatrix( pathTime, camera );
+        osg::Matrixd view = osg::Matrixd::inverse( camera );
+
+        if ( usePrefetch )
+            replay._prefetcher->update( now, view, proj );
+
+        // request the tiles the terrain would page in this frame: subtiles
+        // in range whose parent is already in the scene graph.
+        std::vector<TileKey> required;
+        replay._prefetcher->getRequiredKeys( view, proj, 1.0f, required );
+
+        for( std::vector<TileKey>::const_iterator k = required.begin(); k != required.end(); ++k )
+        {
+            if ( needs.find(*k) != needs.end() )
+                continue;
+
+            if ( !isLoaded(k->createParentKey(), roots, needs) )
+                continue;
+
+            Need& need = needs[*k];
+            need._firstNeeded     = osg::Timer::instance()->tick();
+            need._readyWhenNeeded = usePrefetch && replay._prefetcher->isReady( *k );
+            need._request         = new PagerRequest( *k, &replay, (float)now );
+            pager->add( need._request.get() );
+        }
+
+        ++frames;
+
+        double frameTime = osg::Timer::instance()->delta_s( frameStart, osg::Timer::instance()->tick() );
+        if ( frameTime < 1.0/fps )
+            OpenThreads::Thread::microSleep( (unsigned)(1.0e6 * (1.0/fps - frameTime)) );
+    }
+
+    double wall = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    // let the pager finish up.
+    if ( usePrefetch )
+        replay._prefetcher->clear();
+
+    while( pager->getNumRequests() > 0 )
+        OpenThreads::Thread::microSleep( 10000 );
+
+    bool busy = true;
+    while( busy )
+    {
+        busy = false;
+        for( Needs::const_iterator i = needs.begin(); i != needs.end() && !busy; ++i )
+            busy = !i->second._request->isCompleted();
+        if ( busy )
+            OpenThreads::Thread::microSleep( 10000 );
+    }
+
+    // Tally the results.
+    unsigned numReady = 0u;
+    std::vector<double> latencies;
+    for( Needs::const_iterator i = needs.begin(); i != needs.end(); ++i )
+    {
+        if ( i->second._readyWhenNeeded )
+            ++numReady;
+        if ( i->second._request->_loaded )
+            latencies.push_back( 1000.0 * osg::Timer::instance()->delta_s(i->second._firstNeeded, i->second._request->_doneTime) );
+    }
+    std::sort( latencies.begin(), latencies.end() );
+
+    double meanLatency = 0.0;
+    for( unsigned i = 0; i < latencies.size(); ++i )
+        meanLatency += latencies[i];
+    if ( !latencies.empty() )
+        meanLatency /= (double)latencies.size();
+
+    double p95Latency = latencies.empty() ? 0.0 : latencies[(latencies.size()-1) * 95 / 100];
+
+    TilePrefetcher::Stats stats;
+    replay._prefetcher->getStats( stats );
+
+    std::cout
+        << std::fixed << std::setprecision(3)
+        << "Frames        : " << frames << " in " << wall << " s" << std::endl
+        << "Tiles needed  : " << needs.size() << std::endl
+        << "Ready in time : " << numReady << " (" << (needs.empty() ? 0.0 : 100.0*(double)numReady/(double)needs.size()) << "%)" << std::endl
+        << "Latency       : " << meanLatency << " ms mean, " << p95Latency << " ms 95th percentile" << std::endl;
+
+    if ( usePrefetch )
+    {
+        std::cout
+            << "Prefetch      : " << stats._numSubmitted << " submitted, " << stats._numCanceled << " canceled, "
+            << stats._numHits << " hits, " << stats._numLate << " late, " << stats._numMisses << " misses" << std::endl;
+    }
+
+    std::cout
+        << "Peak memory   : " << getPeakMemoryMB() << " MB" << std::endl;
+
+    return 0;
+}
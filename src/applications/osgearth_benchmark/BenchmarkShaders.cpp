@@ -0,0 +1,258 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "Benchmark"
+
+#include <osgEarth/VirtualProgram>
+#include <osg/State>
+#include <osg/StateSet>
+#include <osg/Timer>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::ShaderComp;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // A VirtualProgram that can also look its program up the way apply() used
+    // to: accumulate the whole shader map on every call, then find the list of
+    // shaders in an ordered map under a read-write lock. Kept for comparison.
+    class BenchVirtualProgram : public VirtualProgram
+    {
+    public:
+        osg::Program* legacyLookup( osg::State& state ) const
+        {
+            ShaderMap         accumShaderMap;
+            AttribBindingList accumAttribBindings;
+            AttribAliasMap    accumAttribAliases;
+            accumulateShaders( state, accumShaderMap, accumAttribBindings, accumAttribAliases );
+
+            if ( accumShaderMap.empty() )
+                return 0L;
+
+            ShaderVector vec;
+            vec.reserve( accumShaderMap.size() );
+            for( ShaderMap::iterator i = accumShaderMap.begin(); i != accumShaderMap.end(); ++i )
+                vec.push_back( i->second.first.get() );
+
+            {
+                Threading::ScopedReadLock shared( _legacyMutex );
+                LegacyProgramMap::const_iterator p = _legacyCache.find( vec );
+                if ( p != _legacyCache.end() )
+                    return p->second.get();
+            }
+
+            // stand-in for a build; only the first pass gets here.
+            Threading::ScopedWriteLock exclusive( _legacyMutex );
+            osg::ref_ptr<osg::Program>& program = _legacyCache[vec];
+            if ( !program.valid() )
+                program = new osg::Program();
+            return program.get();
+        }
+
+    private:
+        typedef std::map< ShaderVector, osg::ref_ptr<osg::Program> > LegacyProgramMap;
+        mutable LegacyProgramMap          _legacyCache;
+        mutable Threading::ReadWriteMutex _legacyMutex;
+    };
+
+    BenchVirtualProgram* createProgram( const std::string& prefix, unsigned numFunctions, unsigned& counter )
+    {
+        BenchVirtualProgram* vp = new BenchVirtualProgram();
+        for( unsigned f = 0; f < numFunctions; ++f )
+        {
+            std::stringstream name;
+            name << prefix << "_" << counter++;
+            std::string source = "void " + name.str() + "(inout vec4 color) { color.r += 0.01; }\n";
+            vp->setFunction( name.str(), source, LOCATION_FRAGMENT_COLORING, (float)f );
+        }
+        return vp;
+    }
+
+    osg::StateSet* createStateSet( VirtualProgram* vp )
+    {
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttributeAndModes( vp, osg::StateAttribute::ON );
+        return ss;
+    }
+
+    // One drawable's worth of state: the VP stack root -> parent -> leaf.
+    struct Draw
+    {
+        osg::StateSet*             _parent;
+        osg::StateSet*             _leaf;
+        const BenchVirtualProgram* _vp;
+    };
+
+    // Pushes each draw's state, looks up its program, and pops it again, for
+    // the given number of passes. Returns nanoseconds per draw.
+    // mode: 0 = push/pop only, 1 = legacy lookup, 2 = hashed lookup
+    double runDraws(osg::State&              state,
+                    osg::StateSet*           root,
+                    const std::vector<Draw>& draws,
+                    unsigned                 passes,
+                    int                      mode,
+                    unsigned&                misses)
+    {
+        misses = 0u;
+        state.pushStateSet( root );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        for( unsigned p = 0; p < passes; ++p )
+        {
+            for( std::vector<Draw>::const_iterator d = draws.begin(); d != draws.end(); ++d )
+            {
+                state.pushStateSet( d->_parent );
+                state.pushStateSet( d->_leaf );
+
+                osg::Program* program = 0L;
+                if ( mode == 1 )
+                    program = d->_vp->legacyLookup( state );
+                else if ( mode == 2 )
+                    program = d->_vp->getProgram( state );
+
+                if ( mode != 0 && !program )
+                    ++misses;
+
+                state.popStateSet();
+                state.popStateSet();
+            }
+        }
+
+        double ns = 1.0e9 * osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        state.popStateSet();
+        return ns / (double)(passes * draws.size());
+    }
+}
+
+
+int
+Benchmark::shaders( osg::ArgumentParser& args )
+{
+    unsigned numDraws = 5000u;
+    while( args.read( "--draws", numDraws ) );
+    numDraws = osg::maximum( numDraws, 1u );
+
+    unsigned numParents = 16u;
+    while( args.read( "--parents", numParents ) );
+    numParents = osg::maximum( numParents, 1u );
+
+    unsigned numFunctions = 4u;
+    while( args.read( "--functions", numFunctions ) );
+    numFunctions = osg::maximum( numFunctions, 1u );
+
+    unsigned passes = 20u;
+    while( args.read( "--iterations", passes ) );
+    passes = osg::maximum( passes, 1u );
+
+    // A root VP, a layer of parent VPs under it, and the drawables' leaf VPs,
+    // each with its own set of functions.
+    unsigned counter = 0u;
+    osg::ref_ptr<BenchVirtualProgram> rootVP = createProgram( "oe_root", numFunctions, counter );
+    osg::ref_ptr<osg::StateSet>       root   = createStateSet( rootVP.get() );
+
+    std::vector< osg::ref_ptr<osg::StateSet> > parents( numParents );
+    for( unsigned p = 0; p < numParents; ++p )
+        parents[p] = createStateSet( createProgram( "oe_parent", numFunctions, counter ) );
+
+    // "unique": every drawable has its own leaf VP, visited in an order that
+    // hops from parent to parent.
+    std::vector< osg::ref_ptr<osg::StateSet> > leaves( numDraws );
+    std::vector<Draw> uniqueDraws( numDraws );
+    for( unsigned i = 0; i < numDraws; ++i )
+    {
+        BenchVirtualProgram* vp = createProgram( "oe_leaf", 1u, counter );
+        leaves[i] = createStateSet( vp );
+        uniqueDraws[i]._parent = parents[i % numParents].get();
+        uniqueDraws[i]._leaf   = leaves[i].get();
+        uniqueDraws[i]._vp     = vp;
+    }
+
+    // "shared": one leaf VP used under every parent, so each lookup sees a
+    // different stack than the one before it.
+    osg::ref_ptr<BenchVirtualProgram> sharedVP   = createProgram( "oe_shared", 1u, counter );
+    osg::ref_ptr<osg::StateSet>       sharedLeaf = createStateSet( sharedVP.get() );
+    std::vector<Draw> sharedDraws( numDraws );
+    for( unsigned i = 0; i < numDraws; ++i )
+    {
+        sharedDraws[i]._parent = parents[i % numParents].get();
+        sharedDraws[i]._leaf   = sharedLeaf.get();
+        sharedDraws[i]._vp     = sharedVP.get();
+    }
+
+    osg::ref_ptr<osg::State> state = new osg::State();
+
+    std::cout
+        << "Resolving VirtualProgram stacks (" << numParents << " parents, "
+        << numFunctions << " functions per VP), " << passes << " passes (ns per draw)" << std::endl
+        << std::endl
+        << std::right
+        << std::setw(10) << "Leaves"
+        << std::setw(8)  << "Draws"
+        << std::setw(12) << "Push/pop"
+        << std::setw(10) << "Legacy"
+        << std::setw(10) << "Hashed"
+        << std::setw(10) << "Speedup" << std::endl;
+
+    const char*              names[2] = { "unique", "shared" };
+    const std::vector<Draw>* sets[2]  = { &uniqueDraws, &sharedDraws };
+
+    for( unsigned s = 0; s < 2; ++s )
+    {
+        const std::vector<Draw>& draws = *sets[s];
+        unsigned misses = 0u;
+
+        // warm up both caches so that only lookups are timed.
+        runDraws( *state.get(), root.get(), draws, 1u, 1, misses );
+        runDraws( *state.get(), root.get(), draws, 1u, 2, misses );
+
+        double baseline = runDraws( *state.get(), root.get(), draws, passes, 0, misses );
+        double legacy   = runDraws( *state.get(), root.get(), draws, passes, 1, misses ) - baseline;
+        double hashed   = runDraws( *state.get(), root.get(), draws, passes, 2, misses ) - baseline;
+
+        if ( misses > 0u )
+        {
+            std::cout << "Hashed lookup found no program for " << misses << " draws!" << std::endl;
+            return -1;
+        }
+
+        legacy = osg::maximum( legacy, 0.0 );
+        hashed = osg::maximum( hashed, 0.0 );
+
+        std::cout
+            << std::right << std::fixed
+            << std::setw(10) << names[s]
+            << std::setw(8)  << draws.size()
+            << std::setw(12) << std::setprecision(1) << baseline
+            << std::setw(10) << std::setprecision(1) << legacy
+            << std::setw(10) << std::setprecision(1) << hashed
+            << std::setw(9)  << std::setprecision(1) << (hashed > 0.0 ? legacy/hashed : 0.0) << "x" << std::endl;
+    }
+
+    return 0;
+}
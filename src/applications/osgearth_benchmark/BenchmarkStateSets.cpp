@@ -0,0 +1,311 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarth/StateSetCache>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osg/BlendFunc>
+#include <osg/Depth>
+#include <osg/LineWidth>
+#include <osg/Material>
+#include <osg/Timer>
+
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // The original cache: one ordered set per kind, ordered by a deep
+    // compare() and guarded by a single mutex. Kept here for comparison.
+    class SingleSetCache
+    {
+    public:
+        bool share( osg::ref_ptr<osg::StateSet>& input, osg::ref_ptr<osg::StateSet>& output )
+        {
+            bool shared = false;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                std::pair<StateSetSet::iterator,bool> result = _stateSets.insert( input );
+                output = result.first->get();
+                shared = !result.second;
+            }
+
+            if ( !shared )
+            {
+                osg::StateSet::AttributeList& attrs = input->getAttributeList();
+                for( osg::StateSet::AttributeList::iterator i = attrs.begin(); i != attrs.end(); ++i )
+                {
+                    Threading::ScopedMutexLock lock( _mutex );
+                    std::pair<StateAttributeSet::iterator,bool> result = _attributes.insert( i->second.first );
+                    if ( !result.second )
+                        i->second.first = result.first->get();
+                }
+            }
+            return shared;
+        }
+
+        unsigned size()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _stateSets.size();
+        }
+
+    private:
+        struct CompareStateSets {
+            bool operator()(const osg::ref_ptr<osg::StateSet>& lhs, const osg::ref_ptr<osg::StateSet>& rhs) const {
+                return lhs->compare(*(rhs.get()), true) < 0;
+            }
+        };
+        typedef std::set< osg::ref_ptr<osg::StateSet>, CompareStateSets> StateSetSet;
+
+        struct CompareStateAttributes {
+            bool operator()(const osg::ref_ptr<osg::StateAttribute>& lhs, const osg::ref_ptr<osg::StateAttribute>& rhs) const {
+                return lhs->compare(*rhs.get()) < 0;
+            }
+        };
+        typedef std::set< osg::ref_ptr<osg::StateAttribute>, CompareStateAttributes> StateAttributeSet;
+
+        StateSetSet       _stateSets;
+        StateAttributeSet _attributes;
+        Threading::Mutex  _mutex;
+    };
+
+    // Builds the kind of stateset the feature compilers make for one style
+    // group: every group gets its own attribute instances, and groups with
+    // the same style index are equivalent.
+    osg::StateSet* createStyleStateSet( unsigned style )
+    {
+        unsigned state = 2654435761u * (style + 1u);
+        state = state*1664525u + 1013904223u;
+        float r = (float)(state >> 8) / 16777216.0f;
+        state = state*1664525u + 1013904223u;
+        float g = (float)(state >> 8) / 16777216.0f;
+        state = state*1664525u + 1013904223u;
+        float b = (float)(state >> 8) / 16777216.0f;
+
+        osg::StateSet* ss = new osg::StateSet();
+
+        osg::Material* material = new osg::Material();
+        material->setDiffuse( osg::Material::FRONT_AND_BACK, osg::Vec4(r, g, b, 1.0f) );
+        material->setAmbient( osg::Material::FRONT_AND_BACK, osg::Vec4(r, g, b, 1.0f) );
+        ss->setAttributeAndModes( material, osg::StateAttribute::ON );
+
+        ss->setAttributeAndModes( new osg::LineWidth( 1.0f + (float)(style % 8u) ), osg::StateAttribute::ON );
+
+        if ( style % 3u == 0u )
+        {
+            ss->setAttributeAndModes( new osg::Depth(osg::Depth::LESS, 0.0, 1.0, false), osg::StateAttribute::ON );
+        }
+
+        if ( style % 2u == 0u )
+        {
+            ss->setAttributeAndModes( new osg::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA), osg::StateAttribute::ON );
+            ss->setRenderingHint( osg::StateSet::TRANSPARENT_BIN );
+        }
+
+        ss->setMode( GL_LIGHTING, style % 5u == 0u ? osg::StateAttribute::ON : osg::StateAttribute::OFF );
+
+        return ss;
+    }
+
+    // One sharing thread: runs a contiguous slice of the input through the cache.
+    template<typename CACHE>
+    struct ShareStateSets
+    {
+        CACHE*                                      _cache;
+        std::vector< osg::ref_ptr<osg::StateSet> >* _input;
+        unsigned                                    _begin, _end;
+
+        ShareStateSets() : _cache(0L), _input(0L), _begin(0u), _end(0u) { }
+
+        void execute()
+        {
+            for( unsigned i = _begin; i < _end; ++i )
+            {
+                osg::ref_ptr<osg::StateSet> output;
+                (*_cache).share( (*_input)[i], output, false );
+            }
+        }
+    };
+
+    // Adapts the single-set cache to StateSetCache's share() signature.
+    struct SingleSetAdapter
+    {
+        SingleSetCache _cache;
+
+        bool share( osg::ref_ptr<osg::StateSet>& input, osg::ref_ptr<osg::StateSet>& output, bool )
+        {
+            return _cache.share( input, output );
+        }
+    };
+
+    // Shares all the input statesets on the given number of threads and
+    // returns milliseconds.
+    template<typename CACHE>
+    double runShare(CACHE&                                      cache,
+                    std::vector< osg::ref_ptr<osg::StateSet> >& input,
+                    unsigned                                    numThreads)
+    {
+        // start the threads before the clock.
+        osg::ref_ptr<TaskService> service;
+        if ( numThreads > 1u )
+            service = new TaskService( "osgearth_benchmark", numThreads );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        if ( !service.valid() )
+        {
+            ShareStateSets<CACHE> task;
+            task._cache = &cache;
+            task._input = &input;
+            task._end   = input.size();
+            task.execute();
+        }
+        else
+        {
+            Threading::MultiEvent done( numThreads );
+            unsigned slice = (input.size() + numThreads - 1u) / numThreads;
+            for( unsigned t = 0; t < numThreads; ++t )
+            {
+                ParallelTask< ShareStateSets<CACHE> >* task = new ParallelTask< ShareStateSets<CACHE> >( &done );
+                task->_cache = &cache;
+                task->_input = &input;
+                task->_begin = osg::minimum( t*slice, (unsigned)input.size() );
+                task->_end   = osg::minimum( task->_begin + slice, (unsigned)input.size() );
+                service->add( task );
+            }
+            done.wait();
+        }
+
+        return 1000.0 * osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    }
+
+    void createInput( unsigned groups, unsigned styles, std::vector< osg::ref_ptr<osg::StateSet> >& out )
+    {
+        out.resize( groups );
+        unsigned state = 12345u;
+        for( unsigned i = 0; i < groups; ++i )
+        {
+            state = state*1664525u + 1013904223u;
+            out[i] = createStyleStateSet( (state >> 8) % styles );
+        }
+    }
+}
+
+
+int
+Benchmark::statesets( osg::ArgumentParser& args )
+{
+    std::vector<unsigned> counts;
+    unsigned count = 0u;
+    while( args.read( "--groups", count ) )
+        if ( count > 0u )
+            counts.push_back( count );
+
+    if ( counts.empty() )
+    {
+        counts.push_back( 10000u );
+        counts.push_back( 25000u );
+        counts.push_back( 50000u );
+    }
+
+    unsigned styles = 2000u;
+    while( args.read( "--styles", styles ) );
+    styles = osg::maximum( styles, 1u );
+
+    unsigned numThreads = 4u;
+    while( args.read( "--threads", numThreads ) );
+    numThreads = osg::maximum( numThreads, 1u );
+
+    unsigned iterations = 3u;
+    while( args.read( "--iterations", iterations ) );
+    iterations = osg::maximum( iterations, 1u );
+
+    std::cout
+        << "Sharing style statesets (up to " << styles << " distinct), "
+        << iterations << " runs each (ms per run)" << std::endl
+        << std::endl
+        << std::right
+        << std::setw(8)  << "Groups"
+        << std::setw(9)  << "Unique"
+        << std::setw(9)  << "Threads"
+        << std::setw(12) << "Single set"
+        << std::setw(10) << "Digest"
+        << std::setw(10) << "Speedup" << std::endl;
+
+    std::vector<unsigned> threadCounts;
+    threadCounts.push_back( 1u );
+    if ( numThreads > 1u )
+        threadCounts.push_back( numThreads );
+
+    for( unsigned c = 0; c < counts.size(); ++c )
+    {
+        for( unsigned t = 0; t < threadCounts.size(); ++t )
+        {
+            double   singleTime = 0.0, digestTime = 0.0;
+            unsigned unique     = 0u;
+
+            for( unsigned i = 0; i < iterations; ++i )
+            {
+                // fresh input each run, since sharing rewrites the attributes.
+                std::vector< osg::ref_ptr<osg::StateSet> > input;
+
+                createInput( counts[c], styles, input );
+                SingleSetAdapter single;
+                singleTime += runShare( single, input, threadCounts[t] );
+
+                createInput( counts[c], styles, input );
+                osg::ref_ptr<StateSetCache> cache = new StateSetCache();
+                digestTime += runShare( *cache.get(), input, threadCounts[t] );
+
+                if ( single._cache.size() != cache->size() )
+                {
+                    std::cout
+                        << "Digest cache found " << cache->size() << " unique statesets; single set found "
+                        << single._cache.size() << "!" << std::endl;
+                    return -1;
+                }
+
+                unique = cache->size();
+            }
+
+            singleTime /= (double)iterations;
+            digestTime /= (double)iterations;
+
+            std::cout
+                << std::right << std::fixed
+                << std::setw(8)  << counts[c]
+                << std::setw(9)  << unique
+                << std::setw(9)  << threadCounts[t]
+                << std::setw(12) << std::setprecision(3) << singleTime
+                << std::setw(10) << std::setprecision(3) << digestTime
+                << std::setw(9)  << std::setprecision(1) << (digestTime > 0.0 ? singleTime/digestTime : 0.0) << "x" << std::endl;
+        }
+    }
+
+    return 0;
+}
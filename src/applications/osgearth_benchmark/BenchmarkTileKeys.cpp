@@ -0,0 +1,337 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "Benchmark"
+
+#include <osgEarth/Containers>
+#include <osgEarth/Profile>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TileKey>
+#include <osgEarth/TileKeyIterator>
+#include <osg/Timer>
+
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // A tile key the way they used to be: it built and carried its "lod/x/y"
+    // string, so every key made or copied paid for a string. Kept for comparison.
+    struct LegacyKey
+    {
+        TileKey     _key;
+        std::string _str;
+
+        LegacyKey() { }
+        LegacyKey( const TileKey& key ) : _key(key), _str(Stringify() << key.getLOD() << "/" << key.getTileX() << "/" << key.getTileY()) { }
+
+        bool operator < (const LegacyKey& rhs) const { return _key < rhs._key; }
+    };
+
+    // order-independent fingerprint of a set of tiles.
+    struct Tally
+    {
+        unsigned _count;
+        UInt64   _sum;
+
+        Tally() : _count(0u), _sum(0) { }
+
+        void add( unsigned lod, unsigned x, unsigned y )
+        {
+            UInt64 h = ((UInt64)lod << 58) ^ ((UInt64)x << 29) ^ (UInt64)y;
+            h *= 0x9E3779B97F4A7C15ULL;
+            ++_count;
+            _sum += h ^ (h >> 31);
+        }
+
+        bool operator != (const Tally& rhs) const { return _count != rhs._count || _sum != rhs._sum; }
+    };
+
+    bool intersectsAny( const std::vector<GeoExtent>& extents, const GeoExtent& ex )
+    {
+        for( unsigned i = 0; i < extents.size(); ++i )
+            if ( extents[i].intersects(ex) )
+                return true;
+        return false;
+    }
+
+    // The seeder's walk: down the quadtree from the root keys, making each
+    // child key to test its extent.
+    void walk(const LegacyKey&              key,
+              const std::vector<GeoExtent>& extents,
+              unsigned                      minLevel,
+              unsigned                      maxLevel,
+              Tally&                        tally)
+    {
+        if ( key._key.getLOD() >= minLevel )
+            tally.add( key._key.getLOD(), key._key.getTileX(), key._key.getTileY() );
+
+        if ( key._key.getLOD() < maxLevel )
+        {
+            for( unsigned q = 0; q < 4; ++q )
+            {
+                LegacyKey child( key._key.createChildKey(q) );
+                if ( intersectsAny(extents, child._key.getExtent()) )
+                    walk( child, extents, minLevel, maxLevel, tally );
+            }
+        }
+    }
+
+    double elapsedMS( osg::Timer_t start )
+    {
+        return 1000.0 * osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+    }
+
+    void printRow( const std::string& path, unsigned keys, double before, double after )
+    {
+        std::cout
+            << std::left  << std::setw(22) << path
+            << std::right << std::fixed
+            << std::setw(10) << keys
+            << std::setw(12) << std::setprecision(3) << before
+            << std::setw(12) << std::setprecision(3) << after
+            << std::setw(9)  << std::setprecision(1) << (after > 0.0 ? before/after : 0.0) << "x" << std::endl;
+    }
+}
+
+
+int
+Benchmark::tilekeys( osg::ArgumentParser& args )
+{
+    unsigned minLevel = 0u;
+    while( args.read( "--min-level", minLevel ) );
+
+    unsigned maxLevel = 14u;
+    while( args.read( "--max-level", maxLevel ) );
+
+    std::string profileName = "global-geodetic";
+    while( args.read( "--profile", profileName ) );
+
+    unsigned maxKeys = 250000u;
+    while( args.read( "--max-keys", maxKeys ) );
+    maxKeys = osg::maximum( maxKeys, 1u );
+
+    unsigned iterations = 3u;
+    while( args.read( "--iterations", iterations ) );
+    iterations = osg::maximum( iterations, 1u );
+
+    if ( minLevel > maxLevel )
+        return usage( "--min-level must not be greater than --max-level" );
+
+    osg::ref_ptr<const Profile> profile = Profile::create( profileName );
+    if ( !profile.valid() )
+        return usage( "Unrecognized profile: " + profileName );
+
+    // bounds are in lat/long; move them into the profile once, up front.
+    std::vector<GeoExtent> extents;
+    double xmin=0.0, ymin=0.0, xmax=0.0, ymax=0.0;
+    while( args.read( "--bounds", xmin, ymin, xmax, ymax ) )
+    {
+        GeoExtent ex = profile->clampAndTransformExtent(
+            GeoExtent(profile->getSRS()->getGeographicSRS(), xmin, ymin, xmax, ymax) );
+        if ( ex.isValid() )
+            extents.push_back( ex );
+    }
+
+    if ( extents.empty() )
+    {
+        extents.push_back( profile->clampAndTransformExtent(
+            GeoExtent(profile->getSRS()->getGeographicSRS(), -3.217, 40.113, 7.891, 48.779)) );
+        extents.push_back( profile->clampAndTransformExtent(
+            GeoExtent(profile->getSRS()->getGeographicSRS(), 4.337, 45.271, 12.529, 51.903)) );
+    }
+
+    std::vector<TileKey> roots;
+    profile->getRootKeys( roots );
+
+    std::cout
+        << "Tile keys in " << extents.size() << " extent(s) of " << profileName
+        << ", LOD " << minLevel << " to " << maxLevel << ", "
+        << iterations << " runs each (ms per run)" << std::endl
+        << std::endl
+        << std::left  << std::setw(22) << "Path"
+        << std::right
+        << std::setw(10) << "Keys"
+        << std::setw(12) << "Before"
+        << std::setw(12) << "After"
+        << std::setw(10) << "Speedup" << std::endl;
+
+    // Enumeration: quadtree walk vs. the iterator.
+    {
+        double walkTime = 0.0, keyTime = 0.0, idTime = 0.0;
+        Tally  walkTally, keyTally, idTally;
+
+        for( unsigned i = 0; i < iterations; ++i )
+        {
+            walkTally = Tally();
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            for( unsigned r = 0; r < roots.size(); ++r )
+            {
+                if ( intersectsAny(extents, roots[r].getExtent()) )
+                    walk( LegacyKey(roots[r]), extents, minLevel, maxLevel, walkTally );
+            }
+            walkTime += elapsedMS( start );
+
+            keyTally = Tally();
+            start = osg::Timer::instance()->tick();
+            {
+                TileKeyIterator iter( profile.get(), minLevel, maxLevel );
+                for( unsigned e = 0; e < extents.size(); ++e )
+                    iter.addExtent( extents[e] );
+                while( iter.hasMore() )
+                {
+                    TileKey key = iter.nextKey();
+                    keyTally.add( key.getLOD(), key.getTileX(), key.getTileY() );
+                }
+            }
+            keyTime += elapsedMS( start );
+
+            idTally = Tally();
+            start = osg::Timer::instance()->tick();
+            {
+                TileKeyIterator iter( profile.get(), minLevel, maxLevel );
+                for( unsigned e = 0; e < extents.size(); ++e )
+                    iter.addExtent( extents[e] );
+                while( iter.hasMore() )
+                {
+                    unsigned lod, x, y, profileKeyID;
+                    if ( TileKey::unpackID(iter.nextID(), lod, x, y, profileKeyID) )
+                        idTally.add( lod, x, y );
+                }
+            }
+            idTime += elapsedMS( start );
+        }
+
+        if ( walkTally != keyTally || walkTally != idTally )
+        {
+            std::cout
+                << "Iterator visited " << idTally._count << " tiles; quadtree walk visited "
+                << walkTally._count << "!" << std::endl;
+            return -1;
+        }
+
+        printRow( "enumerate (keys)", walkTally._count, walkTime/(double)iterations, keyTime/(double)iterations );
+        printRow( "enumerate (IDs)",  walkTally._count, walkTime/(double)iterations, idTime/(double)iterations );
+    }
+
+    // The keys for the map and cache paths: the finest ones first, since
+    // that's where the caches and registries spend their time.
+    std::vector<TileKey> keys;
+    {
+        TileKeyIterator iter( profile.get(), maxLevel, maxLevel );
+        for( unsigned e = 0; e < extents.size(); ++e )
+            iter.addExtent( extents[e] );
+        while( iter.hasMore() && keys.size() < maxKeys )
+            keys.push_back( iter.nextKey() );
+    }
+
+    // Map keyed by tile: insert every key, then find every key.
+    {
+        double keyTime = 0.0, idTime = 0.0;
+        unsigned keyFound = 0u, idFound = 0u;
+
+        for( unsigned i = 0; i < iterations; ++i )
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            {
+                std::map<LegacyKey, unsigned> index;
+                for( unsigned k = 0; k < keys.size(); ++k )
+                    index[ LegacyKey(keys[k]) ] = k;
+                keyFound = 0u;
+                for( unsigned k = 0; k < keys.size(); ++k )
+                    keyFound += index.find( LegacyKey(keys[k]) ) != index.end() ? 1u : 0u;
+            }
+            keyTime += elapsedMS( start );
+
+            start = osg::Timer::instance()->tick();
+            {
+                std::map<UInt64, unsigned> index;
+                for( unsigned k = 0; k < keys.size(); ++k )
+                    index[ keys[k].getPackedID() ] = k;
+                idFound = 0u;
+                for( unsigned k = 0; k < keys.size(); ++k )
+                    idFound += index.find( keys[k].getPackedID() ) != index.end() ? 1u : 0u;
+            }
+            idTime += elapsedMS( start );
+        }
+
+        if ( keyFound != keys.size() || idFound != keys.size() )
+        {
+            std::cout << "Packed ID map found " << idFound << " of " << keys.size() << " keys!" << std::endl;
+            return -1;
+        }
+
+        printRow( "map insert+find", keys.size(), keyTime/(double)iterations, idTime/(double)iterations );
+    }
+
+    // LRU cache a quarter the size of the key set, run over the keys twice.
+    {
+        double keyTime = 0.0, idTime = 0.0;
+        unsigned cacheSize = osg::maximum( (unsigned)keys.size()/4u, 1u );
+
+        for( unsigned i = 0; i < iterations; ++i )
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            {
+                LRUCache<LegacyKey, unsigned> cache( cacheSize );
+                for( unsigned pass = 0; pass < 2; ++pass )
+                {
+                    for( unsigned k = 0; k < keys.size(); ++k )
+                    {
+                        LegacyKey key( keys[k] );
+                        LRUCache<LegacyKey, unsigned>::Record rec;
+                        if ( !cache.get(key, rec) )
+                            cache.insert( key, k );
+                    }
+                }
+            }
+            keyTime += elapsedMS( start );
+
+            start = osg::Timer::instance()->tick();
+            {
+                LRUCache<UInt64, unsigned> cache( cacheSize );
+                for( unsigned pass = 0; pass < 2; ++pass )
+                {
+                    for( unsigned k = 0; k < keys.size(); ++k )
+                    {
+                        UInt64 id = keys[k].getPackedID();
+                        LRUCache<UInt64, unsigned>::Record rec;
+                        if ( !cache.get(id, rec) )
+                            cache.insert( id, k );
+                    }
+                }
+            }
+            idTime += elapsedMS( start );
+        }
+
+        printRow( "LRU cache get/insert", keys.size(), keyTime/(double)iterations, idTime/(double)iterations );
+    }
+
+    std::cout
+        << std::endl
+        << "Before: keys that carry their string, made by walking the quadtree." << std::endl
+        << "After:  TileKeyIterator and packed key IDs." << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarthDrivers/engine_mp/TileModelFactory>
+#include <osgEarthDrivers/engine_mp/TileModelCompiler>
+#include <osgEarthDrivers/engine_mp/TileNodeRegistry>
+#include <osgEarthDrivers/engine_mp/MPTerrainEngineOptions>
+
+#include <osgEarth/MapNodeOptions>
+#include <osgEarth/TaskService>
+#include <osgEarth/TileKeyIterator>
+#include <osgEarth/TileSource>
+#include <osgEarth/ThreadingUtils>
+#include <osg/Timer>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+using namespace osgEarth_engine_mp;
+
+#define LC "[osgearth_benchmark] "
+
+namespace
+{
+    // Accumulated per-stage results (all times in seconds).
+    struct Results
+    {
+        Results() : _tiles(0u), _empty(0u), _fetch(0.0), _mosaic(0.0), _compile(0.0) { }
+
+        unsigned _tiles;
+        unsigned _empty;
+        double   _fetch;
+        double   _mosaic;
+        double   _compile;
+    };
+
+    // State shared by all the build threads.
+    struct SharedState
+    {
+        std::vector<TileKey>            _keys;
+        unsigned                        _next;
+        osg::ref_ptr<TileModelFactory>  _factory;
+        MPTerrainEngineOptions          _options;
+        MaskLayerVector                 _masks;
+        bool                            _optimizeTriOrientation;
+        Results                         _results;
+        Threading::Mutex                _mutex;
+
+        SharedState() : _next(0u), _optimizeTriOrientation(true) { }
+
+        bool nextKey( TileKey& out_key )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _next >= _keys.size() )
+                return false;
+            out_key = _keys[_next++];
+            return true;
+        }
+
+        void merge( const Results& r )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _results._tiles   += r._tiles;
+            _results._empty   += r._empty;
+            _results._fetch   += r._fetch;
+            _results._mosaic  += r._mosaic;
+            _results._compile += r._compile;
+        }
+    };
+
+    // One build thread: pulls keys off the shared list until it's empty.
+    struct BuildTiles
+    {
+        SharedState* _state;
+
+        BuildTiles() : _state(0L) { }
+
+        void execute()
+        {
+            // the compiler keeps per-thread caches, so each thread gets its own.
+            osg::ref_ptr<TileModelCompiler> compiler = new TileModelCompiler(
+                _state->_masks, 0, _state->_optimizeTriOrientation, _state->_options );
+
+            Results local;
+            TileKey key;
+            while( _state->nextKey(key) )
+            {
+                osg::ref_ptr<TileModel>   model;
+                bool                      hasRealData = false;
+                TileModelFactory::Timings timings;
+
+                _state->_factory->createTileModel( key, model, hasRealData, &timings );
+                local._fetch  += timings._fetch;
+                local._mosaic += timings._mosaic;
+
+                if ( !model.valid() )
+                {
+                    ++local._empty;
+                    continue;
+                }
+
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                osg::ref_ptr<TileNode> node = compiler->compile( model.get() );
+                local._compile += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+                if ( node.valid() )
+                    ++local._tiles;
+                else
+                    ++local._empty;
+            }
+
+            _state->merge( local );
+        }
+    };
+
+    // Collects the union of the data extents of all the map's layers.
+    void getLayerExtents( const Map* map, std::vector<GeoExtent>& out )
+    {
+        ImageLayerVector imageLayers;
+        map->getImageLayers( imageLayers );
+        for( ImageLayerVector::const_iterator i = imageLayers.begin(); i != imageLayers.end(); ++i )
+        {
+            TileSource* ts = i->get()->getTileSource();
+            if ( ts )
+                out.insert( out.end(), ts->getDataExtents().begin(), ts->getDataExtents().end() );
+        }
+
+        ElevationLayerVector elevationLayers;
+        map->getElevationLayers( elevationLayers );
+        for( ElevationLayerVector::const_iterator i = elevationLayers.begin(); i != elevationLayers.end(); ++i )
+        {
+            TileSource* ts = i->get()->getTileSource();
+            if ( ts )
+                out.insert( out.end(), ts->getDataExtents().begin(), ts->getDataExtents().end() );
+        }
+    }
+
+    // Generates the list of tile keys intersecting the extents, sorted by LOD.
+    void collectKeys(const Profile*                profile,
+                     const std::vector<GeoExtent>& extents,
+                     unsigned                      minLevel,
+                     unsigned                      maxLevel,
+                     std::vector<TileKey>&         out_keys)
+    {
+        TileKeyIterator iter( profile, minLevel, maxLevel );
+        for( std::vector<GeoExtent>::const_iterator e = extents.begin(); e != extents.end(); ++e )
+            iter.addExtent( *e );
+
+        while( iter.hasMore() )
+            out_keys.push_back( iter.nextKey() );
+    }
+}
+
+
+int
+Benchmark::tiles( osg::ArgumentParser& args )
+{
+    unsigned minLevel = 0u;
+    while( args.read( "--min-level", minLevel ) );
+
+    unsigned maxLevel = 5u;
+    while( args.read( "--max-level", maxLevel ) );
+
+    unsigned numThreads = 1u;
+    while( args.read( "--threads", numThreads ) );
+    numThreads = osg::maximum( numThreads, 1u );
+
+    unsigned maxTiles = 0u;
+    while( args.read( "--max-tiles", maxTiles ) );
+
+    std::vector< std::pair<osg::Vec2d, osg::Vec2d> > bounds;
+    double xmin=0.0, ymin=0.0, xmax=0.0, ymax=0.0;
+    while( args.read( "--bounds", xmin, ymin, xmax, ymax ) )
+    {
+        bounds.push_back( std::make_pair(osg::Vec2d(xmin,ymin), osg::Vec2d(xmax,ymax)) );
+    }
+
+    std::string earthFile;
+    for( int i = 1; i < args.argc(); ++i )
+    {
+        if ( !args.isOption(args[i]) )
+        {
+            earthFile = args[i];
+            break;
+        }
+    }
+
+    if ( earthFile.empty() )
+        return usage( "Missing required .earth file" );
+
+    if ( minLevel > maxLevel )
+        return usage( "--min-level must not be greater than --max-level" );
+
+    Config options;
+    osg::ref_ptr<Map> map = loadMap( earthFile, options );
+    if ( !map.valid() )
+        return usage( "Failed to load a map from the earth file" );
+
+    const Profile* profile = map->getProfile();
+    if ( !profile )
+        return usage( "Map has no profile; are any of the layers valid?" );
+
+    // Figure out which tiles to build.
+    std::vector<GeoExtent> extents;
+    for( unsigned i = 0; i < bounds.size(); ++i )
+    {
+        extents.push_back( GeoExtent(
+            profile->getSRS(),
+            bounds[i].first.x(), bounds[i].first.y(), bounds[i].second.x(), bounds[i].second.y()) );
+    }
+
+    if ( extents.empty() )
+        getLayerExtents( map.get(), extents );
+
+    if ( extents.empty() )
+        extents.push_back( profile->getExtent() );
+
+    SharedState state;
+    collectKeys( profile, extents, minLevel, maxLevel, state._keys );
+
+    if ( maxTiles > 0u && state._keys.size() > maxTiles )
+        state._keys.resize( maxTiles );
+
+    if ( state._keys.empty() )
+        return usage( "No tiles to build" );
+
+    // Set up the terrain engine pieces we're measuring.
+    state._options = MPTerrainEngineOptions( MapNodeOptions(options).getTerrainOptions() );
+    state._optimizeTriOrientation = map->getMapOptions().elevationInterpolation() != INTERP_TRIANGULATE;
+
+    osg::ref_ptr<TileNodeRegistry> liveTiles = new TileNodeRegistry( "live" );
+    state._factory = new TileModelFactory( map.get(), liveTiles.get(), state._options );
+
+    std::cout
+        << "Building " << state._keys.size() << " tiles (LOD " << minLevel << " to " << maxLevel
+        << ") on " << numThreads << " thread(s)..." << std::endl;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    osg::ref_ptr<TaskService> service = new TaskService( "osgearth_benchmark", numThreads );
+    Threading::MultiEvent done( numThreads );
+    for( unsigned i = 0; i < numThreads; ++i )
+    {
+        ParallelTask<BuildTiles>* task = new ParallelTask<BuildTiles>( &done );
+        task->_state = &state;
+        service->add( task );
+    }
+    done.wait();
+
+    double wall = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    const Results& r = state._results;
+    unsigned built = osg::maximum( r._tiles, 1u );
+
+    std::cout
+        << std::fixed << std::setprecision(3)
+        << "Tiles built   : " << r._tiles << " (" << r._empty << " empty)" << std::endl
+        << "Wall time     : " << wall << " s" << std::endl
+        << "Throughput    : " << (wall > 0.0 ? (double)r._tiles / wall : 0.0) << " tiles/s" << std::endl
+        << "Fetch         : " << r._fetch   << " s total, " << 1000.0*r._fetch/(double)built   << " ms/tile" << std::endl
+        << "Mosaic        : " << r._mosaic  << " s total, " << 1000.0*r._mosaic/(double)built  << " ms/tile" << std::endl
+        << "Compile       : " << r._compile << " s total, " << 1000.0*r._compile/(double)built << " ms/tile" << std::endl
+        << "Peak memory   : " << getPeakMemoryMB() << " MB" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,235 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Benchmark"
+
+#include <osgEarth/ImageLayer>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/MapOptions>
+#include <osgEarth/XmlUtils>
+
+#include <cstdlib>
+#include <iostream>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif
+
+using namespace osgEarth;
+
+#define LC "[osgearth_benchmark] "
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser args(&argc,argv);
+
+    // none of the benchmarks need a GPU.
+    Benchmark::setHeadless();
+
+    if ( args.read( "--tiles" ) )
+        return Benchmark::tiles( args );
+    else if ( args.read( "--prefetch" ) )
+        return Benchmark::prefetch( args );
+    else if ( args.read( "--images" ) )
+        return Benchmark::images( args );
+    else if ( args.read( "--compress" ) )
+        return Benchmark::compress( args );
+    else if ( args.read( "--declutter" ) )
+        return Benchmark::declutter( args );
+    else if ( args.read( "--statesets" ) )
+        return Benchmark::statesets( args );
+    else if ( args.read( "--shaders" ) )
+        return Benchmark::shaders( args );
+    else if ( args.read( "--tilekeys" ) )
+        return Benchmark::tilekeys( args );
+    else
+        return Benchmark::usage("");
+}
+
+
+int
+Benchmark::usage( const std::string& msg )
+{
+    if ( !msg.empty() )
+    {
+        std::cout << msg << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << "USAGE: osgearth_benchmark" << std::endl
+        << std::endl
+        << "    --tiles file.earth                  ; Measures terrain tile build throughput" << std::endl
+        << "        [--min-level level]             ; Lowest LOD level to build (default=0)" << std::endl
+        << "        [--max-level level]             ; Highest LOD level to build (default=5)" << std::endl
+        << "        [--bounds xmin ymin xmax ymax]* ; Geospatial bounding box (in map coordinates; default=layer data extents)" << std::endl
+        << "        [--threads num]                 ; Number of build threads (default=1)" << std::endl
+        << "        [--max-tiles num]               ; Stop after building this many tiles" << std::endl
+        << std::endl
+        << "    --prefetch file.earth               ; Replays a camera path and measures how many terrain" << std::endl
+        << "                                        ; tiles were ready when first needed" << std::endl
+        << "        --path file.path                ; Recorded camera path (osgViewer animation path format)" << std::endl
+        << "        [--no-prefetch]                 ; Disable predictive prefetch (baseline)" << std::endl
+        << "        [--lookahead seconds]           ; Prefetch prediction time (default=terrain option)" << std::endl
+        << "        [--speed factor]                ; Playback speed multiplier (default=1)" << std::endl
+        << "        [--fps num]                     ; Simulated frame rate (default=60)" << std::endl
+        << "        [--pager-threads num]           ; Number of simulated pager threads (default=2)" << std::endl
+        << std::endl
+        << "    --images                            ; Times the ImageUtils operations with and without the" << std::endl
+        << "                                        ; format-specialized kernels" << std::endl
+        << "        [--size num]*                   ; Image width and height (default=64, 256, 512, 1024)" << std::endl
+        << "        [--format name]*                ; rgba8, rgb8, l8, rgba32f or l32f (default=all)" << std::endl
+        << "        [--iterations num]              ; Calls per measurement (default=20)" << std::endl
+        << std::endl
+        << "    --compress                          ; Measures DXT1/DXT5 texture compression speed," << std::endl
+        << "                                        ; compression ratio and error" << std::endl
+        << "        [--size num]*                   ; Synthetic image width and height (default=256, 512, 1024)" << std::endl
+        << "        [--image file]                  ; Compress this image instead of synthetic ones" << std::endl
+        << "        [--format name]*                ; dxt1 or dxt5 (default=both)" << std::endl
+        << "        [--quality name]*               ; fast, normal or high (default=all)" << std::endl
+        << "        [--threads num]                 ; Threads per image (default=1)" << std::endl
+        << "        [--iterations num]              ; Calls per measurement (default=5)" << std::endl
+        << std::endl
+        << "    --declutter                         ; Times the screen-space declutter pass on synthetic" << std::endl
+        << "                                        ; labels, occupancy grid vs. brute force" << std::endl
+        << "        [--labels num]*                 ; Number of labels (default=500, 2000, 5000, 10000)" << std::endl
+        << "        [--viewport width height]       ; Viewport size in pixels (default=1920 1080)" << std::endl
+        << "        [--label-size width height]     ; Average label size in pixels (default=120 24)" << std::endl
+        << "        [--cell-size pixels]            ; Grid cell size (default=64)" << std::endl
+        << "        [--max-objects num]             ; Stop after accepting this many labels" << std::endl
+        << "        [--frames num]                  ; Frames per measurement (default=20)" << std::endl
+        << std::endl
+        << "    --statesets                         ; Times StateSetCache sharing on synthetic feature style" << std::endl
+        << "                                        ; groups, digest index vs. single ordered set" << std::endl
+        << "        [--groups num]*                 ; Number of style groups (default=10000, 25000, 50000)" << std::endl
+        << "        [--styles num]                  ; Number of distinct styles among them (default=2000)" << std::endl
+        << "        [--threads num]                 ; Also measure on this many threads (default=4)" << std::endl
+        << "        [--iterations num]              ; Runs per measurement (default=3)" << std::endl
+        << std::endl
+        << "    --shaders                           ; Times VirtualProgram program lookups on synthetic VP" << std::endl
+        << "                                        ; stacks, hashed lookup vs. full accumulation" << std::endl
+        << "        [--draws num]                   ; Number of drawables (default=5000)" << std::endl
+        << "        [--parents num]                 ; Number of parent VPs they are spread over (default=16)" << std::endl
+        << "        [--functions num]               ; Shader functions per root and parent VP (default=4)" << std::endl
+        << "        [--iterations num]              ; Passes over the drawables (default=20)" << std::endl
+        << std::endl
+        << "    --tilekeys                          ; Times tile key enumeration and keyed map and cache" << std::endl
+        << "                                        ; lookups, TileKeyIterator and packed IDs vs. full keys" << std::endl
+        << "        [--profile name]                ; Named profile (default=global-geodetic)" << std::endl
+        << "        [--min-level level]             ; Lowest LOD level to enumerate (default=0)" << std::endl
+        << "        [--max-level level]             ; Highest LOD level to enumerate (default=14)" << std::endl
+        << "        [--bounds xmin ymin xmax ymax]* ; Bounding box in lat/long (default=two boxes over Europe)" << std::endl
+        << "        [--max-keys num]                ; Keys for the map and cache lookups (default=250000)" << std::endl
+        << "        [--iterations num]              ; Runs per measurement (default=3)" << std::endl
+        << std::endl;
+
+    return -1;
+}
+
+
+void
+Benchmark::setHeadless()
+{
+#if defined(_WIN32)
+    _putenv( "OSGEARTH_HEADLESS=1" );
+#else
+    setenv( "OSGEARTH_HEADLESS", "1", 0 );
+#endif
+}
+
+
+Map*
+Benchmark::loadMap( const std::string& earthFile, Config& out_options )
+{
+    // Read the map model the same way the earth file loader does, minus the
+    // MapNode (which would start up a terrain engine).
+    osg::ref_ptr<XmlDocument> doc = XmlDocument::load( earthFile );
+    if ( !doc.valid() )
+        return 0L;
+
+    Config docConf = doc->getConfig();
+
+    Config conf;
+    if ( docConf.hasChild( "map" ) )
+        conf = docConf.child( "map" );
+    else if ( docConf.hasChild( "earth" ) )
+        conf = docConf.child( "earth" );
+
+    if ( conf.empty() )
+        return 0L;
+
+    out_options = conf.child( "options" );
+
+    Map* map = new Map( MapOptions(out_options) );
+
+    ConfigSet images = conf.children( "image" );
+    for( ConfigSet::const_iterator i = images.begin(); i != images.end(); ++i )
+    {
+        Config layerDriverConf = *i;
+        layerDriverConf.add( "default_tile_size", "256" );
+
+        ImageLayerOptions layerOpt( layerDriverConf );
+        layerOpt.name() = layerDriverConf.value("name");
+        map->addImageLayer( new ImageLayer(layerOpt) );
+    }
+
+    for( int k=0; k<2; ++k )
+    {
+        std::string tagName = k == 0 ? "elevation" : "heightfield";
+
+        ConfigSet heightfields = conf.children( tagName );
+        for( ConfigSet::const_iterator i = heightfields.begin(); i != heightfields.end(); ++i )
+        {
+            Config layerDriverConf = *i;
+            layerDriverConf.add( "default_tile_size", "15" );
+
+            ElevationLayerOptions layerOpt( layerDriverConf );
+            layerOpt.name() = layerDriverConf.value( "name" );
+            map->addElevationLayer( new ElevationLayer(layerOpt) );
+        }
+    }
+
+    return map;
+}
+
+
+double
+Benchmark::getPeakMemoryMB()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if ( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof(pmc) ) )
+        return (double)pmc.PeakWorkingSetSize / 1048576.0;
+    return 0.0;
+#else
+    struct rusage usage;
+    if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+        return 0.0;
+#  if defined(__APPLE__)
+    return (double)usage.ru_maxrss / 1048576.0; // bytes
+#  else
+    return (double)usage.ru_maxrss / 1024.0;    // kilobytes
+#  endif
+#endif
+}
@@ -30,6 +30,7 @@
 #include <osgEarth/HTTPClient>
 #include <osgEarthUtil/TMSPackager>
 #include <osgEarthDrivers/tms/TMSOptions>
+#include <osgEarthDrivers/mbtiles/MBTilesOptions>
 
 #include <iostream>
 #include <sstream>
@@ -62,6 +63,7 @@ usage( const std::string& msg = "" )
         << "            [--max-level <num>]             : max LOD level for tiles (all layers; default=inf)\n"
         << "            [--out-earth <earthfile>]       : export an earth file referencing the new repo\n"
         << "            [--ext <extension>]             : overrides the image file extension (e.g. jpg)\n"
+        << "            [--mbtiles]                     : write each layer to one .mbtiles file instead of a TMS folder\n"
         << "            [--overwrite]                   : overwrite existing tiles\n"
         << "            [--keep-empties]                : writes out fully transparent image tiles (normally discarded)\n"
         << "            [--continue-single-color]       : continues to subdivide single color tiles, subdivision typicall stops on single color images\n"
@@ -159,6 +161,9 @@ makeTMS( osg::ArgumentParser& args )
 
     bool continueSingleColor = args.read("--continue-single-color");
 
+    // whether to write each layer to an MBTiles database
+    bool mbtiles = args.read("--mbtiles");
+
     // load up the map
     osg::ref_ptr<MapNode> mapNode = MapNode::load( args );
     if ( !mapNode.valid() )
@@ -225,19 +230,33 @@ makeTMS( osg::ArgumentParser& args )
             }
 
             std::string layerRoot = osgDB::concatPaths( rootFolder, layerFolder );
+            if ( mbtiles )
+                layerRoot += ".mbtiles";
+
             TMSPackager::Result r = packager.package( layer, layerRoot, extension );
             if ( r.ok )
             {
                 // save to the output map if requested:
                 if ( outMap.valid() )
                 {
-                    // new TMS driver info:
-                    TMSOptions tms;
-                    tms.url() = URI(
-                        osgDB::concatPaths(layerFolder, "tms.xml"),
-                        outEarthFile );
-
-                    ImageLayerOptions layerOptions( layer->getName(), tms );
+                    // new TMS or MBTiles driver info:
+                    TileSourceOptions driver;
+                    if ( mbtiles )
+                    {
+                        MBTilesOptions mbt;
+                        mbt.filename() = osgDB::getRealPath( layerRoot );
+                        driver = mbt;
+                    }
+                    else
+                    {
+                        TMSOptions tms;
+                        tms.url() = URI(
+                            osgDB::concatPaths(layerFolder, "tms.xml"),
+                            outEarthFile );
+                        driver = tms;
+                    }
+
+                    ImageLayerOptions layerOptions( layer->getName(), driver );
                     layerOptions.mergeConfig( layer->getInitialOptions().getConfig(true) );
                     layerOptions.cachePolicy() = CachePolicy::NO_CACHE;
 
@@ -275,6 +294,9 @@ makeTMS( osg::ArgumentParser& args )
             }
 
             std::string layerRoot = osgDB::concatPaths( rootFolder, layerFolder );
+            if ( mbtiles )
+                layerRoot += ".mbtiles";
+
             TMSPackager::Result r = packager.package( layer, layerRoot );
 
             if ( r.ok )
@@ -282,13 +304,24 @@ makeTMS( osg::ArgumentParser& args )
                 // save to the output map if requested:
                 if ( outMap.valid() )
                 {
-                    // new TMS driver info:
-                    TMSOptions tms;
-                    tms.url() = URI(
-                        osgDB::concatPaths(layerFolder, "tms.xml"),
-                        outEarthFile );
-
-                    ElevationLayerOptions layerOptions( layer->getName(), tms );
+                    // new TMS or MBTiles driver info:
+                    TileSourceOptions driver;
+                    if ( mbtiles )
+                    {
+                        MBTilesOptions mbt;
+                        mbt.filename() = osgDB::getRealPath( layerRoot );
+                        driver = mbt;
+                    }
+                    else
+                    {
+                        TMSOptions tms;
+                        tms.url() = URI(
+                            osgDB::concatPaths(layerFolder, "tms.xml"),
+                            outEarthFile );
+                        driver = tms;
+                    }
+
+                    ElevationLayerOptions layerOptions( layer->getName(), driver );
                     layerOptions.mergeConfig( layer->getInitialOptions().getConfig(true) );
                     layerOptions.cachePolicy() = CachePolicy::NO_CACHE;
 
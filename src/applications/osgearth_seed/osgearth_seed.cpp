@@ -29,12 +29,16 @@
 #include <osgEarth/CacheSeed>
 #include <osgEarth/MapNode>
 #include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TileSource>
+#include <osgEarthDrivers/mbtiles/MBTilesOptions>
 
 #include <iostream>
 #include <sstream>
 #include <iterator>
 
 using namespace osgEarth;
+using namespace osgEarth::Drivers;
 
 #define LC "[osgearth_cache] "
 
@@ -80,6 +84,9 @@ usage( const std::string& msg )
         << "        [--bounds xmin ymin xmax ymax]* ; Geospatial bounding box to seed (in map coordinates; default=entire map)" << std::endl
         << "        [--cache-path path]             ; Overrides the cache path in the .earth file" << std::endl
         << "        [--cache-type type]             ; Overrides the cache type in the .earth file" << std::endl
+        << "        [--mbtiles folder]              ; Writes each layer to <folder>/<layer>.mbtiles instead of the cache" << std::endl
+        << "        [--concurrency num]             ; Number of image tiles to request at once (default=1)" << std::endl
+        << "        [--elevation-stats]             ; Also builds the height range and error of each elevation tile" << std::endl
         << std::endl
         << "    --purge file.earth                  ; Purges a layer cache in a .earth file (interactive)" << std::endl
         << std::endl;
@@ -97,6 +104,30 @@ int message( const std::string& msg )
 }
 
 
+/** Opens a writable MBTiles database for a layer and registers it with the seeder. */
+void
+addMBTilesOutput( CacheSeed& seeder, TerrainLayer* layer, const std::string& folder, const std::string& format )
+{
+    std::string name = toLegalFileName( layer->getName() );
+    if ( name.empty() )
+        name = Stringify() << "layer_" << layer->getUID();
+
+    MBTilesOptions options;
+    options.filename() = osgDB::concatPaths( folder, name + ".mbtiles" );
+    options.format()   = format;
+    options.writable() = true;
+
+    osg::ref_ptr<TileSource> output = TileSourceFactory::create( options );
+    if ( output.valid() && output->startup(0L).isOK() && output->isWritable() )
+    {
+        seeder.setOutput( layer, output.get() );
+    }
+    else
+    {
+        OE_WARN << LC << "Failed to open " << *options.filename() << " for writing" << std::endl;
+    }
+}
+
 int
 seed( osg::ArgumentParser& args )
 {    
@@ -127,6 +158,17 @@ seed( osg::ArgumentParser& args )
     std::string cacheType;
     while (args.read("--cache-type", cacheType));
 
+    //Read the MBTiles output folder
+    std::string mbtilesFolder;
+    while (args.read("--mbtiles", mbtilesFolder));
+
+    //Read the number of tiles to request at once
+    unsigned int concurrency = 1;
+    while (args.read("--concurrency", concurrency));
+
+    //Whether to build the elevation tile stats
+    bool elevationStats = args.read("--elevation-stats");
+
     bool verbose = args.read("--verbose");
 
     //Read in the earth file.
@@ -141,6 +183,13 @@ seed( osg::ArgumentParser& args )
     CacheSeed seeder;
     seeder.setMinLevel( minLevel );
     seeder.setMaxLevel( maxLevel );
+    seeder.setConcurrency( concurrency );
+
+    // sources without a non-blocking reader run on the shared request pool; don't let it
+    // be the bottleneck.
+    if ( concurrency > TileRequest::getNumThreads() )
+        TileRequest::setNumThreads( concurrency );
+    seeder.setBuildElevationStats( elevationStats );
 
     for (unsigned int i = 0; i < bounds.size(); i++)
     {
@@ -152,6 +201,26 @@ seed( osg::ArgumentParser& args )
     {
         seeder.setProgressCallback(new ConsoleProgressCallback);
     }
+
+    if ( !mbtilesFolder.empty() )
+    {
+        osgDB::makeDirectory( mbtilesFolder );
+
+        ImageLayerVector imageLayers;
+        mapNode->getMap()->getImageLayers( imageLayers );
+        for( ImageLayerVector::iterator i = imageLayers.begin(); i != imageLayers.end(); ++i )
+        {
+            addMBTilesOutput( seeder, i->get(), mbtilesFolder, "png" );
+        }
+
+        ElevationLayerVector elevationLayers;
+        mapNode->getMap()->getElevationLayers( elevationLayers );
+        for( ElevationLayerVector::iterator i = elevationLayers.begin(); i != elevationLayers.end(); ++i )
+        {
+            addMBTilesOutput( seeder, i->get(), mbtilesFolder, "tif" );
+        }
+    }
+
     seeder.seed( mapNode->getMap() );
 
     return 0;
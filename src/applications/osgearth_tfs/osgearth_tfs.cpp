@@ -52,6 +52,8 @@ usage( const std::string& msg )
         << "    --order-by         ; Sort the features, if not already included in the expression. Append DESC for descending order!" << std::endl
         << "    --crop             ; Crops features instead of doing a centroid check.  Features can be added to multiple tiles when cropping is enabled" << std::endl
         << "    --dest-srs         ;The destination SRS string in any format osgEarth can understand (wkt, proj4, epsg).  If none is specified the source data SRS will be used" << std::endl
+        << "    --threads          ; The number of threads to build and write the tiles with (default is one per processor)" << std::endl
+        << "    --incremental      ; Updates an existing package in the destination, only rewriting the tiles that changed" << std::endl
         << std::endl;
 
     return -1;
@@ -105,6 +107,11 @@ int main(int argc, char** argv)
 
     std::string destSRS;
     while(arguments.read("--dest-srs", destSRS));
+
+    unsigned int numThreads = 0;
+    while (arguments.read("--threads", numThreads));
+
+    bool incremental = arguments.read("--incremental");
     
     std::string filename;
 
@@ -154,6 +161,8 @@ int main(int argc, char** argv)
               << "  OrderBy=" << queryOrderBy << std::endl
               << "  Method= " << method << std::endl
               << "  DestSRS= " << destSRS << std::endl
+              << "  Threads= " << numThreads << std::endl
+              << "  Incremental= " << (incremental ? "true" : "false") << std::endl
               << std::endl;
 
 
@@ -177,6 +186,8 @@ int main(int argc, char** argv)
     packager.setQuery( query );
     packager.setMethod( cropMethod );    
     packager.setDestSRS( destSRS );
+    packager.setNumThreads( numThreads );
+    packager.setIncremental( incremental );
     packager.package( features, destination, layer, description );
     osg::Timer_t endTime = osg::Timer::instance()->tick();
     OE_NOTICE << "Completed in " << osg::Timer::instance()->delta_s( startTime, endTime ) << " s " << std::endl;
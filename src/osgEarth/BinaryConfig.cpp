@@ -0,0 +1,345 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarth/BinaryConfig>
+#include <osgEarth/Notify>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#define LC "[BinaryConfig] "
+
+using namespace osgEarth;
+
+// Layout (all integers are 32-bit little-endian):
+//
+//   header   "OECB", version, string count, string bytes, node count
+//   offsets  string count + 1 offsets into the string bytes; string i runs
+//            from offset i to offset i+1, including its terminating NUL
+//   nodes    node count records of { key, value, first child, child count };
+//            node 0 is the root, and the children of a node are consecutive
+//            records that come after it
+//   strings  the string bytes
+
+namespace
+{
+    const char     SIGNATURE[4] = { 'O', 'E', 'C', 'B' };
+    const unsigned VERSION      = 1u;
+    const unsigned HEADER_SIZE  = 20u;
+    const unsigned RECORD_SIZE  = 16u;
+
+    inline unsigned getU32( const char* p )
+    {
+        const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+        return (unsigned)u[0] | ((unsigned)u[1] << 8) | ((unsigned)u[2] << 16) | ((unsigned)u[3] << 24);
+    }
+
+    inline void putU32( std::string& out, unsigned value )
+    {
+        out.push_back( (char)(value & 0xff) );
+        out.push_back( (char)((value >> 8) & 0xff) );
+        out.push_back( (char)((value >> 16) & 0xff) );
+        out.push_back( (char)((value >> 24) & 0xff) );
+    }
+
+    // gives each distinct string an index, in the order first seen.
+    struct StringTable
+    {
+        std::map<std::string, unsigned> _index;
+        std::vector<const std::string*> _strings;
+        unsigned                        _bytes;
+
+        StringTable() : _bytes(0u) { intern( std::string() ); }
+
+        unsigned intern( const std::string& s )
+        {
+            std::pair<std::map<std::string,unsigned>::iterator, bool> r =
+                _index.insert( std::make_pair(s, (unsigned)_strings.size()) );
+            if ( r.second )
+            {
+                _strings.push_back( &r.first->first );
+                _bytes += s.size() + 1;
+            }
+            return r.first->second;
+        }
+    };
+}
+
+//------------------------------------------------------------------------
+
+bool
+BinaryConfig::write( const Config& conf, std::ostream& out )
+{
+    // lay the nodes out breadth-first, so each node's children are adjacent.
+    StringTable                 strings;
+    std::vector<const Config*>  order;
+    std::vector<unsigned>       records;
+
+    order.push_back( &conf );
+    for( unsigned i = 0; i < order.size(); ++i )
+    {
+        const Config*    c        = order[i];
+        const ConfigSet& children = c->children();
+
+        records.push_back( strings.intern(c->key()) );
+        records.push_back( strings.intern(c->value()) );
+        records.push_back( children.empty() ? 0u : (unsigned)order.size() );
+        records.push_back( (unsigned)children.size() );
+
+        for( ConfigSet::const_iterator k = children.begin(); k != children.end(); ++k )
+            order.push_back( &(*k) );
+    }
+
+    unsigned numStrings = strings._strings.size();
+
+    std::string buf;
+    buf.reserve( HEADER_SIZE + 4u*(numStrings+1u) + 4u*records.size() + strings._bytes );
+
+    buf.append( SIGNATURE, 4 );
+    putU32( buf, VERSION );
+    putU32( buf, numStrings );
+    putU32( buf, strings._bytes );
+    putU32( buf, (unsigned)order.size() );
+
+    unsigned offset = 0u;
+    for( unsigned i = 0; i < numStrings; ++i )
+    {
+        putU32( buf, offset );
+        offset += strings._strings[i]->size() + 1;
+    }
+    putU32( buf, offset );
+
+    for( unsigned i = 0; i < records.size(); ++i )
+        putU32( buf, records[i] );
+
+    for( unsigned i = 0; i < numStrings; ++i )
+        buf.append( strings._strings[i]->c_str(), strings._strings[i]->size() + 1 );
+
+    out.write( buf.data(), buf.size() );
+    return out.good();
+}
+
+bool
+BinaryConfig::isBinary( const char* data, unsigned size )
+{
+    return data && size >= 4u && ::memcmp( data, SIGNATURE, 4 ) == 0;
+}
+
+BinaryConfig*
+BinaryConfig::read( std::istream& in )
+{
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string data;
+    data = buf.str();
+    return adopt( data );
+}
+
+BinaryConfig*
+BinaryConfig::adopt( std::string& buffer )
+{
+    osg::ref_ptr<BinaryConfig> bc = new BinaryConfig();
+    bc->_buffer.swap( buffer );
+    return bc->init( bc->_buffer.data(), bc->_buffer.size() ) ? bc.release() : 0L;
+}
+
+BinaryConfig*
+BinaryConfig::wrap( const char* data, unsigned size )
+{
+    osg::ref_ptr<BinaryConfig> bc = new BinaryConfig();
+    return bc->init( data, size ) ? bc.release() : 0L;
+}
+
+bool
+BinaryConfig::decode( const std::string& data, Config& out )
+{
+    osg::ref_ptr<BinaryConfig> bc = wrap( data.data(), data.size() );
+    if ( !bc.valid() )
+        return false;
+    out = bc->getConfig();
+    return true;
+}
+
+//------------------------------------------------------------------------
+
+BinaryConfig::BinaryConfig() :
+_offsets   ( 0L ),
+_nodes     ( 0L ),
+_strings   ( 0L ),
+_numStrings( 0u ),
+_numNodes  ( 0u )
+{
+    //nop
+}
+
+bool
+BinaryConfig::init( const char* data, unsigned size )
+{
+    if ( !isBinary(data, size) || size < HEADER_SIZE )
+        return false;
+
+    if ( getU32(data+4) != VERSION )
+    {
+        OE_WARN << LC << "Unsupported version " << getU32(data+4) << std::endl;
+        return false;
+    }
+
+    unsigned numStrings  = getU32( data+8 );
+    unsigned stringBytes = getU32( data+12 );
+    unsigned numNodes    = getU32( data+16 );
+
+    // check the sizes in 64 bits so that bad counts can't wrap around.
+    UInt64 expected =
+        (UInt64)HEADER_SIZE +
+        (UInt64)4u * ((UInt64)numStrings + 1u) +
+        (UInt64)RECORD_SIZE * (UInt64)numNodes +
+        (UInt64)stringBytes;
+
+    if ( numStrings == 0u || numNodes == 0u || expected != (UInt64)size )
+    {
+        OE_WARN << LC << "Bad header" << std::endl;
+        return false;
+    }
+
+    const char* offsets = data + HEADER_SIZE;
+    const char* nodes   = offsets + 4u*(numStrings+1u);
+    const char* strings = nodes + RECORD_SIZE*numNodes;
+
+    // every string must lie within the string bytes and end with a NUL.
+    if ( getU32(offsets) != 0u || getU32(offsets + 4u*numStrings) != stringBytes )
+        return false;
+
+    for( unsigned i = 0; i < numStrings; ++i )
+    {
+        unsigned start = getU32( offsets + 4u*i );
+        unsigned end   = getU32( offsets + 4u*(i+1u) );
+        if ( end <= start || end > stringBytes || strings[end-1u] != '\0' )
+            return false;
+    }
+
+    // every node must refer to real strings, and to children after it (so there are no cycles).
+    for( unsigned i = 0; i < numNodes; ++i )
+    {
+        const char* r          = nodes + RECORD_SIZE*i;
+        unsigned    firstChild = getU32( r+8 );
+        unsigned    numChildren= getU32( r+12 );
+
+        if ( getU32(r) >= numStrings || getU32(r+4) >= numStrings )
+            return false;
+
+        if ( numChildren > 0u && (firstChild <= i || firstChild > numNodes || numChildren > numNodes - firstChild) )
+            return false;
+    }
+
+    _offsets    = offsets;
+    _nodes      = nodes;
+    _strings    = strings;
+    _numStrings = numStrings;
+    _numNodes   = numNodes;
+    return true;
+}
+
+const char*
+BinaryConfig::getString( unsigned index ) const
+{
+    return _strings + getU32( _offsets + 4u*index );
+}
+
+const char*
+BinaryConfig::getRecord( unsigned index ) const
+{
+    return _nodes + RECORD_SIZE*index;
+}
+
+void
+BinaryConfig::decodeNode( unsigned index, Config& out ) const
+{
+    const char* r = getRecord( index );
+    out._key          = getString( getU32(r) );
+    out._defaultValue = getString( getU32(r+4) );
+
+    // build the children in place, rather than copying each finished subtree in with add().
+    unsigned first = getU32( r+8 );
+    unsigned count = getU32( r+12 );
+    for( unsigned i = 0; i < count; ++i )
+    {
+        out._children.push_back( Config() );
+        decodeNode( first + i, out._children.back() );
+    }
+}
+
+//------------------------------------------------------------------------
+
+const char*
+BinaryConfig::Node::key() const
+{
+    return _owner ? _owner->getString( getU32(_owner->getRecord(_index)) ) : "";
+}
+
+const char*
+BinaryConfig::Node::value() const
+{
+    return _owner ? _owner->getString( getU32(_owner->getRecord(_index)+4) ) : "";
+}
+
+unsigned
+BinaryConfig::Node::getNumChildren() const
+{
+    return _owner ? getU32( _owner->getRecord(_index)+12 ) : 0u;
+}
+
+BinaryConfig::Node
+BinaryConfig::Node::getChild( unsigned i ) const
+{
+    if ( !_owner || i >= getNumChildren() )
+        return Node();
+    return Node( _owner, getU32(_owner->getRecord(_index)+8) + i );
+}
+
+BinaryConfig::Node
+BinaryConfig::Node::child( const char* key ) const
+{
+    if ( !_owner || !key )
+        return Node();
+
+    const char* r     = _owner->getRecord( _index );
+    unsigned    first = getU32( r+8 );
+    unsigned    count = getU32( r+12 );
+    for( unsigned i = first; i < first + count; ++i )
+    {
+        if ( ::strcmp( _owner->getString(getU32(_owner->getRecord(i))), key ) == 0 )
+            return Node( _owner, i );
+    }
+    return Node();
+}
+
+const char*
+BinaryConfig::Node::value( const char* key ) const
+{
+    return child( key ).value();
+}
+
+Config
+BinaryConfig::Node::getConfig() const
+{
+    Config conf;
+    if ( _owner )
+        _owner->decodeNode( _index, conf );
+    return conf;
+}
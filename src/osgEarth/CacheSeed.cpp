@@ -18,7 +18,9 @@
 */
 
 #include <osgEarth/CacheSeed>
+#include <osgEarth/ElevationTileStats>
 #include <osgEarth/MapFrame>
+#include <osgEarth/TileKeyIterator>
 #include <OpenThreads/ScopedLock>
 #include <limits.h>
 
@@ -30,6 +32,8 @@ using namespace OpenThreads;
 CacheSeed::CacheSeed():
 _minLevel (0),
 _maxLevel (12),
+_concurrency(1),
+_buildElevationStats(false),
 _total    (0),
 _completed(0)
 {
@@ -37,12 +41,27 @@ _completed(0)
 
 void CacheSeed::seed( Map* map )
 {
-    if ( !map->getCache() )
+    if ( !map->getCache() && _outputs.empty() )
     {
         OE_WARN << LC << "Warning: No cache defined; aborting." << std::endl;
         return;
     }
 
+    // outputs are written with the map's tile keys, so the profiles must agree.
+    for( OutputMap::iterator i = _outputs.begin(); i != _outputs.end(); )
+    {
+        const Profile* outProfile = i->second->getProfile();
+        if ( !outProfile || !outProfile->isHorizEquivalentTo(map->getProfile()) )
+        {
+            OE_WARN << LC << "Warning: Output profile does not match the map profile; ignoring output." << std::endl;
+            _outputs.erase( i++ );
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
     std::vector<TileKey> keys;
     map->getProfile()->getRootKeys(keys);
 
@@ -78,7 +97,7 @@ void CacheSeed::seed( Map* map )
         {
             OE_WARN << LC << "Warning: Layer \"" << layer->getName() << "\" does not support seeding; skipping." << std::endl;
         }
-        else if ( !layer->getCache() )
+        else if ( !layer->getCache() && !getOutput(layer) )
         {
             OE_WARN << LC << "Notice: Layer \"" << layer->getName() << "\" has no cache defined; skipping." << std::endl;
         }
@@ -111,7 +130,7 @@ void CacheSeed::seed( Map* map )
         {
             OE_WARN << LC << "Warning: Layer \"" << layer->getName() << "\" does not support seeding; skipping." << std::endl;
         }
-        else if ( !layer->getCache() )
+        else if ( !layer->getCache() && !getOutput(layer) )
         {
             OE_WARN << LC << "Notice: Layer \"" << layer->getName() << "\" has no cache defined; skipping." << std::endl;
         }
@@ -143,6 +162,14 @@ void CacheSeed::seed( Map* map )
     //Estimate the number of tiles
     _total = 0;    
 
+    //Count the tiles under each extent from its tile index ranges, in the map's SRS.
+    std::vector<TileKeyIterator> extentTiles;
+    for (std::vector< GeoExtent >::const_iterator itr = _extents.begin(); itr != _extents.end(); itr++)
+    {
+        extentTiles.push_back( TileKeyIterator(map->getProfile(), _minLevel, _maxLevel) );
+        extentTiles.back().addExtent( *itr );
+    }
+
     for (unsigned int level = _minLevel; level <= _maxLevel; level++)
     {
         double coverageRatio = 0.0;
@@ -155,17 +182,12 @@ void CacheSeed::seed( Map* map )
         }
         else
         {
-            for (std::vector< GeoExtent >::const_iterator itr = _extents.begin(); itr != _extents.end(); itr++)
+            for (unsigned int e = 0; e < _extents.size(); ++e)
             {
-                const GeoExtent& extent = *itr;
+                const GeoExtent& extent = _extents[e];
                 double boundsArea = extent.area();
 
-                TileKey ll = map->getProfile()->createTileKey(extent.xMin(), extent.yMin(), level);
-                TileKey ur = map->getProfile()->createTileKey(extent.xMax(), extent.yMax(), level);
-
-                int tilesWide = ur.getTileX() - ll.getTileX() + 1;
-                int tilesHigh = ll.getTileY() - ur.getTileY() + 1;
-                int tilesAtLevel = tilesWide * tilesHigh;
+                int tilesAtLevel = (int)extentTiles[e].getNumTiles( level );
                 //OE_NOTICE << "Tiles at level " << level << "=" << tilesAtLevel << std::endl;
 
                 bool hasData = false;
@@ -261,13 +283,51 @@ void CacheSeed::seed( Map* map )
 
     OE_INFO << "Processing ~" << _total << " tiles" << std::endl;
 
-    for (unsigned int i = 0; i < keys.size(); ++i)
+    if ( _concurrency > 1 )
     {
-        processKey( mapf, keys[i] );
+        processKeys( mapf, keys );
+    }
+    else
+    {
+        for (unsigned int i = 0; i < keys.size(); ++i)
+        {
+            processKey( mapf, keys[i] );
+        }
     }
 
     _total = _completed;
 
+    // commit anything the outputs are still holding:
+    for( OutputMap::iterator i = _outputs.begin(); i != _outputs.end(); ++i )
+    {
+        i->second->flush();
+    }
+
+    // now that the heightfields are in the cache, build their stats.
+    if ( _buildElevationStats && !(_progress.valid() && _progress->isCanceled()) )
+    {
+        for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+        {
+            ElevationLayer* layer = i->get();
+            if ( !layer->getCache() || getOutput(layer) )
+            {
+                OE_WARN << LC << "Notice: Layer \"" << layer->getName() << "\" has no cache for elevation stats; skipping." << std::endl;
+                continue;
+            }
+
+            OE_NOTICE << LC << "Building elevation stats for layer \"" << layer->getName() << "\"" << std::endl;
+
+            ElevationTileStatsBuilder builder;
+            builder.setMinLevel( _minLevel );
+            builder.setMaxLevel( _maxLevel );
+            builder.setProgressCallback( _progress.get() );
+            for( unsigned e = 0; e < _extents.size(); ++e )
+                builder.addExtent( _extents[e] );
+
+            builder.build( layer, map->getProfile() );
+        }
+    }
+
     if ( _progress.valid()) _progress->reportProgress(_completed, _total, 0, 1, "Finished");
 }
 
@@ -308,31 +368,164 @@ CacheSeed::processKey(const MapFrame& mapf, const TileKey& key ) const
         TileKey k2 = key.createChildKey(2);
         TileKey k3 = key.createChildKey(3); 
 
-        bool intersectsKey = false;
-        if (_extents.empty()) intersectsKey = true;
-        else
+        //Check to see if the bounds intersects ANY of the tile's children.  If it does, then process all of the children
+        //for this level
+        if (intersectsChildren(key))
         {
-            for (unsigned int i = 0; i < _extents.size(); ++i)
+            processKey(mapf, k0);
+            processKey(mapf, k1);
+            processKey(mapf, k2);
+            processKey(mapf, k3);
+        }
+    }
+}
+
+bool
+CacheSeed::intersectsChildren( const TileKey& key ) const
+{
+    if (_extents.empty())
+        return true;
+
+    for (unsigned int q = 0; q < 4; ++q)
+    {
+        GeoExtent childExtent = key.createChildKey(q).getExtent();
+        for (unsigned int i = 0; i < _extents.size(); ++i)
+        {
+            if (_extents[i].intersects( childExtent ))
+                return true;
+        }
+    }
+    return false;
+}
+
+void
+CacheSeed::processKeys(const MapFrame& mapf, const std::vector<TileKey>& keys ) const
+{
+    // Works through the keys in batches of _concurrency, depth first: each batch
+    // is cached together, then the children of that batch are processed before
+    // moving on to the next batch.
+    for (unsigned int start = 0; start < keys.size(); start += _concurrency)
+    {
+        unsigned int end = osg::minimum( start + _concurrency, (unsigned int)keys.size() );
+
+        std::vector<TileKey> batch;
+        for (unsigned int i = start; i < end; ++i)
+        {
+            if ( _minLevel <= keys[i].getLevelOfDetail() && _maxLevel >= keys[i].getLevelOfDetail() )
+                batch.push_back( keys[i] );
+        }
+
+        std::vector<bool> gotData;
+        cacheTiles( mapf, batch, gotData );
+
+        std::vector<TileKey> children;
+        unsigned int b = 0;
+        for (unsigned int i = start; i < end; ++i)
+        {
+            const TileKey& key = keys[i];
+            unsigned int lod = key.getLevelOfDetail();
+
+            bool keyGotData = true;
+            if ( _minLevel <= lod && _maxLevel >= lod )
             {
-                if (_extents[i].intersects( k0.getExtent() ) ||
-                    _extents[i].intersects( k1.getExtent() ) ||
-                    _extents[i].intersects( k2.getExtent() ) ||
-                    _extents[i].intersects( k3.getExtent() ))
+                keyGotData = gotData[b++];
+                if ( keyGotData )
                 {
-                    intersectsKey = true;
+                    incrementCompleted( 1 );
                 }
 
+                if ( _progress.valid() && _progress->isCanceled() )
+                    return; // Task has been cancelled by user
+
+                if ( _progress.valid() && keyGotData && _progress->reportProgress(_completed, _total, std::string("Cached tile: ") + key.str()) )
+                    return; // Canceled
+            }
+
+            if ( keyGotData && lod <= _maxLevel && intersectsChildren(key) )
+            {
+                for (unsigned int q = 0; q < 4; ++q)
+                    children.push_back( key.createChildKey(q) );
             }
         }
 
-        //Check to see if the bounds intersects ANY of the tile's children.  If it does, then process all of the children
-        //for this level
-        if (intersectsKey)
+        if ( !children.empty() )
         {
-            processKey(mapf, k0);
-            processKey(mapf, k1);
-            processKey(mapf, k2);
-            processKey(mapf, k3);
+            processKeys( mapf, children );
+
+            if ( _progress.valid() && _progress->isCanceled() )
+                return;
+        }
+    }
+}
+
+void
+CacheSeed::cacheTiles(const MapFrame& mapf, const std::vector<TileKey>& keys, std::vector<bool>& out_gotData ) const
+{
+    out_gotData.assign( keys.size(), false );
+
+    // Start all the image requests first so they run concurrently..
+    typedef std::vector< osg::ref_ptr<TileRequest> > Requests;
+    std::vector<Requests> requests( keys.size() );
+
+    for (unsigned int k = 0; k < keys.size(); ++k)
+    {
+        for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); i++ )
+        {
+            ImageLayer* layer = i->get();
+            osg::ref_ptr<TileRequest> request;
+            if ( layer->isKeyValid(keys[k]) )
+                request = layer->createImageAsync( keys[k] );
+            requests[k].push_back( request );
+        }
+    }
+
+    // ..then collect the results and store them on this thread.
+    for (unsigned int k = 0; k < keys.size(); ++k)
+    {
+        const TileKey& key = keys[k];
+
+        for (unsigned int r = 0; r < requests[k].size(); ++r)
+        {
+            TileRequest* request = requests[k][r].get();
+            if ( !request )
+                continue;
+
+            request->wait();
+
+            if ( request->getImage() )
+            {
+                out_gotData[k] = true;
+
+                ImageLayer* layer  = mapf.imageLayers()[r].get();
+                TileSource* output = getOutput( layer );
+                if ( output && !output->storeImage(key, request->getImage()) )
+                {
+                    OE_WARN << LC << "Failed to store tile " << key.str() << " for layer \"" << layer->getName() << "\"" << std::endl;
+                }
+            }
+        }
+
+        if ( mapf.elevationLayers().size() > 0 )
+        {
+            osg::ref_ptr<osg::HeightField> hf;
+            mapf.getHeightField( key, false, hf );
+            if ( hf.valid() )
+                out_gotData[k] = true;
+
+            // layers with outputs store their own heightfields:
+            for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+            {
+                ElevationLayer* layer  = i->get();
+                TileSource*     output = getOutput( layer );
+                if ( output && layer->isKeyValid(key) )
+                {
+                    GeoHeightField layerHF = layer->createHeightField( key );
+                    if ( layerHF.valid() && !output->storeHeightField(key, layerHF.getHeightField()) )
+                    {
+                        OE_WARN << LC << "Failed to store tile " << key.str() << " for layer \"" << layer->getName() << "\"" << std::endl;
+                    }
+                }
+            }
         }
     }
 }
@@ -349,7 +542,15 @@ CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
         {
             GeoImage image = layer->createImage( key );
             if ( image.valid() )
+            {
                 gotData = true;
+
+                TileSource* output = getOutput( layer );
+                if ( output && !output->storeImage(key, image.getImage()) )
+                {
+                    OE_WARN << LC << "Failed to store tile " << key.str() << " for layer \"" << layer->getName() << "\"" << std::endl;
+                }
+            }
         }
     }
 
@@ -359,6 +560,21 @@ CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
         mapf.getHeightField( key, false, hf );
         if ( hf.valid() )
             gotData = true;
+
+        // layers with outputs store their own heightfields:
+        for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+        {
+            ElevationLayer* layer  = i->get();
+            TileSource*     output = getOutput( layer );
+            if ( output && layer->isKeyValid(key) )
+            {
+                GeoHeightField layerHF = layer->createHeightField( key );
+                if ( layerHF.valid() && !output->storeHeightField(key, layerHF.getHeightField()) )
+                {
+                    OE_WARN << LC << "Failed to store tile " << key.str() << " for layer \"" << layer->getName() << "\"" << std::endl;
+                }
+            }
+        }
     }
 
     return gotData;
@@ -369,3 +585,22 @@ CacheSeed::addExtent( const GeoExtent& value)
 {
     _extents.push_back( value );
 }
+
+void
+CacheSeed::setOutput( TerrainLayer* layer, TileSource* output )
+{
+    if ( !layer )
+        return;
+
+    if ( output )
+        _outputs[layer->getUID()] = output;
+    else
+        _outputs.erase( layer->getUID() );
+}
+
+TileSource*
+CacheSeed::getOutput( const TerrainLayer* layer ) const
+{
+    OutputMap::const_iterator i = _outputs.find( layer->getUID() );
+    return i != _outputs.end() ? i->second.get() : 0L;
+}
@@ -38,6 +38,14 @@ struct MyGraphicsContext
 {
     MyGraphicsContext()
     {
+        // Headless tools (e.g. osgearth_benchmark) can skip the context entirely
+        // and run with the default capabilities.
+        if ( getenv( "OSGEARTH_HEADLESS" ) )
+        {
+            OE_INFO << LC << "Headless mode; skipping graphics capabilities test" << std::endl;
+            return;
+        }
+
         osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
         traits->x = 0;
         traits->y = 0;
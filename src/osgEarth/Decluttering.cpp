@@ -25,8 +25,10 @@
 #include <osgUtil/StateGraph>
 #include <osgText/Text>
 #include <osg/UserDataContainer>
+#include <osg/Math>
 #include <set>
 #include <algorithm>
+#include <cmath>
 
 #define LC "[Declutter] "
 
@@ -84,8 +86,6 @@ namespace
 
     typedef std::map<const osg::Drawable*, DrawableInfo> DrawableMemory;
     
-    typedef std::pair<const osg::Node*, osg::BoundingBox> RenderLeafBox;
-
     // Data structure stored one-per-View.
     struct PerViewInfo
     {
@@ -97,7 +97,7 @@ namespace
         // re-usable structures (to avoid unnecessary re-allocation)
         osgUtil::RenderBin::RenderLeafList _passed;
         osgUtil::RenderBin::RenderLeafList _failed;
-        std::vector<RenderLeafBox>         _used;
+        DeclutterGrid                      _used;
 
         // time stamp of the previous pass, for calculating animation speed
         double _lastTimeStamp;
@@ -142,6 +142,179 @@ DeclutteringOptions::getConfig() const
 
 //----------------------------------------------------------------------------
 
+namespace
+{
+    // Grid dimensions are capped so a huge viewport can't blow up memory;
+    // the cells just get bigger instead.
+    const unsigned MAX_GRID_DIM = 256u;
+
+    inline bool hasNaN( const osg::BoundingBox& box )
+    {
+        return
+            osg::isNaN(box.xMin()) || osg::isNaN(box.xMax()) ||
+            osg::isNaN(box.yMin()) || osg::isNaN(box.yMax());
+    }
+
+    // Maps a window coordinate to a grid index, clamping anything off the grid
+    // to the edge cells (which keeps overlapping boxes in overlapping cells).
+    inline unsigned toCell( float value, float origin, float invCellSize, unsigned numCells )
+    {
+        float f = (value - origin) * invCellSize;
+        if ( !(f > 0.0f) ) return 0u;
+        if ( f >= (float)numCells ) return numCells-1u;
+        return (unsigned)f;
+    }
+}
+
+DeclutterGrid::DeclutterGrid( float cellSize ) :
+_cellSize   ( osg::maximum(cellSize, 1.0f) ),
+_invCellSize( 1.0f/osg::maximum(cellSize, 1.0f) ),
+_x          ( 0.0f ),
+_y          ( 0.0f ),
+_cols       ( 1u ),
+_rows       ( 1u ),
+_stamp      ( 0u )
+{
+    _cells.resize( 1u );
+}
+
+void
+DeclutterGrid::reset( float x, float y, float width, float height )
+{
+    // empty only the cells that were used last time.
+    for( std::vector<unsigned>::const_iterator i = _occupied.begin(); i != _occupied.end(); ++i )
+        _cells[*i].clear();
+
+    _occupied.clear();
+    _unbounded.clear();
+    _boxes.clear();
+    _stamp = 0u;
+
+    float cellSize = _cellSize;
+    float maxDim   = osg::maximum( width, height );
+    if ( maxDim > cellSize * (float)MAX_GRID_DIM )
+        cellSize = maxDim / (float)MAX_GRID_DIM;
+
+    unsigned cols = osg::clampBetween( (unsigned)ceilf(width/cellSize),  1u, MAX_GRID_DIM );
+    unsigned rows = osg::clampBetween( (unsigned)ceilf(height/cellSize), 1u, MAX_GRID_DIM );
+
+    _x           = x;
+    _y           = y;
+    _invCellSize = 1.0f/cellSize;
+
+    if ( cols != _cols || rows != _rows )
+    {
+        _cols = cols;
+        _rows = rows;
+        _cells.resize( _cols*_rows );
+    }
+}
+
+void
+DeclutterGrid::getCells(const osg::BoundingBox& box,
+                        unsigned& c0, unsigned& r0,
+                        unsigned& c1, unsigned& r1) const
+{
+    c0 = toCell( box.xMin(), _x, _invCellSize, _cols );
+    c1 = toCell( box.xMax(), _x, _invCellSize, _cols );
+    r0 = toCell( box.yMin(), _y, _invCellSize, _rows );
+    r1 = toCell( box.yMax(), _y, _invCellSize, _rows );
+
+    // an inverted (invalid) box can still overlap others under the 2D test,
+    // so cover its whole span.
+    if ( c0 > c1 ) std::swap( c0, c1 );
+    if ( r0 > r1 ) std::swap( r0, r1 );
+}
+
+bool
+DeclutterGrid::test( Entry& entry, const osg::BoundingBox& box, const void* owner )
+{
+    // a box can live in many cells; only test it once per query.
+    if ( entry._stamp == _stamp )
+        return true;
+    entry._stamp = _stamp;
+
+    // only need a 2D test since we're in window space
+    bool isClear =
+        box.xMin() > entry._box.xMax() ||
+        box.xMax() < entry._box.xMin() ||
+        box.yMin() > entry._box.yMax() ||
+        box.yMax() < entry._box.yMin();
+
+    return isClear || owner == entry._owner;
+}
+
+bool
+DeclutterGrid::isClear( const osg::BoundingBox& box, const void* owner )
+{
+    ++_stamp;
+
+    // a degenerate (NaN) box compares as overlapping everything, so check it
+    // against every box.
+    if ( hasNaN(box) )
+    {
+        for( std::vector<Entry>::iterator i = _boxes.begin(); i != _boxes.end(); ++i )
+            if ( !test(*i, box, owner) )
+                return false;
+        return true;
+    }
+
+    for( std::vector<unsigned>::const_iterator i = _unbounded.begin(); i != _unbounded.end(); ++i )
+        if ( !test(_boxes[*i], box, owner) )
+            return false;
+
+    unsigned c0, r0, c1, r1;
+    getCells( box, c0, r0, c1, r1 );
+
+    for( unsigned r = r0; r <= r1; ++r )
+    {
+        for( unsigned c = c0; c <= c1; ++c )
+        {
+            const std::vector<unsigned>& cell = _cells[r*_cols + c];
+            for( std::vector<unsigned>::const_iterator i = cell.begin(); i != cell.end(); ++i )
+                if ( !test(_boxes[*i], box, owner) )
+                    return false;
+        }
+    }
+
+    return true;
+}
+
+void
+DeclutterGrid::insert( const osg::BoundingBox& box, const void* owner )
+{
+    unsigned index = _boxes.size();
+
+    Entry entry;
+    entry._box   = box;
+    entry._owner = owner;
+    entry._stamp = _stamp;
+    _boxes.push_back( entry );
+
+    if ( hasNaN(box) )
+    {
+        _unbounded.push_back( index );
+        return;
+    }
+
+    unsigned c0, r0, c1, r1;
+    getCells( box, c0, r0, c1, r1 );
+
+    for( unsigned r = r0; r <= r1; ++r )
+    {
+        for( unsigned c = c0; c <= c1; ++c )
+        {
+            unsigned cellIndex = r*_cols + c;
+            std::vector<unsigned>& cell = _cells[cellIndex];
+            if ( cell.empty() )
+                _occupied.push_back( cellIndex );
+            cell.push_back( index );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
 /**
  * A custom RenderLeaf sorting algorithm for decluttering objects.
  *
@@ -215,12 +388,14 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
         // Reset the local re-usable containers
         local._passed.clear();          // drawables that pass occlusion test
         local._failed.clear();          // drawables that fail occlusion test
-        local._used.clear();            // list of occupied bounding boxes in screen space
 
         // compute a window matrix so we can do window-space culling:
         const osg::Viewport* vp = cam->getViewport();
         osg::Matrix windowMatrix = vp->computeWindowMatrix();
 
+        // occupied bounding boxes in screen space
+        local._used.reset( vp->x(), vp->y(), vp->width(), vp->height() );
+
         // Track the parent nodes of drawables that are obscured (and culled). Drawables
         // with the same parent node (typically a Geode) are considered to be grouped and
         // will be culled as a group.
@@ -266,25 +441,8 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
                 else
                 {
                     // weed out any drawables that are obscured by closer drawables.
-                    // TODO: think about a more efficient algorithm - right now we are just using
-                    // brute force to compare all bbox's
-                    for( std::vector<RenderLeafBox>::const_iterator j = local._used.begin(); j != local._used.end(); ++j )
-                    {
-                        // only need a 2D test since we're in clip space
-                        bool isClear =
-                            box.xMin() > j->second.xMax() ||
-                            box.xMax() < j->second.xMin() ||
-                            box.yMin() > j->second.yMax() ||
-                            box.yMax() < j->second.yMin();
-
-                        // if there's an overlap (and the conflict isn't from the same drawable
-                        // parent, which is acceptable), then the leaf is culled.
-                        if ( !isClear && drawableParent != j->first )
-                        {
-                            visible = false;
-                            break;
-                        }
-                    }
+                    // (a conflict with the same drawable parent is acceptable.)
+                    visible = local._used.isClear( box, drawableParent );
                 }
             }
 
@@ -292,7 +450,7 @@ struct /*internal*/ DeclutterSort : public osgUtil::RenderBin::SortCallback
             {
                 // passed the test, so add the leaf's bbox to the "used" list, and add the leaf
                 // to the final draw list.
-                local._used.push_back( std::make_pair(drawableParent, box) );
+                local._used.insert( box, drawableParent );
                 local._passed.push_back( leaf );
             }
 
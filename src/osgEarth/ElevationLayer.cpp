@@ -20,7 +20,9 @@
 #include <osgEarth/VerticalDatum>
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/Progress>
+#include <osgEarth/TaskService>
 #include <osg/Version>
+#include <algorithm>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -94,27 +96,46 @@ namespace
             op( hf.get() );
         }
     };
+
+    // whether the layer's source may have data somewhere under the key.
+    bool mayHaveDataUnder( ElevationLayer* layer, const TileKey& key )
+    {
+        TileSource* ts = layer->getTileSource();
+        if ( !ts || ts->getDataExtents().size() == 0 )
+            return true;
+
+        const GeoExtent& extent = key.getExtent();
+        for( DataExtentList::const_iterator i = ts->getDataExtents().begin(); i != ts->getDataExtents().end(); ++i )
+        {
+            if ( i->transform(extent.getSRS()).intersects(extent) )
+                return true;
+        }
+        return false;
+    }
 }
 
 //------------------------------------------------------------------------
 
 ElevationLayer::ElevationLayer( const ElevationLayerOptions& options ) :
 TerrainLayer   ( options, &_runtimeOptions ),
-_runtimeOptions( options )
+_runtimeOptions( options ),
+_tileStats     ( true, 4096 )
 {
     init();
 }
 
 ElevationLayer::ElevationLayer( const std::string& name, const TileSourceOptions& driverOptions ) :
 TerrainLayer   ( ElevationLayerOptions(name, driverOptions), &_runtimeOptions ),
-_runtimeOptions( ElevationLayerOptions(name, driverOptions) )
+_runtimeOptions( ElevationLayerOptions(name, driverOptions) ),
+_tileStats     ( true, 4096 )
 {
     init();
 }
 
 ElevationLayer::ElevationLayer( const ElevationLayerOptions& options, TileSource* tileSource ) :
 TerrainLayer   ( options, &_runtimeOptions, tileSource ),
-_runtimeOptions( options )
+_runtimeOptions( options ),
+_tileStats     ( true, 4096 )
 {
     init();
 }
@@ -358,6 +379,16 @@ ElevationLayer::assembleHeightFieldFromTileSource(const TileKey&    key,
         double dx = (maxx - minx)/(double)(width-1);
         double dy = (maxy - miny)/(double)(height-1);
 
+        // Set up the samplers once for the whole grid. They also transform the
+        // elevation values vertically into the requesting key's vertical datum.
+        const SpatialReference* keySRS = key.getExtent().getSRS();
+        std::vector<GeoHeightFieldSampler> samplers;
+        samplers.reserve( heightFields.size() );
+        for (GeoHeightFieldVector::iterator itr = heightFields.begin(); itr != heightFields.end(); ++itr)
+        {
+            samplers.push_back( GeoHeightFieldSampler(*itr, keySRS, INTERP_BILINEAR, keySRS) );
+        }
+
         //Create the new heightfield by sampling all of them.
         for (unsigned int c = 0; c < width; ++c)
         {
@@ -368,12 +399,10 @@ ElevationLayer::assembleHeightFieldFromTileSource(const TileKey&    key,
 
                 //For each sample point, try each heightfield.  The first one with a valid elevation wins.
                 float elevation = NO_DATA_VALUE;
-                for (GeoHeightFieldVector::iterator itr = heightFields.begin(); itr != heightFields.end(); ++itr)
+                for (unsigned i = 0; i < samplers.size(); ++i)
                 {
-                    // get the elevation value, at the same time transforming it vertically into the 
-                    // requesting key's vertical datum.
                     float e = 0.0;
-                    if (itr->getElevation(key.getExtent().getSRS(), x, y, INTERP_BILINEAR, key.getExtent().getSRS(), e))
+                    if (samplers[i].sample(x, y, e))
                     {
                         elevation = e;
                         break;
@@ -479,6 +508,38 @@ ElevationLayer::createHeightField(const TileKey&    key,
 }
 
 
+namespace
+{
+    struct CreateHeightFieldTask : public TaskRequest
+    {
+        osg::ref_ptr<ElevationLayer> _layer;
+        osg::ref_ptr<TileRequest>    _request;
+
+        void operator()( ProgressCallback* )
+        {
+            GeoHeightField hf;
+            if ( !_request->isCanceled() )
+                hf = _layer->createHeightField( _request->getKey(), _request->getProgressCallback() );
+            _request->complete( hf.getHeightField() );
+        }
+    };
+}
+
+osg::ref_ptr<TileRequest>
+ElevationLayer::createHeightFieldAsync(const TileKey&         key,
+                                       TileRequest::Callback* callback )
+{
+    osg::ref_ptr<TileRequest> request = new TileRequest( key, callback );
+
+    CreateHeightFieldTask* task = new CreateHeightFieldTask();
+    task->_layer   = this;
+    task->_request = request.get();
+    TileRequest::getTaskService()->add( task );
+
+    return request;
+}
+
+
 bool
 ElevationLayer::isKeyValid(const TileKey& key) const
 {
@@ -494,6 +555,60 @@ ElevationLayer::isKeyValid(const TileKey& key) const
 }
 
 
+std::string
+ElevationLayer::getTileStatsCacheKey(const TileKey& key) const
+{
+    return key.str() + "_stats";
+}
+
+bool
+ElevationLayer::getTileStats(const TileKey& key, ElevationTileStats& out_stats)
+{
+    TileKeyCache<ElevationTileStats>::Record rec;
+    if ( _tileStats.get(key, rec) )
+    {
+        out_stats = rec.value();
+        return out_stats.valid();
+    }
+
+    // the stats live in a small record of their own next to the cached
+    // heightfield, so reading them doesn't mean decoding the heightfield.
+    ElevationTileStats stats;
+    CacheBin* cacheBin = getCacheBin( key.getProfile() );
+    if ( cacheBin && getCachePolicy().isCacheReadable() )
+    {
+        ReadResult r = cacheBin->readString( getTileStatsCacheKey(key) );
+        if ( r.succeeded() )
+        {
+            Config conf;
+            if ( conf.fromJSON(r.getString()) )
+                stats = ElevationTileStats( conf );
+        }
+    }
+
+    // remember misses too, so we don't go back to the cache for them.
+    _tileStats.insert( key, stats );
+    out_stats = stats;
+    return stats.valid();
+}
+
+bool
+ElevationLayer::setTileStats(const TileKey&            key,
+                             const ElevationTileStats& stats)
+{
+    CacheBin* cacheBin = getCacheBin( key.getProfile() );
+    if ( !cacheBin || !getCachePolicy().isCacheWriteable() )
+        return false;
+
+    osg::ref_ptr<StringObject> record = new StringObject( stats.getConfig().toJSON() );
+    if ( !cacheBin->write(getTileStatsCacheKey(key), record.get()) )
+        return false;
+
+    _tileStats.insert( key, stats );
+    return true;
+}
+
+
 //------------------------------------------------------------------------
 
 #undef  LC
@@ -698,28 +813,46 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
 
         const SpatialReference* keySRS = keyToUse.getProfile()->getSRS();
 
-        // Create the new heightfield by sampling all layer heightfields.
+        // Set up a sampler per layer, once for the whole grid. Go BACKWARDS
+        // because the last layer is the highest priority.
+        std::vector<GeoHeightFieldSampler> samplers;
+        samplers.reserve( heightFields.size() );
+        for( GeoHeightFieldVector::reverse_iterator itr = heightFields.rbegin(); itr != heightFields.rend(); ++itr )
+        {
+            samplers.push_back( GeoHeightFieldSampler(*itr, keySRS, interpolation, keySRS) );
+        }
+
+        // sample points for one row, and each layer's heights along it
+        // (NO_DATA_VALUE where a layer has no data).
+        std::vector<double> xs( width ), ys( width );
         for (unsigned int c = 0; c < width; ++c)
         {
-            double x = minx + (dx * (double)c);
-            for (unsigned r = 0; r < height; ++r)
+            xs[c] = minx + (dx * (double)c);
+        }
+        std::vector<float> rowHeights( width * samplers.size() );
+        std::vector<float> elevations;
+
+        // Create the new heightfield by sampling all layer heightfields, a row at a time.
+        for (unsigned r = 0; r < height; ++r)
+        {
+            double y = miny + (dy * (double)r);
+            std::fill( ys.begin(), ys.end(), y );
+
+            for (unsigned s = 0; s < samplers.size(); ++s)
             {
-                double y = miny + (dy * (double)r);
+                samplers[s].sample( width, &xs.front(), &ys.front(), &rowHeights[s*width] );
+            }
 
-                //Collect elevations from all of the layers. Iterate BACKWARDS because the last layer
-                // is the highest priority.
-                std::vector<float> elevations;
-                for( GeoHeightFieldVector::reverse_iterator itr = heightFields.rbegin(); itr != heightFields.rend(); ++itr )
+            for (unsigned int c = 0; c < width; ++c)
+            {
+                //Collect the valid elevations from all of the layers, highest priority first.
+                elevations.clear();
+                for (unsigned s = 0; s < samplers.size(); ++s)
                 {
-                    const GeoHeightField& geoHF = *itr;
-
-                    float elevation = 0.0f;
-                    if ( geoHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation) )
+                    float e = rowHeights[s*width + c];
+                    if (e != NO_DATA_VALUE)
                     {
-                        if (elevation != NO_DATA_VALUE)
-                        {
-                            elevations.push_back(elevation);
-                        }
+                        elevations.push_back(e);
                     }
                 }
 
@@ -809,6 +942,8 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
 
         for( GeoHeightFieldVector::iterator itr = offsetHeightFields.begin(); itr != offsetHeightFields.end(); ++itr )
         {
+            GeoHeightFieldSampler sampler( *itr, keySRS, interpolation, keySRS );
+
             for (unsigned int c = 0; c < out_result->getNumColumns(); c++)
             {
                 double x = minx + (dx * (double)c);
@@ -816,7 +951,7 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
                 {                         
                     double y = miny + (dy * (double)r);
                     float elevation = 0.0;                    
-                    if (itr->getElevation(keySRS, x, y, interpolation, keySRS, elevation))
+                    if (sampler.sample(x, y, elevation))
                     {                    
                         double h = out_result->getHeight( c, r );                        
                         h += elevation;                                     
@@ -829,3 +964,61 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
 
     return out_result.valid();
 }
+
+bool
+ElevationLayerVector::getTileStats(const TileKey&      key,
+                                   ElevationTileStats& out_stats ) const
+{
+    ElevationTileStats stats;
+    bool  any = false;
+    float offsetMin = 0.0f, offsetMax = 0.0f, offsetError = 0.0f;
+
+    for( ElevationLayerVector::const_iterator i = this->begin(); i != this->end(); ++i )
+    {
+        ElevationLayer* layer = i->get();
+
+        if ( !layer->getEnabled() || !layer->getVisible() )
+            continue;
+
+        // a layer that starts below this key still has finer data under it,
+        // which stats built from the other layers don't account for.
+        const optional<unsigned>& minLevel = layer->getElevationLayerOptions().minLevel();
+        if ( minLevel.isSet() && key.getLevelOfDetail() < minLevel.value() )
+        {
+            if ( mayHaveDataUnder(layer, key) )
+                return false;
+            continue;
+        }
+
+        if ( layer->isKeyValid(key) )
+        {
+            ElevationTileStats layerStats;
+            if ( !layer->getTileStats(key, layerStats) )
+                return false;
+
+            if ( *layer->getElevationLayerOptions().offset() )
+            {
+                // offsets add to whatever's under them.
+                offsetMin   += layerStats._minHeight;
+                offsetMax   += layerStats._maxHeight;
+                offsetError += layerStats._error;
+            }
+            else
+            {
+                stats.expandBy( layerStats );
+                stats._error = osg::maximum( stats._error, layerStats._error );
+                any = true;
+            }
+        }
+    }
+
+    if ( !any )
+        return false;
+
+    stats._minHeight += offsetMin;
+    stats._maxHeight += offsetMax;
+    stats._error     += offsetError;
+
+    out_stats = stats;
+    return true;
+}
@@ -256,6 +256,21 @@ ElevationQuery::getElevationImpl(const GeoPoint& point,
         return false;
     }
 
+    // Where the elevation stats say a coarser tile departs nowhere from the finer
+    // data under it (flat ground, water), that tile gives the same answer: use it,
+    // and spare fetching the finer tiles. Queries nearby then share it in the cache.
+    ElevationTileStats stats;
+    for( TileKey parent = key.createParentKey(); parent.valid(); parent = parent.createParentKey() )
+    {
+        if (!_mapf.elevationLayers().getTileStats(parent, stats) ||
+            stats._error > 0.0f ||
+            stats._finestLevel < key.getLevelOfDetail() )
+        {
+            break;
+        }
+        key = parent;
+    }
+
     // Check the tile cache. Note that the TileSource already likely has a MemCache
     // attached to it. We employ a secondary cache here for a couple reasons. One, this
     // cache will store not only the heightfield, but also the tesselated tile in the event
@@ -294,15 +309,8 @@ ElevationQuery::getElevationImpl(const GeoPoint& point,
 
     bool result = true;
 
-    const GeoExtent& extent = key.getExtent();
-    double xInterval = extent.width()  / (double)(tile->getNumColumns()-1);
-    double yInterval = extent.height() / (double)(tile->getNumRows()-1);
-    
-    out_elevation = (double) HeightFieldUtils::getHeightAtLocation( 
-        tile.get(), 
-        mapPoint.x(), mapPoint.y(), 
-        extent.xMin(), extent.yMin(), 
-        xInterval, yInterval, _mapf.getMapInfo().getElevationInterpolation() );
+    GeoHeightFieldSampler sampler( tile.get(), key.getExtent(), _mapf.getMapInfo().getElevationInterpolation() );
+    out_elevation = (double) sampler.sampleLocal( mapPoint.x(), mapPoint.y() );
 
     osg::Timer_t end = osg::Timer::instance()->tick();
     _queries++;
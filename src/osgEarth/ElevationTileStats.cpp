@@ -0,0 +1,285 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/ElevationTileStats>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/StringUtils>
+#include <osg/Timer>
+#include <cfloat>
+#include <iomanip>
+
+#define LC "[ElevationTileStatsBuilder] "
+
+using namespace osgEarth;
+
+namespace
+{
+    // full float precision, so that the stored range still contains every height.
+    std::string toExactString( float value )
+    {
+        return Stringify() << std::setprecision(9) << value;
+    }
+}
+
+//------------------------------------------------------------------------
+
+ElevationTileStats::ElevationTileStats() :
+_minHeight  ( FLT_MAX ),
+_maxHeight  ( -FLT_MAX ),
+_error      ( 0.0f ),
+_finestLevel( 0 )
+{
+    //nop
+}
+
+ElevationTileStats::ElevationTileStats( const Config& conf ) :
+_minHeight  ( FLT_MAX ),
+_maxHeight  ( -FLT_MAX ),
+_error      ( 0.0f ),
+_finestLevel( 0 )
+{
+    if ( conf.hasValue("min") && conf.hasValue("max") )
+    {
+        _minHeight   = conf.value<float>( "min", FLT_MAX );
+        _maxHeight   = conf.value<float>( "max", -FLT_MAX );
+        _error       = conf.value<float>( "error", 0.0f );
+        _finestLevel = conf.value<unsigned>( "finest_level", 0u );
+    }
+}
+
+void
+ElevationTileStats::expandBy( float height )
+{
+    if ( height != NO_DATA_VALUE )
+    {
+        if ( height < _minHeight ) _minHeight = height;
+        if ( height > _maxHeight ) _maxHeight = height;
+    }
+}
+
+void
+ElevationTileStats::expandBy( const ElevationTileStats& rhs )
+{
+    if ( rhs.valid() )
+    {
+        if ( rhs._minHeight < _minHeight ) _minHeight = rhs._minHeight;
+        if ( rhs._maxHeight > _maxHeight ) _maxHeight = rhs._maxHeight;
+    }
+}
+
+Config
+ElevationTileStats::getConfig() const
+{
+    Config conf( "elevation_stats" );
+    if ( valid() )
+    {
+        conf.add( "min",   toExactString(_minHeight) );
+        conf.add( "max",   toExactString(_maxHeight) );
+        conf.add( "error", toExactString(_error) );
+        conf.add( "finest_level", _finestLevel );
+    }
+    return conf;
+}
+
+//------------------------------------------------------------------------
+
+ElevationTileStatsBuilder::ElevationTileStatsBuilder() :
+_minLevel   ( 0 ),
+_maxLevel   ( 12 ),
+_incremental( true ),
+_built      ( 0 )
+{
+    //nop
+}
+
+unsigned
+ElevationTileStatsBuilder::build(ElevationLayer* layer, const Profile* profile)
+{
+    _built = 0;
+
+    if ( !layer || !profile )
+        return 0;
+
+    if ( !layer->getCacheBin(profile) )
+    {
+        OE_WARN << LC << "Layer \"" << layer->getName() << "\" has no cache to store stats in; skipping." << std::endl;
+        return 0;
+    }
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    std::vector<TileKey> keys;
+    profile->getRootKeys( keys );
+
+    for( unsigned i = 0; i < keys.size(); ++i )
+    {
+        if ( !intersects(keys[i]) )
+            continue;
+
+        ElevationTileStats stats;
+        float deviation;
+        buildTile( layer, keys[i], 0L, stats, deviation );
+
+        if ( _progress.valid() && _progress->isCanceled() )
+            break;
+    }
+
+    OE_INFO << LC
+        << "Built stats for " << _built << " tiles of layer \"" << layer->getName() << "\" ("
+        << osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() ) << "s)"
+        << std::endl;
+
+    return _built;
+}
+
+bool
+ElevationTileStatsBuilder::intersects(const TileKey& key) const
+{
+    if ( _extents.empty() )
+        return true;
+
+    GeoExtent extent = key.getExtent();
+    for( unsigned i = 0; i < _extents.size(); ++i )
+    {
+        if ( _extents[i].intersects(extent) )
+            return true;
+    }
+    return false;
+}
+
+bool
+ElevationTileStatsBuilder::buildTile(ElevationLayer*       layer,
+                                     const TileKey&        key,
+                                     const GeoHeightField* parentHF,
+                                     ElevationTileStats&   out_stats,
+                                     float&                out_deviation)
+{
+    out_deviation = 0.0f;
+
+    if ( _progress.valid() && _progress->isCanceled() )
+        return false;
+
+    if ( key.getLevelOfDetail() > _maxLevel )
+        return false;
+
+    // above the minimum level, ours or the layer's, we only pass through on
+    // the way to the tiles we want stats for.
+    const optional<unsigned>& layerMinLevel = layer->getElevationLayerOptions().minLevel();
+    if ( key.getLevelOfDetail() < _minLevel ||
+         (layerMinLevel.isSet() && key.getLevelOfDetail() < layerMinLevel.value()) )
+    {
+        for( unsigned q = 0; q < 4; ++q )
+        {
+            TileKey childKey = key.createChildKey(q);
+            if ( intersects(childKey) )
+            {
+                ElevationTileStats childStats;
+                float              childDeviation;
+                buildTile( layer, childKey, 0L, childStats, childDeviation );
+            }
+        }
+        return false;
+    }
+
+    if ( !layer->isKeyValid(key) )
+        return false;
+
+    GeoHeightField hf = layer->createHeightField( key, _progress.get() );
+    if ( !hf.valid() )
+        return false;
+
+    // how far the parent's (interpolated) heightfield strays from this one,
+    // measured at this tile's posts.
+    if ( parentHF )
+    {
+        GeoHeightFieldSampler parent( parentHF->getHeightField(), parentHF->getExtent(), INTERP_BILINEAR );
+
+        const osg::HeightField* grid = hf.getHeightField();
+        const GeoExtent&        ex   = hf.getExtent();
+        double dx = ex.width()  / (double)osg::maximum(grid->getNumColumns()-1, 1u);
+        double dy = ex.height() / (double)osg::maximum(grid->getNumRows()-1,    1u);
+
+        for( unsigned r = 0; r < grid->getNumRows(); ++r )
+        {
+            double y = ex.yMin() + dy*(double)r;
+            for( unsigned c = 0; c < grid->getNumColumns(); ++c )
+            {
+                float h = grid->getHeight(c, r);
+                if ( h == NO_DATA_VALUE )
+                    continue;
+
+                float p = parent.sampleLocal( ex.xMin() + dx*(double)c, y );
+                if ( p == NO_DATA_VALUE )
+                    continue;
+
+                out_deviation = osg::maximum( out_deviation, fabs(p - h) );
+            }
+        }
+    }
+
+    // stats that are already there may cover everything under this tile.
+    if ( _incremental && layer->getTileStats(key, out_stats) && out_stats._finestLevel >= _maxLevel )
+        return true;
+
+    ElevationTileStats stats;
+    const osg::HeightField::HeightList& heights = hf.getHeightField()->getHeightList();
+    for( unsigned i = 0; i < heights.size(); ++i )
+        stats.expandBy( heights[i] );
+
+    // finish the children first: they set this tile's range and error. A child
+    // with no data leaves nothing out, but one outside the extents does.
+    stats._finestLevel = _maxLevel;
+    if ( key.getLevelOfDetail() < _maxLevel )
+    {
+        for( unsigned q = 0; q < 4; ++q )
+        {
+            TileKey childKey = key.createChildKey(q);
+            if ( !intersects(childKey) )
+            {
+                stats._finestLevel = key.getLevelOfDetail();
+                continue;
+            }
+
+            ElevationTileStats childStats;
+            float              childDeviation;
+            if ( buildTile(layer, childKey, &hf, childStats, childDeviation) )
+            {
+                stats.expandBy( childStats );
+                stats._error       = osg::maximum( stats._error, childDeviation + childStats._error );
+                stats._finestLevel = osg::minimum( stats._finestLevel, childStats._finestLevel );
+            }
+        }
+    }
+
+    if ( _progress.valid() && _progress->isCanceled() )
+        return false;
+
+    if ( !stats.valid() )
+        return false;
+
+    if ( layer->setTileStats(key, stats) )
+    {
+        ++_built;
+        if ( _progress.valid() )
+            _progress->reportProgress( _built, 0, std::string("Built stats for tile: ") + key.str() );
+    }
+
+    out_stats = stats;
+    return true;
+}
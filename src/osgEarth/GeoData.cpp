@@ -1761,55 +1761,7 @@ GeoHeightField::getElevation(const SpatialReference* inputSRS,
                              const SpatialReference* outputSRS,
                              float&                  out_elevation) const
 {
-    osg::Vec3d xy(x, y, 0);
-    osg::Vec3d local = xy;
-    const SpatialReference* extentSRS = _extent.getSRS();
-
-
-    // first xform the input point into our local SRS:
-    if ( inputSRS && !inputSRS->transform(xy, extentSRS, local) )
-        return false;
-
-    // check that the point falls within the heightfield bounds:
-    if ( _extent.contains(local.x(), local.y()) )
-    {
-        double xInterval = _extent.width()  / (double)(_heightField->getNumColumns()-1);
-        double yInterval = _extent.height() / (double)(_heightField->getNumRows()-1);
-
-        // sample the heightfield at the input coordinates:
-        // (note: since it's sampling the HF, it will return an MSL height if applicable)
-        out_elevation = HeightFieldUtils::getHeightAtLocation(
-            _heightField.get(), 
-            local.x(), local.y(),
-            _extent.xMin(), _extent.yMin(), 
-            xInterval, yInterval, 
-            interp);
-
-        // if the vertical datums don't match, do a conversion:
-        if ( out_elevation != NO_DATA_VALUE && !extentSRS->isVertEquivalentTo(outputSRS) )
-        {
-            // if the caller provided a custom output SRS, perform the appropriate
-            // Z transformation. This requires a lat/long point:
-
-            osg::Vec3d geolocal(local);
-            if ( !extentSRS->isGeographic() )
-            {
-                extentSRS->transform(geolocal, extentSRS->getGeographicSRS(), geolocal);
-            }
-
-            VerticalDatum::transform(
-                extentSRS->getVerticalDatum(),
-                outputSRS ? outputSRS->getVerticalDatum() : 0L,
-                geolocal.y(), geolocal.x(), out_elevation);
-        }
-
-        return true;
-    }
-    else
-    {
-        out_elevation = 0.0f;
-        return false;
-    }
+    return GeoHeightFieldSampler(*this, inputSRS, interp, outputSRS).sample(x, y, out_elevation);
 }
 
 GeoHeightField
@@ -1834,23 +1786,12 @@ GeoHeightField::createSubSample( const GeoExtent& destEx, ElevationInterpolation
     // copy over the skirt height, adjusting it for tile size.
     dest->setSkirtHeight( _heightField->getSkirtHeight() * div );
 
-    double x, y;
-    int col, row;
-
     double x0 = (destEx.xMin()-_extent.xMin())/_extent.width();
     double y0 = (destEx.yMin()-_extent.yMin())/_extent.height();
-    double xstep = div/double(w-1);
-    double ystep = div/double(h-1);
 
-    for( x = x0, col = 0; col < w; x += xstep, col++ )
-    {
-        for( y = y0, row = 0; row < h; y += ystep, row++ )
-        {
-            float height = HeightFieldUtils::getHeightAtNormalizedLocation(
-                _heightField.get(), x, y, interpolation );
-            dest->setHeight( col, row, height );
-        }
-    }
+    HeightFieldUtils::getHeightsAtNormalizedGrid(
+        _heightField.get(), x0, y0, x0+div, y0+div, w, h,
+        &dest->getHeightList().front(), interpolation );
 
     osg::Vec3d orig( destEx.xMin(), destEx.yMin(), _heightField->getOrigin().z() );
     dest->setOrigin( orig );
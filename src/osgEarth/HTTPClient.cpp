@@ -20,16 +20,22 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Version>
 #include <osgEarth/Progress>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/Registry>
 #include <osgDB/FileNameUtils>
 #include <osg/Notify>
+#include <OpenThreads/Thread>
 #include <string.h>
 #include <sstream>
 #include <fstream>
 #include <iterator>
 #include <iostream>
 #include <algorithm>
+#include <list>
+#include <map>
+#include <set>
 #include <curl/curl.h>
 
 #define LC "[HTTPClient] "
@@ -307,6 +313,11 @@ namespace
 
     static long                        s_timeout = 0;
 
+    // asynchronous transfers: most at once against one host (0 = no limit),
+    // and the number of decoding threads (0 = half the processors, at least 2).
+    static unsigned                    s_asyncMaxPerHost = 6u;
+    static unsigned                    s_asyncNumThreads = 0u;
+
     // HTTP debugging.
     static bool                        s_HTTP_DEBUG = false;
 }
@@ -614,20 +625,14 @@ HTTPClient::download(const std::string& uri,
     return getClient().doDownload( uri, localPath );
 }
 
-HTTPResponse
-HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, ProgressCallback* callback) const
+void
+HTTPClient::getProxySettings(const osgDB::Options* options,
+                             std::string&          out_address,
+                             std::string&          out_auth) const
 {
-    initialize();
-
-    const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ? 
-            options->getAuthenticationMap() :
-            osgDB::Registry::instance()->getAuthenticationMap();
-
     std::string proxy_host;
     std::string proxy_port = "8080";
 
-    std::string proxy_auth;
-
     //TODO: don't do all this proxy setup on every GET. Just do it once per client, or only when 
     // the proxy information changes.
 
@@ -643,7 +648,7 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
         std::string proxy_password = s_proxySettings.get().password();
         if (!proxy_username.empty() && !proxy_password.empty())
         {
-            proxy_auth = proxy_username + std::string(":") + proxy_password;
+            out_auth = proxy_username + std::string(":") + proxy_password;
         }
     }
 
@@ -675,19 +680,33 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, Pr
     const char* proxyEnvAuth = getenv("OSGEARTH_CURL_PROXYAUTH");	
     if (proxyEnvAuth)
     {
-        proxy_auth = std::string(proxyEnvAuth);
+        out_auth = std::string(proxyEnvAuth);
     }
 
-    // Set up proxy server:
-    std::string proxy_addr;
     if ( !proxy_host.empty() )
     {
         std::stringstream buf;
         buf << proxy_host << ":" << proxy_port;
-        std::string bufStr;
-        bufStr = buf.str();
-        proxy_addr = bufStr;
-    
+        out_address = buf.str();
+    }
+}
+
+HTTPResponse
+HTTPClient::doGet( const HTTPRequest& request, const osgDB::Options* options, ProgressCallback* callback) const
+{
+    initialize();
+
+    const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ? 
+            options->getAuthenticationMap() :
+            osgDB::Registry::instance()->getAuthenticationMap();
+
+    std::string proxy_addr;
+    std::string proxy_auth;
+    getProxySettings( options, proxy_addr, proxy_auth );
+
+    // Set up proxy server:
+    if ( !proxy_addr.empty() )
+    {
         if ( s_HTTP_DEBUG )
             OE_NOTICE << LC << "Using proxy: " << proxy_addr << std::endl;
 
@@ -936,10 +955,19 @@ HTTPClient::doReadImage(const std::string&    location,
 {
     initialize();
 
-    ReadResult result;
-
     HTTPResponse response = this->doGet(location, options, callback);
 
+    return decodeImage( location, response, options, callback );
+}
+
+ReadResult
+HTTPClient::decodeImage(const std::string&    location,
+                        const HTTPResponse&   response,
+                        const osgDB::Options* options,
+                        ProgressCallback*     callback)
+{
+    ReadResult result;
+
     if (response.isOK())
     {
         osgDB::ReaderWriter* reader = getReader(location, response);
@@ -1160,3 +1188,418 @@ HTTPClient::doReadString(const std::string&    location,
 
     return result;
 }
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    Threading::Mutex s_asyncServiceMutex;
+
+    // Owns the async service, and stops and frees it at exit, before libcurl goes away.
+    struct AsyncServiceOwner
+    {
+        AsyncServiceOwner() : _service(0L) { }
+        ~AsyncServiceOwner() { delete _service; }
+        OpenThreads::Thread* _service;
+    };
+    AsyncServiceOwner s_asyncServiceOwner;
+
+    // "host[:port]" part of a URL, which transfers are limited by.
+    std::string getHostOf( const std::string& location )
+    {
+        std::string::size_type start = location.find( "://" );
+        start = start == std::string::npos ? 0 : start + 3;
+        std::string::size_type end = location.find_first_of( "/?#", start );
+        return location.substr( start, end == std::string::npos ? std::string::npos : end - start );
+    }
+}
+
+/**
+ * Runs all asynchronous transfers on one thread with a libcurl multi handle,
+ * and passes the finished transfers to a few worker threads for decoding.
+ * Transfers past the per-host limit wait, in order, for one to the same host
+ * to finish.
+ */
+class HTTPClient::AsyncService : public OpenThreads::Thread
+{
+public:
+    struct Transfer
+    {
+        Transfer() : _stream(&_content), _code(0L), _hasContentType(false), _cancelled(false) { }
+
+        std::string                        _location;
+        std::string                        _host;
+        osg::ref_ptr<const osgDB::Options> _options;
+        osg::ref_ptr<ReadCallback>         _callback;
+        osg::ref_ptr<ProgressCallback>     _progress;
+        std::stringstream                  _content;
+        StreamObject                       _stream;
+        long                               _code;
+        std::string                        _contentType;
+        bool                               _hasContentType;
+        bool                               _cancelled;
+    };
+
+    struct Complete : public TaskRequest
+    {
+        Complete( Transfer* transfer ) : _transfer(transfer) { }
+        virtual ~Complete() { delete _transfer; }
+
+        void operator()( ProgressCallback* )
+        {
+            AsyncService::complete( _transfer );
+        }
+
+        Transfer* _transfer;
+    };
+
+    static AsyncService* get()
+    {
+        Threading::ScopedMutexLock lock( s_asyncServiceMutex );
+        if ( !s_asyncServiceOwner._service )
+        {
+            s_asyncServiceOwner._service = new AsyncService();
+            s_asyncServiceOwner._service->start();
+        }
+        return static_cast<AsyncService*>( s_asyncServiceOwner._service );
+    }
+
+    static int getDefaultNumThreads()
+    {
+        return s_asyncNumThreads > 0u ?
+            (int)s_asyncNumThreads :
+            osg::maximum(2, OpenThreads::GetNumberOfProcessors()/2);
+    }
+
+    AsyncService() :
+        _done( false )
+    {
+        _multi   = curl_multi_init();
+        _workers = new TaskService( "HTTPClient async", getDefaultNumThreads() );
+    }
+
+    virtual ~AsyncService()
+    {
+        cancel();
+
+        // transfers that never finished are dropped; nobody is left to hear about them.
+        for( std::vector<Transfer*>::iterator i = _incoming.begin(); i != _incoming.end(); ++i )
+            delete *i;
+        for( std::list<Transfer*>::iterator i = _waiting.begin(); i != _waiting.end(); ++i )
+            delete *i;
+        for( std::set<CURL*>::iterator i = _active.begin(); i != _active.end(); ++i )
+        {
+            char* priv = 0L;
+            curl_easy_getinfo( *i, CURLINFO_PRIVATE, &priv );
+            delete (Transfer*)priv;
+            curl_multi_remove_handle( _multi, *i );
+            curl_easy_cleanup( *i );
+        }
+        for( std::vector<CURL*>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+            curl_easy_cleanup( *i );
+
+        curl_multi_cleanup( _multi );
+
+        // stops the decoding threads; the decodes still queued go with them.
+        _workers = 0L;
+    }
+
+    void add( Transfer* t )
+    {
+        t->_host = getHostOf( t->_location );
+
+        Threading::ScopedMutexLock lock( _mutex );
+        _incoming.push_back( t );
+        _wake.set();
+    }
+
+    void setNumThreads( int value )
+    {
+        _workers->setNumThreads( value );
+    }
+
+    int cancel()
+    {
+        if ( isRunning() )
+        {
+            _done = true;
+            _wake.set();
+            join();
+        }
+        return 0;
+    }
+
+    void run()
+    {
+        bool startable = false;
+
+        while( !_done )
+        {
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                if ( !_incoming.empty() )
+                {
+                    _waiting.insert( _waiting.end(), _incoming.begin(), _incoming.end() );
+                    _incoming.clear();
+                    startable = true;
+                }
+            }
+
+            // start what the per-host limit allows, first come first served.
+            if ( startable )
+            {
+                unsigned maxPerHost = s_asyncMaxPerHost;
+                for( std::list<Transfer*>::iterator i = _waiting.begin(); i != _waiting.end(); )
+                {
+                    unsigned& count = _perHost[(*i)->_host];
+                    if ( maxPerHost == 0u || count < maxPerHost )
+                    {
+                        ++count;
+                        begin( *i );
+                        i = _waiting.erase( i );
+                    }
+                    else ++i;
+                }
+                startable = false;
+            }
+
+            // nothing to do; sleep until a new transfer arrives.
+            if ( _active.empty() )
+            {
+                _wake.waitAndReset();
+                continue;
+            }
+
+            int running = 0;
+            curl_multi_perform( _multi, &running );
+
+            CURLMsg* msg;
+            int      left;
+            while( (msg = curl_multi_info_read(_multi, &left)) != 0L )
+            {
+                if ( msg->msg == CURLMSG_DONE )
+                {
+                    finish( msg->easy_handle, msg->data.result );
+                    startable = !_waiting.empty();
+                }
+            }
+
+            // wait for socket activity, but not so long that new transfers stall.
+            if ( running > 0 )
+            {
+#if LIBCURL_VERSION_NUM >= 0x071c00
+                curl_multi_wait( _multi, 0L, 0, 10, 0L );
+#else
+                OpenThreads::Thread::microSleep( 1000 );
+#endif
+            }
+        }
+    }
+
+    static void complete( Transfer* t )
+    {
+        HTTPResponse response = HTTPClient::createResponse(
+            t->_code,
+            t->_hasContentType ? t->_contentType.c_str() : 0L,
+            t->_cancelled,
+            t->_content.str() );
+
+        ReadResult result = HTTPClient::decodeImage( t->_location, response, t->_options.get(), t->_progress.get() );
+        t->_callback->onRead( t->_location, result );
+    }
+
+private:
+    void begin( Transfer* t )
+    {
+        CURL* handle;
+        if ( _idle.empty() )
+        {
+            handle = curl_easy_init();
+        }
+        else
+        {
+            handle = _idle.back();
+            _idle.pop_back();
+        }
+
+        // same setup as a per-thread client (see initializeImpl and doGet)
+        std::string userAgent = s_userAgent;
+        const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
+        if (userAgentEnv)
+            userAgent = std::string(userAgentEnv);
+
+        long timeout = s_timeout;
+        const char* timeoutEnv = getenv("OSGEARTH_HTTP_TIMEOUT");
+        if (timeoutEnv)
+            timeout = osgEarth::as<long>(std::string(timeoutEnv), 0);
+
+        curl_easy_setopt( handle, CURLOPT_URL, t->_location.c_str() );
+        curl_easy_setopt( handle, CURLOPT_USERAGENT, userAgent.c_str() );
+        curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
+        curl_easy_setopt( handle, CURLOPT_WRITEDATA, (void*)&t->_stream );
+        curl_easy_setopt( handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
+        curl_easy_setopt( handle, CURLOPT_MAXREDIRS, (void*)5 );
+        curl_easy_setopt( handle, CURLOPT_TIMEOUT, timeout );
+        curl_easy_setopt( handle, CURLOPT_SSL_VERIFYPEER, (void*)0 );
+        curl_easy_setopt( handle, CURLOPT_PRIVATE, (void*)t );
+
+        if ( t->_progress.valid() )
+        {
+            curl_easy_setopt( handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback );
+            curl_easy_setopt( handle, CURLOPT_PROGRESSDATA, (void*)t->_progress.get() );
+            curl_easy_setopt( handle, CURLOPT_NOPROGRESS, (void*)0 );
+        }
+
+        std::string proxyAddress, proxyAuth;
+        HTTPClient::getClient().getProxySettings( t->_options.get(), proxyAddress, proxyAuth );
+        if ( !proxyAddress.empty() )
+        {
+            curl_easy_setopt( handle, CURLOPT_PROXY, proxyAddress.c_str() );
+            if ( !proxyAuth.empty() )
+                curl_easy_setopt( handle, CURLOPT_PROXYUSERPWD, proxyAuth.c_str() );
+        }
+
+        const osgDB::AuthenticationMap* authenticationMap = (t->_options.valid() && t->_options->getAuthenticationMap()) ?
+            t->_options->getAuthenticationMap() :
+            osgDB::Registry::instance()->getAuthenticationMap();
+
+        const osgDB::AuthenticationDetails* details = authenticationMap ?
+            authenticationMap->getAuthenticationDetails(t->_location) :
+            0;
+
+        if ( details )
+        {
+            std::string password = details->username + ":" + details->password;
+            curl_easy_setopt( handle, CURLOPT_USERPWD, password.c_str() );
+#if LIBCURL_VERSION_NUM >= 0x070a07
+            curl_easy_setopt( handle, CURLOPT_HTTPAUTH, details->httpAuthentication );
+#endif
+        }
+
+        curl_multi_add_handle( _multi, handle );
+        _active.insert( handle );
+    }
+
+    void finish( CURL* handle, CURLcode res )
+    {
+        char* priv = 0L;
+        curl_easy_getinfo( handle, CURLINFO_PRIVATE, &priv );
+        Transfer* t = (Transfer*)priv;
+
+        curl_easy_getinfo( handle, CURLINFO_RESPONSE_CODE, &t->_code );
+
+        char* contentType = 0L;
+        curl_easy_getinfo( handle, CURLINFO_CONTENT_TYPE, &contentType );
+        if ( contentType )
+        {
+            t->_contentType    = contentType;
+            t->_hasContentType = true;
+        }
+
+        t->_cancelled = res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT;
+
+        if ( s_HTTP_DEBUG )
+        {
+            OE_NOTICE << LC << "GET(" << t->_code << ", async): \"" << t->_location << "\"" << std::endl;
+        }
+
+        // recycle the handle; the multi handle keeps the connections alive.
+        curl_multi_remove_handle( _multi, handle );
+        curl_easy_reset( handle );
+        _active.erase( handle );
+        _idle.push_back( handle );
+
+        std::map<std::string, unsigned>::iterator h = _perHost.find( t->_host );
+        if ( h != _perHost.end() && --h->second == 0u )
+            _perHost.erase( h );
+
+        _workers->add( new Complete(t) );
+    }
+
+    CURLM*                          _multi;
+    Threading::Mutex                _mutex;
+    std::vector<Transfer*>          _incoming;
+    std::list<Transfer*>            _waiting;   // held back by the per-host limit
+    std::map<std::string, unsigned> _perHost;   // transfers running, by host
+    std::set<CURL*>                 _active;
+    std::vector<CURL*>              _idle;
+    Threading::Event                _wake;
+    osg::ref_ptr<TaskService> _workers;
+    volatile bool             _done;
+};
+
+void
+HTTPClient::setMaxAsyncConnectionsPerHost( unsigned value )
+{
+    s_asyncMaxPerHost = value;
+}
+
+unsigned
+HTTPClient::getMaxAsyncConnectionsPerHost()
+{
+    return s_asyncMaxPerHost;
+}
+
+void
+HTTPClient::setNumAsyncThreads( unsigned value )
+{
+    Threading::ScopedMutexLock lock( s_asyncServiceMutex );
+    s_asyncNumThreads = value;
+    if ( s_asyncServiceOwner._service )
+        static_cast<AsyncService*>( s_asyncServiceOwner._service )->setNumThreads( AsyncService::getDefaultNumThreads() );
+}
+
+unsigned
+HTTPClient::getNumAsyncThreads()
+{
+    return s_asyncNumThreads;
+}
+
+HTTPResponse
+HTTPClient::createResponse(long               code,
+                           const char*        contentType,
+                           bool               cancelled,
+                           const std::string& content)
+{
+    // Builds a single-part response, the same way doGet() does.
+    HTTPResponse response( code );
+
+    if ( cancelled )
+    {
+        response._cancelled = true;
+        return response;
+    }
+
+    if ( contentType == 0L )
+    {
+        OE_WARN << LC << "NULL Content-Type (protocol violation)" << std::endl;
+        return HTTPResponse(0L);
+    }
+
+    response._mimeType = contentType;
+
+    osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
+    part->_stream.str( content );
+    part->_headers[IOMetadata::CONTENT_TYPE] = response._mimeType;
+    response._parts.push_back( part.get() );
+
+    return response;
+}
+
+void
+HTTPClient::readImageAsync(const std::string&    location,
+                           const osgDB::Options* options,
+                           ReadCallback*         callback,
+                           ProgressCallback*     progress)
+{
+    if ( !callback )
+        return;
+
+    AsyncService::Transfer* t = new AsyncService::Transfer();
+    t->_location = location;
+    t->_options  = options;
+    t->_callback = callback;
+    t->_progress = progress;
+
+    AsyncService::get()->add( t );
+}
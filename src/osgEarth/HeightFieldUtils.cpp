@@ -20,67 +20,25 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/GeoData>
 #include <osgEarth/Geoid>
+#include <osgEarth/VerticalDatum>
 #include <osgEarth/CullingUtils>
 #include <osg/Notify>
+#include <algorithm>
+#include <vector>
 
 using namespace osgEarth;
 
-float
-HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double r, ElevationInterpolation interpolation)
+namespace
 {
-    float result = 0.0;
-    if (interpolation == INTERP_NEAREST)
+    // Height at fractional pixel (c,r) on the quad whose corner posts are given,
+    // following the triangle split that best fits the corner heights. Shared by
+    // the single-point and grid samplers so they interpolate the same way.
+    inline float getTriangulatedHeight(double c, double r,
+                                       int colMin, int colMax,
+                                       int rowMin, int rowMax,
+                                       float llHeight, float lrHeight,
+                                       float ulHeight, float urHeight)
     {
-        //Nearest interpolation
-        result = hf->getHeight((unsigned int)osg::round(c), (unsigned int)osg::round(r));
-    }
-    else if (interpolation == INTERP_TRIANGULATE)
-    {
-        //Interpolation to make sure that the interpolated point follows the triangles generated by the 4 parent points
-        int rowMin = osg::maximum((int)floor(r), 0);
-        int rowMax = osg::maximum(osg::minimum((int)ceil(r), (int)(hf->getNumRows()-1)), 0);
-        int colMin = osg::maximum((int)floor(c), 0);
-        int colMax = osg::maximum(osg::minimum((int)ceil(c), (int)(hf->getNumColumns()-1)), 0);
-
-        if (rowMin == rowMax)
-        {
-            if (rowMin < (int)hf->getNumRows()-2)
-            {
-                rowMax = rowMin + 1;
-            }
-            else
-            {
-                rowMin = rowMax - 1;
-            }
-         }
-
-         if (colMin == colMax)
-         {
-            if (colMin < (int)hf->getNumColumns()-2)
-            {
-                colMax = colMin + 1;
-            }
-            else
-            {
-               colMin = colMax - 1;
-            }
-         }
-
-        if (rowMin > rowMax) rowMin = rowMax;
-        if (colMin > colMax) colMin = colMax;
-
-        float urHeight = hf->getHeight(colMax, rowMax);
-        float llHeight = hf->getHeight(colMin, rowMin);
-        float ulHeight = hf->getHeight(colMin, rowMax);
-        float lrHeight = hf->getHeight(colMax, rowMin);
-
-        //Make sure not to use NoData in the interpolation
-        if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
-        {
-            return NO_DATA_VALUE;
-        }
-
-
         //The quad consisting of the 4 corner points can be made into two triangles.
         //The "left" triangle is ll, ur, ul
         //The "right" triangle is ll, lr, ur
@@ -155,66 +113,191 @@ HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double
         //Compute the normal
         osg::Vec3d n = (v1 - v0) ^ (v2 - v0);
 
-        result = ( n.x() * ( c - v0.x() ) + n.y() * ( r - v0.y() ) ) / -n.z() + v0.z();
+        return (float)(( n.x() * ( c - v0.x() ) + n.y() * ( r - v0.y() ) ) / -n.z() + v0.z());
     }
-    else
+
+    // Sampling parameters for one grid column (or row), computed once per
+    // grid instead of once per sample. The post selection and weights follow
+    // the same rules as getHeightAtPixel.
+    struct AxisSample
     {
-        //OE_INFO << "getHeightAtPixel: (" << c << ", " << r << ")" << std::endl;
-        int rowMin = osg::maximum((int)floor(r), 0);
-        int rowMax = osg::maximum(osg::minimum((int)ceil(r), (int)(hf->getNumRows()-1)), 0);
-        int colMin = osg::maximum((int)floor(c), 0);
-        int colMax = osg::maximum(osg::minimum((int)ceil(c), (int)(hf->getNumColumns()-1)), 0);
-
-        if (rowMin > rowMax) rowMin = rowMax;
-        if (colMin > colMax) colMin = colMax;
-
-        float urHeight = hf->getHeight(colMax, rowMax);
-        float llHeight = hf->getHeight(colMin, rowMin);
-        float ulHeight = hf->getHeight(colMin, rowMax);
-        float lrHeight = hf->getHeight(colMax, rowMin);
-
-        //Make sure not to use NoData in the interpolation
-        if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+        double _p;       // fractional pixel coordinate
+        int    _min;     // lower post
+        int    _max;     // upper post
+        int    _nearest; // nearest post
+        double _w0;      // bilinear weight of the lower post
+        double _w1;      // bilinear weight of the upper post
+    };
+
+    // returns true if every sample lands exactly on a post.
+    bool computeAxis(double nMin, double nMax, unsigned numSamples, unsigned numPosts,
+                     bool triangulate, std::vector<AxisSample>& out)
+    {
+        bool onPosts = true;
+        out.resize( numSamples );
+
+        for( unsigned i = 0; i < numSamples; ++i )
+        {
+            double n = numSamples > 1 ? nMin + (nMax-nMin) * ((double)i / (double)(numSamples-1)) : nMin;
+            double p = osg::clampBetween(n, 0.0, 1.0) * (double)(numPosts-1);
+
+            AxisSample& a = out[i];
+            a._p       = p;
+            a._min     = osg::maximum((int)floor(p), 0);
+            a._max     = osg::maximum(osg::minimum((int)ceil(p), (int)numPosts-1), 0);
+            a._nearest = (int)osg::round(p);
+
+            if ( a._min == a._max )
+            {
+                // exactly on a post; the lower post gets all the weight.
+                a._w0 = 1.0;
+                a._w1 = 0.0;
+
+                if ( triangulate )
+                {
+                    if ( a._min < (int)numPosts-2 )
+                        a._max = a._min + 1;
+                    else
+                        a._min = a._max - 1;
+                }
+            }
+            else
+            {
+                a._w0 = (double)a._max - p;
+                a._w1 = p - (double)a._min;
+                onPosts = false;
+            }
+
+            if ( a._min > a._max ) a._min = a._max;
+        }
+
+        return onPosts;
+    }
+
+    // Height at fractional pixel (c,r) for each interpolation mode, reading the
+    // posts straight from a heightfield's height list (numCols x numRows,
+    // row-major). getHeightAtPixel and GeoHeightFieldSampler both use these, so
+    // they produce identical results.
+
+    struct NearestPixel
+    {
+        static inline float get(const float* heights, int numCols, int numRows, double c, double r)
         {
-            return NO_DATA_VALUE;
+            return heights[(unsigned)osg::round(r)*numCols + (unsigned)osg::round(c)];
         }
+    };
+
+    struct TriangulatedPixel
+    {
+        static inline float get(const float* heights, int numCols, int numRows, double c, double r)
+        {
+            //Interpolation to make sure that the interpolated point follows the triangles generated by the 4 parent points
+            int rowMin = osg::maximum((int)floor(r), 0);
+            int rowMax = osg::maximum(osg::minimum((int)ceil(r), numRows-1), 0);
+            int colMin = osg::maximum((int)floor(c), 0);
+            int colMax = osg::maximum(osg::minimum((int)ceil(c), numCols-1), 0);
+
+            if (rowMin == rowMax)
+            {
+                if (rowMin < numRows-2)
+                    rowMax = rowMin + 1;
+                else
+                    rowMin = rowMax - 1;
+            }
+
+            if (colMin == colMax)
+            {
+                if (colMin < numCols-2)
+                    colMax = colMin + 1;
+                else
+                    colMin = colMax - 1;
+            }
+
+            if (rowMin > rowMax) rowMin = rowMax;
+            if (colMin > colMax) colMin = colMax;
 
-        //OE_INFO << "Heights (ll, lr, ul, ur) ( " << llHeight << ", " << urHeight << ", " << ulHeight << ", " << urHeight << std::endl;
+            float urHeight = heights[rowMax*numCols + colMax];
+            float llHeight = heights[rowMin*numCols + colMin];
+            float ulHeight = heights[rowMax*numCols + colMin];
+            float lrHeight = heights[rowMin*numCols + colMax];
 
-        if (interpolation == INTERP_BILINEAR)
+            //Make sure not to use NoData in the interpolation
+            if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                return NO_DATA_VALUE;
+
+            return getTriangulatedHeight(
+                c, r, colMin, colMax, rowMin, rowMax,
+                llHeight, lrHeight, ulHeight, urHeight );
+        }
+    };
+
+    struct BilinearPixel
+    {
+        static inline float get(const float* heights, int numCols, int numRows, double c, double r)
         {
+            int rowMin = osg::maximum((int)floor(r), 0);
+            int rowMax = osg::maximum(osg::minimum((int)ceil(r), numRows-1), 0);
+            int colMin = osg::maximum((int)floor(c), 0);
+            int colMax = osg::maximum(osg::minimum((int)ceil(c), numCols-1), 0);
+
+            if (rowMin > rowMax) rowMin = rowMax;
+            if (colMin > colMax) colMin = colMax;
+
+            float urHeight = heights[rowMax*numCols + colMax];
+            float llHeight = heights[rowMin*numCols + colMin];
+            float ulHeight = heights[rowMax*numCols + colMin];
+            float lrHeight = heights[rowMin*numCols + colMax];
+
+            //Make sure not to use NoData in the interpolation
+            if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                return NO_DATA_VALUE;
+
             //Check for exact value
             if ((colMax == colMin) && (rowMax == rowMin))
             {
-                //OE_NOTICE << "Exact value" << std::endl;
-                result = hf->getHeight((int)c, (int)r);
+                return heights[(int)r*numCols + (int)c];
             }
             else if (colMax == colMin)
             {
-                //OE_NOTICE << "Vertically" << std::endl;
                 //Linear interpolate vertically
-                result = ((double)rowMax - r) * llHeight + (r - (double)rowMin) * ulHeight;
+                return ((double)rowMax - r) * llHeight + (r - (double)rowMin) * ulHeight;
             }
             else if (rowMax == rowMin)
             {
-                //OE_NOTICE << "Horizontally" << std::endl;
                 //Linear interpolate horizontally
-                result = ((double)colMax - c) * llHeight + (c - (double)colMin) * lrHeight;
+                return ((double)colMax - c) * llHeight + (c - (double)colMin) * lrHeight;
             }
             else
             {
-                //OE_NOTICE << "Bilinear" << std::endl;
                 //Bilinear interpolate
                 float r1 = ((double)colMax - c) * llHeight + (c - (double)colMin) * lrHeight;
                 float r2 = ((double)colMax - c) * ulHeight + (c - (double)colMin) * urHeight;
-
-                //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
-
-                result = ((double)rowMax - r) * r1 + (r - (double)rowMin) * r2;
+                return ((double)rowMax - r) * r1 + (r - (double)rowMin) * r2;
             }
         }
-        else if (interpolation == INTERP_AVERAGE)
+    };
+
+    struct AveragePixel
+    {
+        static inline float get(const float* heights, int numCols, int numRows, double c, double r)
         {
+            int rowMin = osg::maximum((int)floor(r), 0);
+            int rowMax = osg::maximum(osg::minimum((int)ceil(r), numRows-1), 0);
+            int colMin = osg::maximum((int)floor(c), 0);
+            int colMax = osg::maximum(osg::minimum((int)ceil(c), numCols-1), 0);
+
+            if (rowMin > rowMax) rowMin = rowMax;
+            if (colMin > colMax) colMin = colMax;
+
+            float urHeight = heights[rowMax*numCols + colMax];
+            float llHeight = heights[rowMin*numCols + colMin];
+            float ulHeight = heights[rowMax*numCols + colMin];
+            float lrHeight = heights[rowMin*numCols + colMax];
+
+            //Make sure not to use NoData in the interpolation
+            if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                return NO_DATA_VALUE;
+
             double x_rem = c - (int)c;
             double y_rem = r - (int)r;
 
@@ -223,11 +306,28 @@ HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double
             double w10 = y_rem * (1.0 - x_rem) * (double)ulHeight;
             double w11 = y_rem * x_rem * (double)urHeight;
 
-            result = (float)(w00 + w01 + w10 + w11);
+            return (float)(w00 + w01 + w10 + w11);
         }
-    }
+    };
+}
+
+float
+HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double r, ElevationInterpolation interpolation)
+{
+    const float* heights = &hf->getHeightList().front();
+    int numCols = (int)hf->getNumColumns();
+    int numRows = (int)hf->getNumRows();
 
-    return result;
+    if (interpolation == INTERP_NEAREST)
+        return NearestPixel::get(heights, numCols, numRows, c, r);
+    else if (interpolation == INTERP_TRIANGULATE)
+        return TriangulatedPixel::get(heights, numCols, numRows, c, r);
+    else if (interpolation == INTERP_BILINEAR)
+        return BilinearPixel::get(heights, numCols, numRows, c, r);
+    else if (interpolation == INTERP_AVERAGE)
+        return AveragePixel::get(heights, numCols, numRows, c, r);
+    else
+        return 0.0f;
 }
 
 bool
@@ -282,6 +382,135 @@ HeightFieldUtils::getHeightAtNormalizedLocation(const osg::HeightField* input,
     return getHeightAtPixel( input, px, py, interp );
 }
 
+void
+HeightFieldUtils::getHeightsAtNormalizedGrid(const osg::HeightField* hf,
+                                             double nxMin, double nyMin,
+                                             double nxMax, double nyMax,
+                                             unsigned numCols, unsigned numRows,
+                                             float* out_heights,
+                                             ElevationInterpolation interp)
+{
+    if ( !hf || !out_heights || numCols == 0 || numRows == 0 )
+        return;
+
+    const unsigned hfCols = hf->getNumColumns();
+    const unsigned hfRows = hf->getNumRows();
+    const float*   heights = &hf->getHeightList().front();
+    const bool     triangulate = interp == INTERP_TRIANGULATE;
+
+    std::vector<AxisSample> cols, rows;
+    bool colsOnPosts = computeAxis( nxMin, nxMax, numCols, hfCols, triangulate, cols );
+    bool rowsOnPosts = computeAxis( nyMin, nyMax, numRows, hfRows, triangulate, rows );
+
+    // A triangulated sample on a post is only the post value if none of the
+    // quad's corners is NODATA, so make sure before taking the fast path.
+    bool copyPosts = colsOnPosts && rowsOnPosts;
+    if ( copyPosts && triangulate )
+    {
+        const osg::HeightField::HeightList& list = hf->getHeightList();
+        copyPosts = std::find( list.begin(), list.end(), (float)NO_DATA_VALUE ) == list.end();
+    }
+
+    // Fast path: every sample lands on a post (identical or evenly decimated grid).
+    if ( copyPosts )
+    {
+        for( unsigned r = 0; r < numRows; ++r )
+        {
+            int row = (int)rows[r]._p;
+            const float* in  = heights + row*hfCols;
+            float*       out = out_heights + r*numCols;
+
+            if ( numCols == hfCols && nxMin == 0.0 && nxMax == 1.0 )
+            {
+                std::copy( in, in + hfCols, out );
+            }
+            else
+            {
+                for( unsigned c = 0; c < numCols; ++c )
+                    out[c] = in[(int)cols[c]._p];
+            }
+        }
+        return;
+    }
+
+    for( unsigned r = 0; r < numRows; ++r )
+    {
+        const AxisSample& ry  = rows[r];
+        const float*      lo  = heights + ry._min * hfCols;
+        const float*      hi  = heights + ry._max * hfCols;
+        float*            out = out_heights + r*numCols;
+
+        if ( interp == INTERP_NEAREST )
+        {
+            const float* in = heights + ry._nearest * hfCols;
+            for( unsigned c = 0; c < numCols; ++c )
+                out[c] = in[cols[c]._nearest];
+        }
+
+        else if ( triangulate )
+        {
+            for( unsigned c = 0; c < numCols; ++c )
+            {
+                const AxisSample& cx = cols[c];
+                float llHeight = lo[cx._min], lrHeight = lo[cx._max];
+                float ulHeight = hi[cx._min], urHeight = hi[cx._max];
+
+                if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                    out[c] = NO_DATA_VALUE;
+                else
+                    out[c] = getTriangulatedHeight(
+                        cx._p, ry._p, cx._min, cx._max, ry._min, ry._max,
+                        llHeight, lrHeight, ulHeight, urHeight );
+            }
+        }
+
+        else if ( interp == INTERP_AVERAGE )
+        {
+            double y_rem = ry._p - (int)ry._p;
+            for( unsigned c = 0; c < numCols; ++c )
+            {
+                const AxisSample& cx = cols[c];
+                float llHeight = lo[cx._min], lrHeight = lo[cx._max];
+                float ulHeight = hi[cx._min], urHeight = hi[cx._max];
+
+                if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                {
+                    out[c] = NO_DATA_VALUE;
+                }
+                else
+                {
+                    double x_rem = cx._p - (int)cx._p;
+                    out[c] = (float)(
+                        (1.0 - y_rem) * (1.0 - x_rem) * (double)llHeight +
+                        (1.0 - y_rem) * x_rem * (double)lrHeight +
+                        y_rem * (1.0 - x_rem) * (double)ulHeight +
+                        y_rem * x_rem * (double)urHeight );
+                }
+            }
+        }
+
+        else // INTERP_BILINEAR
+        {
+            // The weights fold the "on a post" and "along an edge" special cases
+            // of getHeightAtPixel into one expression, which keeps this loop free
+            // of branches (apart from NODATA) so the compiler can vectorize it.
+            for( unsigned c = 0; c < numCols; ++c )
+            {
+                const AxisSample& cx = cols[c];
+                float llHeight = lo[cx._min], lrHeight = lo[cx._max];
+                float ulHeight = hi[cx._min], urHeight = hi[cx._max];
+
+                float r1 = cx._w0 * llHeight + cx._w1 * lrHeight;
+                float r2 = cx._w0 * ulHeight + cx._w1 * urHeight;
+                float h  = ry._w0 * r1 + ry._w1 * r2;
+
+                bool noData = urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE;
+                out[c] = noData ? NO_DATA_VALUE : h;
+            }
+        }
+    }
+}
+
 bool
 HeightFieldUtils::getNormalAtNormalizedLocation(const osg::HeightField* input,
                                                 double nx, double ny,
@@ -400,16 +629,9 @@ HeightFieldUtils::resampleHeightField(osg::HeightField*      input,
     output->setYInterval( stepY );
     output->setOrigin( origin );
     
-    for( int y = 0; y < newRows; ++y )
-    {
-        for( int x = 0; x < newColumns; ++x )
-        {
-            double nx = (double)x / (double)(newColumns-1);
-            double ny = (double)y / (double)(newRows-1);
-            float h = getHeightAtNormalizedLocation( input, nx, ny, interp );
-            output->setHeight( x, y, h );
-        }
-    }
+    getHeightsAtNormalizedGrid(
+        input, 0.0, 0.0, 1.0, 1.0, newColumns, newRows,
+        &output->getHeightList().front(), interp );
 
     return output;
 }
@@ -588,6 +810,249 @@ HeightFieldUtils::createClusterCullingCallback(osg::HeightField*          grid,
 
 /******************************************************************************************/
 
+GeoHeightFieldSampler::GeoHeightFieldSampler(const GeoHeightField&   hf,
+                                             const SpatialReference* inputSRS,
+                                             ElevationInterpolation  interp,
+                                             const SpatialReference* srsWithOutputVerticalDatum) :
+_inputSRS   ( inputSRS ),
+_interp     ( interp ),
+_transform  ( false ),
+_shiftDatum ( false ),
+_heights    ( 0L ),
+_numCols    ( 0 ),
+_numRows    ( 0 ),
+_xMin       ( 0.0 ),
+_yMin       ( 0.0 ),
+_colsPerUnit( 0.0 ),
+_rowsPerUnit( 0.0 )
+{
+    init( hf.getHeightField(), hf.getExtent() );
+
+    if ( valid() )
+    {
+        const SpatialReference* srs = _extent.getSRS();
+
+        // decide once whether the points need transforming and the heights
+        // need shifting, instead of asking the SRS's on every sample.
+        _transform = inputSRS && !inputSRS->isHorizEquivalentTo( srs );
+
+        _fromDatum  = srs->getVerticalDatum();
+        _toDatum    = srsWithOutputVerticalDatum ? srsWithOutputVerticalDatum->getVerticalDatum() : 0L;
+        _shiftDatum = srsWithOutputVerticalDatum ?
+            !srs->isVertEquivalentTo( srsWithOutputVerticalDatum ) :
+            _fromDatum.valid();
+    }
+}
+
+GeoHeightFieldSampler::GeoHeightFieldSampler(const osg::HeightField* hf,
+                                             const GeoExtent&        extent,
+                                             ElevationInterpolation  interp) :
+_interp     ( interp ),
+_transform  ( false ),
+_shiftDatum ( false ),
+_heights    ( 0L ),
+_numCols    ( 0 ),
+_numRows    ( 0 ),
+_xMin       ( 0.0 ),
+_yMin       ( 0.0 ),
+_colsPerUnit( 0.0 ),
+_rowsPerUnit( 0.0 )
+{
+    init( hf, extent );
+}
+
+void
+GeoHeightFieldSampler::init(const osg::HeightField* hf, const GeoExtent& extent)
+{
+    if ( !hf || hf->getHeightList().empty() || !extent.isValid() )
+        return;
+
+    _hf      = hf;
+    _extent  = extent;
+    _heights = &hf->getHeightList().front();
+    _numCols = (int)hf->getNumColumns();
+    _numRows = (int)hf->getNumRows();
+    _xMin    = extent.xMin();
+    _yMin    = extent.yMin();
+
+    // posts per unit, so finding a post is a multiply instead of a divide.
+    _colsPerUnit = _numCols > 1 && extent.width()  > 0.0 ? (double)(_numCols-1) / extent.width()  : 0.0;
+    _rowsPerUnit = _numRows > 1 && extent.height() > 0.0 ? (double)(_numRows-1) / extent.height() : 0.0;
+}
+
+float
+GeoHeightFieldSampler::sampleLocal(double x, double y) const
+{
+    double c = osg::clampBetween( (x - _xMin) * _colsPerUnit, 0.0, (double)(_numCols-1) );
+    double r = osg::clampBetween( (y - _yMin) * _rowsPerUnit, 0.0, (double)(_numRows-1) );
+
+    switch( _interp )
+    {
+    case INTERP_NEAREST:     return NearestPixel::get     ( _heights, _numCols, _numRows, c, r );
+    case INTERP_TRIANGULATE: return TriangulatedPixel::get( _heights, _numCols, _numRows, c, r );
+    case INTERP_BILINEAR:    return BilinearPixel::get    ( _heights, _numCols, _numRows, c, r );
+    case INTERP_AVERAGE:     return AveragePixel::get     ( _heights, _numCols, _numRows, c, r );
+    default:                 return 0.0f;
+    }
+}
+
+bool
+GeoHeightFieldSampler::sample(double x, double y, float& out_elevation) const
+{
+    if ( !valid() )
+    {
+        out_elevation = 0.0f;
+        return false;
+    }
+
+    double lx = x, ly = y;
+
+    // first xform the input point into our local SRS:
+    if ( _transform )
+    {
+        osg::Vec3d local;
+        if ( !_inputSRS->transform(osg::Vec3d(x, y, 0.0), _extent.getSRS(), local) )
+            return false;
+        lx = local.x();
+        ly = local.y();
+    }
+
+    if ( !_extent.contains(lx, ly) )
+    {
+        out_elevation = 0.0f;
+        return false;
+    }
+
+    // (note: since it's sampling the HF, it will return an MSL height if applicable)
+    out_elevation = sampleLocal( lx, ly );
+
+    if ( _shiftDatum && out_elevation != NO_DATA_VALUE )
+        shiftDatum( 1u, &lx, &ly, &out_elevation );
+
+    return true;
+}
+
+template<typename PIXEL>
+unsigned
+GeoHeightFieldSampler::sampleAll(unsigned count, const double* x, const double* y, float* out) const
+{
+    double maxCol = (double)(_numCols-1);
+    double maxRow = (double)(_numRows-1);
+
+    unsigned inside = 0u;
+    for( unsigned i = 0; i < count; ++i )
+    {
+        if ( _extent.contains(x[i], y[i]) )
+        {
+            double c = osg::clampBetween( (x[i] - _xMin) * _colsPerUnit, 0.0, maxCol );
+            double r = osg::clampBetween( (y[i] - _yMin) * _rowsPerUnit, 0.0, maxRow );
+            out[i] = PIXEL::get( _heights, _numCols, _numRows, c, r );
+            ++inside;
+        }
+        else
+        {
+            out[i] = NO_DATA_VALUE;
+        }
+    }
+    return inside;
+}
+
+unsigned
+GeoHeightFieldSampler::sample(unsigned count, const double* x, const double* y, float* out) const
+{
+    if ( !valid() )
+    {
+        std::fill( out, out+count, NO_DATA_VALUE );
+        return 0u;
+    }
+
+    // transform all the points at once.
+    std::vector<double> xs, ys;
+    if ( _transform && count > 0u )
+    {
+        std::vector<osg::Vec3d> points( count );
+        for( unsigned i = 0; i < count; ++i )
+            points[i].set( x[i], y[i], 0.0 );
+
+        if ( !_inputSRS->transform(points, _extent.getSRS()) )
+        {
+            // at least one point failed; take them one at a time so the rest
+            // still get sampled.
+            unsigned inside = 0u;
+            for( unsigned i = 0; i < count; ++i )
+            {
+                if ( sample(x[i], y[i], out[i]) )
+                    ++inside;
+                else
+                    out[i] = NO_DATA_VALUE;
+            }
+            return inside;
+        }
+
+        xs.resize( count );
+        ys.resize( count );
+        for( unsigned i = 0; i < count; ++i )
+        {
+            xs[i] = points[i].x();
+            ys[i] = points[i].y();
+        }
+        x = &xs.front();
+        y = &ys.front();
+    }
+
+    unsigned inside = 0u;
+    switch( _interp )
+    {
+    case INTERP_NEAREST:     inside = sampleAll<NearestPixel>     ( count, x, y, out ); break;
+    case INTERP_TRIANGULATE: inside = sampleAll<TriangulatedPixel>( count, x, y, out ); break;
+    case INTERP_BILINEAR:    inside = sampleAll<BilinearPixel>    ( count, x, y, out ); break;
+    case INTERP_AVERAGE:     inside = sampleAll<AveragePixel>     ( count, x, y, out ); break;
+    default:
+        for( unsigned i = 0; i < count; ++i )
+        {
+            bool in = _extent.contains( x[i], y[i] );
+            out[i] = in ? 0.0f : NO_DATA_VALUE;
+            if ( in ) ++inside;
+        }
+    }
+
+    if ( _shiftDatum && inside > 0u )
+        shiftDatum( count, x, y, out );
+
+    return inside;
+}
+
+void
+GeoHeightFieldSampler::shiftDatum(unsigned count, const double* x, const double* y, float* out) const
+{
+    // the datum shift requires lat/long points.
+    const SpatialReference* srs = _extent.getSRS();
+    if ( srs->isGeographic() )
+    {
+        for( unsigned i = 0; i < count; ++i )
+        {
+            if ( out[i] != NO_DATA_VALUE )
+                VerticalDatum::transform( _fromDatum.get(), _toDatum.get(), y[i], x[i], out[i] );
+        }
+    }
+    else
+    {
+        std::vector<osg::Vec3d> geo( count );
+        for( unsigned i = 0; i < count; ++i )
+            geo[i].set( x[i], y[i], 0.0 );
+
+        srs->transform( geo, srs->getGeographicSRS() );
+
+        for( unsigned i = 0; i < count; ++i )
+        {
+            if ( out[i] != NO_DATA_VALUE )
+                VerticalDatum::transform( _fromDatum.get(), _toDatum.get(), geo[i].y(), geo[i].x(), out[i] );
+        }
+    }
+}
+
+/******************************************************************************************/
+
 ReplaceInvalidDataOperator::ReplaceInvalidDataOperator():
 _replaceWith(0.0f)
 {
@@ -24,6 +24,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/StringUtils>
 #include <osgEarth/Progress>
+#include <osgEarth/TaskService>
 #include <osgEarth/URI>
 #include <osg/Version>
 #include <osgDB/WriteFile>
@@ -63,6 +64,8 @@ ImageLayerOptions::setDefaults()
     _minRange.init( -FLT_MAX );
     _maxRange.init( FLT_MAX );
     _lodBlending.init( false );
+    _textureCompressionQuality.init( TextureCompressor::QUALITY_NORMAL );
+    _textureCompressionThreads.init( 1u );
 }
 
 void
@@ -82,6 +85,14 @@ ImageLayerOptions::fromConfig( const Config& conf )
     conf.getIfSet( "lod_blending", _lodBlending );
     conf.getIfSet( "shared",       _shared );
 
+    conf.getIfSet( "texture_compression", "dxt1", _textureCompression, TextureCompressor::FORMAT_DXT1 );
+    conf.getIfSet( "texture_compression", "dxt5", _textureCompression, TextureCompressor::FORMAT_DXT5 );
+    conf.getIfSet( "texture_compression", "auto", _textureCompression, TextureCompressor::FORMAT_AUTO );
+    conf.getIfSet( "texture_compression_quality", "fast",   _textureCompressionQuality, TextureCompressor::QUALITY_FAST );
+    conf.getIfSet( "texture_compression_quality", "normal", _textureCompressionQuality, TextureCompressor::QUALITY_NORMAL );
+    conf.getIfSet( "texture_compression_quality", "high",   _textureCompressionQuality, TextureCompressor::QUALITY_HIGH );
+    conf.getIfSet( "texture_compression_threads", _textureCompressionThreads );
+
     if ( conf.hasValue( "transparent_color" ) )
         _transparentColor = stringToColor( conf.value( "transparent_color" ), osg::Vec4ub(0,0,0,0));
 
@@ -104,6 +115,14 @@ ImageLayerOptions::getConfig( bool isolate ) const
     conf.updateIfSet( "lod_blending", _lodBlending );
     conf.updateIfSet( "shared",       _shared );
 
+    conf.updateIfSet( "texture_compression", "dxt1", _textureCompression, TextureCompressor::FORMAT_DXT1 );
+    conf.updateIfSet( "texture_compression", "dxt5", _textureCompression, TextureCompressor::FORMAT_DXT5 );
+    conf.updateIfSet( "texture_compression", "auto", _textureCompression, TextureCompressor::FORMAT_AUTO );
+    conf.updateIfSet( "texture_compression_quality", "fast",   _textureCompressionQuality, TextureCompressor::QUALITY_FAST );
+    conf.updateIfSet( "texture_compression_quality", "normal", _textureCompressionQuality, TextureCompressor::QUALITY_NORMAL );
+    conf.updateIfSet( "texture_compression_quality", "high",   _textureCompressionQuality, TextureCompressor::QUALITY_HIGH );
+    conf.updateIfSet( "texture_compression_threads", _textureCompressionThreads );
+
     if (_transparentColor.isSet())
         conf.update("transparent_color", colorToString( _transparentColor.value()));
 
@@ -220,6 +239,122 @@ ImageLayerTileProcessor::process( osg::ref_ptr<osg::Image>& image ) const
 
 //------------------------------------------------------------------------
 
+ImageLayerUpsampler::ImageLayerUpsampler(unsigned maxAncestors, unsigned maxAbsent) :
+_ancestors( true, maxAncestors ),
+_absent   ( true, maxAbsent )
+{
+    //nop
+}
+
+void
+ImageLayerUpsampler::clear()
+{
+    _ancestors.clear();
+    _absent.clear();
+}
+
+osg::Image*
+ImageLayerUpsampler::createImage(TileSource*                 source,
+                                 const TileKey&              key,
+                                 TileSource::ImageOperation* op,
+                                 ProgressCallback*           progress,
+                                 bool                        bilinear,
+                                 bool&                       out_isFallback)
+{
+    out_isFallback = false;
+
+    for( TileKey ancestor = key; ancestor.valid(); ancestor = ancestor.createParentKey() )
+    {
+        osg::ref_ptr<osg::Image> image;
+        bool cached = false;
+
+        TileKeyCache< osg::ref_ptr<osg::Image> >::Record rec;
+        if ( _ancestors.get(ancestor, rec) )
+        {
+            image  = rec.value().get();
+            cached = true;
+        }
+        else if (
+            _absent.has(ancestor)                                  ||
+            source->getBlacklist()->contains(ancestor.getTileId()) ||
+            !source->hasDataAtLOD(ancestor.getLevelOfDetail()) )
+        {
+            // known to be absent; don't ask the source again.
+        }
+        else
+        {
+            image = source->createImage( ancestor, op, progress );
+
+            if ( progress && progress->isCanceled() )
+                return 0L;
+
+            if ( !image.valid() )
+            {
+                // Only remember a tile as absent when we know the failure will
+                // happen again: the progress says no retry is needed, or the
+                // source blacklisted the tile. Without a progress, a failure
+                // may be a transient one (a network error, say).
+                if ((progress && !progress->needsRetry()) ||
+                    source->getBlacklist()->contains(ancestor.getTileId()) )
+                {
+                    _absent.insert( ancestor, true );
+                }
+            }
+            else if ( ancestor != key )
+            {
+                _ancestors.insert( ancestor, image );
+            }
+        }
+
+        if ( image.valid() )
+        {
+            if ( ancestor != key )
+                return upsample( image.get(), ancestor, key, bilinear );
+
+            // the caller may modify the image, so never hand out the cached one.
+            return cached ? ImageUtils::cloneImage( image.get() ) : image.release();
+        }
+
+        out_isFallback = true;
+    }
+
+    return 0L;
+}
+
+osg::Image*
+ImageLayerUpsampler::upsample(const osg::Image* image,
+                              const TileKey&    ancestor,
+                              const TileKey&    key,
+                              bool              bilinear) const
+{
+    // the key's window of the ancestor image, in pixels (rows go up from yMin).
+    // Keep the ancestor's pixel size; if we're falling back, chances are we're
+    // planning to mosaic the tile later, and the mosaicer requires same-size images.
+    const GeoExtent& from = ancestor.getExtent();
+    const GeoExtent& to   = key.getExtent();
+    double sx = (double)image->s() / from.width();
+    double sy = (double)image->t() / from.height();
+
+    osg::ref_ptr<osg::Image> result = ImageUtils::resampleSubImage(
+        image,
+        (to.xMin() - from.xMin()) * sx, (to.yMin() - from.yMin()) * sy,
+        (to.xMax() - from.xMin()) * sx, (to.yMax() - from.yMin()) * sy,
+        image->s(), image->t(),
+        bilinear ? ImageUtils::FILTER_BILINEAR : ImageUtils::FILTER_NEAREST );
+
+    if ( !result.valid() )
+    {
+        // formats the resampler can't read (e.g., compressed ones) go the long way.
+        GeoImage raw( const_cast<osg::Image*>(image), from );
+        GeoImage cropped = raw.crop( to, true, image->s(), image->t(), bilinear );
+        result = cropped.takeImage();
+    }
+
+    return result.release();
+}
+
+//------------------------------------------------------------------------
+
 ImageLayer::ImageLayer( const ImageLayerOptions& options ) :
 TerrainLayer( options, &_runtimeOptions ),
 _runtimeOptions( options )
@@ -246,6 +381,14 @@ ImageLayer::init()
 {
     _emptyImage = ImageUtils::createEmptyImage();
     //*((unsigned*)_emptyImage->data()) = 0x7F0000FF;
+
+    if ( _runtimeOptions.textureCompression().isSet() )
+    {
+        _compressor = new TextureCompressor(
+            *_runtimeOptions.textureCompression(),
+            *_runtimeOptions.textureCompressionQuality(),
+            *_runtimeOptions.textureCompressionThreads() );
+    }
 }
 
 void
@@ -350,6 +493,9 @@ ImageLayer::initTileSource()
     // call superclass first.
     TerrainLayer::initTileSource();
 
+    // anything the upsampler knows came from the old source.
+    _upsampler.clear();
+
     // install the pre-caching image processor operation.
     initPreCacheOp();
 }
@@ -425,6 +571,16 @@ ImageLayer::createImageInNativeProfile( const TileKey& key, ProgressCallback* pr
             GeoImage image = createImageInKeyProfile( *k, progress, true, isFallback );
             if ( image.valid() )
             {
+                // the mosaic needs raw pixels.
+                if ( ImageUtils::isCompressed(image.getImage()) )
+                {
+                    osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(image.getImage());
+                    if (convertedImg.valid())
+                    {
+                        image = GeoImage(convertedImg, image.getExtent());
+                    }
+                }
+
                 mosaic.getImages().push_back( TileImage(image.getImage(), *k) );
                 if ( !isFallback )
                     foundAtLeastOneRealTile = true;
@@ -489,6 +645,137 @@ ImageLayer::createImageInNativeProfile( const TileKey& key, ProgressCallback* pr
 }
 
 
+namespace
+{
+    // Runs the blocking createImage() for an asynchronous request.
+    struct CreateImageTask : public TaskRequest
+    {
+        osg::ref_ptr<ImageLayer>  _layer;
+        osg::ref_ptr<TileRequest> _request;
+
+        void operator()( ProgressCallback* )
+        {
+            GeoImage image;
+            if ( !_request->isCanceled() )
+                image = _layer->createImage( _request->getKey(), _request->getProgressCallback() );
+            _request->complete( image.getImage() );
+        }
+    };
+
+    // Post-processes the tile source's result the way createImageInKeyProfile() does.
+    struct CompleteImageRequest : public TileRequest::Callback
+    {
+        osg::ref_ptr<TileRequest>       _request;
+        osg::ref_ptr<TileSource>        _source;
+        osg::ref_ptr<TextureCompressor> _compressor;
+        osg::ref_ptr<CacheBin>          _cacheBin;
+
+        void onComplete( TileRequest* sourceRequest )
+        {
+            osg::ref_ptr<osg::Image> image = sourceRequest->getImage();
+            const TileKey& key = _request->getKey();
+
+            if ( image.valid() )
+            {
+                ImageUtils::featherAlphaRegions( image.get() );
+                ImageUtils::normalizeImage( image.get() );
+
+                if ( _compressor.valid() )
+                {
+                    osg::Image* compressed = _compressor->compress( image.get() );
+                    if ( compressed )
+                        image = compressed;
+                }
+
+                if ( _cacheBin.valid() )
+                    _cacheBin->write( key.str(), image.get() );
+            }
+            else if ( !sourceRequest->isCanceled() && !_request->isCanceled() )
+            {
+                _source->getBlacklist()->add( key.getTileId() );
+            }
+
+            _request->complete( image.get() );
+        }
+    };
+}
+
+osg::ref_ptr<TileRequest>
+ImageLayer::createImageAsync( const TileKey& key, TileRequest::Callback* callback )
+{
+    osg::ref_ptr<TileRequest> request = new TileRequest( key, callback );
+
+    TileSource* source = getTileSource();
+
+    // Only the simplest case, a single tile straight from the tile source, gets
+    // a truly asynchronous read; everything else runs createImage() on a thread.
+    bool direct =
+        getEnabled()       &&
+        !isCacheOnly()     &&
+        source             &&
+        getProfile()       &&
+        key.getProfile()->isEquivalentTo( getProfile() ) &&
+        !(_runtimeOptions.minLevel().isSet() && key.getLOD() < _runtimeOptions.minLevel().value()) &&
+        !_runtimeOptions.minResolution().isSet();
+
+    if ( !direct )
+    {
+        CreateImageTask* task = new CreateImageTask();
+        task->_layer   = this;
+        task->_request = request.get();
+        TileRequest::getTaskService()->add( task );
+        return request;
+    }
+
+    CacheBin* cacheBin = getCacheBin( key.getProfile() );
+
+    if ( cacheBin && getCachePolicy().isCacheReadable() )
+    {
+        ReadResult r = cacheBin->readImage( key.str() );
+        if ( r.succeeded() )
+        {
+            ImageUtils::normalizeImage( r.getImage() );
+
+            // the cache may predate the compression setting; if so, write the
+            // compressed tile back so the next read needn't compress it again.
+            osg::ref_ptr<osg::Image> image = r.getImage();
+            if ( _compressor.valid() && !ImageUtils::isCompressed(image.get()) )
+            {
+                osg::Image* compressed = _compressor->compress( image.get() );
+                if ( compressed )
+                {
+                    image = compressed;
+                    if ( getCachePolicy().isCacheWriteable() )
+                        cacheBin->write( key.str(), image.get() );
+                }
+            }
+
+            request->complete( image.get() );
+            return request;
+        }
+    }
+
+    if ( source->getBlacklist()->contains( key.getTileId() ) ||
+         !source->hasDataAtLOD( key.getLevelOfDetail() )     ||
+         !source->hasDataInExtent( key.getExtent() ) )
+    {
+        request->complete( (osg::Image*)0L );
+        return request;
+    }
+
+    CompleteImageRequest* completer = new CompleteImageRequest();
+    completer->_request    = request.get();
+    completer->_source     = source;
+    completer->_compressor = _compressor.get();
+    if ( cacheBin && getCachePolicy().isCacheWriteable() )
+        completer->_cacheBin = cacheBin;
+
+    source->createImageAsync( key, _preCacheOp.get(), completer );
+
+    return request;
+}
+
+
 GeoImage
 ImageLayer::createImageInKeyProfile( const TileKey& key, ProgressCallback* progress, bool forceFallback, bool& out_isFallback )
 {
@@ -554,6 +841,20 @@ ImageLayer::createImageInKeyProfile( const TileKey& key, ProgressCallback* progr
         if ( r.succeeded() )
         {            
             ImageUtils::normalizeImage( r.getImage() );
+
+            // the cache may predate the compression setting; if so, write the
+            // compressed tile back so the next read needn't compress it again.
+            if ( _compressor.valid() && !ImageUtils::isCompressed(r.getImage()) )
+            {
+                osg::ref_ptr<osg::Image> compressed = _compressor->compress( r.getImage() );
+                if ( compressed.valid() )
+                {
+                    if ( getCachePolicy().isCacheWriteable() )
+                        cacheBin->write( key.str(), compressed.get() );
+                    return GeoImage( compressed.get(), key.getExtent() );
+                }
+            }
+
             return GeoImage( r.releaseImage(), key.getExtent() );
         }
         else
@@ -577,6 +878,15 @@ ImageLayer::createImageInKeyProfile( const TileKey& key, ProgressCallback* progr
         ImageUtils::normalizeImage( result.getImage() );
     }
 
+    // Compress the image if requested, so that it's cached in compressed form.
+    // If the image can't be compressed, just use it as-is.
+    if ( result.valid() && _compressor.valid() )
+    {
+        osg::Image* compressed = _compressor->compress( result.getImage() );
+        if ( compressed )
+            result = GeoImage( compressed, result.getExtent() );
+    }
+
     // If we got a result, the cache is valid and we are caching in the map profile, write to the map cache.
     if (result.valid()  &&
         //JB:  Removed the check to not write out fallback data.  If you have a low resolution base dataset (max lod 3) and a high resolution insert (max lod 22)
@@ -663,43 +973,13 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
     osg::ref_ptr<TileSource::ImageOperation> op = _preCacheOp;
 
     osg::ref_ptr<osg::Image> result;
-    TileKey finalKey = key;
-    bool fellBack = false;
 
     if ( forceFallback )
-    {        
-        while( !result.valid() && finalKey.valid() )
-        {
-            if ( !source->getBlacklist()->contains( finalKey.getTileId() ) )
-            {
-                result = source->createImage( finalKey, op.get(), progress );
-                if ( result.valid() )
-                {
-                    if ( finalKey.getLevelOfDetail() != key.getLevelOfDetail() )
-                    {
-                        // crop the fallback image to match the input key, and ensure that it remains the
-                        // same pixel size; because chances are if we're requesting a fallback that we're
-                        // planning to mosaic it later, and the mosaicer requires same-size images.
-                        GeoImage raw( result.get(), finalKey.getExtent() );
-                        GeoImage cropped = raw.crop( key.getExtent(), true, raw.getImage()->s(), raw.getImage()->t(), *_runtimeOptions.driver()->bilinearReprojection() );
-                        result = cropped.takeImage();
-                        fellBack = true;
-                    }
-                }
-            }
-            if ( !result.valid() )
-            {
-                finalKey = finalKey.createParentKey();
-                out_isFallback = true;
-            }
-        }
-
-        if ( !result.valid() )
-        {
-            result = 0L;
-            //result = _emptyImage.get();
-            finalKey = key;
-        }
+    {
+        result = _upsampler.createImage(
+            source, key, op.get(), progress,
+            *_runtimeOptions.driver()->bilinearReprojection(),
+            out_isFallback );
     }
 
     else
@@ -24,6 +24,9 @@
 #include <osg/ImageSequence>
 #include <osg/Timer>
 #include <osgDB/Registry>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 #include <string.h>
 #include <memory.h>
 
@@ -41,6 +44,548 @@
 
 using namespace osgEarth;
 
+//------------------------------------------------------------------------
+
+// Format-specialized ("typed") kernels. The generic path reads and writes every
+// pixel through a PixelReader/PixelWriter function pointer and an osg::Vec4; for
+// the formats that make up nearly all of our tiles, we run plain loops over the
+// native component type instead, which the compiler is free to unroll and
+// vectorize. Everything else still goes through the generic path.
+
+namespace
+{
+    static bool s_typedKernels = true;
+
+    enum Layout
+    {
+        LAYOUT_GENERIC,     // no typed kernel; use PixelReader/PixelWriter
+        LAYOUT_RGBA8,
+        LAYOUT_RGB8,
+        LAYOUT_L8,
+        LAYOUT_RGBA32F,
+        LAYOUT_L32F
+    };
+
+    Layout getLayout( const osg::Image* image )
+    {
+        if ( !s_typedKernels || !image || image->r() != 1 )
+            return LAYOUT_GENERIC;
+
+        GLenum format = image->getPixelFormat();
+        GLenum type   = image->getDataType();
+
+        if ( type == GL_UNSIGNED_BYTE )
+        {
+            if ( format == GL_RGBA )      return LAYOUT_RGBA8;
+            if ( format == GL_RGB )       return LAYOUT_RGB8;
+            if ( format == GL_LUMINANCE ) return LAYOUT_L8;
+        }
+        else if ( type == GL_FLOAT )
+        {
+            if ( format == GL_RGBA )      return LAYOUT_RGBA32F;
+            if ( format == GL_LUMINANCE ) return LAYOUT_L32F;
+        }
+        return LAYOUT_GENERIC;
+    }
+
+    // Converts between a component type and a normalized float. Unlike the
+    // generic PixelWriter, 8-bit values are rounded rather than truncated, so a
+    // value that passes through unchanged stays unchanged.
+    template<typename T> struct Component;
+
+    template<> struct Component<GLubyte>
+    {
+        static float scale() { return 1.0f/255.0f; }
+        static GLubyte store( float value ) { return (GLubyte)(osg::clampBetween(value, 0.0f, 255.0f) + 0.5f); }
+    };
+
+    template<> struct Component<GLfloat>
+    {
+        static float scale() { return 1.0f; }
+        static GLfloat store( float value ) { return value; }
+    };
+
+    // Start of row "t" in mipmap level "m". Mipmap rows follow the same
+    // (rowSize >> m) convention as PixelReader and PixelWriter.
+    inline const unsigned char* rowData( const osg::Image* image, unsigned t, unsigned m )
+    {
+        return m == 0 ?
+            image->data(0, t) :
+            image->getMipmapData(m) + t*(image->getRowSizeInBytes() >> m);
+    }
+
+    inline unsigned char* rowData( osg::Image* image, unsigned t, unsigned m )
+    {
+        return const_cast<unsigned char*>( rowData(static_cast<const osg::Image*>(image), t, m) );
+    }
+
+    // Nearest-neighbor resize between two images of the same layout. Uses the
+    // same index math as the generic path, but copies the pixels verbatim.
+    template<typename T, unsigned N>
+    void resizeNearest( const osg::Image* input, osg::Image* output, unsigned out_s, unsigned out_t, unsigned m )
+    {
+        unsigned in_s = input->s();
+        unsigned in_t = input->t();
+
+        std::vector<unsigned> cols( out_s );
+        for( unsigned c = 0; c < out_s; ++c )
+            cols[c] = N * osg::minimum( (unsigned)( ((float)c/(float)out_s) * (float)in_s ), in_s-1 );
+
+        for( unsigned r = 0; r < out_t; ++r )
+        {
+            unsigned in_r = osg::minimum( (unsigned)( ((float)r/(float)out_t) * (float)in_t ), in_t-1 );
+            const T* src = (const T*)rowData( input, in_r, 0 );
+            T*       dst = (T*)rowData( output, r, m );
+
+            for( unsigned c = 0; c < out_s; ++c, dst += N )
+            {
+                const T* p = src + cols[c];
+                for( unsigned k = 0; k < N; ++k )
+                    dst[k] = p[k];
+            }
+        }
+    }
+
+    // Row access for the filtering resamplers: converts a row of pixels to and
+    // from floats (CHANNELS per pixel, in the native range of the data type).
+    template<typename T, unsigned N>
+    struct TypedRows
+    {
+        enum { CHANNELS = N };
+
+        static void read( const osg::Image* image, unsigned width, unsigned t, unsigned m, float* out )
+        {
+            const T* p = (const T*)rowData( image, t, m );
+            for( unsigned i = 0; i < width*N; ++i )
+                out[i] = (float)p[i];
+        }
+
+        static void write( const float* in, unsigned width, osg::Image* image, unsigned t, unsigned m )
+        {
+            T* p = (T*)rowData( image, t, m );
+            for( unsigned i = 0; i < width*N; ++i )
+                p[i] = Component<T>::store( in[i] );
+        }
+    };
+
+    // Row access for everything else, by way of PixelReader/PixelWriter.
+    struct GenericRows
+    {
+        enum { CHANNELS = 4 };
+
+        static void read( const osg::Image* image, unsigned width, unsigned t, unsigned m, float* out )
+        {
+            ImageUtils::PixelReader read( image );
+            for( unsigned s = 0; s < width; ++s, out += 4 )
+            {
+                osg::Vec4f c = read( s, t, 0, m );
+                out[0] = c.r(); out[1] = c.g(); out[2] = c.b(); out[3] = c.a();
+            }
+        }
+
+        static void write( const float* in, unsigned width, osg::Image* image, unsigned t, unsigned m )
+        {
+            ImageUtils::PixelWriter write( image );
+            for( unsigned s = 0; s < width; ++s, in += 4 )
+            {
+                write( osg::Vec4f(in[0], in[1], in[2], in[3]), s, t, 0, m );
+            }
+        }
+    };
+
+    // Box filter: each output pixel is the average of the input pixels it covers.
+    // Reduces to a 2x2 average for each mipmap level.
+    template<typename ROWS>
+    void resampleBox( const osg::Image* input, unsigned in_s, unsigned in_t, unsigned in_m,
+                      osg::Image* output, unsigned out_s, unsigned out_t, unsigned out_m )
+    {
+        const unsigned N = ROWS::CHANNELS;
+
+        // input span [c0, c1) under each output column:
+        std::vector<unsigned> c0( out_s ), c1( out_s );
+        for( unsigned c = 0; c < out_s; ++c )
+        {
+            c0[c] = osg::minimum( (unsigned)floor( (double)c*(double)in_s/(double)out_s ), in_s-1 );
+            c1[c] = osg::clampBetween( (unsigned)floor( (double)(c+1)*(double)in_s/(double)out_s ), c0[c]+1, in_s );
+        }
+
+        std::vector<float> inRow( in_s*N ), acc( out_s*N );
+
+        for( unsigned r = 0; r < out_t; ++r )
+        {
+            unsigned r0 = osg::minimum( (unsigned)floor( (double)r*(double)in_t/(double)out_t ), in_t-1 );
+            unsigned r1 = osg::clampBetween( (unsigned)floor( (double)(r+1)*(double)in_t/(double)out_t ), r0+1, in_t );
+
+            std::fill( acc.begin(), acc.end(), 0.0f );
+
+            for( unsigned ir = r0; ir < r1; ++ir )
+            {
+                ROWS::read( input, in_s, ir, in_m, &inRow[0] );
+
+                float* a = &acc[0];
+                for( unsigned c = 0; c < out_s; ++c, a += N )
+                {
+                    const float* p = &inRow[c0[c]*N];
+                    for( unsigned ic = c0[c]; ic < c1[c]; ++ic, p += N )
+                        for( unsigned k = 0; k < N; ++k )
+                            a[k] += p[k];
+                }
+            }
+
+            float* a = &acc[0];
+            for( unsigned c = 0; c < out_s; ++c, a += N )
+            {
+                float w = 1.0f / (float)( (c1[c]-c0[c]) * (r1-r0) );
+                for( unsigned k = 0; k < N; ++k )
+                    a[k] *= w;
+            }
+
+            ROWS::write( &acc[0], out_s, output, r, out_m );
+        }
+    }
+
+    // Input index pair and weight for one output pixel along one axis, with
+    // pixel centers aligned.
+    struct BilinearTap
+    {
+        unsigned _i0, _i1;
+        float    _w;
+    };
+
+    // Taps for resampling the window [begin, end) of the input (in fractional
+    // pixels) into out_size pixels. A nearest tap has a weight of zero.
+    void computeWindowTaps( unsigned in_size, double begin, double end, unsigned out_size,
+                            bool nearest, std::vector<BilinearTap>& taps )
+    {
+        taps.resize( out_size );
+        double ratio = (end-begin)/(double)out_size;
+        for( unsigned i = 0; i < out_size; ++i )
+        {
+            double center = begin + ((double)i + 0.5)*ratio;
+            if ( nearest )
+            {
+                taps[i]._i0 = (unsigned)osg::clampBetween( floor(center), 0.0, (double)(in_size-1) );
+                taps[i]._i1 = taps[i]._i0;
+                taps[i]._w  = 0.0f;
+            }
+            else
+            {
+                double x = osg::clampBetween( center - 0.5, 0.0, (double)(in_size-1) );
+                taps[i]._i0 = (unsigned)x;
+                taps[i]._i1 = osg::minimum( taps[i]._i0+1, in_size-1 );
+                taps[i]._w  = (float)( x - (double)taps[i]._i0 );
+            }
+        }
+    }
+
+    void computeTaps( unsigned in_size, unsigned out_size, std::vector<BilinearTap>& taps )
+    {
+        computeWindowTaps( in_size, 0.0, (double)in_size, out_size, false, taps );
+    }
+
+    // Resamples with precomputed taps: one per output column and one per output row.
+    template<typename ROWS>
+    void resampleTaps( const osg::Image* input, unsigned in_s, unsigned in_m,
+                       const std::vector<BilinearTap>& cols, const std::vector<BilinearTap>& rows,
+                       osg::Image* output, unsigned out_m )
+    {
+        const unsigned N     = ROWS::CHANNELS;
+        const unsigned out_s = cols.size();
+        const unsigned out_t = rows.size();
+
+        // the two input rows in play; consecutive output rows usually share them.
+        std::vector<float> row0( in_s*N ), row1( in_s*N ), outRow( out_s*N );
+        int loaded0 = -1, loaded1 = -1;
+
+        for( unsigned r = 0; r < out_t; ++r )
+        {
+            int y0 = (int)rows[r]._i0, y1 = (int)rows[r]._i1;
+
+            if ( loaded0 != y0 )
+            {
+                if ( loaded1 == y0 ) {
+                    row0.swap( row1 );
+                    std::swap( loaded0, loaded1 );
+                }
+                else {
+                    ROWS::read( input, in_s, y0, in_m, &row0[0] );
+                    loaded0 = y0;
+                }
+            }
+            if ( loaded1 != y1 )
+            {
+                ROWS::read( input, in_s, y1, in_m, &row1[0] );
+                loaded1 = y1;
+            }
+
+            float wy = rows[r]._w;
+            float* out = &outRow[0];
+            for( unsigned c = 0; c < out_s; ++c, out += N )
+            {
+                const float* p00 = &row0[cols[c]._i0*N];
+                const float* p10 = &row0[cols[c]._i1*N];
+                const float* p01 = &row1[cols[c]._i0*N];
+                const float* p11 = &row1[cols[c]._i1*N];
+                float wx = cols[c]._w;
+                for( unsigned k = 0; k < N; ++k )
+                {
+                    float top    = p00[k] + (p10[k]-p00[k])*wx;
+                    float bottom = p01[k] + (p11[k]-p01[k])*wx;
+                    out[k] = top + (bottom-top)*wy;
+                }
+            }
+
+            ROWS::write( &outRow[0], out_s, output, r, out_m );
+        }
+    }
+
+    template<typename ROWS>
+    void resampleBilinear( const osg::Image* input, unsigned in_s, unsigned in_t, unsigned in_m,
+                           osg::Image* output, unsigned out_s, unsigned out_t, unsigned out_m )
+    {
+        std::vector<BilinearTap> cols, rows;
+        computeTaps( in_s, out_s, cols );
+        computeTaps( in_t, out_t, rows );
+        resampleTaps<ROWS>( input, in_s, in_m, cols, rows, output, out_m );
+    }
+
+    template<typename ROWS>
+    void resampleFiltered( const osg::Image* input, unsigned in_m, osg::Image* output,
+                           unsigned out_s, unsigned out_t, unsigned out_m,
+                           ImageUtils::ResampleFilter filter )
+    {
+        unsigned in_s = input->s() >> in_m;
+        unsigned in_t = input->t() >> in_m;
+
+        // a box filter only makes sense when reducing; otherwise interpolate.
+        if ( filter == ImageUtils::FILTER_BOX && in_s >= out_s && in_t >= out_t )
+            resampleBox<ROWS>( input, in_s, in_t, in_m, output, out_s, out_t, out_m );
+        else
+            resampleBilinear<ROWS>( input, in_s, in_t, in_m, output, out_s, out_t, out_m );
+    }
+
+    // Resamples mipmap level "in_m" of the input into mipmap level "out_m" of the
+    // output with a box or bilinear filter. Input and output may be the same image
+    // (e.g. when building a mipmap chain) as long as the levels differ.
+    bool resampleLevel( const osg::Image* input, unsigned in_m, osg::Image* output,
+                        unsigned out_s, unsigned out_t, unsigned out_m,
+                        ImageUtils::ResampleFilter filter )
+    {
+        if ( (input->s() >> in_m) == 0 || (input->t() >> in_m) == 0 || out_s == 0 || out_t == 0 )
+            return false;
+
+        Layout layout = getLayout( input );
+        if ( layout != getLayout(output) )
+            layout = LAYOUT_GENERIC;
+
+        switch( layout )
+        {
+        case LAYOUT_RGBA8:   resampleFiltered< TypedRows<GLubyte,4> >( input, in_m, output, out_s, out_t, out_m, filter ); break;
+        case LAYOUT_RGB8:    resampleFiltered< TypedRows<GLubyte,3> >( input, in_m, output, out_s, out_t, out_m, filter ); break;
+        case LAYOUT_L8:      resampleFiltered< TypedRows<GLubyte,1> >( input, in_m, output, out_s, out_t, out_m, filter ); break;
+        case LAYOUT_RGBA32F: resampleFiltered< TypedRows<GLfloat,4> >( input, in_m, output, out_s, out_t, out_m, filter ); break;
+        case LAYOUT_L32F:    resampleFiltered< TypedRows<GLfloat,1> >( input, in_m, output, out_s, out_t, out_m, filter ); break;
+        default:             resampleFiltered< GenericRows >         ( input, in_m, output, out_s, out_t, out_m, filter ); break;
+        }
+        return true;
+    }
+
+    template<typename ROWS>
+    void resampleWindowTyped( const osg::Image* input, double s0, double t0, double s1, double t1,
+                              osg::Image* output, bool nearest )
+    {
+        std::vector<BilinearTap> cols, rows;
+        computeWindowTaps( input->s(), s0, s1, output->s(), nearest, cols );
+        computeWindowTaps( input->t(), t0, t1, output->t(), nearest, rows );
+        resampleTaps<ROWS>( input, input->s(), 0, cols, rows, output, 0 );
+    }
+
+    // Resamples the window (s0, t0)-(s1, t1) of the input into all of the output.
+    void resampleWindow( const osg::Image* input, double s0, double t0, double s1, double t1,
+                         osg::Image* output, bool nearest )
+    {
+        Layout layout = getLayout( input );
+        if ( layout != getLayout(output) )
+            layout = LAYOUT_GENERIC;
+
+        switch( layout )
+        {
+        case LAYOUT_RGBA8:   resampleWindowTyped< TypedRows<GLubyte,4> >( input, s0, t0, s1, t1, output, nearest ); break;
+        case LAYOUT_RGB8:    resampleWindowTyped< TypedRows<GLubyte,3> >( input, s0, t0, s1, t1, output, nearest ); break;
+        case LAYOUT_L8:      resampleWindowTyped< TypedRows<GLubyte,1> >( input, s0, t0, s1, t1, output, nearest ); break;
+        case LAYOUT_RGBA32F: resampleWindowTyped< TypedRows<GLfloat,4> >( input, s0, t0, s1, t1, output, nearest ); break;
+        case LAYOUT_L32F:    resampleWindowTyped< TypedRows<GLfloat,1> >( input, s0, t0, s1, t1, output, nearest ); break;
+        default:             resampleWindowTyped< GenericRows >         ( input, s0, t0, s1, t1, output, nearest ); break;
+        }
+    }
+
+    template<typename T, unsigned N>
+    void mixTyped( const osg::Image* src, osg::Image* dest, float a, bool srcHasAlpha, bool destHasAlpha )
+    {
+        const float    scale  = Component<T>::scale();
+        const unsigned colors = N == 4 ? 3 : N;
+
+        // same math as the generic MixImage functor.
+        for( int t = 0; t < src->t(); ++t )
+        {
+            const T* s = (const T*)src->data(0, t);
+            T*       d = (T*)dest->data(0, t);
+
+            for( int i = 0; i < src->s(); ++i, s += N, d += N )
+            {
+                float sa = srcHasAlpha && N == 4 ? a * (float)s[N-1] * scale : a;
+                for( unsigned k = 0; k < colors; ++k )
+                    d[k] = Component<T>::store( ((float)d[k]*scale*(1.0f-sa) + (float)s[k]*scale*sa) / scale );
+                if ( N == 4 )
+                {
+                    float da = destHasAlpha ? (float)d[N-1] * scale : 1.0f;
+                    d[N-1] = Component<T>::store( osg::maximum(sa, da) / scale );
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    bool isEmptyTyped( const osg::Image* image, float alphaThreshold )
+    {
+        const float scale = Component<T>::scale();
+        for( int t = 0; t < image->t(); ++t )
+        {
+            const T* p = (const T*)image->data(0, t);
+            bool opaque = false;
+            for( int s = 0; s < image->s(); ++s )
+                opaque |= (float)p[4*s+3] * scale > alphaThreshold;
+            if ( opaque )
+                return false;
+        }
+        return true;
+    }
+
+    template<typename T, unsigned N>
+    bool isSingleColorTyped( const osg::Image* image, float threshold )
+    {
+        const float scale = Component<T>::scale();
+
+        float ref[N];
+        const T* p0 = (const T*)image->data(0, 0);
+        for( unsigned k = 0; k < N; ++k )
+            ref[k] = (float)p0[k] * scale;
+
+        for( int t = 0; t < image->t(); ++t )
+        {
+            const T* p = (const T*)image->data(0, t);
+            bool different = false;
+            for( int s = 0; s < image->s(); ++s, p += N )
+                for( unsigned k = 0; k < N; ++k )
+                    different |= fabs( (float)p[k]*scale - ref[k] ) > threshold;
+            if ( different )
+                return false;
+        }
+        return true;
+    }
+
+    template<typename T>
+    void premultiplyTyped( osg::Image* image )
+    {
+        const float scale = Component<T>::scale();
+        for( int t = 0; t < image->t(); ++t )
+        {
+            T* p = (T*)image->data(0, t);
+            for( int s = 0; s < image->s(); ++s, p += 4 )
+            {
+                float a = (float)p[3] * scale;
+                p[0] = Component<T>::store( (float)p[0] * a );
+                p[1] = Component<T>::store( (float)p[1] * a );
+                p[2] = Component<T>::store( (float)p[2] * a );
+            }
+        }
+    }
+
+    template<typename T>
+    inline bool isOpaque( const T* pixel, float maxAlpha )
+    {
+        return (float)pixel[3] * Component<T>::scale() > maxAlpha;
+    }
+
+    template<typename T>
+    inline void copyPixel( T* dest, const T* src )
+    {
+        dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = src[3];
+    }
+
+    // Same algorithm as the generic featherAlphaRegions, but copies the
+    // neighboring pixel verbatim.
+    template<typename T>
+    void featherTyped( osg::Image* image, float maxAlpha )
+    {
+        const int ns = image->s();
+        const int nt = image->t();
+
+        for( int t=0; t<nt; ++t )
+        {
+            T*   row     = (T*)image->data(0, t);
+            bool rowdone = false;
+            for( int s=0; s<ns && !rowdone; ++s )
+            {
+                T* pixel = row + 4*s;
+                if ( !isOpaque(pixel, maxAlpha) )
+                {
+                    bool wrote = false;
+                    if ( s < ns-1 && isOpaque(pixel+4, maxAlpha) ) {
+                        copyPixel( pixel, pixel+4 );
+                        wrote = true;
+                    }
+                    if ( !wrote && s > 0 && isOpaque(pixel-4, maxAlpha) ) {
+                        copyPixel( pixel, pixel-4 );
+                        rowdone = true;
+                    }
+                }
+            }
+        }
+
+        for( int s=0; s<ns; ++s )
+        {
+            bool coldone = false;
+            for( int t=0; t<nt && !coldone; ++t )
+            {
+                T* pixel = (T*)image->data(s, t);
+                if ( !isOpaque(pixel, maxAlpha) )
+                {
+                    bool wrote = false;
+                    if ( t < nt-1 ) {
+                        T* n = (T*)image->data(s, t+1);
+                        if ( isOpaque(n, maxAlpha) ) {
+                            copyPixel( pixel, n );
+                            wrote = true;
+                        }
+                    }
+                    if ( !wrote && t > 0 ) {
+                        T* n = (T*)image->data(s, t-1);
+                        if ( isOpaque(n, maxAlpha) ) {
+                            copyPixel( pixel, n );
+                            coldone = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+ImageUtils::setTypedKernelsEnabled( bool value )
+{
+    s_typedKernels = value;
+}
+
+bool
+ImageUtils::getTypedKernelsEnabled()
+{
+    return s_typedKernels;
+}
+
+//------------------------------------------------------------------------
+
 osg::Image*
 ImageUtils::cloneImage( const osg::Image* input )
 {
@@ -168,19 +713,30 @@ ImageUtils::resizeImage(const osg::Image* input,
                         unsigned int out_s, unsigned int out_t, 
                         osg::ref_ptr<osg::Image>& output,
                         unsigned int mipmapLevel )
+{
+    return resampleImage( input, out_s, out_t, output, FILTER_NEAREST, mipmapLevel );
+}
+
+bool
+ImageUtils::resampleImage(const osg::Image*         input,
+                          unsigned int              out_s,
+                          unsigned int              out_t,
+                          osg::ref_ptr<osg::Image>& output,
+                          ResampleFilter            filter,
+                          unsigned int              mipmapLevel )
 {
     if ( !input && out_s == 0 && out_t == 0 )
         return false;
 
     if ( !PixelReader::supports(input) )
     {
-        OE_WARN << LC << "resizeImage: unsupported format" << std::endl;
+        OE_WARN << LC << "resampleImage: unsupported format" << std::endl;
         return false;
     }
 
     if ( output.valid() && !PixelWriter::supports(output.get()) )
     {
-        OE_WARN << LC << "resizeImage: pre-allocated output image is in an unsupported format" << std::endl;
+        OE_WARN << LC << "resampleImage: pre-allocated output image is in an unsupported format" << std::endl;
         return false;
     }
 
@@ -213,6 +769,22 @@ ImageUtils::resizeImage(const osg::Image* input,
     {
         memcpy( output->data(), input->data(), input->getTotalSizeInBytes() );
     }
+    else if ( filter != FILTER_NEAREST )
+    {
+        resampleLevel( input, 0, output.get(), out_s, out_t, mipmapLevel, filter );
+    }
+    else if ( getLayout(input) != LAYOUT_GENERIC && getLayout(input) == getLayout(output.get()) )
+    {
+        switch( getLayout(input) )
+        {
+        case LAYOUT_RGBA8:   resizeNearest<GLubyte,4>( input, output.get(), out_s, out_t, mipmapLevel ); break;
+        case LAYOUT_RGB8:    resizeNearest<GLubyte,3>( input, output.get(), out_s, out_t, mipmapLevel ); break;
+        case LAYOUT_L8:      resizeNearest<GLubyte,1>( input, output.get(), out_s, out_t, mipmapLevel ); break;
+        case LAYOUT_RGBA32F: resizeNearest<GLfloat,4>( input, output.get(), out_s, out_t, mipmapLevel ); break;
+        case LAYOUT_L32F:    resizeNearest<GLfloat,1>( input, output.get(), out_s, out_t, mipmapLevel ); break;
+        default: break;
+        }
+    }
     else
     {       
         PixelReader read( input );
@@ -247,6 +819,44 @@ ImageUtils::resizeImage(const osg::Image* input,
     return true;
 }
 
+osg::Image*
+ImageUtils::resampleSubImage(const osg::Image* input,
+                             double            s0,
+                             double            t0,
+                             double            s1,
+                             double            t1,
+                             unsigned int      out_s,
+                             unsigned int      out_t,
+                             ResampleFilter    filter )
+{
+    if ( !input || input->r() != 1 || out_s == 0 || out_t == 0 || s1 <= s0 || t1 <= t0 )
+        return 0L;
+
+    if ( !PixelReader::supports(input) )
+    {
+        OE_DEBUG << LC << "resampleSubImage: unsupported format" << std::endl;
+        return 0L;
+    }
+
+    osg::ref_ptr<osg::Image> output = new osg::Image();
+
+    if ( PixelWriter::supports(input) )
+    {
+        output->allocateImage( out_s, out_t, 1, input->getPixelFormat(), input->getDataType(), input->getPacking() );
+        output->setInternalTextureFormat( input->getInternalTextureFormat() );
+    }
+    else
+    {
+        // for unsupported write formats, convert to RGBA8 automatically.
+        output->allocateImage( out_s, out_t, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        output->setInternalTextureFormat( GL_RGB8A_INTERNAL );
+    }
+
+    resampleWindow( input, s0, t0, s1, t1, output.get(), filter == FILTER_NEAREST );
+
+    return output.release();
+}
+
 osg::Image*
 ImageUtils::createMipmapBlendedImage( const osg::Image* primary, const osg::Image* secondary )
 {
@@ -284,16 +894,19 @@ ImageUtils::createMipmapBlendedImage( const osg::Image* primary, const osg::Imag
 
     result->setMipmapLevels( mipmapDataOffsets );
 
-    // now, populate the image levels.
-    int level_s = primary->s();
-    int level_t = primary->t();
+    // now, populate the image levels. Each level is box-filtered from the one
+    // above it (level 1 comes from the secondary image, if there is one).
+    ImageUtils::resizeImage( primary, primary->s(), primary->t(), result, 0 );
 
-    for( int level=0; level<numMipmapLevels; ++level )
+    int level_s = primary->s() >> 1;
+    int level_t = primary->t() >> 1;
+
+    for( int level=1; level<numMipmapLevels; ++level )
     {
-        if ( secondary && level > 0 )
-            ImageUtils::resizeImage( secondary, level_s, level_t, result, level );
+        if ( level == 1 && secondary )
+            resampleLevel( secondary, 0, result.get(), level_s, level_t, level, FILTER_BOX );
         else
-            ImageUtils::resizeImage( primary, level_s, level_t, result, level );
+            resampleLevel( result.get(), level-1, result.get(), level_s, level_t, level, FILTER_BOX );
 
         level_s >>= 1;
         level_t >>= 1;
@@ -334,7 +947,19 @@ ImageUtils::mix(osg::Image* dest, const osg::Image* src, float a)
     mixer._srcHasAlpha = src->getPixelSizeInBits() == 32;
     mixer._destHasAlpha = src->getPixelSizeInBits() == 32;    
 
-    mixer.accept( src, dest );  
+    Layout layout = getLayout(src);
+    if ( layout != getLayout(dest) )
+        layout = LAYOUT_GENERIC;
+
+    switch( layout )
+    {
+    case LAYOUT_RGBA8:   mixTyped<GLubyte,4>( src, dest, mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha ); break;
+    case LAYOUT_RGB8:    mixTyped<GLubyte,3>( src, dest, mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha ); break;
+    case LAYOUT_L8:      mixTyped<GLubyte,1>( src, dest, mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha ); break;
+    case LAYOUT_RGBA32F: mixTyped<GLfloat,4>( src, dest, mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha ); break;
+    case LAYOUT_L32F:    mixTyped<GLfloat,1>( src, dest, mixer._a, mixer._srcHasAlpha, mixer._destHasAlpha ); break;
+    default:             mixer.accept( src, dest ); break;
+    }
 
     return true;
 }
@@ -473,6 +1098,13 @@ ImageUtils::isEmptyImage(const osg::Image* image, float alphaThreshold)
     if ( !hasAlphaChannel(image) )
         return false;
 
+    switch( getLayout(image) )
+    {
+    case LAYOUT_RGBA8:   return isEmptyTyped<GLubyte>( image, alphaThreshold );
+    case LAYOUT_RGBA32F: return isEmptyTyped<GLfloat>( image, alphaThreshold );
+    default: break;
+    }
+
     PixelReader read(image);
     for(unsigned t=0; t<(unsigned)image->t(); ++t) 
     {
@@ -501,6 +1133,16 @@ ImageUtils::createOnePixelImage(const osg::Vec4& color)
 bool
 ImageUtils::isSingleColorImage(const osg::Image* image, float threshold)
 {
+    switch( getLayout(image) )
+    {
+    case LAYOUT_RGBA8:   return isSingleColorTyped<GLubyte,4>( image, threshold );
+    case LAYOUT_RGB8:    return isSingleColorTyped<GLubyte,3>( image, threshold );
+    case LAYOUT_L8:      return isSingleColorTyped<GLubyte,1>( image, threshold );
+    case LAYOUT_RGBA32F: return isSingleColorTyped<GLfloat,4>( image, threshold );
+    case LAYOUT_L32F:    return isSingleColorTyped<GLfloat,1>( image, threshold );
+    default: break;
+    }
+
     PixelReader read(image);
 
     osg::Vec4 referenceColor = read(0, 0);
@@ -631,6 +1273,13 @@ ImageUtils::hasTransparency(const osg::Image* image, float threshold)
 void
 ImageUtils::featherAlphaRegions(osg::Image* image, float maxAlpha)
 {
+    switch( getLayout(image) )
+    {
+    case LAYOUT_RGBA8:   featherTyped<GLubyte>( image, maxAlpha ); return;
+    case LAYOUT_RGBA32F: featherTyped<GLfloat>( image, maxAlpha ); return;
+    default: break;
+    }
+
     PixelReader read (image);
     PixelWriter write(image);
 
@@ -698,6 +1347,48 @@ ImageUtils::featherAlphaRegions(osg::Image* image, float maxAlpha)
 void
 ImageUtils::convertToPremultipliedAlpha(osg::Image* image)
 {
+    // Compressed pixels can't be rewritten in place, so a DXT5 image is decoded
+    // once and left as premultiplied RGBA8; encoding it again would cost more
+    // than the decode and lose quality on every tile build. DXT1 needs nothing:
+    // its transparent texels are already black.
+    if ( isCompressed(image) )
+    {
+        if ( image->getPixelFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT )
+        {
+            osg::ref_ptr<osg::Image> rgba = convertToRGBA8( image );
+            if ( rgba.valid() )
+            {
+                premultiplyTyped<GLubyte>( rgba.get() );
+
+                // take over the decoded data rather than copying it.
+                rgba->setAllocationMode( osg::Image::NO_DELETE );
+                image->setImage(
+                    rgba->s(), rgba->t(), rgba->r(),
+                    rgba->getInternalTextureFormat(), rgba->getPixelFormat(), rgba->getDataType(),
+                    rgba->data(), osg::Image::USE_NEW_DELETE, rgba->getPacking() );
+                image->setMipmapLevels( osg::Image::MipmapDataType() );
+                return;
+            }
+        }
+
+        if ( image->getPixelFormat() != GL_COMPRESSED_RGB_S3TC_DXT1_EXT &&
+             image->getPixelFormat() != GL_COMPRESSED_RGBA_S3TC_DXT1_EXT )
+        {
+            OE_WARN << LC << "convertToPremultipliedAlpha: unsupported compressed format" << std::endl;
+        }
+        return;
+    }
+
+    switch( getLayout(image) )
+    {
+    case LAYOUT_RGBA8:   premultiplyTyped<GLubyte>( image ); return;
+    case LAYOUT_RGBA32F: premultiplyTyped<GLfloat>( image ); return;
+    case LAYOUT_RGB8:
+    case LAYOUT_L8:
+    case LAYOUT_L32F:    return; // no alpha channel, so nothing to do
+    default: break;
+    }
+
     PixelReader read(image);
     PixelWriter write(image);
     for(int s=0; s<image->s(); ++s) {
@@ -1105,6 +1796,72 @@ namespace
         }
     };
 
+    template<>
+    struct ColorReader<GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GLubyte>
+    {
+        static osg::Vec4 read(const ImageUtils::PixelReader* pr, int s, int t, int r, int m)
+        {
+            static const int BLOCK_BYTES = 16;
+
+            unsigned int blocksPerRow = (pr->_image->s()+3)/4;
+            unsigned int bs = s/4, bt = t/4;
+            unsigned int blockStart = (bt*blocksPerRow+bs) * BLOCK_BYTES;
+
+            const GLubyte* p = pr->data() + blockStart;
+
+            int ls = s-4*bs, lt = t-4*bt;
+            int x = ls + (4 * lt);
+
+            // alpha block: two endpoints followed by 16 3-bit indices.
+            float a0 = (float)p[0]/255.0f;
+            float a1 = (float)p[1]/255.0f;
+
+            const GLubyte* h = x < 8 ? p+2 : p+5;
+            unsigned int half = (unsigned int)h[0] | ((unsigned int)h[1] << 8) | ((unsigned int)h[2] << 16);
+            unsigned int aIndex = (half >> (3*(x%8))) & 0x07;
+
+            float alpha;
+            if ( aIndex == 0 )
+                alpha = a0;
+            else if ( aIndex == 1 )
+                alpha = a1;
+            else if ( p[0] > p[1] )
+                alpha = ((float)(8-aIndex)*a0 + (float)(aIndex-1)*a1) / 7.0f;
+            else if ( aIndex < 6 )
+                alpha = ((float)(6-aIndex)*a0 + (float)(aIndex-1)*a1) / 5.0f;
+            else
+                alpha = aIndex == 6 ? 0.0f : 1.0f;
+
+            // color block: always decoded in 4-color mode.
+            const GLushort* c = (const GLushort*)(p + 8);
+
+            GLushort c0p = *c++;
+            osg::Vec4f c0(
+                (float)(c0p >> 11)/31.0f,
+                (float)((c0p & 0x07E0) >> 5)/63.0f,
+                (float)((c0p & 0x001F))/31.0f,
+                alpha );
+
+            GLushort c1p = *c++;
+            osg::Vec4f c1(
+                (float)(c1p >> 11)/31.0f,
+                (float)((c1p & 0x07E0) >> 5)/63.0f,
+                (float)((c1p & 0x001F))/31.0f,
+                alpha );
+
+            static const float one_third  = 1.0f/3.0f;
+            static const float two_thirds = 2.0f/3.0f;
+
+            osg::Vec4f c2 = c0*two_thirds + c1*one_third;
+            osg::Vec4f c3 = c0*one_third  + c1*two_thirds;
+
+            unsigned int table = *(const unsigned int*)c;
+            unsigned int index = (table >> (2*x)) & 0x00000003;
+
+            return index==0? c0 : index==1? c1 : index==2? c2 : c3;
+        }
+    };
+
     template<int GLFormat>
     inline ImageUtils::PixelReader::ReaderFunc
     chooseReader(GLenum dataType)
@@ -1166,6 +1923,9 @@ namespace
         case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
             return &ColorReader<GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GLubyte>::read;
             break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return &ColorReader<GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GLubyte>::read;
+            break;
         default:
             return 0L;
             break;
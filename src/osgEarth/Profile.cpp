@@ -23,8 +23,10 @@
 #include <osgEarth/Cube>
 #include <osgEarth/SpatialReference>
 #include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
 #include <osgDB/FileNameUtils>
 #include <algorithm>
+#include <map>
 #include <sstream>
 
 using namespace osgEarth;
@@ -282,6 +284,42 @@ Profile::create( const ProfileOptions& options )
 
 /****************************************************************************/
 
+namespace
+{
+    // packed tile key IDs have 7 bits for the profile.
+    const unsigned MAX_KEY_ID = 127u;
+
+    static Threading::Mutex                s_keyIDMutex;
+    static std::map<std::string, unsigned> s_keyIDs;
+    static bool                            s_keyIDsExhausted = false;
+
+    unsigned getKeyIDForSignature( const std::string& horizSignature )
+    {
+        Threading::ScopedMutexLock lock( s_keyIDMutex );
+
+        std::map<std::string, unsigned>::const_iterator i = s_keyIDs.find( horizSignature );
+        if ( i != s_keyIDs.end() )
+            return i->second;
+
+        if ( s_keyIDs.size() >= MAX_KEY_ID )
+        {
+            // IDs are never given back, since caches may still hold keys packed with them.
+            if ( !s_keyIDsExhausted )
+            {
+                s_keyIDsExhausted = true;
+                OE_WARN << LC << "Out of profile key IDs (" << MAX_KEY_ID << " tiling schemes in use); "
+                    << "tile keys in new profiles will have no packed ID, and caches will fall back on full keys"
+                    << std::endl;
+            }
+            return 0u;
+        }
+
+        unsigned id = s_keyIDs.size() + 1u;
+        s_keyIDs[horizSignature] = id;
+        return id;
+    }
+}
+
 
 Profile::Profile(const SpatialReference* srs,
                  double xmin, double ymin, double xmax, double ymax,
@@ -305,6 +343,7 @@ osg::Referenced( true )
     _fullSignature = Stringify() << std::hex << hashString( temp.getConfig().toJSON() );
     temp.vsrsString() = "";
     _horizSignature = Stringify() << std::hex << hashString( temp.getConfig().toJSON() );
+    _keyID = getKeyIDForSignature( _horizSignature );
 }
 
 Profile::Profile(const SpatialReference* srs,
@@ -332,6 +371,7 @@ osg::Referenced( true )
     _fullSignature = Stringify() << std::hex << hashString( temp.getConfig().toJSON() );
     temp.vsrsString() = "";
     _horizSignature = Stringify() << std::hex << hashString( temp.getConfig().toJSON() );
+    _keyID = getKeyIDForSignature( _horizSignature );
 }
 
 Profile::ProfileType
@@ -686,6 +726,8 @@ Profile::addIntersectingTiles(const GeoExtent& key_ext, std::vector<TileKey>& ou
 
     OE_DEBUG << std::fixed << "  Dest Tiles: " << tileMinX << "," << tileMinY << " => " << tileMaxX << "," << tileMaxY << std::endl;
 
+    out_intersectingKeys.reserve( out_intersectingKeys.size() + (tileMaxX-tileMinX+1)*(tileMaxY-tileMinY+1) );
+
     for (int i = tileMinX; i <= tileMaxX; ++i)
     {
         for (int j = tileMinY; j <= tileMaxY; ++j)
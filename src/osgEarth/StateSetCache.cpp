@@ -17,9 +17,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/StateSetCache>
+#include <osgEarth/Hasher>
 #include <osg/NodeVisitor>
 #include <osg/Geode>
 #include <osg/BufferIndexBinding>
+#include <osg/BlendFunc>
+#include <osg/CullFace>
+#include <osg/Depth>
+#include <osg/LineStipple>
+#include <osg/LineWidth>
+#include <osg/Material>
+#include <osg/Point>
+#include <osg/PolygonMode>
+#include <osg/PolygonOffset>
+#include <osg/Texture>
 
 #define LC "[StateSetCache] "
 
@@ -156,6 +167,196 @@ namespace
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    void addVec4( Hasher& h, const osg::Vec4& v )
+    {
+        h.add( v.r() ); h.add( v.g() ); h.add( v.b() ); h.add( v.a() );
+    }
+
+    // Adds the contents of the attribute types osgEarth's compilers use the most.
+    // Only values that the attribute's own compare() checks may go in here;
+    // anything else would keep equal attributes from being shared. Other types
+    // are left to compare() to tell apart.
+    void addContents( Hasher& h, const osg::StateAttribute* attr )
+    {
+        if ( const osg::Material* m = dynamic_cast<const osg::Material*>(attr) )
+        {
+            h.add( (int)m->getColorMode() );
+            addVec4( h, m->getAmbient (osg::Material::FRONT) );
+            addVec4( h, m->getAmbient (osg::Material::BACK) );
+            addVec4( h, m->getDiffuse (osg::Material::FRONT) );
+            addVec4( h, m->getDiffuse (osg::Material::BACK) );
+            addVec4( h, m->getSpecular(osg::Material::FRONT) );
+            addVec4( h, m->getSpecular(osg::Material::BACK) );
+            addVec4( h, m->getEmission(osg::Material::FRONT) );
+            addVec4( h, m->getEmission(osg::Material::BACK) );
+            h.add( m->getShininess(osg::Material::FRONT) );
+            h.add( m->getShininess(osg::Material::BACK) );
+        }
+        else if ( const osg::LineWidth* lw = dynamic_cast<const osg::LineWidth*>(attr) )
+        {
+            h.add( lw->getWidth() );
+        }
+        else if ( const osg::LineStipple* ls = dynamic_cast<const osg::LineStipple*>(attr) )
+        {
+            h.add( ls->getFactor() );
+            h.add( ls->getPattern() );
+        }
+        else if ( const osg::Depth* d = dynamic_cast<const osg::Depth*>(attr) )
+        {
+            h.add( (int)d->getFunction() );
+            h.add( d->getZNear() );
+            h.add( d->getZFar() );
+            h.add( d->getWriteMask() );
+        }
+        else if ( const osg::BlendFunc* bf = dynamic_cast<const osg::BlendFunc*>(attr) )
+        {
+            h.add( bf->getSource() );
+            h.add( bf->getDestination() );
+            h.add( bf->getSourceAlpha() );
+            h.add( bf->getDestinationAlpha() );
+        }
+        else if ( const osg::PolygonOffset* po = dynamic_cast<const osg::PolygonOffset*>(attr) )
+        {
+            h.add( po->getFactor() );
+            h.add( po->getUnits() );
+        }
+        else if ( const osg::PolygonMode* pm = dynamic_cast<const osg::PolygonMode*>(attr) )
+        {
+            h.add( (int)pm->getMode(osg::PolygonMode::FRONT) );
+            h.add( (int)pm->getMode(osg::PolygonMode::BACK) );
+        }
+        else if ( const osg::CullFace* cf = dynamic_cast<const osg::CullFace*>(attr) )
+        {
+            h.add( (int)cf->getMode() );
+        }
+        else if ( const osg::Point* pt = dynamic_cast<const osg::Point*>(attr) )
+        {
+            h.add( pt->getSize() );
+        }
+        else if ( const osg::Texture* tex = dynamic_cast<const osg::Texture*>(attr) )
+        {
+            h.add( (int)tex->getFilter(osg::Texture::MIN_FILTER) );
+            h.add( (int)tex->getFilter(osg::Texture::MAG_FILTER) );
+            h.add( (int)tex->getWrap(osg::Texture::WRAP_S) );
+            h.add( (int)tex->getWrap(osg::Texture::WRAP_T) );
+            h.add( (int)tex->getWrap(osg::Texture::WRAP_R) );
+            for( unsigned i = 0; i < tex->getNumImages(); ++i )
+            {
+                const osg::Image* image = tex->getImage(i);
+                if ( image )
+                {
+                    h.add( image->s() );
+                    h.add( image->t() );
+                    h.add( image->r() );
+                    h.add( image->getPixelFormat() );
+                    h.add( image->getDataType() );
+                }
+            }
+        }
+    }
+
+    void addAttributeList( Hasher& h, const osg::StateSet::AttributeList& attrs )
+    {
+        h.add( (unsigned)attrs.size() );
+        for( osg::StateSet::AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            h.add( (int)i->first.first );
+            h.add( i->first.second );
+            h.add( StateSetCache::digest(i->second.first.get()) );
+            h.add( i->second.second );
+        }
+    }
+
+    void addModeList( Hasher& h, const osg::StateSet::ModeList& modes )
+    {
+        h.add( (unsigned)modes.size() );
+        for( osg::StateSet::ModeList::const_iterator i = modes.begin(); i != modes.end(); ++i )
+        {
+            h.add( i->first );
+            h.add( i->second );
+        }
+    }
+
+    void addUniform( Hasher& h, const osg::Uniform* u )
+    {
+        if ( !u )
+            return;
+
+        h.add( u->getName() );
+        h.add( (int)u->getType() );
+        h.add( u->getNumElements() );
+
+        if ( const osg::FloatArray* a = u->getFloatArray() )
+        {
+            if ( !a->empty() )
+                h.add( &a->front(), a->size()*sizeof(float) );
+        }
+        else if ( const osg::IntArray* a = u->getIntArray() )
+        {
+            if ( !a->empty() )
+                h.add( &a->front(), a->size()*sizeof(int) );
+        }
+    }
+}
+
+UInt64
+StateSetCache::digest( const osg::StateAttribute* attr )
+{
+    Hasher h;
+    if ( attr )
+    {
+        h.add( std::string(attr->libraryName()) );
+        h.add( std::string(attr->className()) );
+        h.add( (int)attr->getType() );
+        h.add( attr->getMember() );
+        addContents( h, attr );
+    }
+    return h.get();
+}
+
+UInt64
+StateSetCache::digest( const osg::StateSet* stateSet )
+{
+    Hasher h;
+    if ( !stateSet )
+        return h.get();
+
+    addAttributeList( h, stateSet->getAttributeList() );
+    addModeList( h, stateSet->getModeList() );
+
+    const osg::StateSet::TextureAttributeList& texAttrs = stateSet->getTextureAttributeList();
+    h.add( (unsigned)texAttrs.size() );
+    for( unsigned unit = 0; unit < texAttrs.size(); ++unit )
+        addAttributeList( h, texAttrs[unit] );
+
+    const osg::StateSet::TextureModeList& texModes = stateSet->getTextureModeList();
+    h.add( (unsigned)texModes.size() );
+    for( unsigned unit = 0; unit < texModes.size(); ++unit )
+        addModeList( h, texModes[unit] );
+
+    const osg::StateSet::UniformList& uniforms = stateSet->getUniformList();
+    h.add( (unsigned)uniforms.size() );
+    for( osg::StateSet::UniformList::const_iterator i = uniforms.begin(); i != uniforms.end(); ++i )
+    {
+        h.add( i->first );
+        addUniform( h, i->second.first.get() );
+        h.add( i->second.second );
+    }
+
+    h.add( (int)stateSet->getRenderBinMode() );
+    if ( stateSet->getRenderBinMode() != osg::StateSet::INHERIT_RENDERBIN_DETAILS )
+    {
+        h.add( stateSet->getBinNumber() );
+        h.add( stateSet->getBinName() );
+    }
+
+    return h.get();
+}
+
+//------------------------------------------------------------------------
+
 void
 StateSetCache::optimize(osg::Node* node)
 {
@@ -235,16 +436,21 @@ StateSetCache::share(osg::ref_ptr<osg::StateSet>& input,
 
     if ( !checkEligible || eligible(input.get()) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
+        // digest outside the lock; it's the expensive part.
+        UInt64 key = digest( input.get() );
+
+        StateSetShard& shard = _stateSetShards[key % NUM_SHARDS];
+        Threading::ScopedMutexLock lock( shard._mutex );
         shareattrs = false;
 
-        std::pair<StateSetSet::iterator,bool> result = _stateSetCache.insert( input );
+        std::pair<StateSetSet::iterator,bool> result = shard._buckets[key].insert( input );
         if ( result.second )
         {
             // first use
             output = input.get();
             shareattrs = true;
             shared = false;
+            shard._size++;
         }
         else
         {
@@ -277,9 +483,12 @@ StateSetCache::share(osg::ref_ptr<osg::StateAttribute>& input,
 {
     if ( !checkEligible || eligible(input.get()) )
     {
-        Threading::ScopedMutexLock lock( _mutex );
+        UInt64 key = digest( input.get() );
+
+        StateAttributeShard& shard = _stateAttributeShards[key % NUM_SHARDS];
+        Threading::ScopedMutexLock lock( shard._mutex );
 
-        std::pair<StateAttributeSet::iterator,bool> result = _stateAttributeCache.insert( input );
+        std::pair<StateAttributeSet::iterator,bool> result = shard._buckets[key].insert( input );
         if ( result.second )
         {
             // first use
@@ -301,11 +510,32 @@ StateSetCache::share(osg::ref_ptr<osg::StateAttribute>& input,
 }
 
 
+unsigned
+StateSetCache::size() const
+{
+    unsigned total = 0;
+    for( unsigned i = 0; i < NUM_SHARDS; ++i )
+    {
+        Threading::ScopedMutexLock lock( _stateSetShards[i]._mutex );
+        total += _stateSetShards[i]._size;
+    }
+    return total;
+}
+
+
 void
 StateSetCache::clear()
 {
-    Threading::ScopedMutexLock lock( _mutex );
+    for( unsigned i = 0; i < NUM_SHARDS; ++i )
+    {
+        Threading::ScopedMutexLock lock( _stateAttributeShards[i]._mutex );
+        _stateAttributeShards[i]._buckets.clear();
+    }
 
-    _stateAttributeCache.clear();
-    _stateSetCache.clear();
+    for( unsigned i = 0; i < NUM_SHARDS; ++i )
+    {
+        Threading::ScopedMutexLock lock( _stateSetShards[i]._mutex );
+        _stateSetShards[i]._buckets.clear();
+        _stateSetShards[i]._size = 0;
+    }
 }
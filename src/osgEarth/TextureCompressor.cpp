@@ -0,0 +1,538 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TextureCompressor>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/ThreadingUtils>
+#include <osg/Texture>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#define LC "[TextureCompressor] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Packs an 8-bit color into RGB565, with rounding.
+    inline unsigned short pack565( const float* c )
+    {
+        unsigned r = (unsigned)( osg::clampBetween(c[0], 0.0f, 255.0f) * (31.0f/255.0f) + 0.5f );
+        unsigned g = (unsigned)( osg::clampBetween(c[1], 0.0f, 255.0f) * (63.0f/255.0f) + 0.5f );
+        unsigned b = (unsigned)( osg::clampBetween(c[2], 0.0f, 255.0f) * (31.0f/255.0f) + 0.5f );
+        return (unsigned short)( (r << 11) | (g << 5) | b );
+    }
+
+    // Expands an RGB565 color to 8 bits per component the same way the GPU does.
+    inline void unpack565( unsigned short p, int* c )
+    {
+        int r = (p >> 11) & 0x1f;
+        int g = (p >> 5)  & 0x3f;
+        int b =  p        & 0x1f;
+        c[0] = (r << 3) | (r >> 2);
+        c[1] = (g << 2) | (g >> 4);
+        c[2] = (b << 3) | (b >> 2);
+    }
+
+    // Orders the endpoints so the block decodes in 4-color (opaque) mode, and picks
+    // the nearest of the 4 palette colors for each pixel. Returns the total squared
+    // error of the block.
+    unsigned fitColorIndices( const unsigned char* rgba, unsigned short& c0, unsigned short& c1, unsigned& out_indices )
+    {
+        if ( c0 < c1 )
+            std::swap( c0, c1 );
+
+        int palette[4][3];
+        unpack565( c0, palette[0] );
+        unpack565( c1, palette[1] );
+        for( unsigned k = 0; k < 3; ++k )
+        {
+            palette[2][k] = (2*palette[0][k] +   palette[1][k]) / 3;
+            palette[3][k] = (  palette[0][k] + 2*palette[1][k]) / 3;
+        }
+
+        // equal endpoints decode in 3-color mode, where only index 0 is safe.
+        unsigned numColors = c0 == c1 ? 1u : 4u;
+
+        unsigned error = 0u;
+        out_indices = 0u;
+
+        for( unsigned i = 0; i < 16; ++i )
+        {
+            const unsigned char* p = rgba + 4*i;
+            unsigned best = 0u, bestDist = ~0u;
+            for( unsigned j = 0; j < numColors; ++j )
+            {
+                int dr = (int)p[0] - palette[j][0];
+                int dg = (int)p[1] - palette[j][1];
+                int db = (int)p[2] - palette[j][2];
+                unsigned dist = (unsigned)(dr*dr + dg*dg + db*db);
+                if ( dist < bestDist )
+                {
+                    bestDist = dist;
+                    best     = j;
+                }
+            }
+            out_indices |= best << (2*i);
+            error += bestDist;
+        }
+
+        return error;
+    }
+
+    // Endpoints from the bounding box of the block's colors, inset slightly
+    // to reduce the error of the interpolated colors.
+    void computeBoundingBoxEndpoints( const unsigned char* rgba, float* c0, float* c1 )
+    {
+        for( unsigned k = 0; k < 3; ++k )
+        {
+            unsigned char lo = rgba[k], hi = rgba[k];
+            for( unsigned i = 1; i < 16; ++i )
+            {
+                lo = std::min( lo, rgba[4*i+k] );
+                hi = std::max( hi, rgba[4*i+k] );
+            }
+            float inset = (float)(hi - lo) / 16.0f;
+            c0[k] = (float)hi - inset;
+            c1[k] = (float)lo + inset;
+        }
+    }
+
+    // Endpoints at the extremes of the block's colors projected onto their
+    // principal axis (found by power iteration on the covariance matrix).
+    void computePrincipalAxisEndpoints( const unsigned char* rgba, float* c0, float* c1 )
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for( unsigned i = 0; i < 16; ++i )
+            for( unsigned k = 0; k < 3; ++k )
+                mean[k] += (float)rgba[4*i+k];
+        for( unsigned k = 0; k < 3; ++k )
+            mean[k] /= 16.0f;
+
+        // covariance: xx, xy, xz, yy, yz, zz
+        float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for( unsigned i = 0; i < 16; ++i )
+        {
+            float r = (float)rgba[4*i+0] - mean[0];
+            float g = (float)rgba[4*i+1] - mean[1];
+            float b = (float)rgba[4*i+2] - mean[2];
+            cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+            cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+        }
+
+        // start from the diagonal of the bounding box, which is usually close.
+        float lo[3], hi[3];
+        computeBoundingBoxEndpoints( rgba, hi, lo );
+        float axis[3] = { hi[0]-lo[0], hi[1]-lo[1], hi[2]-lo[2] };
+        if ( axis[0] == 0.0f && axis[1] == 0.0f && axis[2] == 0.0f )
+        {
+            axis[0] = axis[1] = axis[2] = 1.0f;
+        }
+
+        for( unsigned iter = 0; iter < 4; ++iter )
+        {
+            float v[3] = {
+                cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2],
+                cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2],
+                cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2] };
+
+            float len = sqrtf( v[0]*v[0] + v[1]*v[1] + v[2]*v[2] );
+            if ( len < 1e-6f )
+                break;
+            axis[0] = v[0]/len; axis[1] = v[1]/len; axis[2] = v[2]/len;
+        }
+
+        float len = sqrtf( axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2] );
+        axis[0] /= len; axis[1] /= len; axis[2] /= len;
+
+        float tmin = 0.0f, tmax = 0.0f;
+        for( unsigned i = 0; i < 16; ++i )
+        {
+            float t =
+                ((float)rgba[4*i+0] - mean[0]) * axis[0] +
+                ((float)rgba[4*i+1] - mean[1]) * axis[1] +
+                ((float)rgba[4*i+2] - mean[2]) * axis[2];
+            tmin = std::min( tmin, t );
+            tmax = std::max( tmax, t );
+        }
+
+        for( unsigned k = 0; k < 3; ++k )
+        {
+            c0[k] = mean[k] + tmax*axis[k];
+            c1[k] = mean[k] + tmin*axis[k];
+        }
+    }
+
+    // Least-squares fit of the two endpoints given an index assignment (the
+    // palette weights are fixed, so this is a 2x2 linear system per channel).
+    bool refineEndpoints( const unsigned char* rgba, unsigned indices, float* c0, float* c1 )
+    {
+        static const float w0[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+
+        for( unsigned i = 0; i < 16; ++i )
+        {
+            float a = w0[ (indices >> (2*i)) & 0x3 ];
+            float b = 1.0f - a;
+            aa += a*a; ab += a*b; bb += b*b;
+            for( unsigned k = 0; k < 3; ++k )
+            {
+                ax[k] += a * (float)rgba[4*i+k];
+                bx[k] += b * (float)rgba[4*i+k];
+            }
+        }
+
+        float det = aa*bb - ab*ab;
+        if ( fabs(det) < 1e-6f )
+            return false;
+
+        for( unsigned k = 0; k < 3; ++k )
+        {
+            c0[k] = (ax[k]*bb - bx[k]*ab) / det;
+            c1[k] = (bx[k]*aa - ax[k]*ab) / det;
+        }
+        return true;
+    }
+
+    void encodeColorBlock( const unsigned char* rgba, TextureCompressor::Quality quality, unsigned char* out )
+    {
+        float e0[3], e1[3];
+        if ( quality == TextureCompressor::QUALITY_FAST )
+            computeBoundingBoxEndpoints( rgba, e0, e1 );
+        else
+            computePrincipalAxisEndpoints( rgba, e0, e1 );
+
+        unsigned short c0 = pack565( e0 );
+        unsigned short c1 = pack565( e1 );
+        unsigned indices;
+        unsigned error = fitColorIndices( rgba, c0, c1, indices );
+
+        if ( quality == TextureCompressor::QUALITY_HIGH )
+        {
+            for( unsigned iter = 0; iter < 2 && error > 0u; ++iter )
+            {
+                if ( !refineEndpoints(rgba, indices, e0, e1) )
+                    break;
+
+                unsigned short r0 = pack565( e0 );
+                unsigned short r1 = pack565( e1 );
+                unsigned rindices;
+                unsigned rerror = fitColorIndices( rgba, r0, r1, rindices );
+                if ( rerror >= error )
+                    break;
+
+                c0 = r0; c1 = r1; indices = rindices; error = rerror;
+            }
+        }
+
+        out[0] = (unsigned char)(c0 & 0xff);
+        out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)(c1 & 0xff);
+        out[3] = (unsigned char)(c1 >> 8);
+        out[4] = (unsigned char)(indices & 0xff);
+        out[5] = (unsigned char)((indices >> 8) & 0xff);
+        out[6] = (unsigned char)((indices >> 16) & 0xff);
+        out[7] = (unsigned char)(indices >> 24);
+    }
+
+    // DXT5 alpha: two 8-bit endpoints (a0 > a1, so 6 interpolated values) and a
+    // 3-bit index per pixel.
+    void encodeAlphaBlock( const unsigned char* rgba, unsigned char* out )
+    {
+        int a0 = rgba[3], a1 = rgba[3];
+        for( unsigned i = 1; i < 16; ++i )
+        {
+            a0 = std::max( a0, (int)rgba[4*i+3] );
+            a1 = std::min( a1, (int)rgba[4*i+3] );
+        }
+
+        int palette[8];
+        palette[0] = a0;
+        palette[1] = a1;
+        for( int j = 2; j < 8; ++j )
+            palette[j] = ( (8-j)*a0 + (j-1)*a1 ) / 7;
+
+        // indices for pixels 0-7 and 8-15, 24 bits each.
+        unsigned bits[2] = { 0u, 0u };
+
+        if ( a0 != a1 )
+        {
+            for( unsigned i = 0; i < 16; ++i )
+            {
+                int a = rgba[4*i+3];
+                unsigned best = 0u;
+                int bestDist = 256;
+                for( unsigned j = 0; j < 8; ++j )
+                {
+                    int dist = abs( a - palette[j] );
+                    if ( dist < bestDist )
+                    {
+                        bestDist = dist;
+                        best     = j;
+                    }
+                }
+                bits[i/8] |= best << (3*(i%8));
+            }
+        }
+
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+        out[2] = (unsigned char)(bits[0] & 0xff);
+        out[3] = (unsigned char)((bits[0] >> 8) & 0xff);
+        out[4] = (unsigned char)((bits[0] >> 16) & 0xff);
+        out[5] = (unsigned char)(bits[1] & 0xff);
+        out[6] = (unsigned char)((bits[1] >> 8) & 0xff);
+        out[7] = (unsigned char)((bits[1] >> 16) & 0xff);
+    }
+
+    // One mipmap level of 8-bit RGB or RGBA source pixels.
+    struct SourceLevel
+    {
+        const unsigned char* _data;
+        unsigned             _width;
+        unsigned             _height;
+        unsigned             _rowBytes;
+        unsigned             _components;
+    };
+
+    // Gathers the 4x4 block at (bx, by) as 16 RGBA pixels, replicating the edge
+    // pixels when the image size isn't a multiple of 4.
+    void fetchBlock( const SourceLevel& level, unsigned bx, unsigned by, unsigned char* block )
+    {
+        for( unsigned y = 0; y < 4; ++y )
+        {
+            unsigned row = std::min( by*4 + y, level._height-1 );
+            const unsigned char* rowData = level._data + row*level._rowBytes;
+
+            for( unsigned x = 0; x < 4; ++x, block += 4 )
+            {
+                unsigned col = std::min( bx*4 + x, level._width-1 );
+                const unsigned char* p = rowData + col*level._components;
+                block[0] = p[0];
+                block[1] = p[1];
+                block[2] = p[2];
+                block[3] = level._components == 4 ? p[3] : 255;
+            }
+        }
+    }
+
+    // Encodes a range of block rows of one level.
+    void encodeBlockRows( const SourceLevel& level, unsigned firstRow, unsigned numRows,
+                          bool dxt5, TextureCompressor::Quality quality, unsigned char* out )
+    {
+        unsigned blocksWide = (level._width + 3) / 4;
+        unsigned blockBytes = dxt5 ? 16u : 8u;
+        unsigned char block[64];
+
+        for( unsigned by = firstRow; by < firstRow+numRows; ++by )
+        {
+            unsigned char* dest = out + by*blocksWide*blockBytes;
+            for( unsigned bx = 0; bx < blocksWide; ++bx, dest += blockBytes )
+            {
+                fetchBlock( level, bx, by, block );
+                if ( dxt5 )
+                    TextureCompressor::encodeBlockDXT5( block, quality, dest );
+                else
+                    TextureCompressor::encodeBlockDXT1( block, quality, dest );
+            }
+        }
+    }
+
+    struct EncodeBlockRows
+    {
+        void execute()
+        {
+            encodeBlockRows( _level, _firstRow, _numRows, _dxt5, _quality, _out );
+        }
+
+        SourceLevel                _level;
+        unsigned                   _firstRow;
+        unsigned                   _numRows;
+        bool                       _dxt5;
+        TextureCompressor::Quality _quality;
+        unsigned char*             _out;
+    };
+
+    bool hasTransparentPixels( const osg::Image* image )
+    {
+        if ( image->getPixelFormat() != GL_RGBA )
+            return false;
+
+        for( int t = 0; t < image->t(); ++t )
+        {
+            const unsigned char* p = image->data(0, t);
+            unsigned char minAlpha = 255;
+            for( int s = 0; s < image->s(); ++s )
+                minAlpha = std::min( minAlpha, p[4*s+3] );
+            if ( minAlpha < 255 )
+                return true;
+        }
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------
+
+TextureCompressor::TextureCompressor(Format   format,
+                                     Quality  quality,
+                                     unsigned numThreads) :
+_format    ( format ),
+_quality   ( quality ),
+_numThreads( osg::maximum(numThreads, 1u) )
+{
+    if ( _numThreads > 1u )
+    {
+        _service = new TaskService( "TextureCompressor", _numThreads );
+    }
+}
+
+bool
+TextureCompressor::canCompress( const osg::Image* image )
+{
+    return
+        image                           &&
+        image->s() > 0                  &&
+        image->t() > 0                  &&
+        image->r() == 1                 &&
+        !ImageUtils::isCompressed(image) &&
+        ImageUtils::canConvert( image, GL_RGBA, GL_UNSIGNED_BYTE );
+}
+
+osg::Image*
+TextureCompressor::compress( const osg::Image* input ) const
+{
+    if ( !canCompress(input) )
+        return 0L;
+
+    // The encoder reads 8-bit RGB or RGBA; convert anything else.
+    osg::ref_ptr<const osg::Image> source = input;
+    if ( input->getDataType() != GL_UNSIGNED_BYTE ||
+        (input->getPixelFormat() != GL_RGB && input->getPixelFormat() != GL_RGBA) )
+    {
+        source = ImageUtils::convertToRGBA8( input );
+        if ( !source.valid() )
+            return 0L;
+    }
+
+    bool dxt5 =
+        _format == FORMAT_DXT5 ||
+        (_format == FORMAT_AUTO && hasTransparentPixels(source.get()));
+
+    GLenum   glFormat   = dxt5 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    unsigned blockBytes = dxt5 ? 16u : 8u;
+
+    // Lay out the full mipmap chain.
+    unsigned numLevels = osg::Image::computeNumberOfMipmapLevels( source->s(), source->t() );
+
+    osg::Image::MipmapDataType offsets;
+    unsigned totalBytes = 0u;
+    for( unsigned level = 0; level < numLevels; ++level )
+    {
+        unsigned w = osg::maximum( (unsigned)source->s() >> level, 1u );
+        unsigned h = osg::maximum( (unsigned)source->t() >> level, 1u );
+        if ( level > 0 )
+            offsets.push_back( totalBytes );
+        totalBytes += ((w+3)/4) * ((h+3)/4) * blockBytes;
+    }
+
+    unsigned char* data = new unsigned char[totalBytes];
+
+    osg::ref_ptr<const osg::Image> current = source.get();
+
+    for( unsigned level = 0; level < numLevels; ++level )
+    {
+        unsigned w = osg::maximum( (unsigned)source->s() >> level, 1u );
+        unsigned h = osg::maximum( (unsigned)source->t() >> level, 1u );
+
+        // each level is box-filtered from the one above it.
+        if ( level > 0 )
+        {
+            osg::ref_ptr<osg::Image> next;
+            if ( !ImageUtils::resampleImage(current.get(), w, h, next, ImageUtils::FILTER_BOX) )
+            {
+                OE_WARN << LC << "Failed to generate mipmap level " << level << std::endl;
+                delete [] data;
+                return 0L;
+            }
+            current = next.get();
+        }
+
+        SourceLevel src;
+        src._data       = current->data();
+        src._width      = w;
+        src._height     = h;
+        src._rowBytes   = current->getRowSizeInBytes();
+        src._components = current->getPixelFormat() == GL_RGBA ? 4u : 3u;
+
+        unsigned char* out       = data + (level == 0 ? 0u : offsets[level-1]);
+        unsigned       blockRows = (h+3)/4;
+
+        if ( _service.valid() && blockRows >= 2u*_numThreads )
+        {
+            // split the level into horizontal bands, one per thread:
+            unsigned rowsPerTask = (blockRows + _numThreads - 1u) / _numThreads;
+            unsigned numTasks    = (blockRows + rowsPerTask - 1u) / rowsPerTask;
+
+            Threading::MultiEvent done( numTasks );
+            for( unsigned i = 0; i < numTasks; ++i )
+            {
+                ParallelTask<EncodeBlockRows>* task = new ParallelTask<EncodeBlockRows>( &done );
+                task->_level    = src;
+                task->_firstRow = i*rowsPerTask;
+                task->_numRows  = std::min( rowsPerTask, blockRows - i*rowsPerTask );
+                task->_dxt5     = dxt5;
+                task->_quality  = _quality;
+                task->_out      = out;
+                _service->add( task );
+            }
+            done.wait();
+        }
+        else
+        {
+            encodeBlockRows( src, 0u, blockRows, dxt5, _quality, out );
+        }
+    }
+
+    osg::Image* result = new osg::Image();
+    result->setImage(
+        source->s(), source->t(), 1,
+        glFormat, glFormat, GL_UNSIGNED_BYTE,
+        data, osg::Image::USE_NEW_DELETE );
+    result->setMipmapLevels( offsets );
+
+    return result;
+}
+
+void
+TextureCompressor::encodeBlockDXT1( const unsigned char* rgba, Quality quality, unsigned char* out )
+{
+    encodeColorBlock( rgba, quality, out );
+}
+
+void
+TextureCompressor::encodeBlockDXT5( const unsigned char* rgba, Quality quality, unsigned char* out )
+{
+    encodeAlphaBlock( rgba, out );
+    encodeColorBlock( rgba, quality, out+8 );
+}
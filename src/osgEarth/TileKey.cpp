@@ -22,10 +22,50 @@
 
 using namespace osgEarth;
 
+namespace
+{
+    // packed ID layout, high bits to low: profile key ID, LOD, X, Y.
+    const unsigned LOD_BITS     = 5u;
+    const unsigned XY_BITS      = 26u;
+    const unsigned PROFILE_BITS = 64u - LOD_BITS - 2u*XY_BITS;
+
+    const UInt64 XY_MASK = (((UInt64)1) << XY_BITS) - 1;
+}
+
 //------------------------------------------------------------------------
 
 TileKey TileKey::INVALID( 0, 0, 0, 0L );
 
+UInt64
+TileKey::packID(unsigned lod, unsigned tile_x, unsigned tile_y, unsigned profileKeyID)
+{
+    if ( profileKeyID == 0u || profileKeyID >= (1u << PROFILE_BITS) ||
+         lod >= (1u << LOD_BITS) ||
+         (UInt64)tile_x > XY_MASK || (UInt64)tile_y > XY_MASK )
+    {
+        return 0;
+    }
+
+    return
+        ((UInt64)profileKeyID << (LOD_BITS + 2u*XY_BITS)) |
+        ((UInt64)lod          << (2u*XY_BITS)) |
+        ((UInt64)tile_x       << XY_BITS) |
+        ((UInt64)tile_y);
+}
+
+bool
+TileKey::unpackID(UInt64 id, unsigned& out_lod, unsigned& out_tile_x, unsigned& out_tile_y, unsigned& out_profileKeyID)
+{
+    if ( id == 0 )
+        return false;
+
+    out_tile_y       = (unsigned)( id & XY_MASK );
+    out_tile_x       = (unsigned)( (id >> XY_BITS) & XY_MASK );
+    out_lod          = (unsigned)( (id >> (2u*XY_BITS)) & ((1u << LOD_BITS) - 1u) );
+    out_profileKeyID = (unsigned)( id >> (LOD_BITS + 2u*XY_BITS) );
+    return true;
+}
+
 //------------------------------------------------------------------------
 
 TileKey::TileKey( unsigned int lod, unsigned int tile_x, unsigned int tile_y, const Profile* profile)
@@ -46,18 +86,14 @@ TileKey::TileKey( unsigned int lod, unsigned int tile_x, unsigned int tile_y, co
         double ymin = ymax - height;
 
         _extent = GeoExtent( _profile->getSRS(), xmin, ymin, xmax, ymax );
-
-        _key = Stringify() << _lod << "/" << _x << "/" << _y;
     }
     else
     {
         _extent = GeoExtent::INVALID;
-        _key = "invalid";
     }
 }
 
 TileKey::TileKey( const TileKey& rhs ) :
-_key( rhs._key ),
 _lod(rhs._lod),
 _x(rhs._x),
 _y(rhs._y),
@@ -67,6 +103,16 @@ _extent( rhs._extent )
     //NOP
 }
 
+std::string
+TileKey::str() const
+{
+    // built on demand; most keys never need it.
+    if ( _profile.valid() )
+        return Stringify() << _lod << "/" << _x << "/" << _y;
+    else
+        return "invalid";
+}
+
 const Profile*
 TileKey::getProfile() const
 {
@@ -0,0 +1,296 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TileKeyIterator>
+#include <algorithm>
+#include <cmath>
+
+#define LC "[TileKeyIterator] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+TileKeyIterator::TileKeyIterator(const Profile* profile,
+                                 unsigned       minLevel,
+                                 unsigned       maxLevel) :
+_profile   ( profile ),
+_minLevel  ( minLevel ),
+_maxLevel  ( maxLevel ),
+_everywhere( true ),
+_lod       ( 0 ),
+_row       ( 0 ),
+_rowMax    ( 0 ),
+_span      ( 0 ),
+_x         ( 0 )
+{
+    reset();
+}
+
+void
+TileKeyIterator::addExtent(const GeoExtent& extent)
+{
+    _everywhere = false;
+
+    if ( _profile.valid() && extent.isValid() )
+    {
+        GeoExtent ext = extent;
+        if ( !_profile->getSRS()->isHorizEquivalentTo(extent.getSRS()) )
+            ext = _profile->clampAndTransformExtent( extent );
+
+        if ( ext.isValid() )
+        {
+            GeoExtent first, second;
+            if ( ext.crossesAntimeridian() && ext.splitAcrossAntimeridian(first, second) )
+            {
+                _extents.push_back( first );
+                _extents.push_back( second );
+            }
+            else
+            {
+                _extents.push_back( ext );
+            }
+        }
+    }
+
+    reset();
+}
+
+void
+TileKeyIterator::reset()
+{
+    _lod = _maxLevel + 1;
+
+    if ( _profile.valid() )
+    {
+        for( unsigned lod = _minLevel; lod <= _maxLevel; ++lod )
+        {
+            if ( startLevel(lod) )
+                break;
+        }
+    }
+}
+
+void
+TileKeyIterator::getRanges(unsigned lod, std::vector<Range>& out) const
+{
+    out.clear();
+
+    unsigned numWide, numHigh;
+    _profile->getNumTiles( lod, numWide, numHigh );
+    if ( numWide == 0 || numHigh == 0 )
+        return;
+
+    if ( _everywhere )
+    {
+        Range r;
+        r._xmin = 0;
+        r._ymin = 0;
+        r._xmax = numWide-1;
+        r._ymax = numHigh-1;
+        out.push_back( r );
+        return;
+    }
+
+    double width, height;
+    _profile->getTileDimensions( lod, width, height );
+    const GeoExtent& pex = _profile->getExtent();
+
+    for( std::vector<GeoExtent>::const_iterator e = _extents.begin(); e != _extents.end(); ++e )
+    {
+        // fractional tile indexes of the extent's edges (rows count down from the top).
+        double x0 = (e->xMin() - pex.xMin()) / width;
+        double x1 = (e->xMax() - pex.xMin()) / width;
+        double y0 = (pex.yMax() - e->yMax()) / height;
+        double y1 = (pex.yMax() - e->yMin()) / height;
+
+        // tiles the extent only touches don't count, as in GeoExtent::intersects.
+        double c0 = osg::maximum( floor(x0), 0.0 );
+        double c1 = osg::minimum( ceil(x1) - 1.0, (double)(numWide-1) );
+        double r0 = osg::maximum( floor(y0), 0.0 );
+        double r1 = osg::minimum( ceil(y1) - 1.0, (double)(numHigh-1) );
+
+        if ( c1 < c0 || r1 < r0 )
+            continue;
+
+        Range r;
+        r._xmin = (unsigned)c0;
+        r._ymin = (unsigned)r0;
+        r._xmax = (unsigned)c1;
+        r._ymax = (unsigned)r1;
+        out.push_back( r );
+    }
+}
+
+void
+TileKeyIterator::getSpans(const std::vector<Range>& ranges, unsigned row, std::vector<Span>& out)
+{
+    out.clear();
+
+    for( std::vector<Range>::const_iterator r = ranges.begin(); r != ranges.end(); ++r )
+    {
+        if ( row >= r->_ymin && row <= r->_ymax )
+        {
+            Span s;
+            s._xmin = r->_xmin;
+            s._xmax = r->_xmax;
+            out.push_back( s );
+        }
+    }
+
+    if ( out.size() < 2 )
+        return;
+
+    // merge overlapping and adjacent spans so that no tile comes up twice.
+    std::sort( out.begin(), out.end() );
+    unsigned last = 0;
+    for( unsigned i = 1; i < out.size(); ++i )
+    {
+        if ( out[i]._xmin <= out[last]._xmax + 1 )
+        {
+            out[last]._xmax = osg::maximum( out[last]._xmax, out[i]._xmax );
+        }
+        else
+        {
+            out[++last] = out[i];
+        }
+    }
+    out.resize( last+1 );
+}
+
+bool
+TileKeyIterator::startLevel(unsigned lod)
+{
+    getRanges( lod, _ranges );
+    if ( _ranges.empty() )
+        return false;
+
+    unsigned rowMin = _ranges[0]._ymin;
+    _rowMax = _ranges[0]._ymax;
+    for( unsigned i = 1; i < _ranges.size(); ++i )
+    {
+        rowMin  = osg::minimum( rowMin, _ranges[i]._ymin );
+        _rowMax = osg::maximum( _rowMax, _ranges[i]._ymax );
+    }
+
+    _lod = lod;
+    for( unsigned row = rowMin; row <= _rowMax; ++row )
+    {
+        if ( startRow(row) )
+            return true;
+    }
+    return false;
+}
+
+bool
+TileKeyIterator::startRow(unsigned row)
+{
+    getSpans( _ranges, row, _spans );
+    if ( _spans.empty() )
+        return false;
+
+    _row  = row;
+    _span = 0;
+    _x    = _spans[0]._xmin;
+    return true;
+}
+
+void
+TileKeyIterator::advance()
+{
+    if ( _x < _spans[_span]._xmax )
+    {
+        ++_x;
+        return;
+    }
+
+    if ( ++_span < _spans.size() )
+    {
+        _x = _spans[_span]._xmin;
+        return;
+    }
+
+    for( unsigned row = _row+1; row <= _rowMax; ++row )
+    {
+        if ( startRow(row) )
+            return;
+    }
+
+    for( unsigned lod = _lod+1; lod <= _maxLevel; ++lod )
+    {
+        if ( startLevel(lod) )
+            return;
+    }
+
+    _lod = _maxLevel + 1;
+}
+
+void
+TileKeyIterator::next(unsigned& out_lod, unsigned& out_tile_x, unsigned& out_tile_y)
+{
+    out_lod    = _lod;
+    out_tile_x = _x;
+    out_tile_y = _row;
+    advance();
+}
+
+UInt64
+TileKeyIterator::nextID()
+{
+    unsigned lod, x, y;
+    next( lod, x, y );
+    return TileKey::packID( lod, x, y, _profile->getKeyID() );
+}
+
+TileKey
+TileKeyIterator::nextKey()
+{
+    unsigned lod, x, y;
+    next( lod, x, y );
+    return TileKey( lod, x, y, _profile.get() );
+}
+
+unsigned
+TileKeyIterator::getNumTiles(unsigned lod) const
+{
+    if ( !_profile.valid() || lod < _minLevel || lod > _maxLevel )
+        return 0;
+
+    std::vector<Range> ranges;
+    getRanges( lod, ranges );
+
+    std::vector<Span> spans;
+    unsigned count = 0;
+    for( std::vector<Range>::const_iterator r = ranges.begin(); r != ranges.end(); ++r )
+    {
+        for( unsigned row = r->_ymin; row <= r->_ymax; ++row )
+        {
+            // count each row once, with the first range that covers it.
+            bool counted = false;
+            for( std::vector<Range>::const_iterator q = ranges.begin(); q != r && !counted; ++q )
+                counted = row >= q->_ymin && row <= q->_ymax;
+            if ( counted )
+                continue;
+
+            getSpans( ranges, row, spans );
+            for( unsigned s = 0; s < spans.size(); ++s )
+                count += spans[s]._xmax - spans[s]._xmin + 1;
+        }
+    }
+    return count;
+}
@@ -23,7 +23,9 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/FileUtils>
 #include <osgEarth/Registry>
+#include <osgEarth/TaskService>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/URI>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
@@ -208,6 +210,134 @@ TileSourceOptions::fromConfig( const Config& conf )
 }
 
 
+//------------------------------------------------------------------------
+
+TileRequest::TileRequest(const TileKey& key,
+                         Callback*      callback) :
+_key     ( key ),
+_callback( callback )
+{
+    _progress = new ProgressCallback();
+}
+
+void
+TileRequest::wait()
+{
+    while( !_done.isSet() )
+        _done.wait();
+}
+
+void
+TileRequest::complete(osg::Image* image)
+{
+    _image = image;
+    fire();
+}
+
+void
+TileRequest::complete(osg::HeightField* heightField)
+{
+    _heightField = heightField;
+    fire();
+}
+
+void
+TileRequest::fire()
+{
+    _done.set();
+
+    if ( _callback.valid() )
+        _callback->onComplete( this );
+}
+
+namespace
+{
+    Threading::Mutex          s_taskServiceMutex;
+    osg::ref_ptr<TaskService> s_taskService;
+    unsigned                  s_taskServiceThreads = 4u;
+}
+
+TaskService*
+TileRequest::getTaskService()
+{
+    Threading::ScopedMutexLock lock( s_taskServiceMutex );
+    if ( !s_taskService.valid() )
+        s_taskService = new TaskService( "TileRequest", (int)s_taskServiceThreads );
+    return s_taskService.get();
+}
+
+void
+TileRequest::setNumThreads( unsigned value )
+{
+    Threading::ScopedMutexLock lock( s_taskServiceMutex );
+    s_taskServiceThreads = osg::maximum( value, 1u );
+    if ( s_taskService.valid() )
+        s_taskService->setNumThreads( (int)s_taskServiceThreads );
+}
+
+unsigned
+TileRequest::getNumThreads()
+{
+    Threading::ScopedMutexLock lock( s_taskServiceMutex );
+    return s_taskServiceThreads;
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    struct CreateImageTask : public TaskRequest
+    {
+        osg::ref_ptr<TileSource>                 _source;
+        osg::ref_ptr<TileSource::ImageOperation> _op;
+        osg::ref_ptr<TileRequest>                _request;
+
+        void operator()( ProgressCallback* )
+        {
+            osg::ref_ptr<osg::Image> image;
+            if ( !_request->isCanceled() )
+                image = _source->createImage( _request->getKey(), _op.get(), _request->getProgressCallback() );
+            _request->complete( image.get() );
+        }
+    };
+
+    struct CreateHeightFieldTask : public TaskRequest
+    {
+        osg::ref_ptr<TileSource>                       _source;
+        osg::ref_ptr<TileSource::HeightFieldOperation> _op;
+        osg::ref_ptr<TileRequest>                      _request;
+
+        void operator()( ProgressCallback* )
+        {
+            osg::ref_ptr<osg::HeightField> hf;
+            if ( !_request->isCanceled() )
+                hf = _source->createHeightField( _request->getKey(), _op.get(), _request->getProgressCallback() );
+            _request->complete( hf.get() );
+        }
+    };
+
+    // Finishes a URI-based image request the way createImage() would.
+    struct CompleteImageRequest : public URI::AsyncReadCallback
+    {
+        osg::ref_ptr<TileRequest>                _request;
+        osg::ref_ptr<TileSource::ImageOperation> _op;
+        osg::ref_ptr<MemCache>                   _memCache;
+
+        void onRead( ReadResult& result )
+        {
+            osg::ref_ptr<osg::Image> image = result.getImage();
+
+            if ( _op.valid() )
+                (*_op)( image );
+
+            if ( image.valid() && _memCache.valid() )
+                _memCache->getOrCreateDefaultBin()->write( _request->getKey().str(), image.get() );
+
+            _request->complete( image.get() );
+        }
+    };
+}
+
 //------------------------------------------------------------------------
 
 TileSource::Status TileSource::STATUS_OK = TileSource::Status();
@@ -382,6 +512,77 @@ TileSource::createHeightField(const TileKey&        key,
     return hf;
 }
 
+osg::ref_ptr<TileRequest>
+TileSource::createImageAsync(const TileKey&         key,
+                             ImageOperation*        op,
+                             TileRequest::Callback* callback)
+{
+    osg::ref_ptr<TileRequest> request = new TileRequest( key, callback );
+
+    CreateImageTask* task = new CreateImageTask();
+    task->_source  = this;
+    task->_op      = op;
+    task->_request = request.get();
+    TileRequest::getTaskService()->add( task );
+
+    return request;
+}
+
+osg::ref_ptr<TileRequest>
+TileSource::createHeightFieldAsync(const TileKey&         key,
+                                   HeightFieldOperation*  op,
+                                   TileRequest::Callback* callback)
+{
+    osg::ref_ptr<TileRequest> request = new TileRequest( key, callback );
+
+    CreateHeightFieldTask* task = new CreateHeightFieldTask();
+    task->_source  = this;
+    task->_op      = op;
+    task->_request = request.get();
+    TileRequest::getTaskService()->add( task );
+
+    return request;
+}
+
+osg::ref_ptr<TileRequest>
+TileSource::readImageAsync(const TileKey&         key,
+                           const URI&             uri,
+                           ImageOperation*        op,
+                           TileRequest::Callback* callback,
+                           const osgDB::Options*  dbOptions)
+{
+    osg::ref_ptr<TileRequest> request = new TileRequest( key, callback );
+
+    if ( _status != STATUS_OK )
+    {
+        request->complete( (osg::Image*)0L );
+        return request;
+    }
+
+    // Try the memcache first, just like createImage():
+    if ( _memCache.valid() )
+    {
+        ReadResult r = _memCache->getOrCreateDefaultBin()->readImage( key.str() );
+        if ( r.succeeded() )
+        {
+            request->complete( r.getImage() );
+            return request;
+        }
+    }
+
+    osg::ref_ptr<CompleteImageRequest> completer = new CompleteImageRequest();
+    completer->_request  = request.get();
+    completer->_op       = op;
+    completer->_memCache = _memCache.get();
+
+    if ( !uri.readImageAsync(dbOptions, completer.get(), request->getProgressCallback()) )
+    {
+        return TileSource::createImageAsync( key, op, callback );
+    }
+
+    return request;
+}
+
 bool
 TileSource::isOK() const 
 {
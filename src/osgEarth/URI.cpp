@@ -512,6 +512,97 @@ URI::readImage(const osgDB::Options* dbOptions,
     return doRead<ReadImage>( *this, dbOptions, progress );
 }
 
+namespace
+{
+    // Caches an asynchronously read image, then passes it along.
+    struct CacheAsyncImage : public HTTPClient::ReadCallback
+    {
+        std::string                          _name;
+        std::string                          _cacheKey;
+        osg::ref_ptr<CacheBin>               _bin;
+        osg::ref_ptr<URI::AsyncReadCallback> _callback;
+
+        void onRead( const std::string& location, ReadResult& result )
+        {
+            if ( result.succeeded() && _bin.valid() )
+            {
+                _bin->write( _cacheKey, result.getObject(), result.metadata() );
+            }
+
+            if ( result.getObject() )
+            {
+                result.getObject()->setName( _name );
+            }
+
+            _callback->onRead( result );
+        }
+    };
+}
+
+bool
+URI::readImageAsync(const osgDB::Options* dbOptions,
+                    AsyncReadCallback*    callback,
+                    ProgressCallback*     progress ) const
+{
+    if ( empty() || !callback )
+        return false;
+
+    // This is the remote branch of doRead(), split at the network read.
+    const osgDB::Options* localOptions = dbOptions ? dbOptions : Registry::instance()->getDefaultOptions();
+
+    URI uri = *this;
+    URIAliasMap* aliasMap = URIAliasMap::from( localOptions );
+    if ( aliasMap )
+    {
+        uri = aliasMap->resolve( full(), context() );
+    }
+
+    if (!uri.isRemote()                                  ||
+        Registry::instance()->getURIReadCallback() != 0L ||
+        URIResultCache::from( localOptions ) != 0L       ||
+        URIPostReadCallback::from( dbOptions ) != 0L )
+    {
+        return false;
+    }
+
+    optional<CachePolicy> cp;
+    if ( !Registry::instance()->getCachePolicy( cp, localOptions ) )
+        cp = CachePolicy::DEFAULT;
+
+    if ( cp->usage() == CachePolicy::USAGE_CACHE_ONLY )
+        return false;
+
+    CacheBin* bin = 0L;
+    if ( cp->usage() != CachePolicy::USAGE_NO_CACHE )
+    {
+        bin = s_getCacheBin( dbOptions );
+    }
+
+    if ( bin && cp->isCacheReadable() )
+    {
+        ReadResult result = ReadImage().fromCache( bin, uri.cacheKey(), *cp->maxAge() );
+        if ( result.succeeded() )
+        {
+            result.setIsFromCache( true );
+            result.getObject()->setName( uri.base() );
+            callback->onRead( result );
+            return true;
+        }
+    }
+
+    osg::ref_ptr<osgDB::Options> remoteOptions = Registry::instance()->cloneOrCreateOptions( localOptions );
+    remoteOptions->getDatabasePathList().push_front( osgDB::getFilePath(uri.full()) );
+
+    CacheAsyncImage* cacher = new CacheAsyncImage();
+    cacher->_name     = uri.base();
+    cacher->_cacheKey = uri.cacheKey();
+    cacher->_bin      = bin && cp->isCacheWriteable() ? bin : 0L;
+    cacher->_callback = callback;
+
+    HTTPClient::readImageAsync( uri.full(), remoteOptions.get(), cacher, progress );
+    return true;
+}
+
 ReadResult
 URI::readString(const osgDB::Options* dbOptions,
                 ProgressCallback*     progress ) const
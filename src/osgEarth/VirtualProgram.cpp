@@ -20,12 +20,15 @@
 
 #include <osgEarth/Registry>
 #include <osgEarth/Capabilities>
+#include <osgEarth/Hasher>
 #include <osgEarth/ShaderFactory>
 #include <osgEarth/ShaderUtils>
+#include <osgEarth/TaskService>
 #include <osg/Shader>
 #include <osg/Program>
 #include <osg/State>
 #include <osg/Notify>
+#include <OpenThreads/Atomic>
 #include <sstream>
 
 #define LC "[VirtualProgram] "
@@ -54,6 +57,24 @@ namespace
 
     bool s_dumpShaders = false;        // debugging
 
+    // source of VP content IDs; every change to any VP takes a new one.
+    OpenThreads::Atomic s_contentIDs;
+
+    // most VP stacks a context remembers per VP before starting over.
+    const unsigned MAX_STACKS_PER_CONTEXT = 256u;
+
+    // thread that builds programs for VPs set to build asynchronously.
+    Threading::Mutex          s_buildServiceMutex;
+    osg::ref_ptr<TaskService> s_buildService;
+
+    TaskService* getBuildService()
+    {
+        Threading::ScopedMutexLock lock( s_buildServiceMutex );
+        if ( !s_buildService.valid() )
+            s_buildService = new TaskService( "VirtualProgram", 1 );
+        return s_buildService.get();
+    }
+
     /** A hack for OSG 2.8.x to get access to the state attribute vector. */
     /** TODO: no longer needed in OSG 3+ ?? */
     class StateHack : public osg::State 
@@ -110,7 +131,9 @@ VirtualProgram::get(osg::StateSet* stateset)
 
 VirtualProgram::VirtualProgram( unsigned mask ) : 
 _mask              ( mask ),
-_inherit           ( true )
+_inherit           ( true ),
+_buildAsync        ( false ),
+_contentID         ( ++s_contentIDs )
 {
     // check the the dump env var
     if ( ::getenv(OSGEARTH_DUMP_SHADERS) != 0L )
@@ -137,6 +160,8 @@ _shaderMap         ( rhs._shaderMap ),
 _mask              ( rhs._mask ),
 _functions         ( rhs._functions ),
 _inherit           ( rhs._inherit ),
+_buildAsync        ( rhs._buildAsync ),
+_contentID         ( ++s_contentIDs ),
 _template          ( osg::clone(rhs._template.get()) )
 {
     //nop
@@ -185,6 +210,14 @@ VirtualProgram::compare(const osg::StateAttribute& sa) const
     return 0; // passed all the above comparison macros, must be equal.
 }
 
+void
+VirtualProgram::dirtyContent()
+{
+    // a new ID means the VP stacks this VP is part of hash differently,
+    // so the contexts look their programs up again.
+    _contentID = ++s_contentIDs;
+}
+
 void
 VirtualProgram::addBindAttribLocation( const std::string& name, GLuint index )
 {
@@ -194,6 +227,7 @@ VirtualProgram::addBindAttribLocation( const std::string& name, GLuint index )
 #else
     _attribBindingList[name] = index;
 #endif
+    dirtyContent();
 }
 
 void
@@ -202,6 +236,7 @@ VirtualProgram::removeBindAttribLocation( const std::string& name )
     std::map<std::string,std::string>::iterator i = _attribAliases.find(name);
     if ( i != _attribAliases.end() )
         _attribBindingList.erase(i->second);
+    dirtyContent();
 }
 
 void
@@ -239,6 +274,7 @@ VirtualProgram::setShader(const std::string&                 shaderID,
 
     shader->setName( shaderID );
     _shaderMap[shaderID] = ShaderEntry(shader, ov);
+    dirtyContent();
 
     return shader;
 }
@@ -262,6 +298,7 @@ VirtualProgram::setShader(osg::Shader*                       shader,
     ShaderPreProcessor::run( shader );
 
     _shaderMap[shader->getName()] = ShaderEntry(shader, ov);
+    dirtyContent();
 
     return shader;
 }
@@ -305,6 +342,7 @@ void
 VirtualProgram::removeShader( const std::string& shaderID )
 {
     _shaderMap.erase( shaderID );
+    dirtyContent();
 
     for(FunctionLocationMap::iterator i = _functions.begin(); i != _functions.end(); ++i )
     {
@@ -368,9 +406,10 @@ VirtualProgram::setInheritShaders( bool value )
     if ( _inherit != value )
     {
         _inherit = value;
-        // not particularly thread safe if called after use.. meh
+        dirtyContent();
+
+        Threading::ScopedWriteLock exclusive( _programCacheMutex );
         _programCache.clear();
-        _accumulatedFunctions.clear();
     }
 }
 
@@ -574,32 +613,19 @@ VirtualProgram::addTemplateDataToProgram( osg::Program* program )
 
 
 osg::Program*
-VirtualProgram::buildProgram(osg::State&        state, 
-                             ShaderMap&         accumShaderMap,
-                             AttribBindingList& accumAttribBindings,
-                             AttribAliasMap&    accumAttribAliases)
+VirtualProgram::buildProgram(const ShaderVector&        keyVector,
+                             const AttribBindingList&   accumAttribBindings,
+                             const AttribAliasMap&      accumAttribAliases,
+                             const FunctionLocationMap& accumFunctions)
 {
     OE_TEST << LC << "Building new Program for VP " << getName() << std::endl;
 
-    // build a new set of accumulated functions, to support the creation of main()
-    refreshAccumulatedFunctions( state );
-
     // create new MAINs for this function stack.
-    osg::Shader* vertMain = Registry::shaderFactory()->createVertexShaderMain( _accumulatedFunctions );
-    osg::Shader* fragMain = Registry::shaderFactory()->createFragmentShaderMain( _accumulatedFunctions );
-
-    // build a new "key vector" now that we've changed the shader map.
-    // we call is a key vector because it uniquely identifies this shader program
-    // based on its accumlated function set.
-    ShaderVector keyVector;
-    for( ShaderMap::iterator i = accumShaderMap.begin(); i != accumShaderMap.end(); ++i )
-    {
-        keyVector.push_back( i->second.first.get() );
-    }
+    osg::Shader* vertMain = Registry::shaderFactory()->createVertexShaderMain( accumFunctions );
+    osg::Shader* fragMain = Registry::shaderFactory()->createFragmentShaderMain( accumFunctions );
 
-    // finally, add the mains (AFTER building the key vector .. we don't want or
-    // need to mains in the key vector since they are completely derived from the
-    // other elements of the key vector.)
+    // add the mains to the key vector. (We don't want or need the mains in the key
+    // vector itself since they are completely derived from its other elements.)
     ShaderVector buildVector( keyVector );
     buildVector.push_back( vertMain );
     buildVector.push_back( fragMain );
@@ -613,13 +639,32 @@ VirtualProgram::buildProgram(osg::State&        state,
     addShadersToProgram( buildVector, accumAttribBindings, accumAttribAliases, program );
     addTemplateDataToProgram( program );
 
-    // finally, put own new program in the cache.
-    _programCache[ keyVector ] = program;
-
     return program;
 }
 
 
+struct VirtualProgram::BuildProgramTask : public TaskRequest
+{
+    osg::ref_ptr<VirtualProgram> _vp;
+    UInt64                       _programKey;
+    ShaderVector                 _keyVector;
+    AttribBindingList            _bindings;
+    AttribAliasMap               _aliases;
+    FunctionLocationMap          _functions;
+
+    void operator()( ProgressCallback* progress )
+    {
+        osg::ref_ptr<osg::Program> program = _vp->buildProgram( _keyVector, _bindings, _aliases, _functions );
+
+        Threading::ScopedWriteLock exclusive( _vp->_programCacheMutex );
+        ProgramEntry& entry = _vp->_programCache[_programKey];
+        entry._key     = _keyVector;
+        entry._program = program.get();
+        _vp->_pendingBuilds.erase( _programKey );
+    }
+};
+
+
 void
 VirtualProgram::apply( osg::State& state ) const
 {
@@ -635,11 +680,155 @@ VirtualProgram::apply( osg::State& state ) const
         return;
     }
 
-    // first, find and collect all the VirtualProgram attributes:
+    osg::Program* program = getProgram( state );
+    if ( program )
+    {
+        program->apply( state );
+    }
+}
+
+
+UInt64
+VirtualProgram::getStackKey( const osg::State& state ) const
+{
+    // Every change to a VP gives it a new content ID, so the IDs of the VPs
+    // on the stack identify the accumulated program without accumulating it.
+    Hasher key;
+    key.mix( _contentID );
+
+    if ( _inherit )
+    {
+        const StateHack::AttributeVec* av = StateHack::GetAttributeVec( state, this );
+        if ( av )
+        {
+            for( StateHack::AttributeVec::const_iterator i = av->begin(); i != av->end(); ++i )
+            {
+                const VirtualProgram* vp = dynamic_cast<const VirtualProgram*>( i->first );
+                if ( vp )
+                    key.mix( vp->_contentID );
+            }
+        }
+    }
+
+    return key.get();
+}
+
+
+osg::Program*
+VirtualProgram::getProgram( osg::State& state ) const
+{
+    // First see whether this context already resolved the same stack of VPs,
+    // most likely on the last call. That takes a walk of the attribute stack
+    // and a compare; no allocations and no locks.
+    UInt64 stackKey = getStackKey( state );
+
+    ContextPrograms& cp = _contextPrograms[state.getContextID()];
+    if ( cp._lastProgram.valid() && cp._lastStackKey == stackKey )
+        return cp._lastProgram.get();
+
+    std::map< UInt64, osg::ref_ptr<osg::Program> >::const_iterator s = cp._byStack.find( stackKey );
+    if ( s != cp._byStack.end() )
+    {
+        cp._lastStackKey = stackKey;
+        cp._lastProgram  = s->second.get();
+        return s->second.get();
+    }
+
+    // Otherwise, collect all the shaders and find the program built from them.
     ShaderMap         accumShaderMap;
     AttribBindingList accumAttribBindings;
     AttribAliasMap    accumAttribAliases;
-    
+    accumulateShaders( state, accumShaderMap, accumAttribBindings, accumAttribAliases );
+
+    if ( accumShaderMap.empty() )
+        return 0L;
+
+    // assemble a list of the shaders in the map; it uniquely identifies the program,
+    // and its hash is the program cache key.
+    // (Note: at present, the "cache key" does not include any information on the vertex
+    // attribute bindings. Technically it should, but in practice this might not be an
+    // issue; it is unlikely one would have two identical shader programs with different
+    // bindings.)
+    ShaderVector keyVector;
+    keyVector.reserve( accumShaderMap.size() );
+    Hasher programHash;
+    for( ShaderMap::const_iterator i = accumShaderMap.begin(); i != accumShaderMap.end(); ++i )
+    {
+        keyVector.push_back( i->second.first.get() );
+        programHash.mix( (UInt64)(size_t)i->second.first.get() );
+    }
+    UInt64 programKey = programHash.get();
+
+    osg::Program* program = 0L;
+    {
+        Threading::ScopedReadLock shared( _programCacheMutex );
+        ProgramMap::const_iterator p = _programCache.find( programKey );
+        if ( p != _programCache.end() && p->second._key == keyVector )
+            program = p->second._program.get();
+    }
+
+    if ( !program )
+    {
+        // build a new set of accumulated functions, to support the creation of main()
+        FunctionLocationMap accumFunctions;
+        accumulateFunctions( state, accumFunctions );
+
+        VirtualProgram* nc = const_cast<VirtualProgram*>(this);
+
+        Threading::ScopedWriteLock exclusive( _programCacheMutex );
+
+        // look again in case of contention:
+        ProgramMap::const_iterator p = _programCache.find( programKey );
+        if ( p != _programCache.end() && p->second._key == keyVector )
+        {
+            program = p->second._program.get();
+        }
+
+        else if ( _buildAsync )
+        {
+            if ( nc->_pendingBuilds.insert( programKey ).second )
+            {
+                BuildProgramTask* task = new BuildProgramTask();
+                task->_vp         = nc;
+                task->_programKey = programKey;
+                task->_keyVector  = keyVector;
+                task->_bindings   = accumAttribBindings;
+                task->_aliases    = accumAttribAliases;
+                task->_functions  = accumFunctions;
+                getBuildService()->add( task );
+            }
+            return 0L;
+        }
+
+        else
+        {
+            program = nc->buildProgram( keyVector, accumAttribBindings, accumAttribAliases, accumFunctions );
+            ProgramEntry& entry = nc->_programCache[programKey];
+            entry._key     = keyVector;
+            entry._program = program;
+        }
+    }
+
+    // remember it for next time. (VP edits orphan entries, so start over
+    // once there are too many.)
+    if ( cp._byStack.size() >= MAX_STACKS_PER_CONTEXT )
+        cp._byStack.clear();
+
+    cp._byStack[stackKey] = program;
+    cp._lastStackKey      = stackKey;
+    cp._lastProgram       = program;
+
+    return program;
+}
+
+
+void
+VirtualProgram::accumulateShaders(const osg::State& state,
+                                  ShaderMap&         accumShaderMap,
+                                  AttribBindingList& accumAttribBindings,
+                                  AttribAliasMap&    accumAttribAliases) const
+{
+    // first, find and collect all the VirtualProgram attributes:
     if ( _inherit )
     {
         const StateHack::AttributeVec* av = StateHack::GetAttributeVec( state, this );
@@ -685,59 +874,6 @@ VirtualProgram::apply( osg::State& state ) const
 
     const AttribAliasMap& aliases = this->getAttribAliases();
     accumAttribAliases.insert( aliases.begin(), aliases.end() );
-
-
-    if ( accumShaderMap.size() )
-    {
-        // next, assemble a list of the shaders in the map so we can use it as our
-        // program cache key.
-        // (Note: at present, the "cache key" does not include any information on the vertex
-        // attribute bindings. Technically it should, but in practice this might not be an
-        // issue; it is unlikely one would have two identical shader programs with different
-        // bindings.)
-        ShaderVector vec;
-        vec.reserve( accumShaderMap.size() );
-        for( ShaderMap::iterator i = accumShaderMap.begin(); i != accumShaderMap.end(); ++i )
-        {
-            ShaderEntry& entry = i->second;
-            vec.push_back( entry.first.get() );
-        }
-        
-        // see if there's already a program associated with this list:
-        osg::Program* program = 0L;
-        
-        // look up the program:
-        {
-            Threading::ScopedReadLock shared( _programCacheMutex );
-            
-            ProgramMap::const_iterator p = _programCache.find( vec );
-            if ( p != _programCache.end() )
-            {
-                program = p->second.get();
-            }
-        }
-        
-        // if not found, lock and build it:
-        if ( !program )
-        {
-            Threading::ScopedWriteLock exclusive( _programCacheMutex );
-            
-            // look again in case of contention:
-            ProgramMap::const_iterator p = _programCache.find( vec );
-            if ( p != _programCache.end() )
-            {
-                program = p->second.get();
-            }
-            else
-            {
-                VirtualProgram* nc = const_cast<VirtualProgram*>(this);
-                program = nc->buildProgram( state, accumShaderMap, accumAttribBindings, accumAttribAliases);
-            }
-        }
-        
-        // finally, apply the program attribute.
-        program->apply( state );
-    }
 }
 
 void
@@ -748,15 +884,12 @@ VirtualProgram::getFunctions( FunctionLocationMap& out ) const
 }
 
 void
-VirtualProgram::refreshAccumulatedFunctions( const osg::State& state )
+VirtualProgram::accumulateFunctions( const osg::State& state, FunctionLocationMap& out ) const
 {
     // This method searches the state's attribute stack and accumulates all 
     // the user functions (including those in this program).
 
-    // mutex no longer required since this method is called safely
-    //Threading::ScopedMutexLock lock( _functionsMutex );
-
-    _accumulatedFunctions.clear();
+    out.clear();
 
     if ( _inherit )
     {
@@ -784,7 +917,7 @@ VirtualProgram::refreshAccumulatedFunctions( const osg::State& state )
                     for( FunctionLocationMap::const_iterator j = rhs.begin(); j != rhs.end(); ++j )
                     {
                         const OrderedFunctionMap& source = j->second;
-                        OrderedFunctionMap&       dest   = _accumulatedFunctions[j->first];
+                        OrderedFunctionMap&       dest   = out[j->first];
 
                         for( OrderedFunctionMap::const_iterator k = source.begin(); k != source.end(); ++k )
                         {
@@ -798,7 +931,6 @@ VirtualProgram::refreshAccumulatedFunctions( const osg::State& state )
                                 }
                             }
                             dest.insert( *k );
-                            //_accumulatedFunctions[j->first].insert( *k );
                         }
                     }
                 }
@@ -807,10 +939,13 @@ VirtualProgram::refreshAccumulatedFunctions( const osg::State& state )
     }
 
     // add the local ones too:
-    for( FunctionLocationMap::const_iterator j = _functions.begin(); j != _functions.end(); ++j )
+    FunctionLocationMap local;
+    getFunctions( local );
+
+    for( FunctionLocationMap::const_iterator j = local.begin(); j != local.end(); ++j )
     {
         const OrderedFunctionMap& source = j->second;
-        OrderedFunctionMap&       dest   = _accumulatedFunctions[j->first];
+        OrderedFunctionMap&       dest   = out[j->first];
 
         for( OrderedFunctionMap::const_iterator k = source.begin(); k != source.end(); ++k )
         {
@@ -824,7 +959,6 @@ VirtualProgram::refreshAccumulatedFunctions( const osg::State& state )
                 }
             }
             dest.insert( *k );
-            //_accumulatedFunctions[j->first].insert( *k );
         }
     } 
 }
@@ -18,14 +18,14 @@
  */
 
 #include <osgEarthFeatures/FeatureTileSource>
-#include <osgEarthFeatures/ResampleFilter>
 #include <osgEarthFeatures/TransformFilter>
-#include <osgEarthFeatures/BufferFilter>
 #include <osgEarthSymbology/Style>
 //TODO: replace this with GeometryRasterizer
 #include <osgEarthSymbology/AGG.h>
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -35,10 +35,11 @@
 #include <osgDB/WriteFile>
 
 #include "AGGLiteOptions"
+#include "FeatureTileIndex"
+#include "LineStroker"
 
 #include <sstream>
-#include <OpenThreads/Mutex>
-#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 
 #define LC "[AGGLite] "
 
@@ -46,7 +47,53 @@ using namespace osgEarth;
 using namespace osgEarth::Features;
 using namespace osgEarth::Symbology;
 using namespace osgEarth::Drivers;
-using namespace OpenThreads;
+
+/********************************************************************/
+
+namespace
+{
+    // Scratch space for rendering one tile. Tiles render concurrently, so each
+    // thread borrows one of these for the duration and hands it back; that way
+    // the rasterizer's cell storage is allocated once and then reused.
+    struct RenderState
+    {
+        agg::rasterizer         _ras;
+        LineStroker             _stroker;
+        Contours                _contours;
+        std::vector<osg::Vec2d> _points;
+        std::vector<osg::Vec2d> _clipped;
+
+        RenderState()
+        {
+            _ras.gamma(1.3);
+        }
+    };
+
+    void appendContour( const std::vector<osg::Vec2d>& points, Contours& out )
+    {
+        if ( points.size() >= 3 )
+        {
+            out._points.insert( out._points.end(), points.begin(), points.end() );
+            out._ends.push_back( out._points.size() );
+        }
+    }
+
+    // Runs a tile request on the rasterizer's own thread pool.
+    struct RenderTileTask : public TaskRequest
+    {
+        osg::ref_ptr<TileSource>                 _source;
+        osg::ref_ptr<TileSource::ImageOperation> _op;
+        osg::ref_ptr<TileRequest>                _request;
+
+        void operator()( ProgressCallback* )
+        {
+            osg::ref_ptr<osg::Image> image;
+            if ( !_request->isCanceled() )
+                image = _source->createImage( _request->getKey(), _op.get(), _request->getProgressCallback() );
+            _request->complete( image.get() );
+        }
+    };
+}
 
 /********************************************************************/
 
@@ -70,6 +117,75 @@ public:
         return new BuildData();
     }
 
+    //override
+    osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+    {
+        if ( !useFeatureIndex() )
+            return FeatureTileSource::createImage( key, progress );
+
+        osg::ref_ptr<osg::Image> image = new osg::Image();
+        image->allocateImage( getPixelsPerTile(), getPixelsPerTile(), 1, GL_RGBA, GL_UNSIGNED_BYTE );
+
+        preProcess( image.get(), 0L );
+
+        // gather features a little past the tile's edges, for the lines that
+        // cross into it.
+        const GeoExtent& extent = key.getExtent();
+        double xmin = extent.xMin() - 0.05*extent.width();
+        double ymin = extent.yMin() - 0.05*extent.height();
+        double xmax = extent.xMax() + 0.05*extent.width();
+        double ymax = extent.yMax() + 0.05*extent.height();
+
+        const StyleSheet* styles = _options.styles();
+
+        if ( _features->hasEmbeddedStyles() )
+        {
+            // each feature carries its own style, which rasterize() picks up.
+            FeatureList features;
+            getFeatureIndex( 0, Query() )->getFeatures( xmin, ymin, xmax, ymax, features );
+            rasterize( Style(), features, extent, image.get() );
+        }
+        else if ( styles && styles->selectors().size() > 0 )
+        {
+            unsigned slot = 1;
+            for( StyleSelectorList::const_iterator i = styles->selectors().begin(); i != styles->selectors().end(); ++i, ++slot )
+            {
+                const StyleSelector& sel = *i;
+                const Style* style = styles->getStyle( sel.getSelectedStyleName() );
+
+                FeatureList features;
+                getFeatureIndex( slot, sel.query().value() )->getFeatures( xmin, ymin, xmax, ymax, features );
+                rasterize( *style, features, extent, image.get() );
+            }
+        }
+        else
+        {
+            FeatureList features;
+            getFeatureIndex( 0, Query() )->getFeatures( xmin, ymin, xmax, ymax, features );
+            rasterize( styles ? *styles->getDefaultStyle() : Style(), features, extent, image.get() );
+        }
+
+        postProcess( image.get(), 0L );
+
+        return image.release();
+    }
+
+    //override
+    osg::ref_ptr<TileRequest> createImageAsync(const TileKey&         key,
+                                               ImageOperation*        op,
+                                               TileRequest::Callback* callback)
+    {
+        osg::ref_ptr<TileRequest> request = new TileRequest( key, callback );
+
+        RenderTileTask* task = new RenderTileTask();
+        task->_source  = this;
+        task->_op      = op;
+        task->_request = request.get();
+        getRenderService()->add( task );
+
+        return request;
+    }
+
     //override
     bool preProcess(osg::Image* image, osg::Referenced* buildData)
     {
@@ -96,19 +212,55 @@ public:
         FilterContext context;
         context.profile() = getFeatureSource()->getFeatureProfile();
 
-        const LineSymbol* masterLine = style.getSymbol<LineSymbol>();
-        const PolygonSymbol* masterPoly = style.getSymbol<PolygonSymbol>();
+        // Transform the features into the map's SRS:
+        TransformFilter xform( imageExtent.getSRS() );
+        xform.setLocalizeCoordinates( false );
+        context = xform.push( features, context );
 
-        //bool embeddedStyles = getFeatureSource()->hasEmbeddedStyles();
+        rasterize( style, features, imageExtent, image );
 
-        // if only a line symbol exists, and there are polygons in the mix, draw them
-        // as outlines (line rings).
-        //OE_INFO << LC << "Line Symbol = " << (masterLine == 0L ? "null" : masterLine->getConfig().toString()) << std::endl;
-        //OE_INFO << LC << "Poly SYmbol = " << (masterPoly == 0L ? "null" : masterPoly->getConfig().toString()) << std::endl;
+        bd->_pass++;
+        return true;
+    }
+
+    //override
+    bool postProcess( osg::Image* image, osg::Referenced* data )
+    {
+        //convert from ABGR to RGBA
+        unsigned char* pixel = image->data();
+        for(int i=0; i<image->s()*image->t()*4; i+=4, pixel+=4)
+        {
+            std::swap( pixel[0], pixel[3] );
+            std::swap( pixel[1], pixel[2] );
+        }
+        return true;
+    }
 
-        //bool convertPolysToRings = poly == 0L && line != 0L;
-        //if ( convertPolysToRings )
-        //    OE_INFO << LC << "No PolygonSymbol; will draw polygons to rings" << std::endl;
+    virtual std::string getExtension()  const 
+    {
+        return "png";
+    }
+
+protected:
+
+    virtual ~AGGLiteRasterizerTileSource()
+    {
+        for( unsigned i = 0; i < _renderStates.size(); ++i )
+            delete _renderStates[i];
+    }
+
+    /**
+     * Draws features (already in the image's SRS) into the image. Only reads
+     * the features, so it's safe to share them between tiles and threads.
+     */
+    void rasterize(
+        const Style&       style,
+        const FeatureList& features,
+        const GeoExtent&   imageExtent,
+        osg::Image*        image )
+    {
+        const LineSymbol* masterLine = style.getSymbol<LineSymbol>();
+        const PolygonSymbol* masterPoly = style.getSymbol<PolygonSymbol>();
 
         // initialize:
         double xmin = imageExtent.xMin();
@@ -116,261 +268,274 @@ public:
         double xf = (double)image->s() / imageExtent.width();
         double yf = (double)image->t() / imageExtent.height();
 
-        // strictly speaking we should iterate over the features and buffer each one that's a line,
-        // rather then checking for the existence of a LineSymbol.
-        FeatureList linesToBuffer;
-        for(FeatureList::iterator i = features.begin(); i != features.end(); i++)
-        {
-            Feature* feature = i->get();
-            Geometry* geom = feature->getGeometry();
+        // line widths in map units are in the feature data's units; figure out
+        // how big a pixel is in those units.
+        const SpatialReference* featureSRS = getFeatureSource()->getFeatureProfile()->getSRS();
+        GeoExtent imageExtentInFeatureSRS = imageExtent.transform( featureSRS );
+        double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
 
-            if ( geom )
-            {
-                // check for an embedded style:
-                const LineSymbol* line = feature->style().isSet() ? 
-                    feature->style()->getSymbol<LineSymbol>() : masterLine;
+        osg::Vec4 color = osg::Vec4(1, 1, 1, 1);
+        if ( masterLine )
+            color = masterLine->stroke()->color();
 
-                const PolygonSymbol* poly =
-                    feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
+        // set up the AGG renderer:
+        agg::rendering_buffer rbuf( image->data(), image->s(), image->t(), image->s()*4 );
+        agg::renderer<agg::span_abgr32> ren(rbuf);
 
-                // if we have polygons but only a LineSymbol, draw the poly as a line.
-                if ( geom->getComponentType() == Geometry::TYPE_POLYGON )
-                {
-                    if ( !poly && line )
-                    {
-                        Feature* outline = new Feature( *feature );
-                        geom = geom->cloneAs( Geometry::TYPE_RING );
-                        outline->setGeometry( geom );
-                        *i = outline;
-                        feature = outline;
-                    }
-                    //TODO: fix to enable outlined polys. doesn't work, not sure why -gw
-                    //else if ( poly && line )
-                    //{
-                    //    Feature* outline = new Feature();
-                    //    geom = geom->cloneAs( Geometry::TYPE_LINESTRING );
-                    //    outline->setGeometry( geom );
-                    //    features.push_back( outline );
-                    //}
-                }
+        RenderState* state = acquireRenderState();
+        agg::rasterizer& ras     = state->_ras;
+        LineStroker&     stroker = state->_stroker;
+        Contours&        contours = state->_contours;
 
-                bool needsBuffering =
-                    geom->getComponentType() == Geometry::TYPE_LINESTRING || 
-                    geom->getComponentType() == Geometry::TYPE_RING;
+        stroker.setClipBox( 0.0, 0.0, (double)image->s(), (double)image->t() );
 
-                if ( needsBuffering )
-                {
-                    linesToBuffer.push_back( feature );
-                }
-            }
-        }
+        // downsample the line data so that it is no higher resolution than the
+        // image to which we intend to rasterize it.
+        stroker.setMinSpacing( _options.optimizeLineSampling() == true ? 1.0 : 0.0 );
 
-        if ( linesToBuffer.size() > 0 )
+        // render the features
+        for(FeatureList::const_iterator i = features.begin(); i != features.end(); i++)
         {
-            //We are buffering in the features native extent, so we need to use the transform extent to get the proper "resolution" for the image
-            const SpatialReference* featureSRS = context.profile()->getSRS();
-            GeoExtent transformedExtent = imageExtent.transform(featureSRS);
+            const Feature* feature = i->get();
+            const Geometry* geometry = feature->getGeometry();
+            if ( !geometry )
+                continue;
+
+            // check for an embedded style:
+            const LineSymbol* line = feature->style().isSet() ? 
+                feature->style()->getSymbol<LineSymbol>() : masterLine;
 
-            double trans_xf = (double)image->s() / transformedExtent.width();
-            double trans_yf = (double)image->t() / transformedExtent.height();
+            const PolygonSymbol* poly =
+                feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
 
-            // resolution of the image (pixel extents):
-            double xres = 1.0/trans_xf;
-            double yres = 1.0/trans_yf;
+            // if we have polygons but only a LineSymbol, draw the poly as a line.
+            bool outlinePolygons = !poly && line;
 
-            // downsample the line data so that it is no higher resolution than to image to which
-            // we intend to rasterize it. If you don't do this, you run the risk of the buffer 
-            // operation taking forever on very high-res input data.
-            if ( _options.optimizeLineSampling() == true )
+            if ( line )
             {
-                ResampleFilter resample;
-                resample.minLength() = osg::minimum( xres, yres );
-                context = resample.push( linesToBuffer, context );
+                stroker.setWidth( getLineWidthInPixels(line, featureSRS, imageExtentInFeatureSRS, pixelWidth) );
+                stroker.setLineCap( line->stroke()->lineCap().value() );
+                stroker.setLineJoin( line->stroke()->lineJoin().value() );
+            }
+            else
+            {
+                stroker.setWidth( 1.0 );
+                stroker.setLineCap( Stroke::LINECAP_FLAT );
+                stroker.setLineJoin( Stroke::LINEJOIN_ROUND );
             }
 
-            // now run the buffer operation on all lines:
-            BufferFilter buffer;
-            double lineWidth = 1.0;
-            if ( masterLine )
+            ConstGeometryIterator gi( geometry, false );
+            while( gi.hasMore() )
             {
-                buffer.capStyle() = masterLine->stroke()->lineCap().value();
+                const Geometry* g = gi.next();
+                osg::Vec4 c = color;
 
-                if ( masterLine->stroke()->width().isSet() )
+                bool fill = g->getType() == Geometry::TYPE_POLYGON && !outlinePolygons;
+
+                if ( !fill )
                 {
-                    lineWidth = masterLine->stroke()->width().value();
+                    if ( line )
+                        c = line->stroke()->color();
+                    else if ( poly )
+                        c = poly->fill()->color();
+                }
+                else
+                {
+                    if ( poly )
+                        c = poly->fill()->color();
+                    else if ( line )
+                        c = line->stroke()->color();
+                }
+
+                unsigned int a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
+                agg::rgba8 fgColor( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
 
-                    GeoExtent imageExtentInFeatureSRS = imageExtent.transform(featureSRS);
-                    double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
+                contours.clear();
 
-                    // if the width units are specified, process them:
-                    if (masterLine->stroke()->widthUnits().isSet() &&
-                        masterLine->stroke()->widthUnits().get() != Units::PIXELS)
+                if ( g->getType() == Geometry::TYPE_POINTSET )
+                {
+                    for( Geometry::const_iterator p = g->begin(); p != g->end(); ++p )
+                        stroker.dot( osg::Vec2d(xf*(p->x()-xmin), yf*(p->y()-ymin)), contours );
+                    ras.filling_rule( agg::fill_non_zero );
+                }
+                else
+                {
+                    // a polygon's holes belong with its outer ring, whether
+                    // we're filling or outlining it.
+                    std::vector<const Geometry*> rings;
+                    rings.push_back( g );
+                    if ( g->getType() == Geometry::TYPE_POLYGON )
                     {
-                        const Units& featureUnits = featureSRS->getUnits();
-                        const Units& strokeUnits  = masterLine->stroke()->widthUnits().value();
+                        const RingCollection& holes = static_cast<const Symbology::Polygon*>(g)->getHoles();
+                        for( RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h )
+                            rings.push_back( h->get() );
+                    }
 
-                        // if the units are different than those of the feature data, we need to
-                        // do a units conversion.
-                        if ( featureUnits != strokeUnits )
+                    for( unsigned r = 0; r < rings.size(); ++r )
+                    {
+                        const Geometry* ring = rings[r];
+                        state->_points.clear();
+                        for( Geometry::const_iterator p = ring->begin(); p != ring->end(); ++p )
+                            state->_points.push_back( osg::Vec2d(xf*(p->x()-xmin), yf*(p->y()-ymin)) );
+
+                        if ( fill )
                         {
-                            if ( Units::canConvert(strokeUnits, featureUnits) )
-                            {
-                                // linear to linear, no problem
-                                lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
-                            }
-                            else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
-                            {
-                                // linear to angular? approximate degrees per meter at the 
-                                // latitude of the tile's centroid.
-                                lineWidth = masterLine->stroke()->widthUnits()->convertTo(Units::METERS, lineWidth);
-                                double circ = featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI;
-                                double x, y;
-                                context.profile()->getExtent().getCentroid(x, y);
-                                double radians = (lineWidth/circ) * cos(osg::DegreesToRadians(y));
-                                lineWidth = osg::RadiansToDegrees(radians);
-                            }
+                            stroker.clipRing( state->_points, state->_clipped );
+                            appendContour( state->_clipped, contours );
+                        }
+                        else
+                        {
+                            stroker.stroke( state->_points, ring->getType() != Geometry::TYPE_LINESTRING, contours );
                         }
-
-                        // enfore a minimum width of one pixel.
-                        float minPixels = masterLine->stroke()->minPixels().getOrUse( 1.0f );
-                        lineWidth = osg::clampAbove(lineWidth, pixelWidth*minPixels);
                     }
 
-                    else // pixels
-                    {
-                        lineWidth *= pixelWidth;
-                    }
+                    // strokes are built from overlapping pieces, so they need
+                    // the non-zero rule; fills need even-odd for their holes.
+                    ras.filling_rule( fill ? agg::fill_even_odd : agg::fill_non_zero );
                 }
-            }
-
-            buffer.distance() = lineWidth * 0.5;   // since the distance is for one side
-            buffer.push( linesToBuffer, context );
-        }
-
-        // Transform the features into the map's SRS:
-        TransformFilter xform( imageExtent.getSRS() );
-        xform.setLocalizeCoordinates( false );
-        context = xform.push( features, context );
-
-        // set up the AGG renderer:
-        agg::rendering_buffer rbuf( image->data(), image->s(), image->t(), image->s()*4 );
-
-        // Create the renderer and the rasterizer
-        agg::renderer<agg::span_abgr32> ren(rbuf);
-        agg::rasterizer ras;
 
-        // Setup the rasterizer
-        ras.gamma(1.3);
-        ras.filling_rule(agg::fill_even_odd);
+                if ( contours.empty() )
+                    continue;
 
-        GeoExtent cropExtent = GeoExtent(imageExtent);
-        cropExtent.scale(1.1, 1.1);
+                unsigned p = 0;
+                for( unsigned k = 0; k < contours._ends.size(); ++k )
+                {
+                    ras.move_to_d( contours._points[p].x(), contours._points[p].y() );
+                    for( ++p; p < contours._ends[k]; ++p )
+                        ras.line_to_d( contours._points[p].x(), contours._points[p].y() );
+                }
 
-        osg::ref_ptr<Symbology::Polygon> cropPoly = new Symbology::Polygon( 4 );
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMin(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMin(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMax(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMax(), 0 ));
+                ras.render(ren, fgColor);
+                ras.reset();
+            }
+        }
 
-        double lineWidth = 1.0;
-        if ( masterLine )
-            lineWidth = (double)masterLine->stroke()->width().value();
+        releaseRenderState( state );
+    }
 
-        osg::Vec4 color = osg::Vec4(1, 1, 1, 1);
-        if ( masterLine )
-            color = masterLine->stroke()->color();
+    /** Width of a line symbol's stroke, in pixels. */
+    double getLineWidthInPixels(
+        const LineSymbol*       line,
+        const SpatialReference* featureSRS,
+        const GeoExtent&        imageExtentInFeatureSRS,
+        double                  pixelWidth ) const
+    {
+        const Stroke& stroke = *line->stroke();
+        double lineWidth = stroke.width().value();
 
-        // render the features
-        for(FeatureList::iterator i = features.begin(); i != features.end(); i++)
+        // if the width units are specified, process them:
+        if (stroke.widthUnits().isSet() &&
+            stroke.widthUnits().get() != Units::PIXELS)
         {
-            Feature* feature = i->get();
-
-            Geometry* geometry = feature->getGeometry();
+            const Units& featureUnits = featureSRS->getUnits();
+            const Units& strokeUnits  = stroke.widthUnits().value();
 
-            osg::ref_ptr< Geometry > croppedGeometry;
-            if ( ! geometry->crop( cropPoly.get(), croppedGeometry ) )
-                continue;
-
-            // set up a default color:
-            osg::Vec4 c = color;
-            unsigned int a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
-            agg::rgba8 fgColor( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
-
-            GeometryIterator gi( croppedGeometry.get() );
-            while( gi.hasMore() )
+            // if the units are different than those of the feature data, we need to
+            // do a units conversion.
+            if ( featureUnits != strokeUnits )
             {
-                c = color;
-                Geometry* g = gi.next();
-            
-                const LineSymbol* line = feature->style().isSet() ? 
-                    feature->style()->getSymbol<LineSymbol>() : masterLine;
-
-                const PolygonSymbol* poly =
-                    feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
-
-                if (g->getType() == Geometry::TYPE_RING || g->getType() == Geometry::TYPE_LINESTRING)
+                if ( Units::canConvert(strokeUnits, featureUnits) )
                 {
-                    if ( line )
-                        c = line->stroke()->color();
-                    else if ( poly )
-                        c = poly->fill()->color();
+                    // linear to linear, no problem
+                    lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
                 }
-
-                else if ( g->getType() == Geometry::TYPE_POLYGON )
+                else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
                 {
-                    if ( poly )
-                        c = poly->fill()->color();
-                    else if ( line )
-                        c = line->stroke()->color();
+                    // linear to angular? approximate degrees per meter at the 
+                    // latitude of the tile's centroid.
+                    lineWidth = strokeUnits.convertTo(Units::METERS, lineWidth);
+                    double circ = featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI;
+                    double x, y;
+                    imageExtentInFeatureSRS.getCentroid(x, y);
+                    double radians = (lineWidth/circ) * cos(osg::DegreesToRadians(y));
+                    lineWidth = osg::RadiansToDegrees(radians);
                 }
+            }
 
-                a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
-                fgColor = agg::rgba8( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+            // enfore a minimum width of one pixel.
+            float minPixels = stroke.minPixels().getOrUse( 1.0f );
+            return osg::maximum( lineWidth / pixelWidth, (double)minPixels );
+        }
 
-                ras.filling_rule( agg::fill_even_odd );
-                for( Geometry::iterator p = g->begin(); p != g->end(); p++ )
-                {
-                    const osg::Vec3d& p0 = *p;
-                    double x0 = xf*(p0.x()-xmin);
-                    double y0 = yf*(p0.y()-ymin);
-
-                    if ( p == g->begin() )
-                        ras.move_to_d( x0, y0 );
-                    else
-                        ras.line_to_d( x0, y0 );
-                }
-            }
-            ras.render(ren, fgColor);
-            ras.reset();
+        else // pixels
+        {
+            return lineWidth;
         }
+    }
 
-        bd->_pass++;
-        return true;
+    /** Whether to render from a FeatureTileIndex instead of querying for each tile. */
+    bool useFeatureIndex() const
+    {
+        return
+            _options.featureIndex() == true &&
+            _features.valid() &&
+            _features->getFeatureProfile() &&
+            !_features->getFeatureProfile()->getTiled() &&
+            !_features->isWritable();
     }
 
-    //override
-    bool postProcess( osg::Image* image, osg::Referenced* data )
+    /** Index of the features for one style selector, built on first use. */
+    FeatureTileIndex* getFeatureIndex( unsigned slot, const Query& query )
     {
-        //convert from ABGR to RGBA
-        unsigned char* pixel = image->data();
-        for(int i=0; i<image->s()*image->t()*4; i+=4, pixel+=4)
+        Threading::ScopedMutexLock lock( _indexMutex );
+        if ( slot >= _indexes.size() )
+            _indexes.resize( slot+1 );
+
+        if ( !_indexes[slot].valid() )
         {
-            std::swap( pixel[0], pixel[3] );
-            std::swap( pixel[1], pixel[2] );
+            _indexes[slot] = new FeatureTileIndex(
+                _features.get(), query, getProfile()->getSRS(), _options.geometryTypeOverride() );
         }
-        return true;
+
+        return _indexes[slot].get();
     }
 
-    virtual std::string getExtension()  const 
+    RenderState* acquireRenderState()
     {
-        return "png";
+        Threading::ScopedMutexLock lock( _renderStatesMutex );
+        if ( _renderStates.empty() )
+            return new RenderState();
+
+        RenderState* state = _renderStates.back();
+        _renderStates.pop_back();
+        return state;
+    }
+
+    void releaseRenderState( RenderState* state )
+    {
+        Threading::ScopedMutexLock lock( _renderStatesMutex );
+        _renderStates.push_back( state );
+    }
+
+    TaskService* getRenderService()
+    {
+        Threading::ScopedMutexLock lock( _renderServiceMutex );
+        if ( !_renderService.valid() )
+        {
+            int numThreads = _options.renderThreads().value() > 0u ?
+                (int)_options.renderThreads().value() :
+                osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+
+            _renderService = new TaskService( "AGGLite", numThreads );
+        }
+        return _renderService.get();
     }
 
 private:
     const AGGLiteOptions _options;
     std::string _configPath;
+
+    std::vector< osg::ref_ptr<FeatureTileIndex> > _indexes;
+    Threading::Mutex                              _indexMutex;
+
+    std::vector<RenderState*>                     _renderStates;
+    Threading::Mutex                              _renderStatesMutex;
+
+    osg::ref_ptr<TaskService>                     _renderService;
+    Threading::Mutex                              _renderServiceMutex;
 };
 
+
 // Reads tiles from a TileCache disk cache.
 class AGGLiteRasterizerTileSourceDriver : public TileSourceDriver
 {
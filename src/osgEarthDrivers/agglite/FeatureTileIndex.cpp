@@ -0,0 +1,205 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "FeatureTileIndex"
+#include <osgEarth/Notify>
+#include <osg/Timer>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#define LC "[AGGLite] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    // most cells one grid dimension may have.
+    const unsigned MAX_CELLS_PER_SIDE = 512u;
+
+    // clamps a (fractional) cell coordinate to [0, n-1].
+    inline unsigned toCell( double v, unsigned n )
+    {
+        double c = floor(v);
+        return c <= 0.0 ? 0u : c >= (double)n ? n-1u : (unsigned)c;
+    }
+}
+
+FeatureTileIndex::FeatureTileIndex(FeatureSource*                  source,
+                                   const Query&                    query,
+                                   const SpatialReference*         outputSRS,
+                                   const optional<Geometry::Type>& typeOverride) :
+_xmin      ( DBL_MAX ),
+_ymin      ( DBL_MAX ),
+_xmax      ( -DBL_MAX ),
+_ymax      ( -DBL_MAX ),
+_cols      ( 0u ),
+_rows      ( 0u ),
+_cellWidth ( 1.0 ),
+_cellHeight( 1.0 )
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    const SpatialReference* featureSRS = source->getFeatureProfile()->getSRS();
+    bool needsXform = outputSRS && featureSRS && !featureSRS->isEquivalentTo( outputSRS );
+
+    // read, convert and measure all the features.
+    osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor( query );
+    while( cursor.valid() && cursor->hasMore() )
+    {
+        osg::ref_ptr<Feature> feature = cursor->nextFeature();
+        if ( !feature.valid() )
+            continue;
+
+        Geometry* geom = feature->getGeometry();
+        if ( !geom )
+            continue;
+
+        if ( typeOverride.isSet() && typeOverride.value() != geom->getComponentType() )
+        {
+            geom = geom->cloneAs( typeOverride.value() );
+            if ( !geom )
+                continue;
+            feature->setGeometry( geom );
+        }
+
+        if ( needsXform )
+        {
+            GeometryIterator parts( geom );
+            while( parts.hasMore() )
+            {
+                Geometry* part = parts.next();
+                featureSRS->transform( part->asVector(), outputSRS );
+            }
+        }
+
+        Bounds b = geom->getBounds();
+        if ( !b.isValid() )
+            continue;
+
+        Entry e;
+        e._feature = feature.get();
+        e._xmin    = b.xMin();
+        e._ymin    = b.yMin();
+        e._xmax    = b.xMax();
+        e._ymax    = b.yMax();
+        _entries.push_back( e );
+
+        _xmin = osg::minimum( _xmin, e._xmin );
+        _ymin = osg::minimum( _ymin, e._ymin );
+        _xmax = osg::maximum( _xmax, e._xmax );
+        _ymax = osg::maximum( _ymax, e._ymax );
+    }
+
+    if ( _entries.empty() )
+        return;
+
+    // size the grid for a couple of features per cell.
+    unsigned side = (unsigned)ceil( sqrt(0.5 * (double)_entries.size()) );
+    side = osg::clampBetween( side, 1u, MAX_CELLS_PER_SIDE );
+    _cols = _xmax > _xmin ? side : 1u;
+    _rows = _ymax > _ymin ? side : 1u;
+    _cellWidth  = _xmax > _xmin ? (_xmax - _xmin) / (double)_cols : 1.0;
+    _cellHeight = _ymax > _ymin ? (_ymax - _ymin) / (double)_rows : 1.0;
+
+    // count the entries in each cell, then fill them in.
+    std::vector<unsigned> counts( _cols*_rows + 1, 0u );
+    for( unsigned i = 0; i < _entries.size(); ++i )
+    {
+        const Entry& e = _entries[i];
+        unsigned c0, r0, c1, r1;
+        getCells( e._xmin, e._ymin, e._xmax, e._ymax, c0, r0, c1, r1 );
+        for( unsigned r = r0; r <= r1; ++r )
+            for( unsigned c = c0; c <= c1; ++c )
+                ++counts[r*_cols + c];
+    }
+
+    _cellStart.resize( _cols*_rows + 1 );
+    unsigned total = 0u;
+    for( unsigned i = 0; i < _cols*_rows; ++i )
+    {
+        _cellStart[i] = total;
+        total += counts[i];
+        counts[i] = _cellStart[i];
+    }
+    _cellStart[_cols*_rows] = total;
+
+    _cellEntries.resize( total );
+    for( unsigned i = 0; i < _entries.size(); ++i )
+    {
+        const Entry& e = _entries[i];
+        unsigned c0, r0, c1, r1;
+        getCells( e._xmin, e._ymin, e._xmax, e._ymax, c0, r0, c1, r1 );
+        for( unsigned r = r0; r <= r1; ++r )
+            for( unsigned c = c0; c <= c1; ++c )
+                _cellEntries[counts[r*_cols + c]++] = i;
+    }
+
+    OE_INFO << LC
+        << "Indexed " << _entries.size() << " features in a "
+        << _cols << "x" << _rows << " grid ("
+        << osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() ) << "s)"
+        << std::endl;
+}
+
+void
+FeatureTileIndex::getCells(double xmin, double ymin, double xmax, double ymax,
+                           unsigned& c0, unsigned& r0, unsigned& c1, unsigned& r1) const
+{
+    c0 = toCell( (xmin - _xmin) / _cellWidth,  _cols );
+    c1 = toCell( (xmax - _xmin) / _cellWidth,  _cols );
+    r0 = toCell( (ymin - _ymin) / _cellHeight, _rows );
+    r1 = toCell( (ymax - _ymin) / _cellHeight, _rows );
+}
+
+void
+FeatureTileIndex::getFeatures(double xmin, double ymin, double xmax, double ymax,
+                              FeatureList& out) const
+{
+    if ( _entries.empty() || xmin > _xmax || xmax < _xmin || ymin > _ymax || ymax < _ymin )
+        return;
+
+    unsigned c0, r0, c1, r1;
+    getCells( xmin, ymin, xmax, ymax, c0, r0, c1, r1 );
+
+    // a feature can sit in several cells, so collect, sort and de-dupe.
+    std::vector<unsigned> hits;
+    for( unsigned r = r0; r <= r1; ++r )
+    {
+        for( unsigned c = c0; c <= c1; ++c )
+        {
+            unsigned cell = r*_cols + c;
+            for( unsigned k = _cellStart[cell]; k < _cellStart[cell+1]; ++k )
+            {
+                const Entry& e = _entries[_cellEntries[k]];
+                if ( e._xmin <= xmax && e._xmax >= xmin && e._ymin <= ymax && e._ymax >= ymin )
+                    hits.push_back( _cellEntries[k] );
+            }
+        }
+    }
+
+    std::sort( hits.begin(), hits.end() );
+    hits.erase( std::unique(hits.begin(), hits.end()), hits.end() );
+
+    for( std::vector<unsigned>::const_iterator i = hits.begin(); i != hits.end(); ++i )
+    {
+        out.push_back( _entries[*i]._feature.get() );
+    }
+}
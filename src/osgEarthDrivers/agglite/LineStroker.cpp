@@ -0,0 +1,420 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "LineStroker"
+#include <osg/Math>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace osgEarth::Symbology;
+
+namespace
+{
+    // mitre joins longer than this many half-widths are beveled instead.
+    const double MITRE_LIMIT = 4.0;
+
+    // how far an arc may stray from a true circle, in pixels.
+    const double ARC_TOLERANCE = 0.25;
+
+    inline osg::Vec2d rotate( const osg::Vec2d& v, double angle )
+    {
+        double c = cos(angle), s = sin(angle);
+        return osg::Vec2d( v.x()*c - v.y()*s, v.x()*s + v.y()*c );
+    }
+
+    inline osg::Vec2d direction( const osg::Vec2d& from, const osg::Vec2d& to )
+    {
+        osg::Vec2d d = to - from;
+        d.normalize();
+        return d;
+    }
+
+    // Is the point on the inside of clip edge "edge" (0=xmin, 1=xmax, 2=ymin, 3=ymax)?
+    inline bool inside( int edge, const osg::Vec2d& p, double value )
+    {
+        switch( edge )
+        {
+        case 0:  return p.x() >= value;
+        case 1:  return p.x() <= value;
+        case 2:  return p.y() >= value;
+        default: return p.y() <= value;
+        }
+    }
+
+    // Where segment a-b crosses clip edge "edge".
+    inline osg::Vec2d crossing( int edge, const osg::Vec2d& a, const osg::Vec2d& b, double value )
+    {
+        if ( edge < 2 )
+        {
+            double t = (value - a.x()) / (b.x() - a.x());
+            return osg::Vec2d( value, a.y() + t*(b.y() - a.y()) );
+        }
+        else
+        {
+            double t = (value - a.y()) / (b.y() - a.y());
+            return osg::Vec2d( a.x() + t*(b.x() - a.x()), value );
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+LineStroker::LineStroker() :
+_halfWidth ( 0.5 ),
+_arcStep   ( osg::PI_2 ),
+_minSpacing( 0.0 ),
+_xmin      ( -DBL_MAX ),
+_ymin      ( -DBL_MAX ),
+_xmax      ( DBL_MAX ),
+_ymax      ( DBL_MAX ),
+_cap       ( Stroke::LINECAP_FLAT ),
+_join      ( Stroke::LINEJOIN_ROUND )
+{
+    //nop
+}
+
+void
+LineStroker::setWidth( double pixels )
+{
+    _halfWidth = osg::maximum( pixels, 0.0 ) * 0.5;
+
+    // pick an arc step so the chords stay within the tolerance, but always
+    // use at least 8 and at most 128 steps for a full circle.
+    _arcStep = _halfWidth > ARC_TOLERANCE ?
+        2.0 * acos( 1.0 - ARC_TOLERANCE/_halfWidth ) :
+        osg::PI_4;
+    _arcStep = osg::clampBetween( _arcStep, 2.0*osg::PI/128.0, osg::PI_4 );
+}
+
+void
+LineStroker::setClipBox( double xmin, double ymin, double xmax, double ymax )
+{
+    _xmin = xmin;
+    _ymin = ymin;
+    _xmax = xmax;
+    _ymax = ymax;
+}
+
+bool
+LineStroker::inBox( const osg::Vec2d& p, double pad ) const
+{
+    return
+        p.x() >= _xmin - pad && p.x() <= _xmax + pad &&
+        p.y() >= _ymin - pad && p.y() <= _ymax + pad;
+}
+
+bool
+LineStroker::clipSegment( osg::Vec2d& a, osg::Vec2d& b, double pad ) const
+{
+    // Liang-Barsky
+    double t0 = 0.0, t1 = 1.0;
+    double dx = b.x() - a.x(), dy = b.y() - a.y();
+
+    double p[4] = { -dx, dx, -dy, dy };
+    double q[4] = { a.x() - (_xmin - pad), (_xmax + pad) - a.x(), a.y() - (_ymin - pad), (_ymax + pad) - a.y() };
+
+    for( int i = 0; i < 4; ++i )
+    {
+        if ( p[i] == 0.0 )
+        {
+            if ( q[i] < 0.0 )
+                return false;
+        }
+        else
+        {
+            double t = q[i] / p[i];
+            if ( p[i] < 0.0 )
+            {
+                if ( t > t1 ) return false;
+                if ( t > t0 ) t0 = t;
+            }
+            else
+            {
+                if ( t < t0 ) return false;
+                if ( t < t1 ) t1 = t;
+            }
+        }
+    }
+
+    osg::Vec2d a0 = a;
+    if ( t0 > 0.0 )
+        a.set( a0.x() + t0*dx, a0.y() + t0*dy );
+    if ( t1 < 1.0 )
+        b.set( a0.x() + t1*dx, a0.y() + t1*dy );
+
+    return true;
+}
+
+void
+LineStroker::endContour( unsigned start, Contours& out )
+{
+    std::vector<osg::Vec2d>& pts = out._points;
+    unsigned end = pts.size();
+
+    // signed area (shoelace); every contour gets the same winding.
+    double area = 0.0;
+    for( unsigned i = start, j = end-1; i < end; j = i++ )
+    {
+        area += pts[j].x()*pts[i].y() - pts[i].x()*pts[j].y();
+    }
+
+    if ( end - start < 3 || fabs(area) < 1e-12 )
+    {
+        pts.resize( start );
+        return;
+    }
+
+    if ( area < 0.0 )
+    {
+        std::reverse( pts.begin() + start, pts.end() );
+    }
+
+    out._ends.push_back( end );
+}
+
+void
+LineStroker::addArc( const osg::Vec2d& center, const osg::Vec2d& from, double angle, Contours& out )
+{
+    unsigned start = out._points.size();
+    unsigned steps = osg::maximum( 1u, (unsigned)ceil(fabs(angle) / _arcStep) );
+
+    out._points.push_back( center );
+    for( unsigned k = 0; k <= steps; ++k )
+    {
+        out._points.push_back( center + rotate(from, angle*(double)k/(double)steps) );
+    }
+
+    endContour( start, out );
+}
+
+void
+LineStroker::addJoin( const osg::Vec2d& v, const osg::Vec2d& d0, const osg::Vec2d& d1, Contours& out )
+{
+    double cross = d0.x()*d1.y() - d0.y()*d1.x();
+    double dot   = d0 * d1;
+
+    // straight through; the segment quads already meet.
+    if ( fabs(cross) < 1e-9 && dot > 0.0 )
+        return;
+
+    // the join fills the gap on the outside of the turn.
+    osg::Vec2d o0, o1;
+    if ( cross > 0.0 )
+    {
+        o0.set(  d0.y(), -d0.x() );
+        o1.set(  d1.y(), -d1.x() );
+    }
+    else
+    {
+        o0.set( -d0.y(),  d0.x() );
+        o1.set( -d1.y(),  d1.x() );
+    }
+    o0 *= _halfWidth;
+    o1 *= _halfWidth;
+
+    if ( _join == Stroke::LINEJOIN_ROUND )
+    {
+        double angle = atan2( o0.x()*o1.y() - o0.y()*o1.x(), o0*o1 );
+        addArc( v, o0, angle, out );
+    }
+    else
+    {
+        unsigned start = out._points.size();
+        out._points.push_back( v );
+        out._points.push_back( v + o0 );
+
+        // the mitre tip is at h/cos(theta/2) along the bisector; past the
+        // limit, leave it off and the join becomes a bevel.
+        osg::Vec2d m = o0 + o1;
+        double len2 = m.length2();
+        if ( len2 > 1e-12 )
+        {
+            double scale = 2.0*_halfWidth*_halfWidth / len2;
+            if ( scale*sqrt(len2) <= MITRE_LIMIT*_halfWidth )
+                out._points.push_back( v + m*scale );
+        }
+
+        out._points.push_back( v + o1 );
+        endContour( start, out );
+    }
+}
+
+void
+LineStroker::addCap( const osg::Vec2d& p, const osg::Vec2d& dir, Contours& out )
+{
+    osg::Vec2d left( -dir.y()*_halfWidth, dir.x()*_halfWidth );
+
+    if ( _cap == Stroke::LINECAP_ROUND )
+    {
+        addArc( p, left, -osg::PI, out );
+    }
+    else if ( _cap == Stroke::LINECAP_SQUARE )
+    {
+        osg::Vec2d ext = dir * _halfWidth;
+        unsigned start = out._points.size();
+        out._points.push_back( p + left );
+        out._points.push_back( p + left + ext );
+        out._points.push_back( p - left + ext );
+        out._points.push_back( p - left );
+        endContour( start, out );
+    }
+}
+
+void
+LineStroker::dot( const osg::Vec2d& point, Contours& out )
+{
+    if ( _halfWidth <= 0.0 || !inBox(point, _halfWidth + 1.0) )
+        return;
+
+    unsigned start = out._points.size();
+    unsigned steps = osg::maximum( 8u, (unsigned)ceil(2.0*osg::PI / _arcStep) );
+    osg::Vec2d r( _halfWidth, 0.0 );
+    for( unsigned k = 0; k < steps; ++k )
+    {
+        out._points.push_back( point + rotate(r, 2.0*osg::PI*(double)k/(double)steps) );
+    }
+    endContour( start, out );
+}
+
+void
+LineStroker::stroke( const std::vector<osg::Vec2d>& input, bool closed, Contours& out )
+{
+    if ( input.empty() || _halfWidth <= 0.0 )
+        return;
+
+    // drop repeated (and, optionally, closely spaced) vertices. An open line
+    // always keeps its last point so it reaches all the way to the end.
+    double spacing2 = osg::maximum( _minSpacing, 1e-6 );
+    spacing2 *= spacing2;
+
+    _points.clear();
+    for( std::vector<osg::Vec2d>::const_iterator i = input.begin(); i != input.end(); ++i )
+    {
+        if ( _points.empty() || (*i - _points.back()).length2() >= spacing2 )
+            _points.push_back( *i );
+    }
+
+    if ( !closed && _points.size() > 1 && _points.back() != input.back() )
+        _points.back() = input.back();
+
+    while( closed && _points.size() > 1 && (_points.back() - _points.front()).length2() < spacing2 )
+        _points.pop_back();
+
+    unsigned n = _points.size();
+    if ( n == 1 )
+    {
+        if ( _cap == Stroke::LINECAP_ROUND )
+            dot( _points[0], out );
+        return;
+    }
+
+    if ( closed && n < 3 )
+        closed = false;
+
+    double pad = _halfWidth * (_join == Stroke::LINEJOIN_MITRE ? MITRE_LIMIT : 1.0) + 2.0;
+
+    // one quad per segment, cut down to the clip box.
+    unsigned numSegments = closed ? n : n-1;
+    for( unsigned i = 0; i < numSegments; ++i )
+    {
+        osg::Vec2d a = _points[i];
+        osg::Vec2d b = _points[(i+1) % n];
+        osg::Vec2d d = direction( a, b );
+
+        if ( !clipSegment(a, b, pad) )
+            continue;
+
+        osg::Vec2d normal( -d.y()*_halfWidth, d.x()*_halfWidth );
+
+        unsigned start = out._points.size();
+        out._points.push_back( a + normal );
+        out._points.push_back( b + normal );
+        out._points.push_back( b - normal );
+        out._points.push_back( a - normal );
+        endContour( start, out );
+    }
+
+    // joins at the interior vertices (all of them, for a ring):
+    unsigned first = closed ? 0 : 1;
+    unsigned last  = closed ? n : n-1;
+    for( unsigned i = first; i < last; ++i )
+    {
+        const osg::Vec2d& v = _points[i];
+        if ( inBox(v, pad) )
+        {
+            addJoin(
+                v,
+                direction( _points[(i+n-1) % n], v ),
+                direction( v, _points[(i+1) % n] ),
+                out );
+        }
+    }
+
+    // caps at the ends of an open line:
+    if ( !closed && _cap != Stroke::LINECAP_FLAT )
+    {
+        if ( inBox(_points[0], pad) )
+            addCap( _points[0], direction(_points[1], _points[0]), out );
+
+        if ( inBox(_points[n-1], pad) )
+            addCap( _points[n-1], direction(_points[n-2], _points[n-1]), out );
+    }
+}
+
+void
+LineStroker::clipRing( const std::vector<osg::Vec2d>& ring, std::vector<osg::Vec2d>& out )
+{
+    const double pad = 1.0;
+    double bounds[4] = { _xmin - pad, _xmax + pad, _ymin - pad, _ymax + pad };
+
+    // Sutherland-Hodgman, one edge of the box at a time.
+    out = ring;
+    for( int edge = 0; edge < 4 && !out.empty(); ++edge )
+    {
+        bool allInside = true;
+        for( unsigned i = 0; i < out.size() && allInside; ++i )
+            allInside = inside( edge, out[i], bounds[edge] );
+
+        if ( allInside )
+            continue;
+
+        _clipScratch.swap( out );
+        out.clear();
+
+        const std::vector<osg::Vec2d>& in = _clipScratch;
+        for( unsigned i = 0, j = in.size()-1; i < in.size(); j = i++ )
+        {
+            const osg::Vec2d& prev = in[j];
+            const osg::Vec2d& curr = in[i];
+            bool prevIn = inside( edge, prev, bounds[edge] );
+            bool currIn = inside( edge, curr, bounds[edge] );
+
+            if ( currIn )
+            {
+                if ( !prevIn )
+                    out.push_back( crossing(edge, prev, curr, bounds[edge]) );
+                out.push_back( curr );
+            }
+            else if ( prevIn )
+            {
+                out.push_back( crossing(edge, prev, curr, bounds[edge]) );
+            }
+        }
+    }
+}
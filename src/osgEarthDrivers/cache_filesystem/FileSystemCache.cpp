@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include "FileSystemCache"
+#include <osgEarth/BinaryConfig>
 #include <osgEarth/Cache>
 #include <osgEarth/StringUtils>
 #include <osgEarth/ThreadingUtils>
@@ -101,25 +102,30 @@ namespace
 
         bool                              _ok;
         std::string                       _metaPath;
+        std::string                       _legacyMetaPath;
         osg::ref_ptr<osgDB::ReaderWriter> _rw;
         osg::ref_ptr<osgDB::Options>      _rwOptions;
         Threading::ReadWriteMutex         _rwmutex;
     };
 
-    void writeMeta( const std::string& fullPath, const Config& meta )
+    // Metadata is written in the binary Config encoding; caches written
+    // before that hold JSON, which we can still read.
+    bool writeMeta( const std::string& fullPath, const Config& meta )
     {
-        std::ofstream outmeta( fullPath.c_str() );
+        std::ofstream outmeta( fullPath.c_str(), std::ios_base::out | std::ios_base::binary );
         if ( outmeta.is_open() )
         {
-            outmeta << meta.toJSON();
+            BinaryConfig::write( meta, outmeta );
             outmeta.flush();
             outmeta.close();
+            return true;
         }
+        return false;
     }
 
-    void readMeta( const std::string& fullPath, Config& meta )
+    bool readMeta( const std::string& fullPath, Config& meta )
     {
-        std::ifstream inmeta( fullPath.c_str() );
+        std::ifstream inmeta( fullPath.c_str(), std::ios_base::in | std::ios_base::binary );
         if ( inmeta.is_open() )
         {
             inmeta >> std::noskipws;
@@ -127,8 +133,12 @@ namespace
             buf << inmeta.rdbuf();
             std::string bufStr;
             bufStr = buf.str();
-            meta.fromJSON( bufStr );
+            if ( BinaryConfig::isBinary(bufStr) )
+                return BinaryConfig::decode( bufStr, meta );
+            else
+                return meta.fromJSON( bufStr );
         }
+        return false;
     }
 }
 
@@ -191,7 +201,8 @@ namespace
     _ok      ( true )
     {
         std::string binPath = osgDB::concatPaths( rootPath, binID );
-        _metaPath = osgDB::concatPaths( binPath, "osgearth_cacheinfo.json" );
+        _metaPath       = osgDB::concatPaths( binPath, "osgearth_cacheinfo.bin" );
+        _legacyMetaPath = osgDB::concatPaths( binPath, "osgearth_cacheinfo.json" );
 
         OE_INFO << LC << "Initializing cache bin: " << _metaPath << std::endl;
         osgDB::makeDirectoryForFile( _metaPath );
@@ -398,7 +409,7 @@ namespace
                 }
                 else if ( type == osgDB::REGULAR_FILE )
                 {
-                    if ( full != _metaPath )
+                    if ( full != _metaPath && full != _legacyMetaPath )
                     {
                         ok = ::unlink( full.c_str() );
                         OE_DEBUG << LC << "Unlink: " << full << std::endl;
@@ -432,7 +443,10 @@ namespace
         ScopedReadLock sharedLock( _rwmutex );
         
         Config conf;
-        conf.fromJSON( URI(_metaPath).getString(_rwOptions.get()) );
+        if ( osgDB::fileExists(_metaPath) )
+            readMeta( _metaPath, conf );
+        else if ( osgDB::fileExists(_legacyMetaPath) )
+            readMeta( _legacyMetaPath, conf );
 
         return conf;
     }
@@ -444,15 +458,7 @@ namespace
 
         ScopedWriteLock exclusiveLock( _rwmutex );
 
-        std::fstream output( _metaPath.c_str(), std::ios_base::out );
-        if ( output.is_open() )
-        {
-            output << conf.toJSON(true);
-            output.flush();
-            output.close();
-            return true;
-        }
-        return false;
+        return writeMeta( _metaPath, conf );
     }
 }
 
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include "EarthFileSerializer"
+#include <osgEarth/BinaryConfig>
 #include <osgEarth/Map>
 #include <osgEarth/MapNode>
 #include <osgEarth/Registry>
@@ -33,6 +34,15 @@ using namespace osgEarth;
 
 #define LC "[ReaderWriterEarth] "
 
+namespace
+{
+    // whether the writer options ask for the binary encoding ("-O binary")
+    bool wantsBinary( const osgDB::Options* options )
+    {
+        return options && options->getOptionString().find("binary") != std::string::npos;
+    }
+}
+
 // Macros to determine the filename for dependent libs.
 #define Q2(x) #x
 #define Q(x)  Q2(x)
@@ -95,7 +105,7 @@ class ReaderWriterEarth : public osgDB::ReaderWriter
             if ( !acceptsExtension( osgDB::getFileExtension(fileName) ) )
                 return WriteResult::FILE_NOT_HANDLED;
 
-            std::ofstream out( fileName.c_str());
+            std::ofstream out( fileName.c_str(), wantsBinary(options) ? std::ios::out | std::ios::binary : std::ios::out );
             if ( out.is_open() )
                 return writeNode( node, out, options );
 
@@ -113,6 +123,15 @@ class ReaderWriterEarth : public osgDB::ReaderWriter
             EarthFileSerializer2 ser;
             Config conf = ser.serialize( mapNode );
 
+            // precompiled earth file: the binary encoding, which loads without
+            // any XML parsing.
+            if ( wantsBinary(options) )
+            {
+                return BinaryConfig::write( conf, out ) ?
+                    WriteResult::FILE_SAVED :
+                    WriteResult::ERROR_IN_WRITING_FILE;
+            }
+
             // dump that Config out as XML.
             osg::ref_ptr<XmlDocument> xml = new XmlDocument( conf );
             xml->store( out );
@@ -169,18 +188,46 @@ class ReaderWriterEarth : public osgDB::ReaderWriter
             // from an "anonymous" stream here)
             URIContext uriContext( options ); 
 
-            osg::ref_ptr<XmlDocument> doc = XmlDocument::load( in, uriContext );
-            if ( !doc.valid() )
-                return ReadResult::ERROR_IN_READING_FILE;
-
-            Config docConf = doc->getConfig();
+            std::string buffer;
+            {
+                std::stringstream buf;
+                buf << in.rdbuf();
+                buffer = buf.str();
+            }
 
-            // support both "map" and "earth" tag names at the top level
             Config conf;
-            if ( docConf.hasChild( "map" ) )
-                conf = docConf.child( "map" );
-            else if ( docConf.hasChild( "earth" ) )
-                conf = docConf.child( "earth" );
+
+            if ( BinaryConfig::isBinary(buffer) )
+            {
+                // a precompiled earth file; its root is the map itself.
+                osg::ref_ptr<BinaryConfig> bin = BinaryConfig::adopt( buffer );
+                if ( !bin.valid() )
+                    return ReadResult::ERROR_IN_READING_FILE;
+
+                BinaryConfig::Node root = bin->root();
+                std::string key = root.key();
+                if ( key == "map" || key == "earth" )
+                {
+                    conf = root.getConfig();
+                    conf.setReferrer( uriContext.referrer() );
+                }
+            }
+
+            else
+            {
+                std::stringstream xmlIn( buffer );
+                osg::ref_ptr<XmlDocument> doc = XmlDocument::load( xmlIn, uriContext );
+                if ( !doc.valid() )
+                    return ReadResult::ERROR_IN_READING_FILE;
+
+                Config docConf = doc->getConfig();
+
+                // support both "map" and "earth" tag names at the top level
+                if ( docConf.hasChild( "map" ) )
+                    conf = docConf.child( "map" );
+                else if ( docConf.hasChild( "earth" ) )
+                    conf = docConf.child( "earth" );
+            }
 
             MapNode* mapNode =0L;
             if ( !conf.empty() )
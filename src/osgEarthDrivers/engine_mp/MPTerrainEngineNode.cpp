@@ -114,6 +114,24 @@ MPTerrainEngineNode::getUID() const
     return _uid;
 }
 
+void
+MPTerrainEngineNode::getTileResidencyStats(TileResidencyManager::Stats& out) const
+{
+    if ( _residency.valid() )
+        _residency->getStats( out );
+    else
+        out = TileResidencyManager::Stats();
+}
+
+void
+MPTerrainEngineNode::getTilePrefetchStats(TilePrefetcher::Stats& out) const
+{
+    if ( _prefetcher.valid() )
+        _prefetcher->getStats( out );
+    else
+        out = TilePrefetcher::Stats();
+}
+
 //------------------------------------------------------------------------
 
 MPTerrainEngineNode::ElevationChangedCallback::ElevationChangedCallback( MPTerrainEngineNode* terrain ):
@@ -190,6 +208,14 @@ MPTerrainEngineNode::postInitialize( const Map* map, const TerrainOptions& optio
     {
         _deadTiles = new TileNodeRegistry("dead");
     }
+
+    // memory accounting (and optional budget) for paged tiles:
+    unsigned budgetMB = *_terrainOptions.tileMemoryBudgetMB();
+    _residency = new TileResidencyManager( (UInt64)budgetMB * 1024u * 1024u );
+    if ( budgetMB > 0u )
+    {
+        OE_INFO << LC << "Tile memory budget = " << budgetMB << " MB" << std::endl;
+    }
     
     // initialize the model factory:
     _tileModelFactory = new TileModelFactory(getMap(), _liveTiles.get(), _terrainOptions );
@@ -298,8 +324,28 @@ MPTerrainEngineNode::createTerrain()
     if (_tileModelFactory)
         _tileModelFactory->getHeightFieldCache()->clear();
 
+    // the old tiles are going away.
+    if ( _residency.valid() )
+        _residency->clear();
+
+    // predictive prefetch needs the map profile, so it's set up here.
+    if ( _prefetcher.valid() )
+    {
+        _prefetcher->clear();
+    }
+    else if ( _terrainOptions.prefetch() == true )
+    {
+        _prefetcher = new TilePrefetcher(
+            _update_mapf->getProfile(),
+            _tileModelFactory.get(),
+            _liveTiles.get(),
+            _terrainOptions );
+
+        OE_INFO << LC << "Tile prefetch enabled, lookahead = " << _prefetcher->getLookahead() << " s" << std::endl;
+    }
+
     // New terrain
-    _terrain = new TerrainNode( _deadTiles.get() );
+    _terrain = new TerrainNode( _deadTiles.get(), _residency.get(), _prefetcher.get() );
     this->addChild( _terrain );
 
     // Enable blending on the terrain node; this will result in the underlying
@@ -359,6 +405,8 @@ MPTerrainEngineNode::getKeyNodeFactory()
             compiler,
             _liveTiles.get(),
             _deadTiles.get(),
+            _residency.get(),
+            _prefetcher.get(),
             _terrainOptions, 
             MapInfo( getMap() ),
             _terrain, 
@@ -84,6 +84,8 @@ SerialKeyNodeFactory::SerialKeyNodeFactory(TileModelFactory*             modelFa
                                            TileModelCompiler*            modelCompiler,
                                            TileNodeRegistry*             liveTiles,
                                            TileNodeRegistry*             deadTiles,
+                                           TileResidencyManager*         residency,
+                                           TilePrefetcher*               prefetcher,
                                            const MPTerrainEngineOptions& options,
                                            const MapInfo&                mapInfo,
                                            TerrainNode*                  terrain,
@@ -92,6 +94,8 @@ _modelFactory    ( modelFactory ),
 _modelCompiler   ( modelCompiler ),
 _liveTiles       ( liveTiles ),
 _deadTiles       ( deadTiles ),
+_residency       ( residency ),
+_prefetcher      ( prefetcher ),
 _options         ( options ),
 _mapInfo         ( mapInfo ),
 _terrain         ( terrain ),
@@ -130,7 +134,7 @@ SerialKeyNodeFactory::createTile(TileModel* model,
 
         osgDB::Options* dbOptions = Registry::instance()->cloneOrCreateOptions();
 
-        TileGroup* plod = new TileGroup(tileNode, _engineUID, _liveTiles.get(), _deadTiles.get(), dbOptions);
+        TileGroup* plod = new TileGroup(tileNode, _engineUID, _liveTiles.get(), _deadTiles.get(), _residency.get(), dbOptions);
         plod->setSubtileRange( minRange );
 
 
@@ -181,7 +185,21 @@ SerialKeyNodeFactory::createNode( const TileKey& key, ProgressCallback* progress
     if ( progress && progress->isCanceled() )
         return 0L;
 
-    _modelFactory->createTileModel(key, model, isReal);
+    // use a model built ahead of time by the prefetcher if there is one.
+    if ( _prefetcher.valid() && _prefetcher->take(key, model, isReal) )
+    {
+        // the parent may have arrived after the model was built.
+        if ( !model->_parentModel.valid() )
+        {
+            osg::ref_ptr<TileNode> parentTile;
+            if ( _liveTiles->get(key.createParentKey(), parentTile) )
+                model->_parentModel = parentTile->getTileModel();
+        }
+    }
+    else
+    {
+        _modelFactory->createTileModel(key, model, isReal);
+    }
 
     if ( progress && progress->isCanceled() )
         return 0L;
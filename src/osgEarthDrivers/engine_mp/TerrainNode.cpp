@@ -23,6 +23,7 @@
 #include <osgEarth/Map>
 #include <osgEarth/NodeUtils>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/CullingUtils>
 
 #include <osg/NodeCallback>
 #include <osg/NodeVisitor>
@@ -37,8 +38,12 @@ using namespace OpenThreads;
 
 //----------------------------------------------------------------------------
 
-TerrainNode::TerrainNode(TileNodeRegistry* removedTiles ) :
+TerrainNode::TerrainNode(TileNodeRegistry*     removedTiles,
+                         TileResidencyManager* residency,
+                         TilePrefetcher*       prefetcher ) :
 _tilesToQuickRelease            ( removedTiles ),
+_residency                      ( residency ),
+_prefetcher                     ( prefetcher ),
 _quickReleaseCallbackInstalled  ( false )
 {
     // tick the update count to install the quick release callback:
@@ -46,6 +51,12 @@ _quickReleaseCallbackInstalled  ( false )
     {
         ADJUST_UPDATE_TRAV_COUNT( this, 1 );
     }
+
+    // the residency manager needs an update traversal every frame.
+    if ( _residency.valid() )
+    {
+        ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+    }
 }
 
 
@@ -80,6 +91,30 @@ TerrainNode::traverse( osg::NodeVisitor &nv )
                 ADJUST_UPDATE_TRAV_COUNT( this, -1 );
             }
         }
+
+        // enforce the tile memory budget. This runs in the same thread that
+        // the DatabasePager uses to merge and expire tiles.
+        if ( _residency.valid() && nv.getFrameStamp() )
+        {
+            _residency->update( nv.getFrameStamp()->getFrameNumber() );
+        }
+    }
+
+    else if ( nv.getVisitorType() == nv.CULL_VISITOR )
+    {
+        // let the prefetcher track the camera and schedule tiles ahead of it.
+        if ( _prefetcher.valid() && nv.getFrameStamp() )
+        {
+            osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+            if ( cv && cv->getModelViewMatrix() && cv->getProjectionMatrix() )
+            {
+                _prefetcher->update(
+                    nv.getFrameStamp()->getSimulationTime(),
+                    *cv->getModelViewMatrix(),
+                    *cv->getProjectionMatrix(),
+                    cv->getLODScale() );
+            }
+        }
     }
 
     osg::Group::traverse( nv );
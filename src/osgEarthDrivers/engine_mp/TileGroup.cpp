@@ -33,6 +33,7 @@ TileGroup::TileGroup(TileNode*         tilenode,
                      const UID&        engineUID,
                      TileNodeRegistry* live,
                      TileNodeRegistry* dead,
+                     TileResidencyManager* residency,
                      osgDB::Options*   dbOptions)
 {
     _numSubtilesUpsampling = 0;
@@ -45,7 +46,7 @@ TileGroup::TileGroup(TileNode*         tilenode,
     for(unsigned q=0; q<4; ++q)
     {
         TileKey subkey = tilenode->getKey().createChildKey(q);
-        TilePagedLOD* lod = new TilePagedLOD(this, subkey, engineUID, live, dead);
+        TilePagedLOD* lod = new TilePagedLOD(this, subkey, engineUID, live, dead, residency);
         lod->setDatabaseOptions( dbOptions );
         lod->setCenter( tilenode->getBound().center() );
         lod->setRadius( tilenode->getBound().radius() );
@@ -70,6 +71,11 @@ TileGroup::traverse(osg::NodeVisitor& nv)
         if ( nv.getVisitorType() == nv.CULL_VISITOR )
         {
             range = nv.getDistanceFromEyePoint( getBound().center(), true );
+
+            // mark the tile as recently visible, even if we end up drawing
+            // the subtiles instead; the residency manager uses this.
+            if ( nv.getFrameStamp() )
+                _tilenode->setLastTraversalFrame( nv.getFrameStamp()->getFrameNumber() );
         }
 
         // if all four subtiles have reported that they are upsampling, 
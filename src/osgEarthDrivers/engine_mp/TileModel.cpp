@@ -64,6 +64,54 @@ TileModel::ElevationData::getHeight(const osg::Vec3d&      ndc,
     return true;
 }
 
+bool
+TileModel::ElevationData::getHeights(const GeoLocator*      ndcLocator,
+                                     unsigned               numCols,
+                                     unsigned               numRows,
+                                     ElevationInterpolation interp,
+                                     std::vector<float>&    output ) const
+{
+    if ( !_locator.valid() || !ndcLocator || !_hf.valid() || numCols < 2 || numRows < 2 )
+        return false;
+
+    output.resize( numCols*numRows );
+
+    // When the two locators are related by a scale/bias (same SRS, linear
+    // mapping) the grid maps to a regular grid in the heightfield, and we can
+    // sample it in one pass. Check that by converting an interior point.
+    osg::Vec3d ll, ur, probe;
+    GeoLocator::convertLocalCoordBetween( *ndcLocator, osg::Vec3d(0.0, 0.0, 0.0), *_locator.get(), ll );
+    GeoLocator::convertLocalCoordBetween( *ndcLocator, osg::Vec3d(1.0, 1.0, 0.0), *_locator.get(), ur );
+    GeoLocator::convertLocalCoordBetween( *ndcLocator, osg::Vec3d(0.25, 0.75, 0.0), *_locator.get(), probe );
+
+    const double epsilon = 1e-6;
+    bool linear =
+        osg::equivalent( probe.x(), ll.x() + 0.25*(ur.x()-ll.x()), epsilon ) &&
+        osg::equivalent( probe.y(), ll.y() + 0.75*(ur.y()-ll.y()), epsilon );
+
+    if ( linear )
+    {
+        HeightFieldUtils::getHeightsAtNormalizedGrid(
+            _hf.get(), ll.x(), ll.y(), ur.x(), ur.y(), numCols, numRows, &output[0], interp );
+    }
+    else
+    {
+        // e.g. a Mercator tile over a geographic heightfield; go post by post.
+        for( unsigned j = 0; j < numRows; ++j )
+        {
+            for( unsigned i = 0; i < numCols; ++i )
+            {
+                osg::Vec3d ndc( (double)i/(double)(numCols-1), (double)j/(double)(numRows-1), 0.0 );
+                osg::Vec3d hf_ndc;
+                GeoLocator::convertLocalCoordBetween( *ndcLocator, ndc, *_locator.get(), hf_ndc );
+                output[j*numCols + i] = HeightFieldUtils::getHeightAtNormalizedLocation( _hf.get(), hf_ndc.x(), hf_ndc.y(), interp );
+            }
+        }
+    }
+
+    return true;
+}
+
 bool
 TileModel::ElevationData::getNormal(const osg::Vec3d& ndc,
                                     const GeoLocator* ndcLocator,
@@ -503,6 +503,10 @@ namespace
         //}
         //bool hfEquivToTile = hfLocator.valid() ? d.geoLocator->isEquivalentTo( *d.hfGeoLocator.get() ) : false;
 
+        // sample all the raw heights in one pass:
+        std::vector<float> heights;
+        bool haveHeights = hf && d.model->_elevationData.getHeights( d.model->_tileLocator, d.numCols, d.numRows, INTERP_TRIANGULATE, heights );
+
         // populate vertex and tex coord arrays    
         for(unsigned j=0; j < d.numRows; ++j)
         {
@@ -517,7 +521,9 @@ namespace
 
                 if ( hf )
                 {
-                    validValue = d.model->_elevationData.getHeight( ndc, d.model->_tileLocator, heightValue, INTERP_TRIANGULATE );
+                    validValue = haveHeights;
+                    if ( haveHeights )
+                        heightValue = heights[iv];
                 }
                 //if ( hfLocator )
                 //{
@@ -21,6 +21,7 @@
 #include <osgEarth/MapInfo>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/HeightFieldUtils>
+#include <osg/Timer>
 
 using namespace osgEarth_engine_mp;
 using namespace osgEarth;
@@ -270,7 +271,8 @@ TileModelFactory::getHeightFieldCache() const
 void
 TileModelFactory::createTileModel(const TileKey&           key, 
                                   osg::ref_ptr<TileModel>& out_model,
-                                  bool&                    out_hasRealData)
+                                  bool&                    out_hasRealData,
+                                  Timings*                 out_timings)
 {
     MapFrame mapf( _map, Map::MASKED_TERRAIN_LAYERS );
     
@@ -286,6 +288,8 @@ TileModelFactory::createTileModel(const TileKey&           key,
     // LOD key.
     out_hasRealData = false;
     
+    osg::Timer_t t0 = out_timings ? osg::Timer::instance()->tick() : 0;
+
     // Fetch the image data and make color layers.
     unsigned order = 0;
     for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); ++i )
@@ -306,11 +310,20 @@ TileModelFactory::createTileModel(const TileKey&           key,
         }
     }
 
+    osg::Timer_t t1 = out_timings ? osg::Timer::instance()->tick() : 0;
+
     // make an elevation layer.
     BuildElevationData build;
     build.init( key, mapf, _terrainOptions, model.get(), _hfCache );
     build.execute();
 
+    if ( out_timings )
+    {
+        osg::Timer_t t2 = osg::Timer::instance()->tick();
+        out_timings->_fetch  += osg::Timer::instance()->delta_s( t0, t1 );
+        out_timings->_mosaic += osg::Timer::instance()->delta_s( t1, t2 );
+    }
+
 
     // Bail out now if there's no data to be had.
     if ( model->_colorData.size() == 0 && !model->_elevationData.getHeightField() )
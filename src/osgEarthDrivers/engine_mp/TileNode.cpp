@@ -33,8 +33,9 @@ using namespace OpenThreads;
 //----------------------------------------------------------------------------
 
 TileNode::TileNode( const TileKey& key, const TileModel* model ) :
-_key  ( key ),
-_model( model )
+_key               ( key ),
+_model             ( model ),
+_lastTraversalFrame( 0u )
 {
     this->setName( key.str() );
 
@@ -101,6 +102,8 @@ TileNode::traverse( osg::NodeVisitor& nv )
 
         // set the birth time if not already set.
         const osg::FrameStamp* fs = nv.getFrameStamp();
+        if ( fs )
+            _lastTraversalFrame = fs->getFrameNumber();
 
         float bt;
         _bornUniform->get( bt );
@@ -36,14 +36,27 @@ _name( name )
 }
 
 
+unsigned
+TileNodeRegistry::getShardIndex( const TileKey& key )
+{
+    // neighboring keys land in different shards.
+    unsigned h = key.getTileX() * 73856093u ^ key.getTileY() * 19349663u ^ key.getLOD() * 83492791u;
+    return (h ^ (h >> 16)) % NUM_SHARDS;
+}
+
+
 void
 TileNodeRegistry::add( TileNode* tile )
 {
     if ( tile )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        _tiles[ tile->getKey() ] = tile;
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        Shard& shard = _shards[getShardIndex(tile->getKey())];
+        Threading::ScopedMutexLock exclusive( shard._mutex );
+        osg::ref_ptr<TileNode>& entry = shard._tiles[ tile->getKey() ];
+        if ( !entry.valid() )
+            ++_count;
+        entry = tile;
+        OE_TEST << LC << _name << ": tiles=" << size() << std::endl;
     }
 }
 
@@ -51,14 +64,9 @@ TileNodeRegistry::add( TileNode* tile )
 void
 TileNodeRegistry::add( const TileNodeVector& tiles )
 {
-    if ( tiles.size() > 0 )
+    for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
-        {
-            _tiles[ i->get()->getKey() ] = i->get();
-        }
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        add( i->get() );
     }
 }
 
@@ -68,20 +76,23 @@ TileNodeRegistry::remove( TileNode* tile )
 {
     if ( tile )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        _tiles.erase( tile->getKey() );
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        Shard& shard = _shards[getShardIndex(tile->getKey())];
+        Threading::ScopedMutexLock exclusive( shard._mutex );
+        if ( shard._tiles.erase( tile->getKey() ) > 0 )
+            --_count;
+        OE_TEST << LC << _name << ": tiles=" << size() << std::endl;
     }
 }
 
 
 bool
-TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
+TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile ) const
 {
-    Threading::ScopedReadLock shared( _tilesMutex );
+    const Shard& shard = _shards[getShardIndex(key)];
+    Threading::ScopedMutexLock shared( shard._mutex );
 
-    TileNodeMap::iterator i = _tiles.find(key);
-    if ( i != _tiles.end() )
+    TileNodeMap::const_iterator i = shard._tiles.find(key);
+    if ( i != shard._tiles.end() )
     {
         out_tile = i->second.get();
         return true;
@@ -93,14 +104,16 @@ TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 bool
 TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 {
-    Threading::ScopedWriteLock exclusive( _tilesMutex );
+    Shard& shard = _shards[getShardIndex(key)];
+    Threading::ScopedMutexLock exclusive( shard._mutex );
 
-    TileNodeMap::iterator i = _tiles.find(key);
-    if ( i != _tiles.end() )
+    TileNodeMap::iterator i = shard._tiles.find(key);
+    if ( i != shard._tiles.end() )
     {
         out_tile = i->second.get();
-        _tiles.erase( i );
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        shard._tiles.erase( i );
+        --_count;
+        OE_TEST << LC << _name << ": tiles=" << size() << std::endl;
         return true;
     }
     return false;
@@ -110,26 +123,49 @@ TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 void
 TileNodeRegistry::run( TileNodeRegistry::Operation& op )
 {
-    Threading::ScopedWriteLock lock( _tilesMutex );
-    unsigned size = _tiles.size();
-    op.operator()( _tiles );
-    if ( size != _tiles.size() )
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+    for( unsigned s=0; s<NUM_SHARDS; ++s )
+    {
+        Shard& shard = _shards[s];
+        Threading::ScopedMutexLock lock( shard._mutex );
+        if ( shard._tiles.empty() )
+            continue;
+
+        unsigned before = shard._tiles.size();
+        op.operator()( shard._tiles );
+        unsigned after  = shard._tiles.size();
+
+        // the operation may have added or removed tiles.
+        for( ; before > after; --before ) --_count;
+        for( ; before < after; ++before ) ++_count;
+    }
+    OE_TEST << LC << _name << ": tiles=" << size() << std::endl;
 }
 
 
 void
 TileNodeRegistry::run( const TileNodeRegistry::ConstOperation& op ) const
 {
-    Threading::ScopedReadLock lock( _tilesMutex );
-    op.operator()( _tiles );
-    OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+    for( unsigned s=0; s<NUM_SHARDS; ++s )
+    {
+        const Shard& shard = _shards[s];
+        Threading::ScopedMutexLock lock( shard._mutex );
+        if ( !shard._tiles.empty() )
+            op.operator()( shard._tiles );
+    }
+    OE_TEST << LC << _name << ": tiles=" << size() << std::endl;
 }
 
 
 bool
 TileNodeRegistry::empty() const
 {
-    // don't bother mutex-protecteding this.
-    return _tiles.empty();
+    return size() == 0u;
+}
+
+
+unsigned
+TileNodeRegistry::size() const
+{
+    // don't bother mutex-protecting this.
+    return (unsigned)_count;
 }
@@ -18,6 +18,7 @@
 */
 #include "TilePagedLOD"
 #include "TileNodeRegistry"
+#include <osgEarth/NodeUtils>
 #include <osg/Version>
 
 using namespace osgEarth_engine_mp;
@@ -33,11 +34,13 @@ TilePagedLOD::TilePagedLOD(TileGroup*        tilegroup,
                            const TileKey&    subkey,
                            const UID&        engineUID,
                            TileNodeRegistry* live,
-                           TileNodeRegistry* dead) :
+                           TileNodeRegistry* dead,
+                           TileResidencyManager* residency) :
 osg::PagedLOD(),
 _tilegroup ( tilegroup ),
 _live      ( live ),
 _dead      ( dead ),
+_residency ( residency ),
 _upsampling( false )
 {
     _numChildrenThatCannotBeExpired = 0;
@@ -58,6 +61,8 @@ TilePagedLOD::addChild(osg::Node* node)
     {
         //OE_NOTICE << LC << "add group " << subtilegroup->getTileNode()->getKey().str() << std::endl;
         _live->add( subtilegroup->getTileNode() );
+        if ( _residency )
+            _residency->add( subtilegroup->getTileNode(), this );
         ++_tilegroup->numSubtilesLoaded();
         return osg::PagedLOD::addChild( node );
     }
@@ -69,6 +74,8 @@ TilePagedLOD::addChild(osg::Node* node)
         {
             _upsampling = false;
             _live->add( subtile );
+            if ( _residency )
+                _residency->add( subtile, this );
             ++_tilegroup->numSubtilesLoaded();
             return osg::PagedLOD::addChild( node );
         }
@@ -128,25 +135,62 @@ TilePagedLOD::removeExpiredChildren(double         expiryTime,
             _perRangeDataList[cindex]._timeStamp   + minExpiryTime   < expiryTime &&
             _perRangeDataList[cindex]._frameNumber + minExpiryFrames < expiryFrame)
         {
-            osg::Node* nodeToRemove = _children[cindex].get();
-            removedChildren.push_back(nodeToRemove);
+            OE_DEBUG << LC << "Expired " << _prefix << std::endl;
+            return removeChildTile( &removedChildren );
+        }
+    }
+    return false;
+}
 
-            TileNode* tilenode = dynamic_cast<TileNode*>(nodeToRemove);
-            if (!tilenode)
-                tilenode = dynamic_cast<TileGroup*>(nodeToRemove)->getTileNode();
-            if ( tilenode )
-            {
-                if ( _live )
-                    _live->remove( tilenode );
-                if ( _dead )
-                    _dead->add( tilenode );
-            }
 
-            OE_DEBUG << "Expired " << _prefix << std::endl;
-            --_tilegroup->numSubtilesLoaded();
+bool
+TilePagedLOD::evictChild()
+{
+    if (_children.size()>_numChildrenThatCannotBeExpired)
+    {
+        // only evict leaves; evicting a tile with loaded subtiles would
+        // discard the (more recently visible) subtree along with it.
+        TileGroup* group = dynamic_cast<TileGroup*>( _children.back().get() );
+        if ( group && group->numSubtilesLoaded() > 0 )
+            return false;
 
-            return Group::removeChildren(cindex,1);
-        }
+        OE_DEBUG << LC << "Evicted " << _prefix << std::endl;
+        return removeChildTile( 0L );
     }
     return false;
 }
+
+
+bool
+TilePagedLOD::removeChildTile(osg::NodeList* removedChildren)
+{
+    unsigned cindex = _children.size() - 1;
+
+    osg::Node* nodeToRemove = _children[cindex].get();
+    if ( removedChildren )
+        removedChildren->push_back(nodeToRemove);
+
+    TileNode* tilenode = dynamic_cast<TileNode*>(nodeToRemove);
+    if (!tilenode)
+        tilenode = dynamic_cast<TileGroup*>(nodeToRemove)->getTileNode();
+    if ( tilenode )
+    {
+        if ( _live )
+            _live->remove( tilenode );
+        if ( _dead )
+            _dead->add( tilenode );
+    }
+
+    // the subtiles go along with it, without the pager telling their own
+    // PagedLODs, so unregister the whole subtree.
+    if ( _residency )
+    {
+        FindNodesVisitor<TileNode> subtree;
+        nodeToRemove->accept( subtree );
+        for( std::vector<TileNode*>::const_iterator t = subtree._results.begin(); t != subtree._results.end(); ++t )
+            _residency->remove( *t );
+    }
+    --_tilegroup->numSubtilesLoaded();
+
+    return Group::removeChildren(cindex,1);
+}
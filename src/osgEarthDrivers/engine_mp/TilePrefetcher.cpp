@@ -0,0 +1,445 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TilePrefetcher"
+
+#include <osgEarth/GeoData>
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+using namespace osgEarth_engine_mp;
+using namespace osgEarth;
+
+#define LC "[TilePrefetcher] "
+
+//#define OE_TEST OE_INFO
+#define OE_TEST OE_NULL
+
+namespace
+{
+    // camera motion is estimated over (at most) this much history:
+    const double   HISTORY_SECONDS = 0.25;
+    const unsigned HISTORY_SAMPLES = 8u;
+
+    // number of poses sampled along the predicted path:
+    const unsigned NUM_PREDICTION_STEPS = 3u;
+
+    // the prediction is recomputed at most this often (seconds):
+    const double   MIN_PREDICTION_INTERVAL = 0.1;
+
+    // a camera that moves and turns less than this over the history is still:
+    const double   STILL_DISTANCE = 0.01;
+    const double   STILL_ANGLE    = osg::DegreesToRadians( 0.01 );
+
+    // number of tile bounds to remember:
+    const unsigned MAX_CACHED_BOUNDS = 8192u;
+
+    // Computes the bounding sphere of a tile on the ellipsoid, and the range
+    // at which the terrain will start requesting its subtiles (the same
+    // calculation as SerialKeyNodeFactory.)
+    void getTileBound(const TileKey& key, double rangeFactor, osg::Vec3d& out_center, double& out_radius, double& out_subtileRange)
+    {
+        const GeoExtent& e = key.getExtent();
+        const SpatialReference* srs = e.getSRS();
+
+        double cx, cy;
+        e.getCentroid( cx, cy );
+        GeoPoint( srs, cx, cy, 0.0, ALTMODE_ABSOLUTE ).toWorld( out_center );
+
+        osg::Vec3d ll, lr, ul, ur;
+        GeoPoint( srs, e.xMin(), e.yMin(), 0.0, ALTMODE_ABSOLUTE ).toWorld( ll );
+        GeoPoint( srs, e.xMax(), e.yMin(), 0.0, ALTMODE_ABSOLUTE ).toWorld( lr );
+        GeoPoint( srs, e.xMin(), e.yMax(), 0.0, ALTMODE_ABSOLUTE ).toWorld( ul );
+        GeoPoint( srs, e.xMax(), e.yMax(), 0.0, ALTMODE_ABSOLUTE ).toWorld( ur );
+
+        out_radius = osg::maximum(
+            osg::maximum( (ll-out_center).length(), (lr-out_center).length() ),
+            osg::maximum( (ul-out_center).length(), (ur-out_center).length() ) );
+
+        out_subtileRange = 0.5 * (ur-ll).length() * rangeFactor;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// A background request that builds one tile model.
+struct TilePrefetcher::Request : public TaskRequest
+{
+    // The task service runs the lowest priority value first, so the priority
+    // is the predicted time (in seconds) until the tile is needed.
+    Request( const TileKey& key, TileModelFactory* factory, float secondsUntilNeeded )
+        : TaskRequest ( secondsUntilNeeded ),
+          _key        ( key ),
+          _factory    ( factory ),
+          _hasRealData( false ) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        if ( progress && progress->isCanceled() )
+            return;
+
+        osg::ref_ptr<TileModel> model;
+        bool hasRealData = false;
+        _factory->createTileModel( _key, model, hasRealData );
+
+        _hasRealData = hasRealData;
+        _model       = model.get();
+    }
+
+    // a canceled request is also marked COMPLETED, but has no model.
+    bool isReady() const { return isCompleted() && _model.valid(); }
+
+    TileKey                        _key;
+    osg::ref_ptr<TileModelFactory> _factory;
+    osg::ref_ptr<TileModel>        _model;
+    bool                           _hasRealData;
+};
+
+//----------------------------------------------------------------------------
+
+TilePrefetcher::TilePrefetcher(const Profile*                         profile,
+                               TileModelFactory*                      factory,
+                               TileNodeRegistry*                      liveTiles,
+                               const Drivers::MPTerrainEngineOptions& options) :
+_profile       ( profile ),
+_factory       ( factory ),
+_liveTiles     ( liveTiles ),
+_maxLOD        ( osg::minimum(*options.maxLOD(), 30u) ),
+_rangeFactor   ( *options.minTileRangeFactor() ),
+_lookahead     ( *options.prefetchLookahead() ),
+_maxPending    ( 64u ),
+_lastPrediction( -DBL_MAX ),
+_bounds        ( true, MAX_CACHED_BOUNDS )
+{
+    if ( _profile.valid() )
+        _profile->getAllKeysAtLOD( *options.firstLOD(), _rootKeys );
+
+    _service = new TaskService( "mp-prefetch", osg::maximum(*options.prefetchThreads(), 1u) );
+}
+
+
+TilePrefetcher::~TilePrefetcher()
+{
+    clear();
+}
+
+
+void
+TilePrefetcher::extrapolate(const Pose& first, const Pose& last, double dt, osg::Matrixd& out_viewMatrix)
+{
+    double span = last._time - first._time;
+
+    // linear velocity:
+    osg::Vec3d velocity = (last._eye - first._eye) / span;
+    osg::Vec3d eye = last._eye + velocity * dt;
+
+    // angular velocity:
+    double     angle;
+    osg::Vec3d axis;
+    osg::Quat  delta = first._rotation.inverse() * last._rotation;
+    delta.getRotate( angle, axis );
+    if ( angle > osg::PI )
+        angle -= 2.0*osg::PI;
+
+    osg::Quat rotation = last._rotation * osg::Quat( angle * (dt/span), axis );
+
+    out_viewMatrix = osg::Matrixd::inverse(
+        osg::Matrixd::rotate( rotation ) * osg::Matrixd::translate( eye ) );
+}
+
+
+void
+TilePrefetcher::update(double              time,
+                       const osg::Matrixd& viewMatrix,
+                       const osg::Matrixd& projMatrix,
+                       float               lodScale)
+{
+    if ( _rootKeys.empty() || _lookahead <= 0.0 )
+        return;
+
+    osg::Matrixd camera = osg::Matrixd::inverse( viewMatrix );
+
+    Pose pose;
+    pose._time     = time;
+    pose._eye      = camera.getTrans();
+    pose._rotation = camera.getRotate();
+
+    Pose first, last;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        // only sample one camera per frame (ignore RTT and slave cameras):
+        if ( !_poses.empty() && time <= _poses.back()._time )
+            return;
+
+        // a long gap means the old history no longer describes the motion.
+        if ( !_poses.empty() && time - _poses.back()._time > HISTORY_SECONDS )
+            _poses.clear();
+
+        _poses.push_back( pose );
+        while( _poses.size() > HISTORY_SAMPLES || (_poses.size() > 2 && time - _poses.front()._time > HISTORY_SECONDS) )
+            _poses.pop_front();
+
+        if ( _poses.size() < 2 )
+            return;
+
+        // the prediction only changes as fast as the camera moves, so there's
+        // no need to walk the tiles every frame.
+        if ( time - _lastPrediction < MIN_PREDICTION_INTERVAL )
+            return;
+        _lastPrediction = time;
+
+        first = _poses.front();
+        last  = _poses.back();
+    }
+
+    double     angle;
+    osg::Vec3d axis;
+    (first._rotation.inverse() * last._rotation).getRotate( angle, axis );
+    if ( angle > osg::PI )
+        angle = 2.0*osg::PI - angle;
+
+    bool moving =
+        (last._eye - first._eye).length() > STILL_DISTANCE ||
+        angle > STILL_ANGLE;
+
+    // Sample the predicted path and note when each new key first shows up.
+    // A still camera predicts nothing new, which cancels whatever's pending.
+    typedef std::map<TileKey, double> KeyTimes;
+    KeyTimes predicted;
+
+    if ( moving )
+    {
+        // What the terrain needs right now; the pager is already dealing with these.
+        std::vector<TileKey> current;
+        getRequiredKeys( viewMatrix, projMatrix, lodScale, current );
+
+        std::vector<TileKey> keys;
+        keys.reserve( current.size() );
+
+        for( unsigned step = 1; step <= NUM_PREDICTION_STEPS; ++step )
+        {
+            double dt = _lookahead * (double)step / (double)NUM_PREDICTION_STEPS;
+
+            osg::Matrixd predictedView;
+            extrapolate( first, last, dt, predictedView );
+
+            keys.clear();
+            getRequiredKeys( predictedView, projMatrix, lodScale, keys );
+
+            for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+            {
+                if ( !std::binary_search(current.begin(), current.end(), *k) && predicted.find(*k) == predicted.end() )
+                    predicted[*k] = dt;
+            }
+        }
+    }
+
+    // Schedule the soonest first, coarsest first.
+    std::vector< std::pair<double, TileKey> > schedule;
+    schedule.reserve( predicted.size() );
+    for( KeyTimes::const_iterator i = predicted.begin(); i != predicted.end(); ++i )
+    {
+        schedule.push_back( std::make_pair(i->second + 0.001*(double)i->first.getLOD(), i->first) );
+    }
+    std::sort( schedule.begin(), schedule.end() );
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    unsigned pending = 0u;
+
+    for( Entries::iterator e = _entries.begin(); e != _entries.end(); )
+    {
+        Entries::iterator i = e++;
+        Request* request = i->second._request.get();
+
+        if ( predicted.find(i->first) != predicted.end() )
+        {
+            i->second._lastPredicted = time;
+            if ( !request->isCompleted() )
+                ++pending;
+        }
+        else if ( !request->isReady() )
+        {
+            // fell out of the prediction before it finished.
+            request->cancel();
+            _entries.erase( i );
+            ++_stats._numCanceled;
+        }
+        else if ( time - i->second._lastPredicted > 2.0*_lookahead )
+        {
+            // built, but the camera went elsewhere.
+            _entries.erase( i );
+        }
+    }
+
+    for( unsigned i = 0; i < schedule.size() && pending < _maxPending; ++i )
+    {
+        const TileKey& key = schedule[i].second;
+
+        if ( _entries.find(key) != _entries.end() )
+            continue;
+
+        osg::ref_ptr<TileNode> live;
+        if ( _liveTiles.valid() && _liveTiles->get(key, live) )
+            continue;
+
+        Entry& entry = _entries[key];
+        entry._request       = new Request( key, _factory.get(), (float)schedule[i].first );
+        entry._lastPredicted = time;
+
+        _service->add( entry._request.get() );
+        ++_stats._numSubmitted;
+        ++pending;
+    }
+
+    OE_TEST << LC << "Predicted " << predicted.size() << " keys; " << pending << " requests pending, "
+        << _entries.size() << " entries" << std::endl;
+}
+
+
+bool
+TilePrefetcher::take(const TileKey&           key,
+                     osg::ref_ptr<TileModel>& out_model,
+                     bool&                    out_hasRealData)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    Entries::iterator i = _entries.find( key );
+    if ( i == _entries.end() )
+    {
+        ++_stats._numMisses;
+        return false;
+    }
+
+    osg::ref_ptr<Request> request = i->second._request.get();
+    _entries.erase( i );
+
+    if ( !request->isReady() )
+    {
+        // the caller is about to build it anyway.
+        request->cancel();
+        ++_stats._numLate;
+        return false;
+    }
+
+    out_model       = request->_model.get();
+    out_hasRealData = request->_hasRealData;
+    ++_stats._numHits;
+    return true;
+}
+
+
+bool
+TilePrefetcher::isReady(const TileKey& key) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    Entries::const_iterator i = _entries.find( key );
+    return i != _entries.end() && i->second._request->isReady();
+}
+
+
+void
+TilePrefetcher::getRequiredKeys(const osg::Matrixd&   viewMatrix,
+                                const osg::Matrixd&   projMatrix,
+                                float                 lodScale,
+                                std::vector<TileKey>& out_keys) const
+{
+    // side planes only; near/far are computed by the cull visitor, so
+    // they're meaningless in the camera's projection matrix.
+    osg::Polytope frustum;
+    frustum.setToUnitFrustum( false, false );
+    frustum.transformProvidingInverse( viewMatrix * projMatrix );
+
+    osg::Vec3d eye = osg::Matrixd::inverse( viewMatrix ).getTrans();
+
+    for( std::vector<TileKey>::const_iterator k = _rootKeys.begin(); k != _rootKeys.end(); ++k )
+    {
+        collectRequiredKeys( *k, frustum, eye, lodScale, out_keys );
+    }
+
+    // a walk down the quadtree never visits a key twice, so it only needs sorting.
+    std::sort( out_keys.begin(), out_keys.end() );
+}
+
+
+void
+TilePrefetcher::getBound(const TileKey& key, TileBound& out_bound) const
+{
+    BoundCache::Record rec;
+    if ( _bounds.get(key, rec) )
+    {
+        out_bound = rec.value();
+        return;
+    }
+
+    getTileBound( key, _rangeFactor, out_bound._center, out_bound._radius, out_bound._subtileRange );
+    _bounds.insert( key, out_bound );
+}
+
+
+void
+TilePrefetcher::collectRequiredKeys(const TileKey&        key,
+                                    osg::Polytope&        frustum,
+                                    const osg::Vec3d&     eye,
+                                    float                 lodScale,
+                                    std::vector<TileKey>& out_keys) const
+{
+    if ( key.getLOD() >= _maxLOD )
+        return;
+
+    TileBound bound;
+    getBound( key, bound );
+
+    if ( !frustum.contains( osg::BoundingSphere(bound._center, bound._radius) ) )
+        return;
+
+    if ( (bound._center - eye).length() * lodScale > bound._subtileRange )
+        return;
+
+    for( unsigned q = 0; q < 4; ++q )
+    {
+        TileKey child = key.createChildKey( q );
+        out_keys.push_back( child );
+        collectRequiredKeys( child, frustum, eye, lodScale, out_keys );
+    }
+}
+
+
+void
+TilePrefetcher::clear()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    for( Entries::iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        i->second._request->cancel();
+    }
+    _entries.clear();
+    _poses.clear();
+    _lastPrediction = -DBL_MAX;
+}
+
+
+void
+TilePrefetcher::getStats(TilePrefetcher::Stats& out) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    out = _stats;
+}
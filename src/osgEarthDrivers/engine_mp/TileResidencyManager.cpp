@@ -0,0 +1,353 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TileResidencyManager"
+#include "TilePagedLOD"
+#include "MPGeometry"
+
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <set>
+#include <vector>
+
+using namespace osgEarth_engine_mp;
+using namespace osgEarth;
+
+#define LC "[TileResidencyManager] "
+
+//#define OE_TEST OE_INFO
+#define OE_TEST OE_NULL
+
+namespace
+{
+    // Sums the size of all the vertex and primitive data under a tile.
+    struct GeometrySizeVisitor : public osg::NodeVisitor
+    {
+        unsigned                    _bytes;
+        std::set<const osg::Object*> _seen;
+
+        GeometrySizeVisitor()
+            : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _bytes(0u) { }
+
+        void addArray( const osg::Array* array )
+        {
+            if ( array && _seen.insert(array).second )
+                _bytes += array->getTotalDataSize();
+        }
+
+        void apply( osg::Geode& geode )
+        {
+            for( unsigned i=0; i<geode.getNumDrawables(); ++i )
+            {
+                osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+                if ( !geom )
+                    continue;
+
+                osg::Geometry::ArrayList arrays;
+                geom->getArrayList( arrays );
+                for( osg::Geometry::ArrayList::const_iterator a = arrays.begin(); a != arrays.end(); ++a )
+                    addArray( a->get() );
+
+                for( unsigned p=0; p<geom->getNumPrimitiveSets(); ++p )
+                {
+                    osg::DrawElements* de = geom->getPrimitiveSet(p)->getDrawElements();
+                    if ( de && _seen.insert(de).second )
+                        _bytes += de->getTotalDataSize();
+                }
+
+                // MPGeometry keeps per-layer texture coordinates outside the
+                // normal osg::Geometry array list.
+                MPGeometry* mp = dynamic_cast<MPGeometry*>( geom );
+                if ( mp )
+                {
+                    addArray( mp->_tileCoords.get() );
+                    for( std::vector<MPGeometry::Layer>::const_iterator layer = mp->_layers.begin(); layer != mp->_layers.end(); ++layer )
+                    {
+                        addArray( layer->_texCoords.get() );
+                        addArray( layer->_tileCoords.get() );
+                    }
+                }
+            }
+            traverse( geode );
+        }
+    };
+
+    // A tile that may be evicted.
+    struct Candidate
+    {
+        osg::ref_ptr<TilePagedLOD>    _owner;
+        osg::ref_ptr<TileNode>        _tile;
+    };
+}
+
+//----------------------------------------------------------------------------
+
+TileResidencyManager::TileResidencyManager(UInt64 budgetBytes) :
+_maxEvictionsPerFrame( 16u ),
+_frameNumber         ( 0u ),
+_warnedOverBudget    ( false )
+{
+    _stats._budgetBytes = budgetBytes;
+}
+
+
+void
+TileResidencyManager::setBudget(UInt64 budgetBytes)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _stats._budgetBytes = budgetBytes;
+    _warnedOverBudget = false;
+}
+
+
+void
+TileResidencyManager::computeFootprint(TileNode* tile,
+                                       unsigned& out_cpuBytes,
+                                       unsigned& out_gpuBytes)
+{
+    out_cpuBytes = 0u;
+    out_gpuBytes = 0u;
+
+    if ( !tile )
+        return;
+
+    // Vertex data lives in system memory and is mirrored in a VBO.
+    GeometrySizeVisitor gsv;
+    tile->accept( gsv );
+    out_cpuBytes += gsv._bytes;
+    out_gpuBytes += gsv._bytes;
+
+    const TileModel* model = tile->getTileModel();
+    if ( model )
+    {
+        // The heightfield stays resident for normalization and upsampling.
+        osg::HeightField* hf = model->_elevationData.getHeightField();
+        if ( hf && hf->getFloatArray() )
+        {
+            out_cpuBytes += hf->getFloatArray()->getTotalDataSize();
+        }
+
+        for( TileModel::ColorDataByUID::const_iterator i = model->_colorData.begin(); i != model->_colorData.end(); ++i )
+        {
+            const TileModel::ColorData& color = i->second;
+
+            // Textures inherited from an ancestor (upsampled/fallback data) are
+            // accounted to the tile that created them.
+            if ( color.getTileKey() != tile->getKey() )
+                continue;
+
+            osg::Texture2D* tex = color.getTexture();
+            if ( tex && tex->getImage() )
+            {
+                unsigned imageBytes = tex->getImage()->getTotalSizeInBytesIncludingMipmaps();
+                out_gpuBytes += imageBytes;
+
+                // the image is discarded once it's been uploaded to the GPU, unless
+                // the texture says otherwise.
+                if ( !tex->getUnRefImageDataAfterApply() )
+                    out_cpuBytes += imageBytes;
+            }
+        }
+    }
+}
+
+
+void
+TileResidencyManager::add(TileNode* tile, TilePagedLOD* owner)
+{
+    if ( !tile || !owner )
+        return;
+
+    Record record;
+    record._tile  = tile;
+    record._owner = owner;
+    computeFootprint( tile, record._cpuBytes, record._gpuBytes );
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    Records::iterator i = _records.find( tile );
+    if ( i != _records.end() )
+        removeRecord( i );
+
+    // a tile that was just merged hasn't been traversed yet; count it as seen
+    // now, so it isn't the first thing to go.
+    record._addedFrame = _frameNumber;
+    record._lru        = _lru.insert( std::make_pair(_frameNumber, tile) );
+
+    _records[tile] = record;
+    _stats._numTiles  = _records.size();
+    _stats._cpuBytes += record._cpuBytes;
+    _stats._gpuBytes += record._gpuBytes;
+    _stats._peakBytes = osg::maximum( _stats._peakBytes, _stats.getTotalBytes() );
+
+    OE_TEST << LC << "Added " << tile->getKey().str() << ": cpu=" << record._cpuBytes
+        << ", gpu=" << record._gpuBytes << ", total=" << _stats.getTotalBytes() << std::endl;
+}
+
+
+void
+TileResidencyManager::remove(TileNode* tile)
+{
+    if ( !tile )
+        return;
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    Records::iterator i = _records.find( tile );
+    if ( i != _records.end() )
+        removeRecord( i );
+}
+
+
+void
+TileResidencyManager::removeRecord(Records::iterator i)
+{
+    // assumes the mutex is locked.
+    _stats._cpuBytes -= osg::minimum( _stats._cpuBytes, (UInt64)i->second._cpuBytes );
+    _stats._gpuBytes -= osg::minimum( _stats._gpuBytes, (UInt64)i->second._gpuBytes );
+    _lru.erase( i->second._lru );
+    _records.erase( i );
+    _stats._numTiles = _records.size();
+}
+
+
+void
+TileResidencyManager::clear()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _records.clear();
+    _lru.clear();
+    _stats._numTiles = 0u;
+    _stats._cpuBytes = 0;
+    _stats._gpuBytes = 0;
+}
+
+
+void
+TileResidencyManager::update(unsigned frameNumber)
+{
+    std::vector<Candidate> candidates;
+    UInt64                 excess = 0;
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        _frameNumber = frameNumber;
+
+        if ( _stats._budgetBytes == 0 || _stats.getTotalBytes() <= _stats._budgetBytes )
+        {
+            _warnedOverBudget = false;
+            return;
+        }
+
+        excess = _stats.getTotalBytes() - _stats._budgetBytes;
+
+        // Collect the least-recently-visible tiles until they cover the excess.
+        UInt64 covered = 0;
+        LRU::iterator i = _lru.begin();
+        while( i != _lru.end() && covered < excess )
+        {
+            LRU::iterator     current = i++;
+            Records::iterator r       = _records.find( current->second );
+            Record&           record  = r->second;
+
+            Candidate c;
+            c._tile  = record._tile.get();
+            c._owner = record._owner.get();
+
+            // a record whose tile or owner went away without telling us is
+            // just stale bookkeeping.
+            if ( !c._tile.valid() || !c._owner.valid() )
+            {
+                removeRecord( r );
+                continue;
+            }
+
+            // seen since it was filed: refile it. It lands further along, where
+            // we'll come across it again in its proper place.
+            unsigned lastFrame = osg::maximum( c._tile->getLastTraversalFrame(), record._addedFrame );
+            if ( lastFrame != current->first )
+            {
+                _lru.erase( current );
+                record._lru = _lru.insert( std::make_pair(lastFrame, c._tile.get()) );
+                if ( i == _lru.end() || record._lru->first < i->first )
+                    i = record._lru;
+                continue;
+            }
+
+            // never evict something that was visible in the last frame; that
+            // would just cause it to page right back in. Nothing after this
+            // one is any older.
+            if ( lastFrame + 1u >= frameNumber )
+                break;
+
+            candidates.push_back( c );
+            covered += record._cpuBytes + record._gpuBytes;
+        }
+    }
+
+    unsigned evicted = 0u;
+    UInt64   freed   = 0;
+
+    // The owner calls back into remove(), so don't hold the lock here.
+    for( std::vector<Candidate>::iterator c = candidates.begin();
+         c != candidates.end() && freed < excess && evicted < _maxEvictionsPerFrame;
+         ++c )
+    {
+        unsigned cpu, gpu;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            Records::const_iterator r = _records.find( c->_tile.get() );
+            if ( r == _records.end() )
+                continue;
+            cpu = r->second._cpuBytes;
+            gpu = r->second._gpuBytes;
+        }
+
+        // the owner only evicts leaf tiles; parents become eligible once
+        // their subtiles are gone.
+        if ( c->_owner->evictChild() )
+        {
+            freed += cpu + gpu;
+            ++evicted;
+        }
+    }
+
+    Threading::ScopedMutexLock lock( _mutex );
+    _stats._numEvicted += evicted;
+
+    if ( evicted > 0u )
+    {
+        OE_DEBUG << LC << "Evicted " << evicted << " tiles (" << freed << " bytes); "
+            << _stats.getTotalBytes() << " of " << _stats._budgetBytes << " bytes in use" << std::endl;
+    }
+    else if ( !_warnedOverBudget )
+    {
+        OE_WARN << LC << "Over the tile memory budget (" << _stats.getTotalBytes() << " of "
+            << _stats._budgetBytes << " bytes) with no tiles eligible for eviction" << std::endl;
+        _warnedOverBudget = true;
+    }
+}
+
+
+void
+TileResidencyManager::getStats(TileResidencyManager::Stats& out) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    out = _stats;
+}
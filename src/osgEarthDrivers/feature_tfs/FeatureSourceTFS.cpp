@@ -26,6 +26,7 @@
 #include <osgEarthFeatures/BufferFilter>
 #include <osgEarthFeatures/ScaleFilter>
 #include <osgEarthFeatures/OgrUtils>
+#include <osgEarthFeatures/GeoJSON>
 #include <osgEarthUtil/TFS>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -124,12 +125,16 @@ public:
 
     bool getFeatures( const std::string& buffer, const std::string& mimeType, FeatureList& features )
     {        
-        // find the right driver for the given mime type
+        // GeoJSON is parsed natively; no need for OGR or its global lock.
+        if ( isJSON(mimeType) )
+        {
+            return getFeaturesFromGeoJSON( buffer, features );
+        }
+
         OGR_SCOPED_LOCK;
                 
         // find the right driver for the given mime type
         OGRSFDriverH ogrDriver =
-            isJSON(mimeType) ? OGRGetDriverByName( "GeoJSON" ) :
             isGML(mimeType)  ? OGRGetDriverByName( "GML" ) :
             0L;
 
@@ -177,6 +182,25 @@ public:
         return true;
     }
 
+
+    bool getFeaturesFromGeoJSON( const std::string& buffer, FeatureList& features )
+    {
+        FeatureList parsed;
+        GeoJSONReader reader( _layer.getSRS() );
+        if ( !reader.read(buffer, parsed) )
+        {
+            OE_WARN << LC << "Error reading TFS response: " << reader.getError() << std::endl;
+            return false;
+        }
+
+        for( FeatureList::iterator i = parsed.begin(); i != parsed.end(); ++i )
+        {
+            if ( !isBlacklisted(i->get()->getFID()) )
+                features.push_back( i->get() );
+        }
+        return true;
+    }
+
     
     std::string getExtensionForMimeType(const std::string& mime)
     {
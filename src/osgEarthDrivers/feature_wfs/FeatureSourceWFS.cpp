@@ -26,6 +26,7 @@
 #include <osgEarthFeatures/ScaleFilter>
 #include <osgEarthUtil/WFS>
 #include <osgEarthFeatures/OgrUtils>
+#include <osgEarthFeatures/GeoJSON>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -190,14 +191,19 @@ public:
 
     bool getFeatures( const std::string& buffer, const std::string& mimeType, FeatureList& features )
     {
-        OGR_SCOPED_LOCK;        
-
         bool json = isJSON( mimeType );
         bool gml  = isGML( mimeType );
 
+        // GeoJSON is parsed natively; no need for OGR or its global lock.
+        if ( json )
+        {
+            return getFeaturesFromGeoJSON( buffer, features );
+        }
+
+        OGR_SCOPED_LOCK;        
+
         // find the right driver for the given mime type
         OGRSFDriverH ogrDriver =
-            json ? OGRGetDriverByName( "GeoJSON" ) :
             gml  ? OGRGetDriverByName( "GML" ) :
             0L;        
 
@@ -211,22 +217,13 @@ public:
 
         std::string tmpName;
 
-        OGRDataSourceH ds = 0;
-        //GML needs to be saved to a temp file to load from disk.  GeoJSON can be loaded directly from memory
-        if (gml)
-        {
-            std::string ext = getExtensionForMimeType( mimeType );
-            //Save the response to a temp file            
-            std::string tmpPath = getTempPath();        
-            tmpName = getTempName(tmpPath, ext);
-            saveResponse(buffer, tmpName );
-            ds = OGROpen( tmpName.c_str(), FALSE, &ogrDriver );
-        }
-        else if (json)
-        {
-            //Open GeoJSON directly from memory
-            ds = OGROpen( buffer.c_str(), FALSE, &ogrDriver );
-        }        
+        //GML needs to be saved to a temp file to load from disk.
+        std::string ext = getExtensionForMimeType( mimeType );
+        //Save the response to a temp file            
+        std::string tmpPath = getTempPath();        
+        tmpName = getTempName(tmpPath, ext);
+        saveResponse(buffer, tmpName );
+        OGRDataSourceH ds = OGROpen( tmpName.c_str(), FALSE, &ogrDriver );
 
         
         if ( !ds )
@@ -270,6 +267,28 @@ public:
         return true;
     }
 
+
+    bool getFeaturesFromGeoJSON( const std::string& buffer, FeatureList& features )
+    {
+        FeatureProfile* fp = getFeatureProfile();
+        const SpatialReference* srs = fp ? fp->getSRS() : 0L;
+
+        FeatureList parsed;
+        GeoJSONReader reader( srs );
+        if ( !reader.read(buffer, parsed) )
+        {
+            OE_WARN << LC << "Error reading WFS response: " << reader.getError() << std::endl;
+            return false;
+        }
+
+        for( FeatureList::iterator i = parsed.begin(); i != parsed.end(); ++i )
+        {
+            if ( !isBlacklisted(i->get()->getFID()) )
+                features.push_back( i->get() );
+        }
+        return true;
+    }
+
     
     std::string getExtensionForMimeType(const std::string& mime)
     {
@@ -23,6 +23,9 @@
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/ImageToHeightFieldConverter>
+#include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -42,16 +45,55 @@ using namespace osgEarth::Drivers;
 
 #define LC "[MBTilesSource] "
 
+namespace
+{
+    const char* SELECT_TILE_SQL = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
+    const char* SELECT_META_SQL = "SELECT value from metadata where name = ?";
+    const char* INSERT_TILE_SQL = "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
+    const char* INSERT_META_SQL = "INSERT INTO metadata (name, value) VALUES (?, ?)";
+
+    // A read-only database connection with its prepared statements. The
+    // statements are reset after each use, so they are prepared only once.
+    struct Connection
+    {
+        Connection() : _db(0L), _selectTile(0L), _selectMeta(0L) { }
+
+        ~Connection()
+        {
+            if ( _selectTile ) sqlite3_finalize( _selectTile );
+            if ( _selectMeta ) sqlite3_finalize( _selectMeta );
+            if ( _db )         sqlite3_close( _db );
+        }
+
+        sqlite3*      _db;
+        sqlite3_stmt* _selectTile;
+        sqlite3_stmt* _selectMeta;
+    };
+}
+
+
 class MBTilesSource : public TileSource
 {
 public:
     MBTilesSource( const TileSourceOptions& options ) :
       TileSource( options ),
       _options( options ),      
-      _database( NULL ),
       _minLevel( 0 ),
-      _maxLevel( 20 )
+      _maxLevel( 20 ),
+      _writeDb( 0L ),
+      _insertTile( 0L ),
+      _numBatched( 0u ),
+      _hasTiles( false ),
+      _warnedHeightFormat( false )
+    {
+    }
+
+    virtual ~MBTilesSource()
     {
+        closeWriter();
+
+        for( std::vector<Connection*>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+            delete *i;
     }
 
     // override
@@ -76,14 +118,24 @@ public:
         }
 #endif
 
-        int flags = SQLITE_OPEN_READONLY;
-        int rc = sqlite3_open_v2( _options.filename()->c_str(), &_database, flags, 0L );
-        if ( rc != 0 )
-        {                        
+        // In write mode, open (or create) the database for writing first so
+        // the tables exist by the time the readers connect.
+        if ( _options.writable() == true )
+        {
+            Status status = openWriter();
+            if ( status.isError() )
+                return status;
+        }
+
+        //Open the first read connection to make sure the database is usable
+        Connection* conn = checkOut();
+        if ( !conn )
+        {
             std::stringstream buf;
-            buf << "Failed to open database \"" << *_options.filename() << "\": " << sqlite3_errmsg(_database);
+            buf << "Failed to open database \"" << *_options.filename() << "\"";
             return Status::Error(buf.str());
         }
+        checkIn( conn );
 
         //Print out some metadata
         std::string name, type, version, description, format;
@@ -122,6 +174,16 @@ public:
 
         computeLevels();
 
+        // a new database gets its metadata now that we know the format:
+        if ( _writeDb && format.empty() )
+        {
+            writeMetaData( "name", osgDB::getStrippedName(*_options.filename()) );
+            writeMetaData( "type", "baselayer" );
+            writeMetaData( "version", "1.0.0" );
+            writeMetaData( "description", "" );
+            writeMetaData( "format", _tileFormat );
+        }
+
         _emptyImage = ImageUtils::createEmptyImage( 256, 256 );
         
         return STATUS_OK;
@@ -135,12 +197,20 @@ public:
         int x = key.getTileX();
         int y = key.getTileY();
 
-        if (z < (int)_minLevel)
+        // storeImage widens the level range as it writes.
+        unsigned minLevel, maxLevel;
+        {
+            Threading::ScopedMutexLock lock( _writeMutex );
+            minLevel = _minLevel;
+            maxLevel = _maxLevel;
+        }
+
+        if (z < (int)minLevel)
         {
             return _emptyImage.get();            
         }
 
-        if (z > (int)_maxLevel)
+        if (z > (int)maxLevel)
         {
             //If we're at the max level, just return NULL
             return NULL;
@@ -151,31 +221,41 @@ public:
         y  = numRows - y - 1;
 
         //Get the image
-        sqlite3_stmt* select = NULL;
-        std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
-        if ( rc != SQLITE_OK )
-        {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+        Connection* conn = checkOut();
+        if ( !conn )
             return NULL;
-        }
 
-        bool valid = true;        
+        sqlite3_stmt* select = conn->_selectTile;
         sqlite3_bind_int( select, 1, z );
         sqlite3_bind_int( select, 2, x );
         sqlite3_bind_int( select, 3, y );
 
-
-        osg::Image* result = NULL;
-        rc = sqlite3_step( select );
+        // copy the blob out so the connection can go back to the pool
+        // before decoding the image.
+        std::string imageString;
+        bool found = false;
+        int rc = sqlite3_step( select );
         if ( rc == SQLITE_ROW)
         {                     
             // the pointer returned from _blob gets freed internally by sqlite, supposedly
             const char* data = (const char*)sqlite3_column_blob( select, 0 );
             int imageBufLen = sqlite3_column_bytes( select, 0 );
+            imageString.assign( data, imageBufLen );
+            found = true;
+        }
+        else
+        {
+            OE_DEBUG << LC << "SQL QUERY failed for " << SELECT_TILE_SQL << ": " << std::endl;
+        }
 
+        sqlite3_reset( select );
+        sqlite3_clear_bindings( select );
+        checkIn( conn );
+
+        osg::Image* result = NULL;
+        if ( found && _rw.valid() )
+        {
             // deserialize the image from the buffer:
-            std::string imageString( data, imageBufLen );
             std::stringstream imageBufStream( imageString );
             osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
             if (rr.validImage())
@@ -183,36 +263,141 @@ public:
                 result = rr.takeImage();                
             }
         }
+
+        return result;
+    }
+
+    // override
+    bool isWritable() const
+    {
+        return _writeDb != 0L;
+    }
+
+    // override
+    bool storeImage( const TileKey& key,
+                     osg::Image* image,
+                     ProgressCallback* progress )
+    {
+        if ( !_writeDb || !image || !_rw.valid() )
+            return false;
+
+        // the tile formats MBTiles uses can't hold block-compressed data.
+        osg::ref_ptr<osg::Image> source = image;
+        if ( ImageUtils::isCompressed(image) )
+            source = ImageUtils::convertToRGBA8( image );
+
+        // serialize the image:
+        std::stringstream buf;
+        osgDB::ReaderWriter::WriteResult wr = _rw->writeImage( *source.get(), buf, _dbOptions.get() );
+        if ( !wr.success() )
+        {
+            OE_WARN << LC << "Failed to encode tile " << key.str() << " as " << _tileFormat << std::endl;
+            return false;
+        }
+        std::string data = buf.str();
+
+        int z = key.getLevelOfDetail();
+        int x = key.getTileX();
+        unsigned int numRows, numCols;
+        key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+        int y = numRows - key.getTileY() - 1;
+
+        Threading::ScopedMutexLock lock( _writeMutex );
+
+        if ( _numBatched == 0u )
+        {
+            if ( sqlite3_exec( _writeDb, "BEGIN TRANSACTION", NULL, NULL, NULL ) != SQLITE_OK )
+            {
+                OE_WARN << LC << "Failed to begin a transaction; storing tiles one at a time: " << sqlite3_errmsg(_writeDb) << std::endl;
+            }
+        }
+
+        sqlite3_bind_int ( _insertTile, 1, z );
+        sqlite3_bind_int ( _insertTile, 2, x );
+        sqlite3_bind_int ( _insertTile, 3, y );
+        sqlite3_bind_blob( _insertTile, 4, data.data(), data.length(), SQLITE_STATIC );
+
+        int rc = sqlite3_step( _insertTile );
+        sqlite3_reset( _insertTile );
+        sqlite3_clear_bindings( _insertTile );
+
+        if ( rc != SQLITE_DONE )
+        {
+            OE_WARN << LC << "Failed to store tile " << key.str() << ": " << sqlite3_errmsg(_writeDb) << std::endl;
+            return false;
+        }
+
+        // keep the level range current so the new tiles are readable:
+        if ( !_hasTiles )
+        {
+            _minLevel = _maxLevel = z;
+            _hasTiles = true;
+        }
         else
         {
-            OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
-            valid = false;
+            _minLevel = osg::minimum( _minLevel, (unsigned)z );
+            _maxLevel = osg::maximum( _maxLevel, (unsigned)z );
         }
 
-        sqlite3_finalize( select );
-        return result;
+        if ( ++_numBatched >= osg::maximum(*_options.batchSize(), 1u) )
+        {
+            commit();
+        }
 
+        return true;
     }
 
-    bool getMetaData( const std::string& key, std::string& value )
+    // override
+    bool storeHeightField( const TileKey& key,
+                           osg::HeightField* hf,
+                           ProgressCallback* progress )
     {
-        //get the metadata
-        sqlite3_stmt* select = NULL;
-        std::string query = "SELECT value from metadata where name = ?";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
-        if ( rc != SQLITE_OK )
+        if ( !hf )
+            return false;
+
+        // heightfields are stored as single-channel 32-bit float images, which
+        // only TIFF holds; the PNG and JPEG writers would mangle them.
+        std::string format = toLower( _tileFormat );
+        if ( format != "tif" && format != "tiff" )
         {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            Threading::ScopedMutexLock lock( _writeMutex );
+            if ( !_warnedHeightFormat )
+            {
+                OE_WARN << LC << "Can't store heightfields as \"" << _tileFormat << "\"; use the tif format" << std::endl;
+                _warnedHeightFormat = true;
+            }
             return false;
         }
 
+        ImageToHeightFieldConverter conv;
+        osg::ref_ptr<osg::Image> image = conv.convert( hf, 32 );
+        return image.valid() && storeImage( key, image.get(), progress );
+    }
+
+    // override
+    void flush()
+    {
+        Threading::ScopedMutexLock lock( _writeMutex );
+        commit();
+    }
+
+    bool getMetaData( const std::string& key, std::string& value )
+    {
+        //get the metadata
+        Connection* conn = checkOut();
+        if ( !conn )
+            return false;
+
+        sqlite3_stmt* select = conn->_selectMeta;
 
         bool valid = true;
         std::string keyStr = std::string( key );
-        rc = sqlite3_bind_text( select, 1, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
+        int rc = sqlite3_bind_text( select, 1, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
         if (rc != SQLITE_OK )
         {
-            OE_WARN << LC << "Failed to bind text: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            OE_WARN << LC << "Failed to bind text: " << SELECT_META_SQL << "; " << sqlite3_errmsg(conn->_db) << std::endl;
+            sqlite3_reset( select );
+            checkIn( conn );
             return false;
         }
 
@@ -223,30 +408,40 @@ public:
         }
         else
         {
-            OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
+            OE_DEBUG << LC << "SQL QUERY failed for " << SELECT_META_SQL << ": " << std::endl;
             valid = false;
         }
 
-        sqlite3_finalize( select );
+        sqlite3_reset( select );
+        sqlite3_clear_bindings( select );
+        checkIn( conn );
         return valid;
     }
 
     void computeLevels()
     {        
+        Connection* conn = checkOut();
+        if ( !conn )
+            return;
+
         sqlite3_stmt* select = NULL;
         std::string query = "SELECT min(zoom_level), max(zoom_level) from tiles";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
+        int rc = sqlite3_prepare_v2( conn->_db, query.c_str(), -1, &select, 0L );
         if ( rc != SQLITE_OK )
         {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(conn->_db) << std::endl;
+            checkIn( conn );
+            return;
         }
 
         rc = sqlite3_step( select );
-        if ( rc == SQLITE_ROW)
+        if ( rc == SQLITE_ROW && sqlite3_column_type(select, 0) != SQLITE_NULL )
         {                     
+            Threading::ScopedMutexLock lock( _writeMutex );
             _minLevel = sqlite3_column_int( select, 0 );
             _maxLevel = sqlite3_column_int( select, 1 );
-            OE_NOTICE << "Min=" << _minLevel << " Max=" << _maxLevel << std::endl;
+            _hasTiles = true;
+            OE_DEBUG << LC << "Min=" << _minLevel << " Max=" << _maxLevel << std::endl;
         }
         else
         {
@@ -254,6 +449,7 @@ public:
         }
 
         sqlite3_finalize( select );        
+        checkIn( conn );
     }
 
     // override
@@ -263,8 +459,165 @@ public:
     }
 
 private:
+
+    // Takes a read connection from the pool, opening a new one if they are all in use.
+    Connection* checkOut()
+    {
+        {
+            Threading::ScopedMutexLock lock( _poolMutex );
+            if ( !_idle.empty() )
+            {
+                Connection* conn = _idle.back();
+                _idle.pop_back();
+                return conn;
+            }
+        }
+
+        Connection* conn = new Connection();
+
+        // NOMUTEX: each connection is only ever used by one thread at a time.
+        int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+        int rc = sqlite3_open_v2( _options.filename()->c_str(), &conn->_db, flags, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to open database \"" << *_options.filename() << "\": " << sqlite3_errmsg(conn->_db) << std::endl;
+            delete conn;
+            return 0L;
+        }
+
+        // wait out a writer's commit instead of failing the read.
+        sqlite3_busy_timeout( conn->_db, 5000 );
+
+        if ( *_options.mmapSize() > 0u )
+        {
+            std::string pragma = Stringify() << "PRAGMA mmap_size=" << *_options.mmapSize();
+            sqlite3_exec( conn->_db, pragma.c_str(), NULL, NULL, NULL );
+        }
+
+        if ( sqlite3_prepare_v2( conn->_db, SELECT_TILE_SQL, -1, &conn->_selectTile, 0L ) != SQLITE_OK ||
+             sqlite3_prepare_v2( conn->_db, SELECT_META_SQL, -1, &conn->_selectMeta, 0L ) != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL; " << sqlite3_errmsg(conn->_db) << std::endl;
+            delete conn;
+            return 0L;
+        }
+
+        return conn;
+    }
+
+    // Returns a read connection to the pool.
+    void checkIn( Connection* conn )
+    {
+        Threading::ScopedMutexLock lock( _poolMutex );
+        _idle.push_back( conn );
+    }
+
+    Status openWriter()
+    {
+        int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        int rc = sqlite3_open_v2( _options.filename()->c_str(), &_writeDb, flags, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            std::stringstream buf;
+            buf << "Failed to open database \"" << *_options.filename() << "\" for writing: " << sqlite3_errmsg(_writeDb);
+            closeWriter();
+            return Status::Error(buf.str());
+        }
+
+        // wait out the readers' locks instead of failing the commit.
+        sqlite3_busy_timeout( _writeDb, 5000 );
+
+        // a packaging run can always start over, so trade durability for speed.
+        sqlite3_exec( _writeDb, "PRAGMA synchronous=OFF", NULL, NULL, NULL );
+
+        const char* schema =
+            "CREATE TABLE IF NOT EXISTS metadata (name text, value text);"
+            "CREATE TABLE IF NOT EXISTS tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob);"
+            "CREATE UNIQUE INDEX IF NOT EXISTS tile_index on tiles (zoom_level, tile_column, tile_row);";
+
+        char* errmsg = 0L;
+        rc = sqlite3_exec( _writeDb, schema, NULL, NULL, &errmsg );
+        if ( rc != SQLITE_OK )
+        {
+            std::stringstream buf;
+            buf << "Failed to create tables in \"" << *_options.filename() << "\": " << (errmsg ? errmsg : "");
+            sqlite3_free( errmsg );
+            closeWriter();
+            return Status::Error(buf.str());
+        }
+
+        rc = sqlite3_prepare_v2( _writeDb, INSERT_TILE_SQL, -1, &_insertTile, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            std::stringstream buf;
+            buf << "Failed to prepare SQL: " << INSERT_TILE_SQL << "; " << sqlite3_errmsg(_writeDb);
+            closeWriter();
+            return Status::Error(buf.str());
+        }
+
+        return STATUS_OK;
+    }
+
+    void closeWriter()
+    {
+        Threading::ScopedMutexLock lock( _writeMutex );
+        commit();
+
+        if ( _insertTile )
+        {
+            sqlite3_finalize( _insertTile );
+            _insertTile = 0L;
+        }
+        if ( _writeDb )
+        {
+            sqlite3_close( _writeDb );
+            _writeDb = 0L;
+        }
+    }
+
+    // Commits the open write transaction. Call with _writeMutex held.
+    void commit()
+    {
+        if ( _writeDb && _numBatched > 0u )
+        {
+            char* errmsg = 0L;
+            if ( sqlite3_exec( _writeDb, "COMMIT", NULL, NULL, &errmsg ) != SQLITE_OK )
+            {
+                OE_WARN << LC << "Failed to commit " << _numBatched << " tiles to \"" << *_options.filename() << "\": "
+                    << (errmsg ? errmsg : sqlite3_errmsg(_writeDb)) << std::endl;
+
+                // don't leave the transaction open under the next batch.
+                if ( !sqlite3_get_autocommit(_writeDb) )
+                    sqlite3_exec( _writeDb, "ROLLBACK", NULL, NULL, NULL );
+            }
+            sqlite3_free( errmsg );
+            _numBatched = 0u;
+        }
+    }
+
+    void writeMetaData( const std::string& key, const std::string& value )
+    {
+        Threading::ScopedMutexLock lock( _writeMutex );
+
+        sqlite3_stmt* insert = NULL;
+        int rc = sqlite3_prepare_v2( _writeDb, INSERT_META_SQL, -1, &insert, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << INSERT_META_SQL << "; " << sqlite3_errmsg(_writeDb) << std::endl;
+            return;
+        }
+
+        sqlite3_bind_text( insert, 1, key.c_str(), key.length(), SQLITE_STATIC );
+        sqlite3_bind_text( insert, 2, value.c_str(), value.length(), SQLITE_STATIC );
+        if ( sqlite3_step( insert ) != SQLITE_DONE )
+        {
+            OE_WARN << LC << "Failed to write metadata \"" << key << "\": " << sqlite3_errmsg(_writeDb) << std::endl;
+        }
+
+        sqlite3_finalize( insert );
+    }
+
     const MBTilesOptions _options;    
-    sqlite3* _database;
     unsigned int _minLevel;
     unsigned int _maxLevel;
     osg::ref_ptr< osg::Image> _emptyImage;
@@ -273,6 +626,17 @@ private:
     osg::ref_ptr<osgDB::Options> _dbOptions;
     std::string _tileFormat;
 
+    // pool of read connections
+    std::vector<Connection*> _idle;
+    Threading::Mutex         _poolMutex;
+
+    // write connection
+    sqlite3*         _writeDb;
+    sqlite3_stmt*    _insertTile;
+    unsigned         _numBatched;
+    bool             _hasTiles;
+    bool             _warnedHeightFormat;
+    Threading::Mutex _writeMutex;
 };
 
 
@@ -21,6 +21,8 @@
 #include <osgEarth/Registry>
 #include <osgEarth/URI>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -31,6 +33,7 @@
 #include <sstream>
 
 #include <noise/noise.h>
+#include <noise/noisegen.h>
 
 using namespace noise;
 
@@ -44,7 +47,10 @@ class NoiseSource : public TileSource
 public:
     NoiseSource( const TileSourceOptions& options ) : TileSource( options ), _options(options)
     {
-        //nop
+        if ( _options.threads().get() > 1 )
+        {
+            _service = new TaskService( "NoiseSource", _options.threads().get() );
+        }
     }
 
     // Yahoo! uses spherical mercator, but the top LOD is a 2x2 tile set.
@@ -90,6 +96,139 @@ public:
     }
 
 
+    // Configures a Perlin module from the driver options.
+    void setupNoise(module::Perlin& noise) const
+    {
+        noise.SetFrequency  ( _options.frequency().get() );
+        noise.SetPersistence( _options.persistence().get() );
+        noise.SetLacunarity ( _options.lacunarity().get() );
+        noise.SetOctaveCount( _options.octaves().get() );
+    }
+
+    // Evaluates the Perlin function for a batch of points. This is the same
+    // math as module::Perlin::GetValue (so the results are identical) but it
+    // runs one octave at a time over the whole batch, which keeps the inner
+    // loops short and free of calls into the module.
+    static void sampleBatch(const module::Perlin&    noise,
+                            std::vector<osg::Vec3d>& points,
+                            double*                  out)
+    {
+        const unsigned     count       = points.size();
+        const double       lacunarity  = noise.GetLacunarity();
+        const double       persistence = noise.GetPersistence();
+        const int          octaves     = noise.GetOctaveCount();
+        const int          seed        = noise.GetSeed();
+        const NoiseQuality quality     = noise.GetNoiseQuality();
+
+        const double frequency = noise.GetFrequency();
+        for( unsigned i = 0; i < count; ++i )
+        {
+            points[i] *= frequency;
+            out[i] = 0.0;
+        }
+
+        double curPersistence = 1.0;
+        for( int octave = 0; octave < octaves; ++octave )
+        {
+            int octaveSeed = (seed + octave) & 0xffffffff;
+
+            for( unsigned i = 0; i < count; ++i )
+            {
+                const osg::Vec3d& p = points[i];
+                double signal = GradientCoherentNoise3D(
+                    MakeInt32Range(p.x()), MakeInt32Range(p.y()), MakeInt32Range(p.z()),
+                    octaveSeed, quality );
+                out[i] += signal * curPersistence;
+            }
+
+            for( unsigned i = 0; i < count; ++i )
+                points[i] *= lacunarity;
+
+            curPersistence *= persistence;
+        }
+    }
+
+    // Samples the noise on the posts of some rows of a regular grid. Geographic
+    // posts are transformed to ECEF in one batch per row.
+    void sampleRows(const SpatialReference* srs,
+                    double x0, double y0, double dx, double dy,
+                    unsigned numCols, unsigned firstRow, unsigned numRows,
+                    double* out) const
+    {
+        module::Perlin noise;
+        setupNoise( noise );
+
+        const SpatialReference* ecef = srs->isGeographic() ? srs->getECEF() : 0L;
+
+        std::vector<osg::Vec3d> points( numCols );
+        for( unsigned r = firstRow; r < firstRow+numRows; ++r )
+        {
+            double y = y0 + (double)r * dy;
+            for( unsigned c = 0; c < numCols; ++c )
+                points[c].set( x0 + (double)c * dx, y, 0.0 );
+
+            if ( ecef )
+                srs->transform( points, ecef );
+
+            sampleBatch( noise, points, &out[r*numCols] );
+        }
+    }
+
+    // Task that samples a block of grid rows.
+    struct SampleRows
+    {
+        const NoiseSource*      _source;
+        const SpatialReference* _srs;
+        double                  _x0, _y0, _dx, _dy;
+        unsigned                _numCols, _firstRow, _numRows;
+        double*                 _out;
+
+        void execute()
+        {
+            _source->sampleRows( _srs, _x0, _y0, _dx, _dy, _numCols, _firstRow, _numRows, _out );
+        }
+    };
+
+    // Samples the noise on a regular grid of posts, row-major starting at
+    // (x0,y0), spreading the rows across the task service if there is one.
+    void sampleGrid(const SpatialReference* srs,
+                    double x0, double y0, double dx, double dy,
+                    unsigned numCols, unsigned numRows,
+                    std::vector<double>& out) const
+    {
+        out.resize( numCols*numRows );
+
+        unsigned numThreads = _service.valid() ? (unsigned)_service->getNumThreads() : 1u;
+        if ( numThreads > 1u && numRows >= 2u*numThreads )
+        {
+            unsigned rowsPerTask = (numRows + numThreads - 1u) / numThreads;
+            unsigned numTasks    = (numRows + rowsPerTask - 1u) / rowsPerTask;
+
+            Threading::MultiEvent done( numTasks );
+            for( unsigned i = 0; i < numTasks; ++i )
+            {
+                ParallelTask<SampleRows>* task = new ParallelTask<SampleRows>( &done );
+                task->_source   = this;
+                task->_srs      = srs;
+                task->_x0       = x0;
+                task->_y0       = y0;
+                task->_dx       = dx;
+                task->_dy       = dy;
+                task->_numCols  = numCols;
+                task->_firstRow = i * rowsPerTask;
+                task->_numRows  = osg::minimum( rowsPerTask, numRows - task->_firstRow );
+                task->_out      = &out[0];
+                _service->add( task );
+            }
+            done.wait();
+        }
+        else
+        {
+            sampleRows( srs, x0, y0, dx, dy, numCols, 0u, numRows, &out[0] );
+        }
+    }
+
+
     osg::Image* createImage(const TileKey&        key,
                             ProgressCallback*     progress )
     {
@@ -99,12 +238,6 @@ public:
         }
         else
         {
-            module::Perlin noise;
-            noise.SetFrequency  ( _options.frequency().get() );
-            noise.SetPersistence( _options.persistence().get() );
-            noise.SetLacunarity ( _options.lacunarity().get() );
-            noise.SetOctaveCount( _options.octaves().get() );
-
             const SpatialReference* srs = key.getProfile()->getSRS();
 
             osg::Image* image = new osg::Image();
@@ -113,27 +246,19 @@ public:
             double dx = key.getExtent().width()  / (double)(image->s()-1);
             double dy = key.getExtent().height() / (double)(image->t()-1);
 
+            std::vector<double> values;
+            sampleGrid( srs, key.getExtent().xMin(), key.getExtent().yMin(), dx, dy, image->s(), image->t(), values );
+
             ImageUtils::PixelWriter write(image);
-            for(int s=0; s<image->s(); ++s)
+            for(int t=0; t<image->t(); ++t)
             {
-                for(int t=0; t<image->t(); ++t)
+                const double* row = &values[t*image->s()];
+                for(int s=0; s<image->s(); ++s)
                 {
-                    double lon = key.getExtent().xMin() + (double)s * dx;
-                    double lat = key.getExtent().yMin() + (double)t * dy;
-
-                    osg::Vec3d world(lon, lat, 0.0);
-                    if ( srs->isGeographic() )
-                        srs->transform(world, srs->getECEF(), world);
-
-                    double n = noise.GetValue(world.x(), world.y(), world.z());
-                    //world.normalize();
-                    //double n = 0.1 * stripes(world.x() + 2.0*turbulence(noise, world, 1.0), 1.6);
-                    //double n = -.10 * turbulence(noise, world, 0.2);
-
                     // scale and bias from[-1..1] to [0..1] for coloring. It should be noted that
                     // the Perlin noise function can generate values outside this range, hence
                     // the clamp!
-                    n = osg::clampBetween( (n+1.0)*0.5, 0.0, 1.0 );
+                    double n = osg::clampBetween( (row[s]+1.0)*0.5, 0.0, 1.0 );
 
                     write(osg::Vec4f(n,n,n,1), s, t);
                 }
@@ -147,40 +272,32 @@ public:
     osg::HeightField* createHeightField(const TileKey&        key,
                                         ProgressCallback*     progress )
     {
-        module::Perlin noise;
-        noise.SetFrequency  ( _options.frequency().get() );
-        noise.SetPersistence( _options.persistence().get() );
-        noise.SetLacunarity ( _options.lacunarity().get() );
-        noise.SetOctaveCount( _options.octaves().get() );
-
         const SpatialReference* srs = key.getProfile()->getSRS();
 
         osg::HeightField* hf = new osg::HeightField();
         hf->allocate( getPixelsPerTile(), getPixelsPerTile() );
 
-        double dx = key.getExtent().width() / (double)(hf->getNumColumns()-1);
-        double dy = key.getExtent().height() / (double)(hf->getNumRows()-1);
+        unsigned numCols = hf->getNumColumns();
+        unsigned numRows = hf->getNumRows();
+
+        double dx = key.getExtent().width() / (double)(numCols-1);
+        double dy = key.getExtent().height() / (double)(numRows-1);
 
         double bias  = _options.bias().get();
         double scale = _options.scale().get();
 
+        std::vector<double> values;
+        sampleGrid( srs, key.getExtent().xMin(), key.getExtent().yMin(), dx, dy, numCols, numRows, values );
+
         //Initialize the heightfield
-        for (unsigned int c = 0; c < hf->getNumColumns(); c++) 
+        for (unsigned int r = 0; r < numRows; r++)
         {
-            for (unsigned int r = 0; r < hf->getNumRows(); r++)
-            {                
-                double lon = key.getExtent().xMin() + (double)c * dx;
-                double lat = key.getExtent().yMin() + (double)r * dy;
-
-                osg::Vec3d world(lon, lat, 0.0);
-                if ( srs->isGeographic() )
-                    srs->transform(world, srs->getECEF(), world);
-
-                double n = noise.GetValue(world.x(), world.y(), world.z());
-
+            const double* row = &values[r*numCols];
+            for (unsigned int c = 0; c < numCols; c++) 
+            {
                 // Scale the noise value which is between -1 and 1...ish
                 double h = osg::clampBetween(
-                    (float)(bias + scale * n),
+                    (float)(bias + scale * row[c]),
                     *_options.minElevation(),
                     *_options.maxElevation() );
 
@@ -197,12 +314,6 @@ public:
 
     osg::Image* createNormalMap(const TileKey& key, ProgressCallback* progress)
     {
-        module::Perlin noise;
-        noise.SetFrequency  ( _options.frequency().get() );
-        noise.SetPersistence( _options.persistence().get() );
-        noise.SetLacunarity ( _options.lacunarity().get() );
-        noise.SetOctaveCount( _options.octaves().get() );
-
         // set up the image and prepare to write to it.
         osg::Image* image = new osg::Image();
         image->allocateImage( getPixelsPerTile(), getPixelsPerTile(), 1, GL_RGB, GL_UNSIGNED_BYTE );
@@ -228,39 +339,25 @@ public:
             udy = srs->transformUnits(dy, ecef, ex.south()+0.5*dy);
         }
 
-        double z = 0.0;
-        std::vector<osg::Vec3d> v(4);
-        double samples[4];
+        // The neighbors of each pixel lie one post away on the same grid, so
+        // sample a grid with a one-post border once and share the samples.
+        unsigned numCols = image->s() + 2;
+        unsigned numRows = image->t() + 2;
+        std::vector<double> values;
+        sampleGrid( srs, ex.xMin()-dx, ex.yMin()-dy, dx, dy, numCols, numRows, values );
 
-        for(int s=0; s<image->s(); ++s)
+        for(int t=0; t<image->t(); ++t)
         {
-            for(int t=0; t<image->t(); ++t)
-            {
-                double x = ex.xMin() + (double)s * dx;
-                double y = ex.yMin() + (double)t * dy;
-
-                if ( isGeo )
-                {
-                    v[0].set(x-dx, y, z);
-                    v[1].set(x+dx, y, z);
-                    v[2].set(x, y+dy, z);
-                    v[3].set(x, y-dy, z);
-                    srs->transform(v, ecef);
-                    for(int i=0; i<4; ++i )
-                        samples[i] = bias + scale * sample(noise, v[i]);
-                }
-                else
-                {
-                    samples[0] = bias + scale * sample(noise, osg::Vec3d(x-dx, y, z));
-                    samples[1] = bias + scale * sample(noise, osg::Vec3d(x+dx, y, z));
-                    samples[2] = bias + scale * sample(noise, osg::Vec3d(x, y+dy, z));
-                    samples[3] = bias + scale * sample(noise, osg::Vec3d(x, y-dy, z));
-                }
+            const double* below  = &values[(t  )*numCols + 1];
+            const double* center = &values[(t+1)*numCols + 1];
+            const double* above  = &values[(t+2)*numCols + 1];
 
-                osg::Vec3d west (-udx,    0, samples[0]);
-                osg::Vec3d east ( udx,    0, samples[1]);
-                osg::Vec3d north(   0,  udy, samples[2]);
-                osg::Vec3d south(   0, -udy, samples[3]);
+            for(int s=0; s<image->s(); ++s)
+            {
+                osg::Vec3d west (-udx,    0, bias + scale * center[s-1]);
+                osg::Vec3d east ( udx,    0, bias + scale * center[s+1]);
+                osg::Vec3d north(   0,  udy, bias + scale * above[s]);
+                osg::Vec3d south(   0, -udy, bias + scale * below[s]);
 
                 // calculate the normal at the center point.
                 osg::Vec3 normal = (east-west) ^ (north-south);
@@ -285,6 +382,7 @@ private:
     //module::Perlin               _noise;
     const NoiseOptions           _options;
     osg::ref_ptr<osgDB::Options> _dbOptions;
+    osg::ref_ptr<TaskService>    _service;
 };
 
 
@@ -159,6 +159,23 @@ public:
         return 0;
     }
 
+    osg::ref_ptr<TileRequest> createImageAsync(const TileKey&         key,
+                                               ImageOperation*        op,
+                                               TileRequest::Callback* callback )
+    {
+        // Only a tile that's really in the tile map can go out as a plain URI read;
+        // the empty-image fallbacks above are left to the synchronous path.
+        if (_tileMap.valid() && key.getLevelOfDetail() <= _tileMap->getMaxLevel() && _tileMap->intersectsKey(key))
+        {
+            std::string image_url = _tileMap->getURL( key, _invertY );
+            if (!image_url.empty())
+            {
+                return readImageAsync( key, URI(image_url), op, callback, _dbOptions.get() );
+            }
+        }
+        return TileSource::createImageAsync( key, op, callback );
+    }
+
     virtual int getPixelsPerTile() const
     {
         return _tileMap->getFormat().getWidth();
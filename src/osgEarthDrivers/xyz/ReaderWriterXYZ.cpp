@@ -90,6 +90,28 @@ public:
 
     osg::Image* createImage(const TileKey&     key,
                             ProgressCallback*  progress )
+    {
+        URI uri = createURI( key );
+
+        OE_TEST << LC << "URI: " << uri.full() << ", key: " << uri.cacheKey() << std::endl;
+
+        return uri.getImage( _dbOptions.get(), progress );
+    }
+
+    osg::ref_ptr<TileRequest> createImageAsync(const TileKey&         key,
+                                               ImageOperation*        op,
+                                               TileRequest::Callback* callback )
+    {
+        return readImageAsync( key, createURI(key), op, callback, _dbOptions.get() );
+    }
+
+    virtual std::string getExtension() const 
+    {
+        return _format;
+    }
+
+private:
+    URI createURI( const TileKey& key )
     {
         unsigned x, y;
         key.getTileXY( x, y );
@@ -120,17 +142,9 @@ public:
         if ( !cacheKey.empty() )
             uri.setCacheKey( cacheKey );
 
-        OE_TEST << LC << "URI: " << uri.full() << ", key: " << uri.cacheKey() << std::endl;
-
-        return uri.getImage( _dbOptions.get(), progress );
-    }
-
-    virtual std::string getExtension() const 
-    {
-        return _format;
+        return uri;
     }
 
-private:
     const XYZOptions       _options;
     std::string            _format;
     std::string            _template;
@@ -18,8 +18,7 @@
  */
 #include <osgEarthFeatures/Feature>
 #include <osgEarth/StringUtils>
-#include <osgEarthFeatures/GeometryUtils>
-#include <osgEarth/JsonUtils>
+#include <osgEarthFeatures/GeoJSON>
 #include <algorithm>
 
 using namespace osgEarth;
@@ -446,100 +445,16 @@ Feature::getWorldBoundingPolytope(const SpatialReference* srs,
 std::string
 Feature::getGeoJSON()
 {
-    std::string geometry = GeometryUtils::geometryToGeoJSON( getGeometry() );
-
-    Json::Value root(Json::objectValue);
-    root["type"] = "Feature";
-    root["id"] = (unsigned int)getFID(); //TODO:  Update JSON to use unsigned longs
-    
-    Json::Reader reader;
-    Json::Value geometryValue( Json::objectValue );
-    if ( reader.parse( geometry, geometryValue ) )
-    {
-        root["geometry"] = geometryValue;
-    }
-
-    //Write out all the properties         
-    Json::Value props(Json::objectValue);    
-    if (getAttrs().size() > 0)
-    {
-
-        for (AttributeTable::const_iterator itr = getAttrs().begin(); itr != getAttrs().end(); ++itr)
-        {
-            if (itr->second.first == ATTRTYPE_INT)
-            {
-                if (itr->second.second.set)
-                {
-                    props[itr->first] = itr->second.getInt();
-                }
-                else
-                {
-                    props[itr->first] = Json::nullValue;
-                }
-            }
-            else if (itr->second.first == ATTRTYPE_DOUBLE)
-            {
-                if (itr->second.second.set)
-                {
-                    props[itr->first] = itr->second.getDouble();
-                }
-                else
-                {
-                    props[itr->first] = Json::nullValue;
-                }
-            }
-            else if (itr->second.first == ATTRTYPE_BOOL)
-            {
-                if (itr->second.second.set)
-                {
-                    props[itr->first] = itr->second.getBool();
-                }
-                else
-                {
-                    props[itr->first] = Json::nullValue;
-                }
-            }
-            else
-            {
-                if (itr->second.second.set)
-                {
-                    props[itr->first] = itr->second.getString();
-                }
-                else
-                {
-                    props[itr->first] = Json::nullValue;
-                }
-            }            
-        }
-    } 
-
-    root["properties"] = props;
-    return Json::FastWriter().write( root );
-    //return Json::StyledWriter().write( root );
+    std::stringstream buf;
+    GeoJSONWriter::write( this, buf );
+    return buf.str();
 }
 
 std::string Feature::featuresToGeoJSON( FeatureList& features)
 {
     std::stringstream buf;
-
-    buf << "{\"type\": \"FeatureCollection\", \"features\": [";
-
-    FeatureList::iterator last = features.end();
-    last--;
-
-    for (FeatureList::iterator i = features.begin(); i != features.end(); i++)
-    {
-        buf << i->get()->getGeoJSON();
-        if (i != last)
-        {
-            buf << ",";
-        }
-    }
-
-    buf << "]}";
-
+    GeoJSONWriter::write( features, buf );
     return buf.str();
-
 }
 
 void Feature::transform( const SpatialReference* srs )
@@ -0,0 +1,1200 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthFeatures/GeoJSON>
+#include <osgEarth/Notify>
+#include <osgEarth/StringUtils>
+#include <algorithm>
+#include <locale>
+#include <ostream>
+#include <sstream>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LC "[GeoJSON] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Coordinates, flattened. GeoJSON doesn't promise that "type" comes before
+    // "coordinates", so they are held here until the geometry type is known.
+    struct Coords
+    {
+        Coords() : _depth(0) { }
+
+        int                     _depth;    // 1=position, 2=line, 3=lines, 4=polygons
+        std::vector<osg::Vec3d> _points;
+        std::vector<unsigned>   _lineEnds; // end of each line in _points
+        std::vector<unsigned>   _polyEnds; // end of each polygon in _lineEnds
+
+        unsigned lineBegin( unsigned i ) const { return i == 0 ? 0 : _lineEnds[i-1]; }
+        unsigned polyBegin( unsigned i ) const { return i == 0 ? 0 : _polyEnds[i-1]; }
+    };
+
+    // The members of a Feature object, held until the whole object is read.
+    struct FeatureParts
+    {
+        FeatureParts() : _hasID(false), _fid(0L) { }
+
+        osg::ref_ptr<Geometry> _geometry;
+        AttributeTable         _attrs;
+        bool                   _hasID;
+        FeatureID              _fid;
+    };
+
+    // The members of a geometry object.
+    struct GeometryParts
+    {
+        std::string        _type;
+        Coords             _coords;
+        GeometryCollection _geometries;
+    };
+
+    // Powers of ten that are exactly representable as doubles.
+    const double s_pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    // Copies the points of a line, reversing them and removing duplicates the
+    // same way OgrUtils::populate() does.
+    void populate( const Coords& coords, unsigned line, Geometry* target )
+    {
+        unsigned begin = coords.lineBegin(line);
+        unsigned end   = coords._lineEnds[line];
+        target->reserve( end-begin );
+        for( unsigned v = end; v > begin; --v )
+        {
+            const osg::Vec3d& p = coords._points[v-1];
+            if ( target->size() == 0 || p != target->back() )
+                target->push_back( p );
+        }
+    }
+
+    Polygon* createPolygon( const Coords& coords, unsigned firstLine, unsigned endLine )
+    {
+        if ( firstLine >= endLine )
+            return 0L;
+
+        Polygon* poly = new Polygon();
+        populate( coords, firstLine, poly );
+        poly->rewind( Ring::ORIENTATION_CCW );
+
+        for( unsigned line = firstLine+1; line < endLine; ++line )
+        {
+            Ring* hole = new Ring();
+            populate( coords, line, hole );
+            hole->rewind( Ring::ORIENTATION_CW );
+            poly->getHoles().push_back( hole );
+        }
+        return poly;
+    }
+
+    Geometry* createGeometry( GeometryParts& parts )
+    {
+        const std::string& type   = parts._type;
+        const Coords&      coords = parts._coords;
+
+        if ( type == "Point" && coords._depth == 1 )
+        {
+            PointSet* points = new PointSet();
+            points->push_back( coords._points[0] );
+            return points;
+        }
+        else if ( type == "MultiPoint" && coords._depth == 2 )
+        {
+            PointSet* points = new PointSet();
+            populate( coords, 0, points );
+            return points;
+        }
+        else if ( type == "LineString" && coords._depth == 2 )
+        {
+            LineString* line = new LineString();
+            populate( coords, 0, line );
+            return line;
+        }
+        else if ( type == "MultiLineString" && coords._depth == 3 )
+        {
+            MultiGeometry* multi = new MultiGeometry();
+            for( unsigned i = 0; i < coords._lineEnds.size(); ++i )
+            {
+                LineString* line = new LineString();
+                populate( coords, i, line );
+                multi->add( line );
+            }
+            return multi;
+        }
+        else if ( type == "Polygon" && coords._depth == 3 )
+        {
+            return createPolygon( coords, 0, coords._lineEnds.size() );
+        }
+        else if ( type == "MultiPolygon" && coords._depth == 4 )
+        {
+            MultiGeometry* multi = new MultiGeometry();
+            for( unsigned i = 0; i < coords._polyEnds.size(); ++i )
+            {
+                Polygon* poly = createPolygon( coords, coords.polyBegin(i), coords._polyEnds[i] );
+                if ( poly )
+                    multi->add( poly );
+            }
+            return multi;
+        }
+        else if ( type == "GeometryCollection" )
+        {
+            return new MultiGeometry( parts._geometries );
+        }
+
+        return 0L;
+    }
+
+    /**
+     * Single-pass recursive descent parser. Each parse method leaves the cursor
+     * just past the value it read, or records an error and returns false.
+     */
+    class Parser
+    {
+    public:
+        Parser(const char* begin, const char* end, const SpatialReference* srs) :
+          _begin(begin), _p(begin), _end(end), _srs(srs), _count(0L) { }
+
+        const std::string& error() const { return _error; }
+
+        bool readDocument( FeatureList& out_features )
+        {
+            if ( !expect('{') )
+                return false;
+
+            // The top level may be a FeatureCollection, a Feature or a Geometry.
+            std::string   type;
+            FeatureParts  feature;
+            GeometryParts geometry;
+            std::string   key;
+            bool          first = true;
+
+            while( nextMember(first, key) )
+            {
+                if ( key == "type" )
+                {
+                    if ( !readString(type) ) return false;
+                }
+                else if ( key == "features" )
+                {
+                    if ( !readFeatures(out_features) ) return false;
+                }
+                else if ( !readFeatureMember(key, feature) && !readGeometryMember(key, geometry) )
+                {
+                    if ( !skipValue() ) return false;
+                }
+                if ( !_error.empty() ) return false;
+            }
+            if ( !_error.empty() )
+                return false;
+
+            if ( type == "Feature" )
+            {
+                out_features.push_back( createFeature(feature) );
+            }
+            else if ( !type.empty() && type != "FeatureCollection" )
+            {
+                geometry._type = type;
+                osg::ref_ptr<Geometry> geom = createGeometry( geometry );
+                if ( !geom.valid() )
+                    return fail( "Unsupported or malformed GeoJSON object \"" + type + "\"" );
+                out_features.push_back( new Feature(geom.get(), _srs, Style(), _count++) );
+            }
+
+            return true;
+        }
+
+        Geometry* readGeometryDocument()
+        {
+            osg::ref_ptr<Geometry> geom;
+            readGeometry( geom );
+            return _error.empty() ? geom.release() : 0L;
+        }
+
+    private:
+        bool readFeatures( FeatureList& out_features )
+        {
+            if ( !expect('[') )
+                return false;
+
+            bool first = true;
+            while( nextElement(first) )
+            {
+                FeatureParts parts;
+                if ( !expect('{') )
+                    return false;
+
+                std::string key;
+                bool firstMember = true;
+                while( nextMember(firstMember, key) )
+                {
+                    if ( !readFeatureMember(key, parts) && !skipValue() )
+                        return false;
+                    if ( !_error.empty() )
+                        return false;
+                }
+                if ( !_error.empty() )
+                    return false;
+
+                out_features.push_back( createFeature(parts) );
+            }
+            return _error.empty();
+        }
+
+        // Reads the value of a Feature member; returns false if the key isn't one.
+        bool readFeatureMember( const std::string& key, FeatureParts& parts )
+        {
+            if ( key == "geometry" )
+            {
+                readGeometry( parts._geometry );
+            }
+            else if ( key == "properties" )
+            {
+                readProperties( parts._attrs );
+            }
+            else if ( key == "id" )
+            {
+                ws();
+                if ( _p < _end && *_p == '"' )
+                {
+                    std::string id;
+                    if ( readString(id) && !id.empty() )
+                    {
+                        char* e = 0L;
+                        unsigned long fid = ::strtoul( id.c_str(), &e, 10 );
+                        if ( e && *e == 0 )
+                        {
+                            parts._fid   = fid;
+                            parts._hasID = true;
+                        }
+                    }
+                }
+                else if ( _p < _end && (*_p == '-' || (*_p >= '0' && *_p <= '9')) )
+                {
+                    double value;
+                    bool   isInt;
+                    if ( readNumber(value, isInt) && value >= 0.0 )
+                    {
+                        parts._fid   = (FeatureID)value;
+                        parts._hasID = true;
+                    }
+                }
+                else
+                {
+                    skipValue();
+                }
+            }
+            else
+            {
+                return false;
+            }
+            return true;
+        }
+
+        // Reads the value of a geometry member; returns false if the key isn't one.
+        bool readGeometryMember( const std::string& key, GeometryParts& parts )
+        {
+            if ( key == "coordinates" )
+            {
+                int depth = readCoords( parts._coords );
+                if ( depth > 0 )
+                    parts._coords._depth = depth;
+            }
+            else if ( key == "geometries" )
+            {
+                if ( !expect('[') )
+                    return true;
+
+                bool first = true;
+                while( nextElement(first) )
+                {
+                    osg::ref_ptr<Geometry> geom;
+                    if ( !readGeometry(geom) )
+                        return true;
+                    if ( geom.valid() )
+                        parts._geometries.push_back( geom.get() );
+                }
+            }
+            else
+            {
+                return false;
+            }
+            return true;
+        }
+
+        Feature* createFeature( FeatureParts& parts )
+        {
+            // like OGR, number features in order when they don't carry their own id.
+            FeatureID fid = parts._hasID ? parts._fid : _count;
+            ++_count;
+
+            Feature* feature = new Feature( parts._geometry.get(), _srs, Style(), fid );
+
+            for( AttributeTable::const_iterator i = parts._attrs.begin(); i != parts._attrs.end(); ++i )
+            {
+                const AttributeValue& a = i->second;
+                if ( !a.second.set )
+                    feature->setNull( i->first, a.first );
+                else if ( a.first == ATTRTYPE_INT )
+                    feature->set( i->first, a.second.intValue );
+                else if ( a.first == ATTRTYPE_DOUBLE )
+                    feature->set( i->first, a.second.doubleValue );
+                else if ( a.first == ATTRTYPE_BOOL )
+                    feature->set( i->first, a.second.boolValue );
+                else
+                    feature->set( i->first, a.second.stringValue );
+            }
+
+            return feature;
+        }
+
+        // Reads a geometry object (or null).
+        bool readGeometry( osg::ref_ptr<Geometry>& out_geom )
+        {
+            ws();
+            if ( _p < _end && *_p == 'n' )
+                return readLiteral( "null" );
+
+            if ( !expect('{') )
+                return false;
+
+            GeometryParts parts;
+            std::string   key;
+            bool          first = true;
+            while( nextMember(first, key) )
+            {
+                if ( key == "type" )
+                {
+                    if ( !readString(parts._type) ) return false;
+                }
+                else if ( !readGeometryMember(key, parts) && !skipValue() )
+                {
+                    return false;
+                }
+                if ( !_error.empty() )
+                    return false;
+            }
+            if ( !_error.empty() )
+                return false;
+
+            out_geom = createGeometry( parts );
+            if ( !out_geom.valid() )
+            {
+                OE_DEBUG << LC << "Skipped unsupported or empty geometry \"" << parts._type << "\"" << std::endl;
+            }
+            return true;
+        }
+
+        // Reads a (nested) coordinates array. Returns its depth, 0 if it was
+        // empty, or -1 on error.
+        int readCoords( Coords& coords )
+        {
+            if ( !expect('[') )
+                return -1;
+
+            ws();
+            if ( _p < _end && *_p != '[' && *_p != ']' )
+            {
+                // a position: two or three numbers (any more are ignored).
+                osg::Vec3d p;
+                unsigned   n = 0;
+                bool       first = true;
+                while( nextElement(first) )
+                {
+                    double value;
+                    bool   isInt;
+                    if ( !readNumber(value, isInt) )
+                        return -1;
+                    if ( n < 3 )
+                        p[n] = value;
+                    ++n;
+                }
+                if ( !_error.empty() )
+                    return -1;
+                if ( n < 2 )
+                {
+                    fail( "Position has fewer than two coordinates" );
+                    return -1;
+                }
+                coords._points.push_back( p );
+                return 1;
+            }
+
+            int  depth = 0;
+            bool first = true;
+            while( nextElement(first) )
+            {
+                int childDepth = readCoords( coords );
+                if ( childDepth < 0 )
+                    return -1;
+
+                if ( childDepth > 0 )
+                {
+                    if ( depth > 0 && childDepth != depth )
+                    {
+                        fail( "Inconsistent nesting of coordinates" );
+                        return -1;
+                    }
+                    depth = childDepth;
+                }
+            }
+            if ( !_error.empty() )
+                return -1;
+
+            if ( depth == 1 )
+                coords._lineEnds.push_back( coords._points.size() );
+            else if ( depth == 2 )
+                coords._polyEnds.push_back( coords._lineEnds.size() );
+
+            return depth > 0 ? depth+1 : 0;
+        }
+
+        bool readProperties( AttributeTable& attrs )
+        {
+            ws();
+            if ( _p < _end && *_p == 'n' )
+                return readLiteral( "null" );
+
+            if ( !expect('{') )
+                return false;
+
+            std::string key;
+            bool first = true;
+            while( nextMember(first, key) )
+            {
+                // OGR lower-cases attribute names, so we do too.
+                std::transform( key.begin(), key.end(), key.begin(), ::tolower );
+                AttributeValue& a = attrs[key];
+                a.second.set = true;
+
+                ws();
+                char c = _p < _end ? *_p : 0;
+                if ( c == '"' )
+                {
+                    a.first = ATTRTYPE_STRING;
+                    if ( !readString(a.second.stringValue) ) return false;
+                }
+                else if ( c == 't' || c == 'f' )
+                {
+                    a.first = ATTRTYPE_BOOL;
+                    a.second.boolValue = (c == 't');
+                    if ( !readLiteral(c == 't' ? "true" : "false") ) return false;
+                }
+                else if ( c == 'n' )
+                {
+                    a.first = ATTRTYPE_STRING;
+                    a.second.set = false;
+                    if ( !readLiteral("null") ) return false;
+                }
+                else if ( c == '{' || c == '[' )
+                {
+                    // nested values are kept as JSON text, as OGR does.
+                    const char* start = _p;
+                    if ( !skipValue() ) return false;
+                    a.first = ATTRTYPE_STRING;
+                    a.second.stringValue.assign( start, _p );
+                }
+                else
+                {
+                    double value;
+                    bool   isInt;
+                    if ( !readNumber(value, isInt) ) return false;
+                    if ( isInt )
+                    {
+                        a.first = ATTRTYPE_INT;
+                        a.second.intValue = (int)value;
+                    }
+                    else
+                    {
+                        a.first = ATTRTYPE_DOUBLE;
+                        a.second.doubleValue = value;
+                    }
+                }
+            }
+            return _error.empty();
+        }
+
+    private: // tokens
+
+        bool fail( const std::string& msg )
+        {
+            if ( _error.empty() )
+                _error = Stringify() << msg << " (at offset " << (_p - _begin) << ")";
+            return false;
+        }
+
+        void ws()
+        {
+            while( _p < _end && (*_p == ' ' || *_p == '\n' || *_p == '\r' || *_p == '\t') )
+                ++_p;
+        }
+
+        bool expect( char c )
+        {
+            ws();
+            if ( _p < _end && *_p == c )
+            {
+                ++_p;
+                return true;
+            }
+            return fail( Stringify() << "Expected '" << c << "'" );
+        }
+
+        // Advances to the next member of an object, reading its key. Returns false
+        // at the end of the object or on an error.
+        bool nextMember( bool& first, std::string& out_key )
+        {
+            ws();
+            if ( _p < _end && *_p == '}' )
+            {
+                ++_p;
+                return false;
+            }
+            if ( !first && !expect(',') )
+                return false;
+            first = false;
+            return readString(out_key) && expect(':');
+        }
+
+        // Advances to the next element of an array. Returns false at the end of
+        // the array or on an error.
+        bool nextElement( bool& first )
+        {
+            ws();
+            if ( _p < _end && *_p == ']' )
+            {
+                ++_p;
+                return false;
+            }
+            if ( !first && !expect(',') )
+                return false;
+            first = false;
+            return true;
+        }
+
+        bool readLiteral( const char* literal )
+        {
+            ws();
+            const char* p = _p;
+            for( ; *literal; ++literal, ++p )
+            {
+                if ( p >= _end || *p != *literal )
+                    return fail( "Invalid literal" );
+            }
+            _p = p;
+            return true;
+        }
+
+        bool readString( std::string& out )
+        {
+            if ( !expect('"') )
+                return false;
+
+            // fast path: no escapes.
+            const char* start = _p;
+            while( _p < _end && *_p != '"' && *_p != '\\' )
+                ++_p;
+            out.assign( start, _p );
+
+            while( _p < _end && *_p != '"' )
+            {
+                if ( *_p != '\\' )
+                {
+                    out.push_back( *_p++ );
+                    continue;
+                }
+
+                if ( ++_p >= _end )
+                    break;
+
+                char c = *_p++;
+                switch( c )
+                {
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'u':
+                    {
+                        unsigned cp;
+                        if ( !readHex4(cp) )
+                            return false;
+
+                        // combine a surrogate pair:
+                        if ( cp >= 0xD800 && cp <= 0xDBFF && _end-_p >= 6 && _p[0] == '\\' && _p[1] == 'u' )
+                        {
+                            _p += 2;
+                            unsigned lo;
+                            if ( !readHex4(lo) )
+                                return false;
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        }
+                        appendUTF8( cp, out );
+                    }
+                    break;
+                default: out.push_back(c); break; // quote, backslash, slash
+                }
+            }
+
+            if ( _p >= _end )
+                return fail( "Unterminated string" );
+
+            ++_p; // closing quote
+            return true;
+        }
+
+        bool readHex4( unsigned& out )
+        {
+            if ( _end - _p < 4 )
+                return fail( "Truncated unicode escape" );
+
+            out = 0;
+            for( int i = 0; i < 4; ++i, ++_p )
+            {
+                char c = *_p;
+                out <<= 4;
+                if      ( c >= '0' && c <= '9' ) out |= (c - '0');
+                else if ( c >= 'a' && c <= 'f' ) out |= (c - 'a' + 10);
+                else if ( c >= 'A' && c <= 'F' ) out |= (c - 'A' + 10);
+                else return fail( "Invalid unicode escape" );
+            }
+            return true;
+        }
+
+        static void appendUTF8( unsigned cp, std::string& out )
+        {
+            if ( cp < 0x80 )
+            {
+                out.push_back( (char)cp );
+            }
+            else if ( cp < 0x800 )
+            {
+                out.push_back( (char)(0xC0 | (cp >> 6)) );
+                out.push_back( (char)(0x80 | (cp & 0x3F)) );
+            }
+            else if ( cp < 0x10000 )
+            {
+                out.push_back( (char)(0xE0 | (cp >> 12)) );
+                out.push_back( (char)(0x80 | ((cp >> 6) & 0x3F)) );
+                out.push_back( (char)(0x80 | (cp & 0x3F)) );
+            }
+            else
+            {
+                out.push_back( (char)(0xF0 | (cp >> 18)) );
+                out.push_back( (char)(0x80 | ((cp >> 12) & 0x3F)) );
+                out.push_back( (char)(0x80 | ((cp >> 6) & 0x3F)) );
+                out.push_back( (char)(0x80 | (cp & 0x3F)) );
+            }
+        }
+
+        // Reads a number without going through the process locale. Up to 15
+        // significant digits with a small exponent (nearly every coordinate) are
+        // converted exactly here; anything else goes to a stream in the classic
+        // locale, so a decimal comma locale can't cut the number short.
+        bool readNumber( double& out, bool& out_isInt )
+        {
+            ws();
+
+            bool negative = false;
+            if ( _p < _end && *_p == '-' )
+            {
+                negative = true;
+                ++_p;
+            }
+            const char* start = _p;
+
+            double   mantissa = 0.0;
+            int      digits   = 0;
+            int      scale    = 0;
+            const char* intStart = _p;
+
+            while( _p < _end && *_p >= '0' && *_p <= '9' )
+            {
+                if ( digits < 15 )
+                {
+                    mantissa = mantissa*10.0 + (*_p - '0');
+                    if ( mantissa > 0.0 ) ++digits;
+                }
+                else
+                {
+                    ++scale, ++digits;
+                }
+                ++_p;
+            }
+
+            if ( _p == intStart )
+                return fail( "Invalid number" );
+
+            out_isInt = true;
+
+            if ( _p < _end && *_p == '.' )
+            {
+                out_isInt = false;
+                ++_p;
+                while( _p < _end && *_p >= '0' && *_p <= '9' )
+                {
+                    if ( digits < 15 )
+                    {
+                        mantissa = mantissa*10.0 + (*_p - '0');
+                        --scale;
+                        if ( mantissa > 0.0 ) ++digits;
+                    }
+                    else
+                    {
+                        ++digits;
+                    }
+                    ++_p;
+                }
+            }
+
+            int exponent = 0;
+            if ( _p < _end && (*_p == 'e' || *_p == 'E') )
+            {
+                out_isInt = false;
+                ++_p;
+                bool negExp = false;
+                if ( _p < _end && (*_p == '+' || *_p == '-') )
+                {
+                    negExp = (*_p == '-');
+                    ++_p;
+                }
+                while( _p < _end && *_p >= '0' && *_p <= '9' )
+                {
+                    if ( exponent < 10000 )
+                        exponent = exponent*10 + (*_p - '0');
+                    ++_p;
+                }
+                if ( negExp )
+                    exponent = -exponent;
+            }
+
+            scale += exponent;
+
+            if ( digits <= 15 && scale >= -22 && scale <= 22 )
+            {
+                out = scale < 0 ? mantissa / s_pow10[-scale] : mantissa * s_pow10[scale];
+            }
+            else
+            {
+                // the sign is already taken off; it's applied below.
+                std::istringstream token( std::string(start, _p) );
+                token.imbue( std::locale::classic() );
+                if ( !(token >> out) )
+                {
+                    // out of double range
+                    out = scale > 0 ? HUGE_VAL : 0.0;
+                }
+            }
+
+            if ( negative )
+                out = -out;
+
+            if ( out_isInt && (out < (double)INT_MIN || out > (double)INT_MAX) )
+                out_isInt = false;
+
+            return true;
+        }
+
+        // Skips over any value.
+        bool skipValue()
+        {
+            ws();
+            if ( _p >= _end )
+                return fail( "Unexpected end of input" );
+
+            char c = *_p;
+            if ( c == '"' )
+            {
+                ++_p;
+                while( _p < _end && *_p != '"' )
+                {
+                    if ( *_p == '\\' ) ++_p;
+                    ++_p;
+                }
+                if ( _p >= _end )
+                    return fail( "Unterminated string" );
+                ++_p;
+                return true;
+            }
+            else if ( c == '{' )
+            {
+                ++_p;
+                std::string key;
+                bool first = true;
+                while( nextMember(first, key) )
+                {
+                    if ( !skipValue() ) return false;
+                }
+                return _error.empty();
+            }
+            else if ( c == '[' )
+            {
+                ++_p;
+                bool first = true;
+                while( nextElement(first) )
+                {
+                    if ( !skipValue() ) return false;
+                }
+                return _error.empty();
+            }
+            else if ( c == 't' ) return readLiteral( "true" );
+            else if ( c == 'f' ) return readLiteral( "false" );
+            else if ( c == 'n' ) return readLiteral( "null" );
+            else
+            {
+                double value;
+                bool   isInt;
+                return readNumber( value, isInt );
+            }
+        }
+
+    private:
+        const char*             _begin;
+        const char*             _p;
+        const char*             _end;
+        const SpatialReference* _srs;
+        FeatureID               _count;
+        std::string             _error;
+    };
+}
+
+//------------------------------------------------------------------------
+
+GeoJSONReader::GeoJSONReader( const SpatialReference* srs ) :
+_srs( srs )
+{
+    //nop
+}
+
+bool
+GeoJSONReader::read( const std::string& buffer, FeatureList& out_features )
+{
+    return read( buffer.data(), buffer.data() + buffer.size(), out_features );
+}
+
+bool
+GeoJSONReader::read( const char* begin, const char* end, FeatureList& out_features )
+{
+    Parser parser( begin, end, _srs.get() );
+    bool ok = parser.readDocument( out_features );
+    _error = parser.error();
+    return ok;
+}
+
+Geometry*
+GeoJSONReader::readGeometry( const std::string& buffer )
+{
+    Parser parser( buffer.data(), buffer.data() + buffer.size(), _srs.get() );
+    Geometry* geom = parser.readGeometryDocument();
+    _error = parser.error();
+    return geom;
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    void writeNumber( std::ostream& out, double value )
+    {
+        char buf[32];
+        sprintf( buf, "%.15g", value );
+        out << buf;
+    }
+
+    // Doubles always get a decimal point so they read back as doubles.
+    void writeDouble( std::ostream& out, double value )
+    {
+        if ( value != value || value > DBL_MAX || value < -DBL_MAX )
+        {
+            out << "null";
+            return;
+        }
+
+        char buf[32];
+        sprintf( buf, "%.15g", value );
+        out << buf;
+        if ( !strpbrk(buf, ".eE") )
+            out << ".0";
+    }
+
+    void writeString( std::ostream& out, const std::string& value )
+    {
+        out << '"';
+        for( std::string::const_iterator i = value.begin(); i != value.end(); ++i )
+        {
+            unsigned char c = (unsigned char)*i;
+            switch( c )
+            {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\b': out << "\\b";  break;
+            case '\f': out << "\\f";  break;
+            case '\n': out << "\\n";  break;
+            case '\r': out << "\\r";  break;
+            case '\t': out << "\\t";  break;
+            default:
+                if ( c < 0x20 )
+                {
+                    char buf[8];
+                    sprintf( buf, "\\u%04x", c );
+                    out << buf;
+                }
+                else
+                {
+                    out << *i;
+                }
+            }
+        }
+        out << '"';
+    }
+
+    bool hasZ( const Geometry* geom )
+    {
+        ConstGeometryIterator i( geom, true );
+        while( i.hasMore() )
+        {
+            const Geometry* part = i.next();
+            for( Geometry::const_iterator p = part->begin(); p != part->end(); ++p )
+                if ( p->z() != 0.0 )
+                    return true;
+        }
+        return false;
+    }
+
+    void writePosition( std::ostream& out, const osg::Vec3d& p, bool z )
+    {
+        out << '[';
+        writeNumber( out, p.x() );
+        out << ',';
+        writeNumber( out, p.y() );
+        if ( z )
+        {
+            out << ',';
+            writeNumber( out, p.z() );
+        }
+        out << ']';
+    }
+
+    // Points and lines are written in reverse, as OGR does, so that they
+    // read back in their original order.
+    void writeLine( std::ostream& out, const Geometry* geom, bool z )
+    {
+        out << '[';
+        for( unsigned i = geom->size(); i > 0; --i )
+        {
+            if ( i < geom->size() ) out << ',';
+            writePosition( out, (*geom)[i-1], z );
+        }
+        out << ']';
+    }
+
+    // Rings are written closed and in their own orientation (outer CCW,
+    // holes CW), per the GeoJSON spec.
+    void writeRing( std::ostream& out, const Geometry* ring, bool z )
+    {
+        out << '[';
+        for( unsigned i = 0; i < ring->size(); ++i )
+        {
+            if ( i > 0 ) out << ',';
+            writePosition( out, (*ring)[i], z );
+        }
+        if ( ring->size() > 0 && ring->front() != ring->back() )
+        {
+            out << ',';
+            writePosition( out, ring->front(), z );
+        }
+        out << ']';
+    }
+
+    void writePolygon( std::ostream& out, const Geometry* geom, bool z )
+    {
+        out << '[';
+        writeRing( out, geom, z );
+        const Polygon* poly = dynamic_cast<const Polygon*>( geom );
+        if ( poly )
+        {
+            for( RingCollection::const_iterator h = poly->getHoles().begin(); h != poly->getHoles().end(); ++h )
+            {
+                out << ',';
+                writeRing( out, h->get(), z );
+            }
+        }
+        out << ']';
+    }
+
+    void writeGeometry( std::ostream& out, const Geometry* geom, bool z )
+    {
+        switch( geom->getType() )
+        {
+        case Geometry::TYPE_POINTSET:
+            if ( geom->size() == 1 )
+            {
+                out << "{\"type\":\"Point\",\"coordinates\":";
+                writePosition( out, geom->front(), z );
+            }
+            else
+            {
+                out << "{\"type\":\"MultiPoint\",\"coordinates\":";
+                writeLine( out, geom, z );
+            }
+            out << '}';
+            break;
+
+        case Geometry::TYPE_LINESTRING:
+            out << "{\"type\":\"LineString\",\"coordinates\":";
+            writeLine( out, geom, z );
+            out << '}';
+            break;
+
+        case Geometry::TYPE_RING:
+        case Geometry::TYPE_POLYGON:
+            out << "{\"type\":\"Polygon\",\"coordinates\":";
+            writePolygon( out, geom, z );
+            out << '}';
+            break;
+
+        case Geometry::TYPE_MULTI:
+            {
+                const GeometryCollection& parts = static_cast<const MultiGeometry*>(geom)->getComponents();
+
+                // use a Multi* type when all the parts agree, and a collection otherwise.
+                Geometry::Type type = parts.empty() ? Geometry::TYPE_UNKNOWN : parts.front()->getType();
+                if ( type == Geometry::TYPE_RING )
+                    type = Geometry::TYPE_POLYGON;
+                for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+                {
+                    Geometry::Type t = i->get()->getType();
+                    if ( t == Geometry::TYPE_RING ) t = Geometry::TYPE_POLYGON;
+                    if ( t != type || t == Geometry::TYPE_MULTI )
+                        type = Geometry::TYPE_UNKNOWN;
+                }
+
+                if ( type == Geometry::TYPE_POINTSET )
+                {
+                    out << "{\"type\":\"MultiPoint\",\"coordinates\":[";
+                    bool first = true;
+                    for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+                    {
+                        const Geometry* part = i->get();
+                        for( unsigned p = part->size(); p > 0; --p )
+                        {
+                            if ( !first ) out << ',';
+                            writePosition( out, (*part)[p-1], z );
+                            first = false;
+                        }
+                    }
+                    out << "]}";
+                }
+                else if ( type == Geometry::TYPE_LINESTRING || type == Geometry::TYPE_POLYGON )
+                {
+                    out << (type == Geometry::TYPE_LINESTRING ?
+                        "{\"type\":\"MultiLineString\",\"coordinates\":[" :
+                        "{\"type\":\"MultiPolygon\",\"coordinates\":[");
+                    for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+                    {
+                        if ( i != parts.begin() ) out << ',';
+                        if ( type == Geometry::TYPE_LINESTRING )
+                            writeLine( out, i->get(), z );
+                        else
+                            writePolygon( out, i->get(), z );
+                    }
+                    out << "]}";
+                }
+                else
+                {
+                    out << "{\"type\":\"GeometryCollection\",\"geometries\":[";
+                    for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+                    {
+                        if ( i != parts.begin() ) out << ',';
+                        writeGeometry( out, i->get(), z );
+                    }
+                    out << "]}";
+                }
+            }
+            break;
+
+        default:
+            out << "null";
+        }
+    }
+
+    void writeProperties( std::ostream& out, const AttributeTable& attrs )
+    {
+        out << '{';
+        for( AttributeTable::const_iterator i = attrs.begin(); i != attrs.end(); ++i )
+        {
+            if ( i != attrs.begin() ) out << ',';
+            writeString( out, i->first );
+            out << ':';
+
+            const AttributeValue& a = i->second;
+            if ( !a.second.set )
+                out << "null";
+            else if ( a.first == ATTRTYPE_INT )
+                out << a.getInt();
+            else if ( a.first == ATTRTYPE_DOUBLE )
+                writeDouble( out, a.getDouble() );
+            else if ( a.first == ATTRTYPE_BOOL )
+                out << (a.getBool() ? "true" : "false");
+            else
+                writeString( out, a.getString() );
+        }
+        out << '}';
+    }
+}
+
+void
+GeoJSONWriter::write( const Geometry* geometry, std::ostream& out )
+{
+    if ( geometry )
+        writeGeometry( out, geometry, hasZ(geometry) );
+    else
+        out << "null";
+}
+
+void
+GeoJSONWriter::write( const Feature* feature, std::ostream& out )
+{
+    out << "{\"type\":\"Feature\",\"id\":" << feature->getFID() << ",\"geometry\":";
+    write( feature->getGeometry(), out );
+    out << ",\"properties\":";
+    writeProperties( out, feature->getAttrs() );
+    out << '}';
+}
+
+void
+GeoJSONWriter::write( const FeatureList& features, std::ostream& out )
+{
+    out << "{\"type\":\"FeatureCollection\",\"features\":[";
+    for( FeatureList::const_iterator i = features.begin(); i != features.end(); ++i )
+    {
+        if ( i != features.begin() ) out << ',';
+        write( i->get(), out );
+    }
+    out << "]}";
+}
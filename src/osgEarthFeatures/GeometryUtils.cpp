@@ -18,6 +18,7 @@
 */
 
 #include <osgEarthFeatures/GeometryUtils>
+#include <osgEarthFeatures/GeoJSON>
 #include <osgEarthFeatures/OgrUtils>
 
 using namespace osgEarth::Features;
@@ -44,18 +45,12 @@ osgEarth::Features::GeometryUtils::geometryToWKT( Geometry* geometry )
 std::string 
 osgEarth::Features::GeometryUtils::geometryToGeoJSON( Geometry* geometry )
 {
-    OGRGeometryH g = OgrUtils::createOgrGeometry( geometry );
     std::string result;
-    if (g)
+    if (geometry)
     {
-        char* buf;   
-        buf = OGR_G_ExportToJson( g );
-        if (buf)
-        {
-            result = std::string(buf);
-            OGRFree( buf );
-        }
-        OGR_G_DestroyGeometry( g );
+        std::stringstream buf;
+        GeoJSONWriter::write( geometry, buf );
+        result = buf.str();
     }
     return result;
 }
@@ -18,20 +18,40 @@
 */
 #include <osgEarthUtil/DataScanner>
 #include <osgEarthDrivers/gdal/GDALOptions>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/URI>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <OpenThreads/Thread>
+#include <gdal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
 
 #define LC "[DataScanner] "
 
+#define INDEX_HEADER "osgEarth.DataScanner.Index 2"
+
 using namespace osgEarth;
 using namespace osgEarth::Util;
 using namespace osgEarth::Drivers;
 
 namespace
 {
+    typedef std::map<std::string, DataScanner::Record> RecordMap;
+
     void traverse(const std::string&              path,
                   const std::vector<std::string>& extensions,
-                  ImageLayerVector&               out_imageLayers)
+                  DataScanner::RecordVector&      out_records)
     {
         if ( osgDB::fileType(path) == osgDB::DIRECTORY )
         {
@@ -42,7 +62,7 @@ namespace
                     continue;
 
                 std::string filepath = osgDB::concatPaths( path, *f );
-                traverse( filepath, extensions, out_imageLayers );
+                traverse( filepath, extensions, out_records );
             }
         }
 
@@ -52,26 +72,592 @@ namespace
 
             if ( std::find(extensions.begin(), extensions.end(), ext) != extensions.end() )
             {
-                GDALOptions gdal;
-                gdal.url() = path;
-                //gdal.interpolation() = INTERP_NEAREST;
+                DataScanner::Record record;
+                record._path = path;
+
+                struct stat info;
+                if ( ::stat(path.c_str(), &info) == 0 )
+                {
+                    record._modified = (long long)info.st_mtime;
+                    record._size     = (long long)info.st_size;
+                }
+
+                out_records.push_back( record );
+            }
+        }
+    }
+
+    // Whether a path is the root itself or lies somewhere beneath it; a plain
+    // prefix test would also match "/data/img2" for the root "/data/img".
+    bool isUnderRoot( const std::string& path, const std::string& root )
+    {
+        if ( path.compare(0, root.size(), root) != 0 )
+            return false;
+
+        if ( path.size() == root.size() || root.empty() )
+            return true;
+
+        char last = root[root.size()-1];
+        char next = path[root.size()];
+        return last == '/' || last == '\\' || next == '/' || next == '\\';
+    }
+
+    // Opens a file with GDAL and records its georeferencing and layout.
+    void probe( DataScanner::Record& r )
+    {
+        r._valid = false;
+
+        bool georeferenced = false;
+        bool hasBands      = false;
+
+        // Each probe has a dataset of its own, which GDAL lets threads use
+        // side by side, so the open, the reads and the close run unlocked.
+        // Only the projection goes through the global GDAL lock, since drivers
+        // build it with the shared OSR machinery.
+        {
+            GDALDatasetH ds = GDALOpen( r._path.c_str(), GA_ReadOnly );
+            if ( !ds )
+            {
+                OE_INFO << LC << "Cannot open " << r._path << std::endl;
+                return;
+            }
+
+            {
+                GDAL_SCOPED_LOCK;
+                const char* proj = GDALGetProjectionRef( ds );
+                if ( proj && strlen(proj) > 0 )
+                    r._srs = proj;
+            }
+
+            georeferenced =
+                GDALGetGeoTransform( ds, r._geoTransform ) == CE_None &&
+                r._geoTransform[2] == 0.0 &&
+                r._geoTransform[4] == 0.0 &&
+                r._geoTransform[5] < 0.0;
+
+            hasBands = GDALGetRasterCount(ds) > 0;
+            if ( georeferenced && hasBands )
+            {
+                GDALRasterBandH band = GDALGetRasterBand( ds, 1 );
+
+                int blockWidth, blockHeight, hasNoData;
+                GDALGetBlockSize( band, &blockWidth, &blockHeight );
+
+                r._width       = GDALGetRasterXSize( ds );
+                r._height      = GDALGetRasterYSize( ds );
+                r._bands       = GDALGetRasterCount( ds );
+                r._dataType    = (int)GDALGetRasterDataType( band );
+                r._blockWidth  = blockWidth;
+                r._blockHeight = blockHeight;
+                r._paletted    = GDALGetRasterColorInterpretation( band ) == GCI_PaletteIndex;
+                r._noData      = GDALGetRasterNoDataValue( band, &hasNoData );
+                r._hasNoData   = hasNoData != 0;
+            }
+
+            GDALClose( ds );
+        }
+
+        if ( r._srs.empty() )
+        {
+            std::string prjLocation = osgDB::getNameLessExtension(r._path) + ".prj";
+            ReadResult rr = URI(prjLocation).readString();
+            if ( rr.succeeded() )
+                r._srs = rr.getString();
+        }
+
+        if ( georeferenced && hasBands && !r._srs.empty() )
+        {
+            r._valid = true;
+        }
+        else
+        {
+            OE_INFO << LC << "Skipping " << r._path << " (no supported georeferencing)" << std::endl;
+        }
+    }
+
+    // State shared by the probing threads.
+    struct ProbeState
+    {
+        std::vector<DataScanner::Record*> _records;
+        unsigned                          _next;
+        Threading::Mutex                  _mutex;
+
+        ProbeState() : _next(0u) { }
+
+        DataScanner::Record* next()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _next < _records.size() ? _records[_next++] : 0L;
+        }
+    };
+
+    // One probing thread: pulls files off the shared list until it's empty.
+    struct ProbeFiles
+    {
+        ProbeState* _state;
+
+        ProbeFiles() : _state(0L) { }
+
+        void execute()
+        {
+            DataScanner::Record* r;
+            while( (r = _state->next()) != 0L )
+                probe( *r );
+        }
+    };
+
+    std::string escapeXML( const std::string& in )
+    {
+        std::string out;
+        out.reserve( in.size() );
+        for( std::string::const_iterator c = in.begin(); c != in.end(); ++c )
+        {
+            if      ( *c == '&' )  out += "&amp;";
+            else if ( *c == '<' )  out += "&lt;";
+            else if ( *c == '>' )  out += "&gt;";
+            else if ( *c == '"' )  out += "&quot;";
+            else                   out += *c;
+        }
+        return out;
+    }
+
+    // SRS's are stored one per line, but a WKT may be pretty-printed over
+    // several; so backslashes, newlines and tabs are escaped.
+    std::string escapeLine( const std::string& in )
+    {
+        std::string out;
+        out.reserve( in.size() );
+        for( std::string::const_iterator c = in.begin(); c != in.end(); ++c )
+        {
+            if      ( *c == '\\' ) out += "\\\\";
+            else if ( *c == '\n' ) out += "\\n";
+            else if ( *c == '\r' ) out += "\\r";
+            else if ( *c == '\t' ) out += "\\t";
+            else                   out += *c;
+        }
+        return out;
+    }
+
+    std::string unescapeLine( const std::string& in )
+    {
+        std::string out;
+        out.reserve( in.size() );
+        for( std::string::const_iterator c = in.begin(); c != in.end(); ++c )
+        {
+            if ( *c == '\\' && c+1 != in.end() )
+            {
+                ++c;
+                if      ( *c == 'n' ) out += '\n';
+                else if ( *c == 'r' ) out += '\r';
+                else if ( *c == 't' ) out += '\t';
+                else                  out += *c;
+            }
+            else out += *c;
+        }
+        return out;
+    }
 
-                ImageLayerOptions options( path, gdal );
-                options.cachePolicy() = CachePolicy::NO_CACHE;
+    // Index file: a header line, then one "S" line per distinct SRS followed
+    // by one "F" line per file, all tab-separated. SRS's are stored once
+    // since a large archive typically has very few of them.
+    void readIndex( const std::string& indexFile, RecordMap& out_records )
+    {
+        std::ifstream in( indexFile.c_str() );
+        if ( !in.is_open() )
+            return;
 
-                ImageLayer* layer = new ImageLayer(options);
-                out_imageLayers.push_back( layer );
-                OE_INFO << LC << "Found " << path << std::endl;
+        std::string line;
+        if ( !std::getline(in, line) || trim(line) != INDEX_HEADER )
+        {
+            OE_WARN << LC << "Ignoring unrecognized index file " << indexFile << std::endl;
+            return;
+        }
+
+        std::vector<std::string> srsTable;
+
+        while( std::getline(in, line) )
+        {
+            if ( line.size() < 2 )
+                continue;
+
+            if ( line[0] == 'S' )
+            {
+                srsTable.push_back( unescapeLine(line.substr(2)) );
+            }
+            else if ( line[0] == 'F' )
+            {
+                // the path comes last, so it may contain anything but a newline.
+                std::istringstream buf( line.substr(2) );
+                DataScanner::Record r;
+                int valid, srs, paletted, hasNoData;
+                buf >> r._modified >> r._size >> valid >> srs
+                    >> r._geoTransform[0] >> r._geoTransform[1] >> r._geoTransform[2]
+                    >> r._geoTransform[3] >> r._geoTransform[4] >> r._geoTransform[5]
+                    >> r._width >> r._height >> r._bands >> r._dataType
+                    >> r._blockWidth >> r._blockHeight >> paletted >> hasNoData >> r._noData;
+
+                if ( buf.fail() || buf.get() != '\t' )
+                    continue;
+
+                std::getline( buf, r._path );
+                r._valid     = valid != 0;
+                r._paletted  = paletted != 0;
+                r._hasNoData = hasNoData != 0;
+                if ( srs >= 0 && srs < (int)srsTable.size() )
+                    r._srs = srsTable[srs];
+
+                out_records[r._path] = r;
             }
         }
     }
+
+    bool writeIndex( const std::string& indexFile, const RecordMap& records )
+    {
+        osgDB::makeDirectoryForFile( indexFile );
+
+        std::ofstream out( indexFile.c_str() );
+        if ( !out.is_open() )
+            return false;
+
+        out << INDEX_HEADER << "\n" << std::setprecision(17);
+
+        std::map<std::string, int> srsTable;
+        for( RecordMap::const_iterator i = records.begin(); i != records.end(); ++i )
+        {
+            const std::string& srs = i->second._srs;
+            if ( !srs.empty() && srsTable.find(srs) == srsTable.end() )
+            {
+                int id = srsTable.size();
+                srsTable[srs] = id;
+                out << "S\t" << escapeLine(srs) << "\n";
+            }
+        }
+
+        for( RecordMap::const_iterator i = records.begin(); i != records.end(); ++i )
+        {
+            const DataScanner::Record& r = i->second;
+            int srs = r._srs.empty() ? -1 : srsTable[r._srs];
+
+            out << "F\t"
+                << r._modified << "\t" << r._size << "\t" << (r._valid ? 1 : 0) << "\t" << srs << "\t"
+                << r._geoTransform[0] << "\t" << r._geoTransform[1] << "\t" << r._geoTransform[2] << "\t"
+                << r._geoTransform[3] << "\t" << r._geoTransform[4] << "\t" << r._geoTransform[5] << "\t"
+                << r._width << "\t" << r._height << "\t" << r._bands << "\t" << r._dataType << "\t"
+                << r._blockWidth << "\t" << r._blockHeight << "\t" << (r._paletted ? 1 : 0) << "\t"
+                << (r._hasNoData ? 1 : 0) << "\t" << r._noData << "\t"
+                << r._path << "\n";
+        }
+
+        return !out.fail();
+    }
+
+    ImageLayer* createLayer( const std::string& name, const std::string& path )
+    {
+        GDALOptions gdal;
+        gdal.url() = path;
+        //gdal.interpolation() = INTERP_NEAREST;
+
+        ImageLayerOptions options( name, gdal );
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+
+        return new ImageLayer(options);
+    }
 }
 
+//-----------------------------------------------------------------------
+
+DataScanner::Record::Record() :
+_modified   ( 0 ),
+_size       ( 0 ),
+_valid      ( false ),
+_width      ( 0u ),
+_height     ( 0u ),
+_bands      ( 0u ),
+_dataType   ( 0 ),
+_blockWidth ( 0u ),
+_blockHeight( 0u ),
+_paletted   ( false ),
+_hasNoData  ( false ),
+_noData     ( 0.0 )
+{
+    _geoTransform[0] = 0.0;
+    _geoTransform[1] = 1.0;
+    _geoTransform[2] = 0.0;
+    _geoTransform[3] = 0.0;
+    _geoTransform[4] = 0.0;
+    _geoTransform[5] = 1.0;
+}
+
+GeoExtent
+DataScanner::Record::getExtent() const
+{
+    if ( !_valid )
+        return GeoExtent::INVALID;
+
+    const SpatialReference* srs = SpatialReference::create( _srs );
+    if ( !srs )
+        return GeoExtent::INVALID;
+
+    return GeoExtent(
+        srs,
+        _geoTransform[0],
+        _geoTransform[3] + (double)_height * _geoTransform[5],
+        _geoTransform[0] + (double)_width  * _geoTransform[1],
+        _geoTransform[3] );
+}
+
+//-----------------------------------------------------------------------
+
+DataScanner::DataScanner() :
+_numThreads( OpenThreads::GetNumberOfProcessors() )
+{
+    //nop
+}
+
+void
+DataScanner::scan(const std::string&              absRootPath,
+                  const std::vector<std::string>& extensions,
+                  RecordVector&                   out_records) const
+{
+    // make sure GDAL is initialized.
+    Registry::instance();
+
+    unsigned first = out_records.size();
+    traverse( absRootPath, extensions, out_records );
+
+    RecordMap index;
+    if ( !_indexFile.empty() )
+        readIndex( _indexFile, index );
+
+    // Re-use what we know about unchanged files, and queue up the rest.
+    ProbeState state;
+    unsigned   reused = 0u;
+    for( unsigned i = first; i < out_records.size(); ++i )
+    {
+        Record& r = out_records[i];
+        RecordMap::const_iterator known = index.find( r._path );
+        if ( known != index.end() && known->second._modified == r._modified && known->second._size == r._size )
+        {
+            r = known->second;
+            ++reused;
+        }
+        else
+        {
+            state._records.push_back( &r );
+        }
+    }
+
+    unsigned numThreads = osg::minimum( osg::maximum(_numThreads, 1u), (unsigned)state._records.size() );
+    if ( numThreads > 1u )
+    {
+        osg::ref_ptr<TaskService> service = new TaskService( "DataScanner", numThreads );
+        Threading::MultiEvent done( numThreads );
+        for( unsigned i = 0; i < numThreads; ++i )
+        {
+            ParallelTask<ProbeFiles>* task = new ParallelTask<ProbeFiles>( &done );
+            task->_state = &state;
+            service->add( task );
+        }
+        done.wait();
+    }
+    else
+    {
+        ProbeFiles task;
+        task._state = &state;
+        task.execute();
+    }
+
+    OE_INFO << LC << "Scanned " << absRootPath << ": "
+        << (out_records.size()-first) << " files, "
+        << state._records.size() << " probed, "
+        << reused << " from the index" << std::endl;
+
+    // Update the index: replace everything it had under this root with what
+    // we found, dropping files that no longer exist.
+    if ( !_indexFile.empty() )
+    {
+        unsigned removed = 0u;
+        for( RecordMap::iterator i = index.begin(); i != index.end(); )
+        {
+            if ( isUnderRoot(i->first, absRootPath) )
+            {
+                index.erase( i++ );
+                ++removed;
+            }
+            else ++i;
+        }
+
+        // nothing new, changed or deleted? Leave it alone.
+        if ( state._records.size() > 0u || removed != reused )
+        {
+            for( unsigned i = first; i < out_records.size(); ++i )
+                index[out_records[i]._path] = out_records[i];
+
+            if ( !writeIndex(_indexFile, index) )
+            {
+                OE_WARN << LC << "Failed to write index file " << _indexFile << std::endl;
+            }
+        }
+    }
+}
 
 void
 DataScanner::findImageLayers(const std::string&              absRootPath,
                              const std::vector<std::string>& extensions,
                              ImageLayerVector&               out_imageLayers) const
 {
-    traverse( absRootPath, extensions, out_imageLayers );
+    RecordVector records;
+    scan( absRootPath, extensions, records );
+
+    for( RecordVector::const_iterator r = records.begin(); r != records.end(); ++r )
+    {
+        if ( r->_valid )
+        {
+            out_imageLayers.push_back( createLayer(r->_path, r->_path) );
+            OE_INFO << LC << "Found " << r->_path << std::endl;
+        }
+    }
+}
+
+void
+DataScanner::createMosaicLayers(const std::string&              absRootPath,
+                                const std::vector<std::string>& extensions,
+                                const std::string&              vrtPath,
+                                ImageLayerVector&               out_imageLayers) const
+{
+    RecordVector records;
+    scan( absRootPath, extensions, records );
+
+    // group the records that can share a mosaic.
+    std::vector<RecordVector>          groups;
+    std::map<std::string, unsigned>    groupIndex;
+
+    for( RecordVector::const_iterator r = records.begin(); r != records.end(); ++r )
+    {
+        if ( !r->_valid )
+            continue;
+
+        if ( r->_paletted )
+        {
+            out_imageLayers.push_back( createLayer(r->_path, r->_path) );
+            continue;
+        }
+
+        std::string key = Stringify() << r->_bands << ";" << r->_dataType << ";" << r->_srs;
+        std::map<std::string, unsigned>::const_iterator g = groupIndex.find( key );
+        if ( g == groupIndex.end() )
+        {
+            groupIndex[key] = groups.size();
+            groups.push_back( RecordVector() );
+            groups.back().push_back( *r );
+        }
+        else
+        {
+            groups[g->second].push_back( *r );
+        }
+    }
+
+    for( unsigned i = 0; i < groups.size(); ++i )
+    {
+        std::string path = vrtPath;
+        if ( i > 0 )
+            path = Stringify() << osgDB::getNameLessExtension(vrtPath) << "_" << i << ".vrt";
+
+        if ( writeVRT(groups[i], path) )
+        {
+            out_imageLayers.push_back( createLayer(osgDB::getSimpleFileName(path), path) );
+            OE_INFO << LC << "Mosaicked " << groups[i].size() << " files into " << path << std::endl;
+        }
+        else
+        {
+            OE_WARN << LC << "Failed to write mosaic " << path << std::endl;
+        }
+    }
+}
+
+bool
+DataScanner::writeVRT(const RecordVector& records,
+                      const std::string&  vrtPath)
+{
+    if ( records.empty() )
+        return false;
+
+    const Record& first = records.front();
+
+    // The mosaic covers the union of the records at the highest resolution.
+    double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+    double resX = DBL_MAX, resY = DBL_MAX;
+    for( RecordVector::const_iterator r = records.begin(); r != records.end(); ++r )
+    {
+        minX = osg::minimum( minX, r->_geoTransform[0] );
+        maxX = osg::maximum( maxX, r->_geoTransform[0] + (double)r->_width * r->_geoTransform[1] );
+        maxY = osg::maximum( maxY, r->_geoTransform[3] );
+        minY = osg::minimum( minY, r->_geoTransform[3] + (double)r->_height * r->_geoTransform[5] );
+        resX = osg::minimum( resX, r->getResolutionX() );
+        resY = osg::minimum( resY, r->getResolutionY() );
+    }
+
+    unsigned width  = (unsigned)(0.5 + (maxX - minX) / resX);
+    unsigned height = (unsigned)(0.5 + (maxY - minY) / resY);
+
+    osgDB::makeDirectoryForFile( vrtPath );
+
+    std::ofstream out( vrtPath.c_str() );
+    if ( !out.is_open() )
+        return false;
+
+    out << std::setprecision(17)
+        << "<VRTDataset rasterXSize=\"" << width << "\" rasterYSize=\"" << height << "\">\n"
+        << "  <SRS>" << escapeXML(first._srs) << "</SRS>\n"
+        << "  <GeoTransform>" << minX << ", " << resX << ", 0, " << maxY << ", 0, " << -resY << "</GeoTransform>\n";
+
+    const char* dataType = GDALGetDataTypeName( (GDALDataType)first._dataType );
+
+    for( unsigned b = 1; b <= first._bands; ++b )
+    {
+        GDALColorInterp interp =
+            first._bands == 1 ? GCI_GrayIndex :
+            first._bands == 2 ? (b == 1 ? GCI_GrayIndex : GCI_AlphaBand) :
+            b == 1            ? GCI_RedBand :
+            b == 2            ? GCI_GreenBand :
+            b == 3            ? GCI_BlueBand :
+            b == 4            ? GCI_AlphaBand :
+                                GCI_Undefined;
+
+        out << "  <VRTRasterBand dataType=\"" << dataType << "\" band=\"" << b << "\">\n"
+            << "    <ColorInterp>" << GDALGetColorInterpretationName(interp) << "</ColorInterp>\n";
+
+        if ( first._hasNoData )
+            out << "    <NoDataValue>" << first._noData << "</NoDataValue>\n";
+
+        for( RecordVector::const_iterator r = records.begin(); r != records.end(); ++r )
+        {
+            // Listing the source properties lets GDAL skip opening the source
+            // until it needs its pixels.
+            const char* source = r->_hasNoData ? "ComplexSource" : "SimpleSource";
+
+            out << "    <" << source << ">\n"
+                << "      <SourceFilename relativeToVRT=\"0\">" << escapeXML(r->_path) << "</SourceFilename>\n"
+                << "      <SourceBand>" << b << "</SourceBand>\n"
+                << "      <SourceProperties RasterXSize=\"" << r->_width << "\" RasterYSize=\"" << r->_height
+                <<          "\" DataType=\"" << dataType << "\" BlockXSize=\"" << r->_blockWidth
+                <<          "\" BlockYSize=\"" << r->_blockHeight << "\" />\n"
+                << "      <SrcRect xOff=\"0\" yOff=\"0\" xSize=\"" << r->_width << "\" ySize=\"" << r->_height << "\" />\n"
+                << "      <DstRect xOff=\"" << (r->_geoTransform[0] - minX) / resX
+                <<          "\" yOff=\"" << (maxY - r->_geoTransform[3]) / resY
+                <<          "\" xSize=\"" << (double)r->_width * r->getResolutionX() / resX
+                <<          "\" ySize=\"" << (double)r->_height * r->getResolutionY() / resY << "\" />\n";
+
+            if ( r->_hasNoData )
+                out << "      <NODATA>" << r->_noData << "</NODATA>\n";
+
+            out << "    </" << source << ">\n";
+        }
+
+        out << "  </VRTRasterBand>\n";
+    }
+
+    out << "</VRTDataset>\n";
+
+    return !out.fail();
 }
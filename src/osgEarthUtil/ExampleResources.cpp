@@ -541,6 +541,12 @@ MapNodeHelper::parse(MapNode*             mapNode,
     std::string imageExtensions;
     args.read("--image-extensions", imageExtensions);
 
+    std::string imageIndex;
+    args.read("--image-index", imageIndex);
+
+    std::string imageMosaic;
+    args.read("--image-mosaic", imageMosaic);
+
     // install a canvas for any UI controls we plan to create:
     ControlCanvas* canvas = ControlCanvas::get(view, false);
 
@@ -714,7 +720,11 @@ MapNodeHelper::parse(MapNode*             mapNode,
         OE_INFO << LC << "Loading images from " << imageFolder << "..." << std::endl;
         ImageLayerVector imageLayers;
         DataScanner scanner;
-        scanner.findImageLayers( imageFolder, extensions, imageLayers );
+        scanner.setIndexFile( imageIndex );
+        if ( !imageMosaic.empty() )
+            scanner.createMosaicLayers( imageFolder, extensions, imageMosaic, imageLayers );
+        else
+            scanner.findImageLayers( imageFolder, extensions, imageLayers );
 
         if ( imageLayers.size() > 0 )
         {
@@ -825,6 +835,8 @@ MapNodeHelper::usage() const
         << "  --autoclip                    : installs an auto-clip plane callback\n"
         << "  --images [path]               : finds and loads image layers from folder [path]\n"
         << "  --image-extensions [ext,...]  : with --images, extensions to use\n"
+        << "  --image-index [file]          : with --images, remember scanned files in [file]\n"
+        << "  --image-mosaic [file.vrt]     : with --images, mosaic the images into one layer\n"
         << "  --out-earth [file]            : write the loaded map to an earth file\n"
         << "  --uniform [name] [min] [max]  : create a uniform controller with min/max values\n";
 }
@@ -17,6 +17,7 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include <osgEarthUtil/LinearLineOfSight>
+#include <osgEarthUtil/Viewshed>
 #include <osgEarth/TerrainEngineNode>
 #include <osgEarth/DPLineSegmentIntersector>
 #include <osgSim/LineOfSight>
@@ -86,7 +87,9 @@ _badColor(1.0f, 0.0f, 0.0f, 1.0f),
 _displayMode( LineOfSight::MODE_SPLIT ),
 //_startAltitudeMode( ALTMODE_ABSOLUTE ),
 //_endAltitudeMode( ALTMODE_ABSOLUTE ),
-_terrainOnly( false )
+_terrainOnly( false ),
+_useElevationData( false ),
+_elevationResolution( 0.0 )
 {
     compute(getNode());
     subscribeToTerrain();
@@ -109,7 +112,9 @@ _badColor(1.0f, 0.0f, 0.0f, 1.0f),
 _displayMode( LineOfSight::MODE_SPLIT ),
 //_startAltitudeMode( ALTMODE_ABSOLUTE ),
 //_endAltitudeMode( ALTMODE_ABSOLUTE ),
-_terrainOnly( false )
+_terrainOnly( false ),
+_useElevationData( false ),
+_elevationResolution( 0.0 )
 {
     compute(getNode());    
     subscribeToTerrain();
@@ -160,6 +165,11 @@ void
 LinearLineOfSightNode::terrainChanged( const osgEarth::TileKey& tileKey, osg::Node* terrain )
 {
     OE_DEBUG << "LineOfSightNode::terrainChanged" << std::endl;
+
+    // results from the elevation data don't depend on the paged terrain.
+    if ( _useElevationData )
+        return;
+
     //Make a temporary group that contains both the old MapNode as well as the new incoming terrain.
     //Because this function is called from the database pager thread we need to include both b/c 
     //the new terrain isn't yet merged with the new terrain.
@@ -291,25 +301,58 @@ LinearLineOfSightNode::compute(osg::Node* node, bool backgroundThread)
 
       //Computes the LOS and redraws the scene
 
-      _start.transform(mapSRS).toWorld( _startWorld, terrain );
-      _end.transform(mapSRS).toWorld( _endWorld, terrain );
-
-
-      DPLineSegmentIntersector* lsi = new DPLineSegmentIntersector(_startWorld, _endWorld);
-      osgUtil::IntersectionVisitor iv( lsi );
-
-      node->accept( iv );
-
-      DPLineSegmentIntersector::Intersections& hits = lsi->getIntersections();
-      if ( hits.size() > 0 )
+      if ( _useElevationData )
       {
-          _hasLOS = false;
-          _hitWorld = hits.begin()->getWorldIntersectPoint();
-          _hit.fromWorld( mapSRS, _hitWorld );
+          // sample the elevation data directly instead of the scene graph.
+          ElevationQuery query( getMapNode()->getMap() );
+          GeoPoint start = _start.transform(mapSRS);
+          GeoPoint end   = _end.transform(mapSRS);
+          double resolution = _elevationResolution > 0.0 ? _elevationResolution : start.distanceTo(end)/200.0;
+          double queryRes   = mapSRS->getECEF()->transformUnits( resolution, mapSRS, start.y() );
+
+          if ( start.altitudeMode() == ALTMODE_RELATIVE )
+          {
+              double h = 0.0;
+              query.getElevation( start, h, queryRes );
+              start.z() += h;
+              start.altitudeMode() = ALTMODE_ABSOLUTE;
+          }
+          if ( end.altitudeMode() == ALTMODE_RELATIVE )
+          {
+              double h = 0.0;
+              query.getElevation( end, h, queryRes );
+              end.z() += h;
+              end.altitudeMode() = ALTMODE_ABSOLUTE;
+          }
+          start.toWorld( _startWorld );
+          end.toWorld( _endWorld );
+
+          _hasLOS = Viewshed::computeLineOfSight( query, mapSRS, _startWorld, _endWorld, resolution, _hitWorld );
+          if ( !_hasLOS )
+              _hit.fromWorld( mapSRS, _hitWorld );
       }
       else
       {
-          _hasLOS = true;
+          _start.transform(mapSRS).toWorld( _startWorld, terrain );
+          _end.transform(mapSRS).toWorld( _endWorld, terrain );
+
+
+          DPLineSegmentIntersector* lsi = new DPLineSegmentIntersector(_startWorld, _endWorld);
+          osgUtil::IntersectionVisitor iv( lsi );
+
+          node->accept( iv );
+
+          DPLineSegmentIntersector::Intersections& hits = lsi->getIntersections();
+          if ( hits.size() > 0 )
+          {
+              _hasLOS = false;
+              _hitWorld = hits.begin()->getWorldIntersectPoint();
+              _hit.fromWorld( mapSRS, _hitWorld );
+          }
+          else
+          {
+              _hasLOS = true;
+          }
       }
     }
 
@@ -463,6 +506,38 @@ LinearLineOfSightNode::setTerrainOnly( bool terrainOnly )
     }
 }
 
+bool
+LinearLineOfSightNode::getUseElevationData() const
+{
+    return _useElevationData;
+}
+
+void
+LinearLineOfSightNode::setUseElevationData( bool value )
+{
+    if (_useElevationData != value)
+    {
+        _useElevationData = value;
+        compute(getNode());
+    }
+}
+
+double
+LinearLineOfSightNode::getElevationResolution() const
+{
+    return _elevationResolution;
+}
+
+void
+LinearLineOfSightNode::setElevationResolution( double resolution )
+{
+    if (_elevationResolution != resolution)
+    {
+        _elevationResolution = osg::maximum(resolution, 0.0);
+        compute(getNode());
+    }
+}
+
 osg::Node*
 LinearLineOfSightNode::getNode()
 {
@@ -126,7 +126,9 @@ _outlineColor( 1.0f, 1.0f, 1.0f, 1.0f),
 _displayMode( LineOfSight::MODE_SPLIT ),
 //_altitudeMode( ALTMODE_ABSOLUTE ),
 _fill(false),
-_terrainOnly( false )
+_terrainOnly( false ),
+_useElevationData( false ),
+_elevationResolution( 0.0 )
 {
     compute(getNode());
     _terrainChangedCallback = new RadialLineOfSightNodeTerrainChangedCallback( this );
@@ -251,6 +253,36 @@ void RadialLineOfSightNode::setTerrainOnly( bool terrainOnly )
     }
 }
 
+bool
+RadialLineOfSightNode::getUseElevationData() const
+{
+    return _useElevationData;
+}
+
+void RadialLineOfSightNode::setUseElevationData( bool value )
+{
+    if (_useElevationData != value)
+    {
+        _useElevationData = value;
+        compute(getNode());
+    }
+}
+
+double
+RadialLineOfSightNode::getElevationResolution() const
+{
+    return _elevationResolution;
+}
+
+void RadialLineOfSightNode::setElevationResolution( double resolution )
+{
+    if (_elevationResolution != resolution)
+    {
+        _elevationResolution = osg::maximum(resolution, 0.0);
+        compute(getNode());
+    }
+}
+
 osg::Node*
 RadialLineOfSightNode::getNode()
 {
@@ -263,6 +295,11 @@ void
 RadialLineOfSightNode::terrainChanged( const osgEarth::TileKey& tileKey, osg::Node* terrain )
 {
     OE_DEBUG << "RadialLineOfSightNode::terrainChanged" << std::endl;
+
+    // results from the elevation data don't depend on the paged terrain.
+    if ( _useElevationData )
+        return;
+
     //Make a temporary group that contains both the old MapNode as well as the new incoming terrain.
     //Because this function is called from the database pager thread we need to include both b/c 
     //the new terrain isn't yet merged with the new terrain.
@@ -285,11 +322,32 @@ RadialLineOfSightNode::compute(osg::Node* node, bool backgroundThread)
     }
 }
 
-void
-RadialLineOfSightNode::compute_line(osg::Node* node, bool backgroundThread)
-{    
+bool
+RadialLineOfSightNode::computeSpokes(osg::Node* node, Viewshed::SpokeVector& out_spokes)
+{
     if ( !getMapNode() )
-        return;
+        return false;
+
+    if ( _useElevationData )
+    {
+        // sample the elevation data directly instead of the scene graph.
+        if ( !_viewshed.valid() )
+        {
+            _viewshed = new Viewshed( getMapNode()->getMap() );
+            _viewshed->setComputeGrid( false );
+        }
+
+        _viewshed->setObserver( _center );
+        _viewshed->setRadius( _radius );
+        _viewshed->setNumSpokes( _numSpokes );
+        _viewshed->setResolution( _elevationResolution > 0.0 ? _elevationResolution : _radius/100.0 );
+        if ( !_viewshed->compute() )
+            return false;
+
+        _centerWorld = _viewshed->getObserverWorld();
+        out_spokes = _viewshed->getSpokes();
+        return true;
+    }
 
     GeoPoint centerMap;
     _center.transform( getMapNode()->getMapSRS(), centerMap );
@@ -304,22 +362,6 @@ RadialLineOfSightNode::compute_line(osg::Node* node, bool backgroundThread)
 
     //Get the number of spokes
     double delta = osg::PI * 2.0 / (double)_numSpokes;
-    
-    osg::Geometry* geometry = new osg::Geometry;
-    geometry->setUseVertexBufferObjects(true);
-
-    osg::Vec3Array* verts = new osg::Vec3Array();
-    verts->reserve(_numSpokes * 5);
-    geometry->setVertexArray( verts );
-
-    osg::Vec4Array* colors = new osg::Vec4Array();
-    colors->reserve( _numSpokes * 5 );
-
-    geometry->setColorArray( colors );
-    geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-
-    osg::Vec3d previousEnd;
-    osg::Vec3d firstEnd;
 
     osg::ref_ptr<osgUtil::IntersectorGroup> ivGroup = new osgUtil::IntersectorGroup();
 
@@ -338,20 +380,52 @@ RadialLineOfSightNode::compute_line(osg::Node* node, bool backgroundThread)
 
     node->accept( iv );
 
+    out_spokes.resize( _numSpokes );
     for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
     {
         DPLineSegmentIntersector* los = dynamic_cast<DPLineSegmentIntersector*>(ivGroup->getIntersectors()[i].get());
         DPLineSegmentIntersector::Intersections& hits = los->getIntersections();
 
-        osg::Vec3d start = los->getStart();
-        osg::Vec3d end = los->getEnd();
+        Viewshed::Spoke& spoke = out_spokes[i];
+        spoke._angle    = delta * (double)i;
+        spoke._endWorld = los->getEnd();
+        spoke._hasLOS   = hits.empty();
+        if ( !spoke._hasLOS )
+            spoke._hitWorld = hits.begin()->getWorldIntersectPoint();
+    }
 
-        osg::Vec3d hit;
-        bool hasLOS = hits.empty();
-        if (!hasLOS)
-        {
-            hit = hits.begin()->getWorldIntersectPoint();
-        }
+    return true;
+}
+
+void
+RadialLineOfSightNode::compute_line(osg::Node* node, bool backgroundThread)
+{    
+    Viewshed::SpokeVector spokes;
+    if ( !computeSpokes(node, spokes) )
+        return;
+    
+    osg::Geometry* geometry = new osg::Geometry;
+    geometry->setUseVertexBufferObjects(true);
+
+    osg::Vec3Array* verts = new osg::Vec3Array();
+    verts->reserve(spokes.size() * 5);
+    geometry->setVertexArray( verts );
+
+    osg::Vec4Array* colors = new osg::Vec4Array();
+    colors->reserve( spokes.size() * 5 );
+
+    geometry->setColorArray( colors );
+    geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+
+    osg::Vec3d previousEnd;
+    osg::Vec3d firstEnd;
+
+    for (unsigned int i = 0; i < spokes.size(); i++)
+    {
+        osg::Vec3d start = _centerWorld;
+        osg::Vec3d end = spokes[i]._endWorld;
+        osg::Vec3d hit = spokes[i]._hitWorld;
+        bool hasLOS = spokes[i]._hasLOS;
 
         if (hasLOS)
         {
@@ -437,73 +511,37 @@ RadialLineOfSightNode::compute_line(osg::Node* node, bool backgroundThread)
 void
 RadialLineOfSightNode::compute_fill(osg::Node* node, bool backgroundThread)
 {
-    if ( !getMapNode() )
+    Viewshed::SpokeVector spokes;
+    if ( !computeSpokes(node, spokes) )
         return;
-
-    GeoPoint centerMap;
-    _center.transform( getMapNode()->getMapSRS(), centerMap );
-    centerMap.toWorld( _centerWorld, getMapNode()->getTerrain() );
-
-    bool isProjected = getMapNode()->getMapSRS()->isProjected();
-
-    osg::Vec3d up = isProjected ? osg::Vec3d(0,0,1) : osg::Vec3d(_centerWorld);
-    up.normalize();
-
-    //Get the "side" vector
-    osg::Vec3d side = isProjected ? osg::Vec3d(1,0,0) : up ^ osg::Vec3d(0,0,1);
-
-    //Get the number of spokes
-    double delta = osg::PI * 2.0 / (double)_numSpokes;
     
     osg::Geometry* geometry = new osg::Geometry;
     geometry->setUseVertexBufferObjects(true);
 
     osg::Vec3Array* verts = new osg::Vec3Array();
-    verts->reserve(_numSpokes * 2);
+    verts->reserve(spokes.size() * 2);
     geometry->setVertexArray( verts );
 
     osg::Vec4Array* colors = new osg::Vec4Array();
-    colors->reserve( _numSpokes * 2 );
+    colors->reserve( spokes.size() * 2 );
 
     geometry->setColorArray( colors );
     geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
 
-    osg::ref_ptr<osgUtil::IntersectorGroup> ivGroup = new osgUtil::IntersectorGroup();
-
-    for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
-    {
-        double angle = delta * (double)i;
-        osg::Quat quat(angle, up );
-        osg::Vec3d spoke = quat * (side * _radius);
-        osg::Vec3d end = _centerWorld + spoke;        
-        osg::ref_ptr<DPLineSegmentIntersector> dplsi = new DPLineSegmentIntersector( _centerWorld, end );
-        ivGroup->addIntersector( dplsi.get() );
-    }
-
-    osgUtil::IntersectionVisitor iv;
-    iv.setIntersector( ivGroup.get() );
-
-    node->accept( iv );
-
-    for (unsigned int i = 0; i < (unsigned int)_numSpokes; i++)
+    for (unsigned int i = 0; i < spokes.size(); i++)
     {
         //Get the current hit
-        DPLineSegmentIntersector* los = dynamic_cast<DPLineSegmentIntersector*>(ivGroup->getIntersectors()[i].get());
-        DPLineSegmentIntersector::Intersections& hits = los->getIntersections();
-
-        osg::Vec3d currEnd = los->getEnd();
-        bool currHasLOS = hits.empty();
-        osg::Vec3d currHit = currHasLOS ? osg::Vec3d() : hits.begin()->getWorldIntersectPoint();
+        osg::Vec3d currEnd = spokes[i]._endWorld;
+        bool currHasLOS = spokes[i]._hasLOS;
+        osg::Vec3d currHit = currHasLOS ? osg::Vec3d() : spokes[i]._hitWorld;
 
         //Get the next hit
         unsigned int nextIndex = i + 1;
-        if (nextIndex == _numSpokes) nextIndex = 0;
-        DPLineSegmentIntersector* losNext = static_cast<DPLineSegmentIntersector*>(ivGroup->getIntersectors()[nextIndex].get());
-        DPLineSegmentIntersector::Intersections& hitsNext = losNext->getIntersections();
+        if (nextIndex == spokes.size()) nextIndex = 0;
 
-        osg::Vec3d nextEnd = losNext->getEnd();
-        bool nextHasLOS = hitsNext.empty();
-        osg::Vec3d nextHit = nextHasLOS ? osg::Vec3d() : hitsNext.begin()->getWorldIntersectPoint();
+        osg::Vec3d nextEnd = spokes[nextIndex]._endWorld;
+        bool nextHasLOS = spokes[nextIndex]._hasLOS;
+        osg::Vec3d nextHit = nextHasLOS ? osg::Vec3d() : spokes[nextIndex]._hitWorld;
         
         if (currHasLOS && nextHasLOS)
         {
@@ -0,0 +1,616 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthUtil/SpatialIndex>
+#include <osgEarth/CullingUtils>
+#include <osgUtil/CullVisitor>
+#include <queue>
+
+#define LC "[SpatialIndex] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+//-----------------------------------------------------------------------
+
+namespace
+{
+    // Position of a box relative to a query volume.
+    enum Classification
+    {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    Classification classifyBox( const osg::Vec3d& center, double halfSize, const osg::Polytope& tope )
+    {
+        Classification result = INSIDE;
+        const osg::Polytope::PlaneList& planes = tope.getPlaneList();
+        for( osg::Polytope::PlaneList::const_iterator p = planes.begin(); p != planes.end(); ++p )
+        {
+            const osg::Vec3d n = p->getNormal();
+            double d      = p->distance( center );
+            double extent = halfSize * (fabs(n.x()) + fabs(n.y()) + fabs(n.z()));
+            if ( d < -extent )
+                return OUTSIDE;
+            if ( d < extent )
+                result = INTERSECTS;
+        }
+        return result;
+    }
+
+    bool sphereInside( const osg::BoundingSphere& bs, const osg::Polytope& tope )
+    {
+        const osg::Polytope::PlaneList& planes = tope.getPlaneList();
+        for( osg::Polytope::PlaneList::const_iterator p = planes.begin(); p != planes.end(); ++p )
+        {
+            if ( p->distance( osg::Vec3d(bs.center()) ) < -bs.radius() )
+                return false;
+        }
+        return true;
+    }
+
+    // squared distance from a point to the nearest/farthest point of a box
+    double minDistance2( const osg::Vec3d& center, double halfSize, const osg::Vec3d& p )
+    {
+        double d2 = 0.0;
+        for( unsigned i = 0; i < 3; ++i )
+        {
+            double d = fabs(p[i] - center[i]) - halfSize;
+            if ( d > 0.0 )
+                d2 += d*d;
+        }
+        return d2;
+    }
+
+    double maxDistance2( const osg::Vec3d& center, double halfSize, const osg::Vec3d& p )
+    {
+        double d2 = 0.0;
+        for( unsigned i = 0; i < 3; ++i )
+        {
+            double d = fabs(p[i] - center[i]) + halfSize;
+            d2 += d*d;
+        }
+        return d2;
+    }
+
+    // Octant of a cell containing a point.
+    unsigned octant( const osg::Vec3d& center, const osg::Vec3d& p )
+    {
+        return
+            (p.x() >= center.x() ? 1u : 0u) |
+            (p.y() >= center.y() ? 2u : 0u) |
+            (p.z() >= center.z() ? 4u : 0u);
+    }
+
+    // Item in the nearest-neighbor search queue: either a cell or an entry.
+    struct Candidate
+    {
+        double _distance2;
+        int    _cell;
+        int    _entry;
+
+        Candidate( double distance2, int cell, int entry )
+            : _distance2(distance2), _cell(cell), _entry(entry) { }
+
+        bool operator < ( const Candidate& rhs ) const {
+            // reversed, so the priority queue pops the nearest first
+            return _distance2 > rhs._distance2;
+        }
+    };
+}
+
+//-----------------------------------------------------------------------
+
+SpatialIndex::SpatialIndex(const osg::Vec3d& center,
+                           double            halfSize) :
+_splitThreshold( 32u ),
+_maxDepth      ( 16u )
+{
+    Cell root;
+    root._center   = center;
+    root._halfSize = halfSize;
+    root._parent   = -1;
+    root._depth    = 0u;
+    root._count    = 0u;
+    for( unsigned i = 0; i < 8; ++i )
+        root._children[i] = -1;
+
+    _cells.push_back( root );
+}
+
+bool
+SpatialIndex::fits(const Cell&                cell,
+                   const osg::BoundingSphere& bound) const
+{
+    // the loose bounds of a cell extend half a cell beyond each of its faces.
+    double limit = 2.0*cell._halfSize - bound.radius();
+    return
+        fabs(bound.center().x() - cell._center.x()) <= limit &&
+        fabs(bound.center().y() - cell._center.y()) <= limit &&
+        fabs(bound.center().z() - cell._center.z()) <= limit;
+}
+
+unsigned
+SpatialIndex::findCell(const osg::BoundingSphere& bound) const
+{
+    // anything that doesn't fit anywhere lives in the root.
+    unsigned c = 0;
+    while( !_cells[c].isLeaf() )
+    {
+        unsigned child = _cells[c]._children[octant(_cells[c]._center, osg::Vec3d(bound.center()))];
+        if ( !fits(_cells[child], bound) )
+            break;
+        c = child;
+    }
+    return c;
+}
+
+void
+SpatialIndex::attach(unsigned entry, unsigned cell)
+{
+    Entry& e = _entries[entry];
+    e._cell = cell;
+    e._slot = _cells[cell]._entries.size();
+    _cells[cell]._entries.push_back( entry );
+
+    for( int c = cell; c >= 0; c = _cells[c]._parent )
+        _cells[c]._count++;
+
+    const Cell& target = _cells[cell];
+    if ( target.isLeaf() && target._entries.size() > _splitThreshold && target._depth < _maxDepth )
+    {
+        split( cell );
+    }
+}
+
+void
+SpatialIndex::detach(unsigned entry)
+{
+    Entry& e    = _entries[entry];
+    Cell&  cell = _cells[e._cell];
+
+    // swap the last entry into the vacated slot.
+    unsigned last = cell._entries.back();
+    cell._entries[e._slot] = last;
+    _entries[last]._slot = e._slot;
+    cell._entries.pop_back();
+
+    for( int c = e._cell; c >= 0; c = _cells[c]._parent )
+        _cells[c]._count--;
+}
+
+void
+SpatialIndex::split(unsigned cell)
+{
+    double   half  = 0.5 * _cells[cell]._halfSize;
+    unsigned depth = _cells[cell]._depth + 1;
+
+    for( unsigned i = 0; i < 8; ++i )
+    {
+        const osg::Vec3d& parentCenter = _cells[cell]._center;
+
+        Cell child;
+        child._center.set(
+            parentCenter.x() + ((i & 1u) ? half : -half),
+            parentCenter.y() + ((i & 2u) ? half : -half),
+            parentCenter.z() + ((i & 4u) ? half : -half) );
+        child._halfSize = half;
+        child._parent   = cell;
+        child._depth    = depth;
+        child._count    = 0u;
+        for( unsigned j = 0; j < 8; ++j )
+            child._children[j] = -1;
+
+        // careful: this may reallocate the cell vector.
+        _cells.push_back( child );
+        _cells[cell]._children[i] = _cells.size() - 1;
+    }
+
+    // push down whatever fits into the new children.
+    std::vector<unsigned> entries;
+    entries.swap( _cells[cell]._entries );
+
+    for( std::vector<unsigned>::const_iterator i = entries.begin(); i != entries.end(); ++i )
+    {
+        Entry&   e     = _entries[*i];
+        unsigned child = _cells[cell]._children[octant(_cells[cell]._center, osg::Vec3d(e._bound.center()))];
+        unsigned target = fits(_cells[child], e._bound) ? child : cell;
+
+        e._cell = target;
+        e._slot = _cells[target]._entries.size();
+        _cells[target]._entries.push_back( *i );
+        if ( target != cell )
+            _cells[target]._count++;
+    }
+}
+
+bool
+SpatialIndex::insert(osg::Node* node)
+{
+    if ( !node )
+        return false;
+
+    osg::BoundingSphere bound = node->getBound();
+    if ( !bound.valid() )
+        bound.radius() = 0.0;
+
+    return insert( node, bound );
+}
+
+bool
+SpatialIndex::insert(osg::Node* node, const osg::BoundingSphere& bound)
+{
+    if ( !node || _entryMap.find(node) != _entryMap.end() )
+        return false;
+
+    Entry e;
+    e._node  = node;
+    e._bound = bound;
+    e._cell  = 0;
+    e._slot  = 0;
+    _entries.push_back( e );
+
+    unsigned index = _entries.size() - 1;
+    _entryMap[node] = index;
+    attach( index, findCell(bound) );
+    return true;
+}
+
+bool
+SpatialIndex::update(osg::Node* node)
+{
+    if ( !node )
+        return false;
+
+    osg::BoundingSphere bound = node->getBound();
+    if ( !bound.valid() )
+        bound.radius() = 0.0;
+
+    return update( node, bound );
+}
+
+bool
+SpatialIndex::update(osg::Node* node, const osg::BoundingSphere& bound)
+{
+    EntryMap::const_iterator i = _entryMap.find( node );
+    if ( i == _entryMap.end() )
+        return false;
+
+    unsigned index = i->second;
+    Entry&   e     = _entries[index];
+    e._bound = bound;
+
+    // most moves are small enough that the object stays in its loose cell,
+    // in which case there's nothing else to do.
+    const Cell& cell = _cells[e._cell];
+    bool stay = fits( cell, bound );
+    if ( stay && !cell.isLeaf() )
+    {
+        unsigned child = cell._children[octant(cell._center, osg::Vec3d(bound.center()))];
+        stay = !fits( _cells[child], bound );
+    }
+
+    if ( !stay )
+    {
+        unsigned target = findCell( bound );
+        if ( target != e._cell )
+        {
+            detach( index );
+            attach( index, target );
+        }
+    }
+
+    return true;
+}
+
+bool
+SpatialIndex::remove(osg::Node* node)
+{
+    EntryMap::iterator i = _entryMap.find( node );
+    if ( i == _entryMap.end() )
+        return false;
+
+    unsigned index = i->second;
+    detach( index );
+    _entryMap.erase( i );
+
+    // move the last entry into the vacated spot.
+    unsigned last = _entries.size() - 1;
+    if ( index != last )
+    {
+        _entries[index] = _entries[last];
+        const Entry& moved = _entries[index];
+        _cells[moved._cell]._entries[moved._slot] = index;
+        _entryMap[moved._node] = index;
+    }
+    _entries.pop_back();
+
+    return true;
+}
+
+bool
+SpatialIndex::contains(osg::Node* node) const
+{
+    return _entryMap.find(node) != _entryMap.end();
+}
+
+void
+SpatialIndex::clear()
+{
+    Cell root = _cells[0];
+    root._count = 0u;
+    root._entries.clear();
+    for( unsigned i = 0; i < 8; ++i )
+        root._children[i] = -1;
+
+    _cells.clear();
+    _cells.push_back( root );
+    _entries.clear();
+    _entryMap.clear();
+}
+
+void
+SpatialIndex::collect(unsigned cell, NodeVector& out_nodes) const
+{
+    const Cell& c = _cells[cell];
+    if ( c._count == 0u )
+        return;
+
+    for( std::vector<unsigned>::const_iterator i = c._entries.begin(); i != c._entries.end(); ++i )
+        out_nodes.push_back( _entries[*i]._node );
+
+    if ( !c.isLeaf() )
+    {
+        for( unsigned i = 0; i < 8; ++i )
+            collect( c._children[i], out_nodes );
+    }
+}
+
+void
+SpatialIndex::queryFrustum(const osg::Polytope& tope, NodeVector& out_nodes) const
+{
+    queryFrustum( 0u, tope, out_nodes );
+}
+
+void
+SpatialIndex::queryFrustum(unsigned cell, const osg::Polytope& tope, NodeVector& out_nodes) const
+{
+    const Cell& c = _cells[cell];
+    if ( c._count == 0u )
+        return;
+
+    // The root may hold objects outside its bounds, so its own entries
+    // are always tested one by one.
+    Classification cls = classifyBox( c._center, 2.0*c._halfSize, tope );
+    if ( cell != 0u )
+    {
+        if ( cls == OUTSIDE )
+            return;
+
+        if ( cls == INSIDE )
+        {
+            collect( cell, out_nodes );
+            return;
+        }
+    }
+
+    for( std::vector<unsigned>::const_iterator i = c._entries.begin(); i != c._entries.end(); ++i )
+    {
+        const Entry& e = _entries[*i];
+        if ( sphereInside(e._bound, tope) )
+            out_nodes.push_back( e._node );
+    }
+
+    if ( !c.isLeaf() && cls != OUTSIDE )
+    {
+        for( unsigned i = 0; i < 8; ++i )
+            queryFrustum( c._children[i], tope, out_nodes );
+    }
+}
+
+void
+SpatialIndex::queryRange(const osg::Vec3d& point, double range, NodeVector& out_nodes) const
+{
+    queryRange( 0u, point, range, out_nodes );
+}
+
+void
+SpatialIndex::queryRange(unsigned cell, const osg::Vec3d& point, double range, NodeVector& out_nodes) const
+{
+    const Cell& c = _cells[cell];
+    if ( c._count == 0u )
+        return;
+
+    double range2 = range*range;
+    double loose  = 2.0*c._halfSize;
+    bool   outside = minDistance2(c._center, loose, point) > range2;
+
+    // as above, the root's own entries are always tested.
+    if ( cell != 0u )
+    {
+        if ( outside )
+            return;
+
+        if ( maxDistance2(c._center, loose, point) <= range2 )
+        {
+            collect( cell, out_nodes );
+            return;
+        }
+    }
+
+    for( std::vector<unsigned>::const_iterator i = c._entries.begin(); i != c._entries.end(); ++i )
+    {
+        const Entry& e = _entries[*i];
+        if ( (osg::Vec3d(e._bound.center()) - point).length() - e._bound.radius() <= range )
+            out_nodes.push_back( e._node );
+    }
+
+    if ( !c.isLeaf() && !outside )
+    {
+        for( unsigned i = 0; i < 8; ++i )
+            queryRange( c._children[i], point, range, out_nodes );
+    }
+}
+
+void
+SpatialIndex::queryNearest(const osg::Vec3d& point,
+                           unsigned          k,
+                           NodeVector&       out_nodes,
+                           double            maxRange) const
+{
+    if ( k == 0u || _entries.empty() )
+        return;
+
+    double maxRange2 = maxRange < DBL_MAX ? maxRange*maxRange : DBL_MAX;
+
+    // Best-first search: cells are queued by the distance to their loose
+    // bounds, which never exceeds the distance to any object inside them.
+    // So once an object reaches the front of the queue, nothing left can
+    // be closer.
+    std::priority_queue<Candidate> queue;
+    queue.push( Candidate(0.0, 0, -1) );
+
+    unsigned found = 0u;
+    while( !queue.empty() && found < k )
+    {
+        Candidate next = queue.top();
+        queue.pop();
+
+        if ( next._entry >= 0 )
+        {
+            out_nodes.push_back( _entries[next._entry]._node );
+            ++found;
+            continue;
+        }
+
+        const Cell& c = _cells[next._cell];
+
+        for( std::vector<unsigned>::const_iterator i = c._entries.begin(); i != c._entries.end(); ++i )
+        {
+            double d2 = (osg::Vec3d(_entries[*i]._bound.center()) - point).length2();
+            if ( d2 <= maxRange2 )
+                queue.push( Candidate(d2, -1, *i) );
+        }
+
+        if ( !c.isLeaf() )
+        {
+            for( unsigned i = 0; i < 8; ++i )
+            {
+                const Cell& child = _cells[c._children[i]];
+                if ( child._count > 0u )
+                {
+                    double d2 = minDistance2( child._center, 2.0*child._halfSize, point );
+                    if ( d2 <= maxRange2 )
+                        queue.push( Candidate(d2, c._children[i], -1) );
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------
+
+#undef  LC
+#define LC "[SpatialIndexGroup] "
+
+SpatialIndexGroup::SpatialIndexGroup()
+{
+    _index = new SpatialIndex();
+}
+
+bool
+SpatialIndexGroup::refresh(osg::Node* child)
+{
+    return _index->update( child );
+}
+
+bool
+SpatialIndexGroup::addChild(osg::Node* child)
+{
+    if ( !osg::Group::addChild(child) )
+        return false;
+
+    _index->insert( child );
+    return true;
+}
+
+bool
+SpatialIndexGroup::insertChild(unsigned index, osg::Node* child)
+{
+    if ( !osg::Group::insertChild(index, child) )
+        return false;
+
+    _index->insert( child );
+    return true;
+}
+
+bool
+SpatialIndexGroup::removeChildren(unsigned pos, unsigned numChildrenToRemove)
+{
+    unsigned end = osg::minimum( pos + numChildrenToRemove, getNumChildren() );
+    for( unsigned i = pos; i < end; ++i )
+    {
+        _index->remove( getChild(i) );
+    }
+
+    return osg::Group::removeChildren( pos, numChildrenToRemove );
+}
+
+bool
+SpatialIndexGroup::setChild(unsigned index, osg::Node* node)
+{
+    osg::ref_ptr<osg::Node> orig = index < getNumChildren() ? getChild(index) : 0L;
+
+    if ( !osg::Group::setChild(index, node) )
+        return false;
+
+    if ( orig.valid() )
+        _index->remove( orig.get() );
+
+    _index->insert( node );
+    return true;
+}
+
+void
+SpatialIndexGroup::traverse(osg::NodeVisitor& nv)
+{
+    if ( nv.getVisitorType() == nv.CULL_VISITOR )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor(nv);
+        if ( cv )
+        {
+            // the frustum is in this group's local frame, same as the
+            // children's bounds.
+            const osg::Polytope& frustum = cv->getCurrentCullingSet().getFrustum();
+
+            SpatialIndex::NodeVector visible;
+            visible.reserve( 256 );
+            _index->queryFrustum( frustum, visible );
+
+            for( SpatialIndex::NodeVector::iterator i = visible.begin(); i != visible.end(); ++i )
+            {
+                (*i)->accept( nv );
+            }
+            return;
+        }
+    }
+
+    osg::Group::traverse( nv );
+}
@@ -18,9 +18,18 @@
 */
 #include <osgEarthUtil/TFSPackager>
 
+#include <osgEarth/Hasher>
 #include <osgEarth/Registry>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarthFeatures/GeoJSON>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 #define LC "[TFSPackager] "
 
@@ -30,261 +39,387 @@ using namespace osgEarth::Symbology;
 using namespace osgEarth::Util;
 
 /******************************************************************************************/
-class FeatureTileVisitor;
-class FeatureTile;
 
-typedef std::list< osgEarth::Features::FeatureID > FeatureIDList;
-
-class FeatureTile : public osg::Referenced
-{
-public:
-    FeatureTile( const TileKey& key ):
-      _key( key ),
-          _isSplit( false )
-      {        
-      }
-
-      const GeoExtent& getExtent() const
-      {
-          return _key.getExtent();
-      }
-
-      const TileKey& getKey() const
-      {
-          return _key;
-      }
-
-      bool getIsSplit() const { return _isSplit;}
-
-      void split()
-      {
-          if (!_isSplit)
-          {
-              for (unsigned int i = 0; i < 4; ++i)
-              {  
-                  _children[i] = new FeatureTile(_key.createChildKey( i ) );
-              }
-              _isSplit = true;
-          }
-      }
-
-      void accept( FeatureTileVisitor* v);
-
-      void traverse( FeatureTileVisitor* v )
-      {
-          if (_isSplit)
-          {
-              for (unsigned int i = 0; i < 4; ++i)
-              {
-                  _children[i]->accept( v );
-              }
-          }
-      }
-
-      FeatureIDList& getFeatures()
-      {
-          return _features;
-      }
-
-
-private:    
-    FeatureIDList _features;
-    TileKey _key;   
-    osg::ref_ptr<FeatureTile> _children[4];
-    bool _isSplit;
-};
-
-class FeatureTileVisitor : public osg::Referenced
+namespace
 {
-public:
-    virtual void traverse(FeatureTile* tile)
+    // name of the file, in the destination, recording what each tile was built from.
+    const char* MANIFEST_FILE = "tfs.manifest";
+
+    // a feature read from the source, already in the output SRS, with its bounds
+    // and a digest of its content.
+    struct Entry
+    {
+        FeatureID             _fid;
+        Bounds                _bounds;
+        UInt64                _digest;
+        osg::ref_ptr<Feature> _feature;
+    };
+    typedef std::vector<Entry> EntryVector;
+
+    // a tile to build, and the features that may go into it, in the order the
+    // source returned them.
+    struct TileJob
+    {
+        TileKey               _key;
+        std::vector<unsigned> _candidates;
+    };
+    typedef std::vector<TileJob> TileJobVector;
+
+    // what a tile was built from, and what went into it.
+    struct TileRecord
     {
-        tile->traverse( this );
+        UInt64   _input;    // digest of the settings, the tile and its candidate features
+        UInt64   _content;  // digest of the features written to the tile
+        unsigned _consumed; // candidates looked at before the rest went to the children
+
+        TileRecord() : _input(0), _content(0), _consumed(0) { }
+    };
+
+    // tile name => record
+    typedef std::map<std::string, TileRecord> Manifest;
+
+    // what building a tile produced.
+    struct TileResult
+    {
+        std::vector<unsigned> _placed;   // features that went into the tile
+        std::string           _name;     // "lod/x/y" of the tile file
+        TileRecord            _record;
+        bool                  _built;    // whether the tile's content was rebuilt
+        bool                  _written;  // whether the file was (re)written
+        TileJobVector         _children; // tiles to build at the next level
+
+        TileResult() : _built(false), _written(false) { }
+    };
+
+    struct BuildSettings
+    {
+        unsigned                _firstLevel;
+        unsigned                _maxLevel;
+        unsigned                _maxFeatures;
+        CropFilter::Method      _method;
+        std::string             _destination;
+        bool                    _incremental;
+        UInt64                  _digest;   // digest of all of the above that shapes the tiles
+        const Manifest*         _previous;
+        Threading::Mutex*       _directoryMutex;
+    };
+
+    //------------------------------------------------------------------------
+
+    // adds everything about a feature that goes into a tile file.
+    void addFeature( Hasher& h, const Feature* f )
+    {
+        h.add( f->getFID() );
+
+        const AttributeTable& attrs = f->getAttrs();
+        for( AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a )
+        {
+            h.add( a->first );
+            h.add( (int)a->second.first );
+            h.add( a->second.getString() );
+        }
+
+        ConstGeometryIterator parts( f->getGeometry() );
+        while( parts.hasMore() )
+        {
+            const Geometry* part = parts.next();
+            h.add( (int)part->getType() );
+            h.add( (unsigned)part->size() );
+            if ( !part->empty() )
+                h.add( &part->front(), (unsigned)(part->size() * sizeof(osg::Vec3d)) );
+        }
     }
-};
 
-void FeatureTile::accept(FeatureTileVisitor* v)
-{    
-    v->traverse( this );
-}
+    UInt64 digestFeature( const Feature* feature )
+    {
+        Hasher h;
+        addFeature( h, feature );
+        return h.get();
+    }
 
-/******************************************************************************************/
+    UInt64 digestFeatures( const FeatureList& features )
+    {
+        Hasher h;
+        for( FeatureList::const_iterator i = features.begin(); i != features.end(); ++i )
+            addFeature( h, i->get() );
+        return h.get();
+    }
 
-class AddFeatureVisitor : public FeatureTileVisitor
-{
-public:
-    AddFeatureVisitor( Feature* feature, int maxFeatures, int firstLevel, int maxLevel, CropFilter::Method cropMethod):
-      _feature( feature ),
-          _maxFeatures( maxFeatures ),      
-          _maxLevel( maxLevel ),
-          _firstLevel( firstLevel ),
-          _added(false),
-          _numAdded( 0 ),
-          _levelAdded(-1),
-          _cropMethod( cropMethod )
-      {
-
-      }
-
-      virtual void traverse( FeatureTile* tile)
-      {        
-          if (_added && _cropMethod != CropFilter::METHOD_CROPPING) return;
-
-          bool traverse = true;
-
-          GeoExtent featureExtent(_feature->getSRS(), _feature->getGeometry()->getBounds());
-          if (featureExtent.intersects( tile->getExtent()))
-          {
-              //If the node contains the feature, and it doesn't contain the max number of features add it.  If it's already full then 
-              //split it.
-              if (tile->getKey().getLevelOfDetail() >= (unsigned int)_firstLevel && 
-                  (tile->getFeatures().size() < (unsigned int)_maxFeatures || tile->getKey().getLevelOfDetail() == _maxLevel || tile->getKey().getLevelOfDetail() == _levelAdded))
-              {
-                  if (_levelAdded < 0 || _levelAdded == tile->getKey().getLevelOfDetail())
-                  {
-                      osg::ref_ptr< Feature > clone = new Feature( *_feature, osg::CopyOp::DEEP_COPY_ALL );
-                      FeatureList features;
-                      features.push_back( clone );
-
-                      CropFilter cropFilter(_cropMethod);
-                      FilterContext context(0);
-                      context.extent() = tile->getExtent();
-                      cropFilter.push( features, context );
-
-
-                      if (!features.empty() && clone->getGeometry() && clone->getGeometry()->isValid())
-                      {
-                          //tile->getFeatures().push_back( clone );
-                          tile->getFeatures().push_back( clone->getFID() );
-                          _added = true;
-                          _levelAdded = tile->getKey().getLevelOfDetail();
-                          _numAdded++;                   
-                          traverse = false;
-                      }
-                  }
-
-                  if (traverse || _cropMethod == CropFilter::METHOD_CROPPING)
-                  {
-                      tile->traverse( this );
-                  }
-              }
-              else
-              {   
-                  tile->split();
-                  tile->traverse( this );
-              }
-
-          }
-
-
-      }
-
-      int _levelAdded;
-
-      bool _added;
-      int _maxFeatures;
-      int _firstLevel;
-      int _maxLevel;
-      int _numAdded;
-
-      CropFilter::Method _cropMethod;
-
-
-
-      osg::ref_ptr< Feature > _feature;
-};
+    //------------------------------------------------------------------------
 
+    bool overlaps( const Bounds& bounds, const GeoExtent& extent )
+    {
+        return
+            bounds.xMin() <= extent.xMax() && bounds.xMax() >= extent.xMin() &&
+            bounds.yMin() <= extent.yMax() && bounds.yMax() >= extent.yMin();
+    }
 
-/******************************************************************************************/
-class WriteFeaturesVisitor : public FeatureTileVisitor
-{
-public:
-    WriteFeaturesVisitor(FeatureSource* features, const std::string& dest, CropFilter::Method cropMethod, const SpatialReference* srs):
-      _dest( dest ),
-          _features( features ),
-          _cropMethod( cropMethod ),
-          _srs( srs )
-      {
-
-      }
-
-      virtual void traverse( FeatureTile* tile)
-      {
-          if (tile->getFeatures().size() > 0)
-          {                 
-              //Actually load up the features
-              FeatureList features;
-              for (FeatureIDList::const_iterator i = tile->getFeatures().begin(); i != tile->getFeatures().end(); i++)
-              {
-                  Feature* f = _features->getFeature( *i );                  
-
-                  if (f)
-                  {
-                      //Reproject the feature to the dest SRS if it's not already
-                      if (!f->getSRS()->isEquivalentTo( _srs ) )
-                      {
-                          f->transform( _srs );
-                      }
-                      features.push_back( f );
-                  }
-                  else
-                  {
-                      OE_NOTICE << "couldn't get feature " << *i << std::endl;
-                  }
-              }
-
-              //Need to do the cropping again since these are brand new features coming from the feature source.
-              CropFilter cropFilter(_cropMethod);
-              FilterContext context(0);
-              context.extent() = tile->getExtent();
-              cropFilter.push( features, context );
-
-              std::string contents = Feature::featuresToGeoJSON( features );
-              std::stringstream buf;
-              int x =  tile->getKey().getTileX();
-              unsigned int numRows, numCols;
-              tile->getKey().getProfile()->getNumTiles(tile->getKey().getLevelOfDetail(), numCols, numRows);
-              int y  = numRows - tile->getKey().getTileY() - 1;
-
-              buf << _dest << "/" << tile->getKey().getLevelOfDetail() << "/" << x << "/" << y << ".json";
-              std::string filename = buf.str();
-              //OE_NOTICE << "Writing " << features.size() << " features to " << filename << std::endl;
-
-              if ( !osgDB::fileExists( osgDB::getFilePath(filename) ) )
-                  osgDB::makeDirectoryForFile( filename );
-
-
-              std::fstream output( filename.c_str(), std::ios_base::out );
-              if ( output.is_open() )
-              {
-                  output << contents;
-                  output.flush();
-                  output.close();                
-              }            
-          }
-          tile->traverse( this );        
-      }
-
-      osg::ref_ptr< FeatureSource > _features;
-      std::string _dest;      
-      CropFilter::Method _cropMethod;
-      osg::ref_ptr< const SpatialReference > _srs;
-};
+    // whether any of a feature may go into a tile, going by its bounds alone.
+    bool touches( CropFilter::Method method, const Bounds& bounds, const GeoExtent& extent )
+    {
+        if ( method == CropFilter::METHOD_CENTROID )
+        {
+            osg::Vec3d centroid = bounds.center();
+            return extent.contains( centroid.x(), centroid.y() );
+        }
+        return overlaps( bounds, extent );
+    }
 
+    // The part of a feature that goes into a tile, or NULL if none of it does.
+    // Features wholly within the tile go in as-is; only the ones that straddle
+    // its edge get cropped, on a copy, since other tiles share the feature.
+    osg::ref_ptr<Feature> clip( const BuildSettings& settings, const Entry& entry, const GeoExtent& extent )
+    {
+        if ( !touches(settings._method, entry._bounds, extent) )
+            return 0L;
+
+        if ( settings._method == CropFilter::METHOD_CENTROID || extent.contains(entry._bounds) )
+            return entry._feature.get();
+
+        osg::ref_ptr<Feature> piece = new Feature( *entry._feature.get() );
+        FeatureList features;
+        features.push_back( piece.get() );
+
+        CropFilter cropFilter( settings._method );
+        FilterContext context( 0L );
+        context.extent() = extent;
+        cropFilter.push( features, context );
+
+        return features.empty() ? 0L : piece.get();
+    }
+
+    // Hands the candidates from 'begin' on down to the children they fall in.
+    void handDown(const BuildSettings& settings,
+                  const EntryVector&   entries,
+                  const TileJob&       job,
+                  unsigned             begin,
+                  TileResult&          result)
+    {
+        const TileKey& key = job._key;
+        if ( key.getLevelOfDetail() >= settings._maxLevel || begin >= job._candidates.size() )
+            return;
+
+        TileKey               childKeys[4];
+        std::vector<unsigned> childCandidates[4];
+        for( unsigned q = 0; q < 4; ++q )
+            childKeys[q] = key.createChildKey( q );
+
+        for( unsigned i = begin; i < job._candidates.size(); ++i )
+        {
+            const Entry& entry = entries[job._candidates[i]];
 
+            // a centroid lands in one child; a feature to crop goes to every child it overlaps.
+            for( unsigned q = 0; q < 4; ++q )
+            {
+                if ( touches(settings._method, entry._bounds, childKeys[q].getExtent()) )
+                {
+                    childCandidates[q].push_back( job._candidates[i] );
+                    if ( settings._method == CropFilter::METHOD_CENTROID )
+                        break;
+                }
+            }
+        }
+
+        for( unsigned q = 0; q < 4; ++q )
+        {
+            if ( !childCandidates[q].empty() )
+            {
+                result._children.push_back( TileJob() );
+                result._children.back()._key = childKeys[q];
+                result._children.back()._candidates.swap( childCandidates[q] );
+            }
+        }
+    }
+
+    // Fills one tile: it keeps the first features (up to the maximum) that fall
+    // within it, and hands the rest down to the children they fall in. At the
+    // max level a tile keeps everything it gets. Then writes the tile file.
+    //
+    // An incremental run skips the tiles whose settings and candidate features
+    // are the same as last time, since they would come out the same; it only
+    // hands their remaining candidates down, going by the manifest. Of the tiles
+    // it does rebuild, it only writes the ones whose content changed.
+    void buildTile(const BuildSettings& settings,
+                   const EntryVector&   entries,
+                   const TileJob&       job,
+                   TileResult&          result)
+    {
+        const TileKey&   key    = job._key;
+        const GeoExtent& extent = key.getExtent();
+        unsigned         lod    = key.getLevelOfDetail();
+        bool             keep   = lod >= settings._firstLevel;
+        bool             atMax  = lod >= settings._maxLevel;
+
+        if ( !keep )
+        {
+            handDown( settings, entries, job, 0, result );
+            return;
+        }
+
+        unsigned int numCols, numRows;
+        key.getProfile()->getNumTiles( lod, numCols, numRows );
+
+        std::stringstream buf;
+        buf << lod << "/" << key.getTileX() << "/" << (numRows - key.getTileY() - 1);
+        std::string name     = buf.str();
+        std::string filename = settings._destination + "/" + name + ".json";
+
+        Hasher input;
+        input.mix( settings._digest );
+        input.mix( lod );
+        input.mix( key.getTileX() );
+        input.mix( key.getTileY() );
+        for( std::vector<unsigned>::const_iterator i = job._candidates.begin(); i != job._candidates.end(); ++i )
+        {
+            input.mix( (UInt64)entries[*i]._fid );
+            input.mix( entries[*i]._digest );
+        }
+
+        const TileRecord* previous = 0L;
+        if ( settings._incremental )
+        {
+            Manifest::const_iterator p = settings._previous->find( name );
+            if ( p != settings._previous->end() && osgDB::fileExists(filename) )
+                previous = &p->second;
+        }
+
+        if ( previous && previous->_input == input.get() )
+        {
+            unsigned consumed = osg::minimum( previous->_consumed, (unsigned)job._candidates.size() );
+
+            // not knowing which of these an edge crop emptied, count them all as placed;
+            // that only affects the "failed" report.
+            for( unsigned i = 0; i < consumed; ++i )
+            {
+                if ( touches(settings._method, entries[job._candidates[i]]._bounds, extent) )
+                    result._placed.push_back( job._candidates[i] );
+            }
+
+            result._name   = name;
+            result._record = *previous;
+            handDown( settings, entries, job, consumed, result );
+            return;
+        }
+
+        FeatureList features;
+        unsigned    count    = 0;
+        unsigned    consumed = 0;
+
+        for( ; consumed < job._candidates.size() && (atMax || count < settings._maxFeatures); ++consumed )
+        {
+            unsigned index = job._candidates[consumed];
+
+            // either it goes here, or none of it is in this tile.
+            osg::ref_ptr<Feature> piece = clip( settings, entries[index], extent );
+            if ( piece.valid() )
+            {
+                features.push_back( piece.get() );
+                result._placed.push_back( index );
+                ++count;
+            }
+        }
+
+        handDown( settings, entries, job, consumed, result );
+
+        if ( features.empty() )
+            return;
+
+        result._name             = name;
+        result._built            = true;
+        result._record._input    = input.get();
+        result._record._content  = digestFeatures( features );
+        result._record._consumed = consumed;
+
+        if ( previous && previous->_content == result._record._content )
+            return;
+
+        {
+            Threading::ScopedMutexLock lock( *settings._directoryMutex );
+            if ( !osgDB::fileExists( osgDB::getFilePath(filename) ) )
+                osgDB::makeDirectoryForFile( filename );
+        }
+
+        std::fstream output( filename.c_str(), std::ios_base::out );
+        if ( output.is_open() )
+        {
+            // stream the features straight to the file.
+            GeoJSONWriter::write( features, output );
+            output.flush();
+            output.close();
+            result._written = true;
+        }
+        else
+        {
+            OE_WARN << LC << "Failed to write " << filename << std::endl;
+        }
+    }
+
+    // One building thread: takes the next unbuilt tile of the level until there are none left.
+    struct BuildTiles
+    {
+        const BuildSettings*     _settings;
+        const EntryVector*       _entries;
+        const TileJobVector*     _jobs;
+        std::vector<TileResult>* _results;
+        unsigned*                _next;
+        Threading::Mutex*        _mutex;
+
+        BuildTiles() : _settings(0L), _entries(0L), _jobs(0L), _results(0L), _next(0L), _mutex(0L) { }
+
+        void execute()
+        {
+            for( ;; )
+            {
+                unsigned i;
+                {
+                    Threading::ScopedMutexLock lock( *_mutex );
+                    if ( *_next >= _jobs->size() )
+                        return;
+                    i = (*_next)++;
+                }
+                buildTile( *_settings, *_entries, (*_jobs)[i], (*_results)[i] );
+            }
+        }
+    };
+
+    void readManifest( const std::string& filename, Manifest& out )
+    {
+        std::ifstream input( filename.c_str() );
+        std::string line;
+        while( std::getline(input, line) )
+        {
+            std::istringstream fields( line );
+            std::string name;
+            TileRecord  record;
+            if ( fields >> name >> record._input >> record._content >> record._consumed )
+                out[name] = record;
+        }
+    }
+
+    void writeManifest( const std::string& filename, const Manifest& manifest )
+    {
+        std::ofstream output( filename.c_str() );
+        for( Manifest::const_iterator i = manifest.begin(); i != manifest.end(); ++i )
+        {
+            output << i->first << " " << i->second._input << " " << i->second._content << " " << i->second._consumed << "\n";
+        }
+    }
+}
 
 /******************************************************************************************/
 
 TFSPackager::TFSPackager():
-_firstLevel( 0 ),
-    _maxLevel( 10 ),
-    _maxFeatures( 300 ),
-    _method( CropFilter::METHOD_CENTROID )
+_firstLevel ( 0 ),
+_maxLevel   ( 10 ),
+_maxFeatures( 300 ),
+_method     ( CropFilter::METHOD_CENTROID ),
+_numThreads ( 0 ),
+_incremental( false )
 {
 }
 
 void
-    TFSPackager::package( FeatureSource* features, const std::string& destination, const std::string& layername, const std::string& description )
+TFSPackager::package( FeatureSource* features, const std::string& destination, const std::string& layername, const std::string& description )
 {   
     if (!_destSRSString.empty())
     {
@@ -302,58 +437,211 @@ void
 
     osg::ref_ptr< const osgEarth::Profile > profile = osgEarth::Profile::create(extent.getSRS(), extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), 1, 1);
 
-
     TileKey rootKey = TileKey(0, 0, 0, profile );    
 
+    osg::Timer_t start = osg::Timer::instance()->tick();
 
-    osg::ref_ptr< FeatureTile > root = new FeatureTile( rootKey );
-    //Loop through all the features and try to insert them into the quadtree
-    osg::ref_ptr< FeatureCursor > cursor = features->createFeatureCursor( _query );
-    int added = 0;
-    int failed = 0;
+    //Read all the features once, converting them to the dest SRS as they stream in.
+    //The SRS transforms serialize on the GDAL lock anyway, so there's no use spreading them out,
+    //and the building threads only ever touch the features held here, never the source.
+    EntryVector entries;
     int skipped = 0;
-    int highestLevel = 0;
 
+    const SpatialReference* lastSRS = 0L;
+    bool needsXform = false;
+
+    osg::ref_ptr< FeatureCursor > cursor = features->createFeatureCursor( _query );
     while (cursor.valid() && cursor->hasMore())
     {        
         osg::ref_ptr< Feature > feature = cursor->nextFeature();
+        if ( !feature.valid() )
+            continue;
 
-        //Reproject the feature to the dest SRS if it's not already
-        if (!feature->getSRS()->isEquivalentTo( _srs ) )
+        if ( feature->getSRS() != lastSRS )
         {
-            feature->transform( _srs );
+            lastSRS = feature->getSRS();
+            needsXform = lastSRS && !lastSRS->isEquivalentTo( _srs.get() );
         }
 
-        if (feature->getGeometry() && feature->getGeometry()->getBounds().valid() && feature->getGeometry()->isValid())
+        if ( needsXform )
         {
+            feature->transform( _srs.get() );
+        }
 
-            AddFeatureVisitor v(feature.get(), _maxFeatures, _firstLevel, _maxLevel, _method);
-            root->accept( &v );
-            if (!v._added)
-            {
-                OE_NOTICE << "Failed to add feature " << feature->getFID() << std::endl;
-                failed++;
-            }
-            else
-            {                
-                if (highestLevel < v._levelAdded)
-                {
-                    highestLevel = v._levelAdded;
-                }
-                added++;
-                OE_DEBUG << "Added " << added << std::endl;
-            }   
+        const Feature* cf = feature.get();
+        const Geometry* geom = cf->getGeometry();
+        Bounds bounds;
+        if ( geom )
+            bounds = geom->getBounds();
+
+        if ( geom && bounds.valid() && geom->isValid() )
+        {
+            entries.push_back( Entry() );
+            Entry& entry = entries.back();
+            entry._fid    = feature->getFID();
+            entry._bounds = bounds;
+            entry._digest  = digestFeature( feature.get() );
+            entry._feature = feature.get();
         }
         else
         {
             OE_NOTICE << "Skipping feature " << feature->getFID() << " with null or invalid geometry" << std::endl;
             skipped++;
         }
-    }   
+    }
+
+    OE_INFO << LC << "Read " << entries.size() << " features in "
+        << osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() ) << "s" << std::endl;
+
+    //The digests of the tiles already in the destination, if we're only updating it.
+    Manifest previous, current;
+    std::string manifestFile = osgDB::concatPaths( destination, MANIFEST_FILE );
+    if ( _incremental )
+    {
+        readManifest( manifestFile, previous );
+    }
+
+    Threading::Mutex directoryMutex;
+
+    BuildSettings settings;
+    settings._firstLevel     = _firstLevel;
+    settings._maxLevel       = _maxLevel;
+    settings._maxFeatures    = osg::maximum( _maxFeatures, 1u );
+    settings._method         = _method;
+    settings._destination    = destination;
+    settings._incremental    = _incremental;
+    settings._previous       = &previous;
+    settings._directoryMutex = &directoryMutex;
+
+    //Anything here that changes changes every tile.
+    Hasher digest;
+    digest.add( settings._firstLevel );
+    digest.add( settings._maxLevel );
+    digest.add( settings._maxFeatures );
+    digest.add( (int)settings._method );
+    digest.add( _srs->getWKT() );
+    digest.add( extent.xMin() );
+    digest.add( extent.yMin() );
+    digest.add( extent.xMax() );
+    digest.add( extent.yMax() );
+    settings._digest = digest.get();
+
+    unsigned numThreads = _numThreads > 0 ? _numThreads : (unsigned)osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+
+    osg::ref_ptr<TaskService> service;
+    if ( numThreads > 1 )
+        service = new TaskService( "TFSPackager", numThreads );
+
+    //Build the quadtree a level at a time, starting with every feature in the root. Each
+    //tile only looks at the features its parent handed down, and the tiles of a level are
+    //independent of one another, so they all build (and write) in parallel.
+    TileJobVector jobs( 1 );
+    jobs[0]._key = rootKey;
+    jobs[0]._candidates.resize( entries.size() );
+    for (unsigned i = 0; i < entries.size(); ++i)
+        jobs[0]._candidates[i] = i;
+
+    std::vector<bool> placed( entries.size(), false );
+    int highestLevel = 0;
+    unsigned written = 0, unchanged = 0, rebuilt = 0;
+
+    while ( !jobs.empty() )
+    {
+        std::vector<TileResult> results( jobs.size() );
+        unsigned next = 0;
+        Threading::Mutex nextMutex;
+
+        unsigned numTasks = service.valid() ? osg::minimum( numThreads, (unsigned)jobs.size() ) : 1u;
+        if ( numTasks <= 1 )
+        {
+            BuildTiles task;
+            task._settings = &settings;
+            task._entries  = &entries;
+            task._jobs     = &jobs;
+            task._results  = &results;
+            task._next     = &next;
+            task._mutex    = &nextMutex;
+            task.execute();
+        }
+        else
+        {
+            Threading::MultiEvent done( numTasks );
+            for (unsigned t = 0; t < numTasks; ++t)
+            {
+                ParallelTask<BuildTiles>* task = new ParallelTask<BuildTiles>( &done );
+                task->_settings = &settings;
+                task->_entries  = &entries;
+                task->_jobs     = &jobs;
+                task->_results  = &results;
+                task->_next     = &next;
+                task->_mutex    = &nextMutex;
+                service->add( task );
+            }
+            done.wait();
+        }
+
+        TileJobVector children;
+        for (unsigned i = 0; i < results.size(); ++i)
+        {
+            TileResult& result = results[i];
+
+            for (std::vector<unsigned>::const_iterator p = result._placed.begin(); p != result._placed.end(); ++p)
+                placed[*p] = true;
+
+            if ( !result._name.empty() )
+            {
+                current[result._name] = result._record;
+                highestLevel = osg::maximum( highestLevel, (int)jobs[i]._key.getLevelOfDetail() );
+                if ( result._built ) ++rebuilt;
+                if ( result._written ) ++written; else ++unchanged;
+            }
+
+            for (TileJobVector::iterator c = result._children.begin(); c != result._children.end(); ++c)
+            {
+                children.push_back( TileJob() );
+                children.back()._key = c->_key;
+                children.back()._candidates.swap( c->_candidates );
+            }
+        }
+
+        jobs.swap( children );
+    }
+
+    int added = 0;
+    int failed = 0;
+    for (unsigned i = 0; i < entries.size(); ++i)
+    {
+        if ( placed[i] )
+        {
+            added++;
+        }
+        else
+        {
+            OE_NOTICE << "Failed to add feature " << entries[i]._fid << std::endl;
+            failed++;
+        }
+    }
     OE_NOTICE << "Added=" << added << " Skipped=" << skipped << " Failed=" << failed << std::endl;
 
-    WriteFeaturesVisitor write(features, destination, _method, _srs);
-    root->accept( &write );
+    //Remove the tiles an earlier run wrote that this one no longer produces.
+    unsigned removed = 0;
+    if ( _incremental )
+    {
+        for (Manifest::const_iterator i = previous.begin(); i != previous.end(); ++i)
+        {
+            if ( current.find(i->first) == current.end() )
+            {
+                std::string filename = destination + "/" + i->first + ".json";
+                if ( ::remove( filename.c_str() ) == 0 )
+                    ++removed;
+            }
+        }
+    }
+
+    OE_NOTICE << "Tiles rebuilt=" << rebuilt << " Written=" << written << " Unchanged=" << unchanged << " Removed=" << removed << std::endl;
+
+    osgDB::makeDirectory( destination );
+    writeManifest( manifestFile, current );
 
     //Write out the meta doc
     TFSLayer layer;
@@ -366,4 +654,3 @@ void
     TFSReaderWriter::write( layer, osgDB::concatPaths( destination, "tfs.xml"));
 
 }
-
@@ -111,9 +111,9 @@ void TMSBackFiller::processKey( const TileKey& key )
         osg::ref_ptr< osg::Image> merged = mosaic.createImage();
         if (merged.valid())
         {
-            //Resize the image so it's the same size as one of the input files
+            //Downsample the image so it's the same size as one of the input files
             osg::ref_ptr<osg::Image> resized;
-            ImageUtils::resizeImage( merged.get(), ul->s(), ul->t(), resized );
+            ImageUtils::resampleImage( merged.get(), ul->s(), ul->t(), resized, ImageUtils::FILTER_BOX );
             std::string outputFilename = getFilename( key );                
             writeTile( key, resized.get() );
         }
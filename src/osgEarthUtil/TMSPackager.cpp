@@ -20,6 +20,8 @@
 #include <osgEarthUtil/TMS>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/ImageToHeightFieldConverter>
+#include <osgEarth/Registry>
+#include <osgEarthDrivers/mbtiles/MBTilesOptions>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/WriteFile>
@@ -28,6 +30,7 @@
 
 using namespace osgEarth::Util;
 using namespace osgEarth;
+using namespace osgEarth::Drivers;
 
 
 TMSPackager::TMSPackager(const Profile* outProfile, osgDB::Options* imageWriteOptions) :
@@ -70,6 +73,54 @@ TMSPackager::shouldPackageKey( const TileKey& key ) const
 }
 
 
+TMSPackager::Result
+TMSPackager::openOutput(const std::string& rootFolder,
+                        const std::string& extension)
+{
+    _output = 0L;
+
+    if ( !endsWith(toLower(rootFolder), ".mbtiles") )
+    {
+        // attempt to create the output folder:
+        osgDB::makeDirectory( rootFolder );
+        if ( !osgDB::fileExists( rootFolder ) )
+            return Result( "Unable to create output folder" );
+
+        return Result();
+    }
+
+    // MBTiles is always spherical mercator.
+    if ( !_outProfile->isHorizEquivalentTo(Registry::instance()->getSphericalMercatorProfile()) )
+        return Result( "MBTiles output requires a spherical-mercator profile" );
+
+    osgDB::makeDirectoryForFile( rootFolder );
+
+    MBTilesOptions options;
+    options.filename() = rootFolder;
+    options.format()   = extension;
+    options.writable() = true;
+
+    osg::ref_ptr<TileSource> output = TileSourceFactory::create( options );
+    if ( !output.valid() || output->startup(_imageWriteOptions.get()).isError() || !output->isWritable() )
+        return Result( Stringify() << "Unable to open \"" << rootFolder << "\" for writing" );
+
+    _output = output.get();
+    return Result();
+}
+
+
+TMSPackager::Result
+TMSPackager::closeOutput(const Result& result)
+{
+    if ( _output.valid() )
+    {
+        _output->flush();
+        _output = 0L;
+    }
+    return result;
+}
+
+
 TMSPackager::Result
 TMSPackager::packageImageTile(ImageLayer*          layer,
                               const TileKey&       key,
@@ -94,7 +145,7 @@ TMSPackager::packageImageTile(ImageLayer*          layer,
             << "." << extension;
 
         bool isSingleColor = false;
-        bool tileOK = osgDB::fileExists(path) && !_overwrite;
+        bool tileOK = !_output.valid() && osgDB::fileExists(path) && !_overwrite;
         if ( !tileOK )
         {
             GeoImage image = layer->createImage( key );
@@ -122,12 +173,24 @@ TMSPackager::packageImageTile(ImageLayer*          layer,
                 {
                     // convert to RGB if necessary
                     osg::ref_ptr<osg::Image> final = image.getImage();
+
+                    // only DDS can store block-compressed tiles.
+                    if ( ImageUtils::isCompressed(final.get()) && extension != "dds" )
+                        final = ImageUtils::convertToRGBA8( final.get() );
+
                     if ( extension == "jpg" && final->getPixelFormat() != GL_RGB )
-                        final = ImageUtils::convertToRGB8( image.getImage() );
+                        final = ImageUtils::convertToRGB8( final.get() );
 
                     // dump it to disk
-                    osgDB::makeDirectoryForFile( path );
-                    tileOK = osgDB::writeImageFile( *final.get(), path, _imageWriteOptions);
+                    if ( _output.valid() )
+                    {
+                        tileOK = _output->storeImage( key, final.get() );
+                    }
+                    else
+                    {
+                        osgDB::makeDirectoryForFile( path );
+                        tileOK = osgDB::writeImageFile( *final.get(), path, _imageWriteOptions);
+                    }
 
                     if ( _verbose )
                     {
@@ -209,20 +272,27 @@ TMSPackager::packageElevationTile(ElevationLayer*      layer,
             << "/" << h - key.getTileY() - 1
             << "." << extension;
 
-        bool tileOK = osgDB::fileExists(path) && !_overwrite;
+        bool tileOK = !_output.valid() && osgDB::fileExists(path) && !_overwrite;
         if ( !tileOK )
         {
 
             GeoHeightField hf = layer->createHeightField( key );
             if ( hf.valid() )
             {
-                // convert the HF to an image
-                ImageToHeightFieldConverter conv;
-                osg::ref_ptr<osg::Image> image = conv.convert( hf.getHeightField() );
+                if ( _output.valid() )
+                {
+                    tileOK = _output->storeHeightField( key, hf.getHeightField() );
+                }
+                else
+                {
+                    // convert the HF to an image
+                    ImageToHeightFieldConverter conv;
+                    osg::ref_ptr<osg::Image> image = conv.convert( hf.getHeightField() );
 
-                // dump it to disk
-                osgDB::makeDirectoryForFile( path );
-                tileOK = osgDB::writeImageFile( *image.get(), path );
+                    // dump it to disk
+                    osgDB::makeDirectoryForFile( path );
+                    tileOK = osgDB::writeImageFile( *image.get(), path );
+                }
 
                 if ( _verbose )
                 {
@@ -289,11 +359,6 @@ TMSPackager::package(ImageLayer*        layer,
     if ( !layer || !_outProfile.valid() )
         return Result( "Illegal null layer or profile" );
 
-    // attempt to create the output folder:
-    osgDB::makeDirectory( rootFolder );
-    if ( !osgDB::fileExists( rootFolder ) )
-        return Result( "Unable to create output folder" );
-
     // collect the root tile keys in preparation for packaging:
     std::vector<TileKey> rootKeys;
     _outProfile->getRootKeys( rootKeys );
@@ -347,15 +412,23 @@ TMSPackager::package(ImageLayer*        layer,
         OE_NOTICE << LC << "MIME-TYPE = " << mimeType << ", Extension = " << extension << std::endl;
     }
 
+    Result opened = openOutput( rootFolder, extension );
+    if ( !opened.ok )
+        return opened;
+
     // package the tile hierarchy
     unsigned maxLevel = 0;
     for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
     {
         Result r = packageImageTile( layer, *i, rootFolder, extension, maxLevel );
         if ( _abortOnError && !r.ok )
-            return r;
+            return closeOutput( r );
     }
 
+    // an MBTiles database carries its own metadata.
+    if ( _output.valid() )
+        return closeOutput( Result() );
+
     // create the tile map metadata:
     osg::ref_ptr<TMS::TileMap> tileMap = TMS::TileMap::create(
         "",
@@ -384,11 +457,6 @@ TMSPackager::package(ElevationLayer*    layer,
     if ( !layer || !_outProfile.valid() )
         return Result( "Illegal null layer or profile" );
 
-    // attempt to create the output folder:
-    osgDB::makeDirectory( rootFolder );
-    if ( !osgDB::fileExists( rootFolder ) )
-        return Result( "Unable to create output folder" );
-
     // collect the root tile keys in preparation for packaging:
     std::vector<TileKey> rootKeys;
     _outProfile->getRootKeys( rootKeys );
@@ -411,14 +479,22 @@ TMSPackager::package(ElevationLayer*    layer,
     if ( !testHF.valid() )
         return Result( "Unable to determine heightfield size" );
 
+    Result opened = openOutput( rootFolder, extension );
+    if ( !opened.ok )
+        return opened;
+
     unsigned maxLevel = 0;
     for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
     {
         Result r = packageElevationTile( layer, *i, rootFolder, extension, maxLevel );
         if ( _abortOnError && !r.ok )
-            return r;
+            return closeOutput( r );
     }
 
+    // an MBTiles database carries its own metadata.
+    if ( _output.valid() )
+        return closeOutput( Result() );
+
     // create the tile map metadata:
     osg::ref_ptr<TMS::TileMap> tileMap = TMS::TileMap::create(
         "",
@@ -20,10 +20,16 @@
 #include <osgEarth/MapNode>
 #include <osgEarth/TerrainEngineNode>
 #include <osgEarth/GeoMath>
+#include <OpenThreads/Thread>
+#include <cfloat>
+#include <cmath>
+#include <set>
 
 using namespace osgEarth;
 using namespace osgEarth::Util;
 
+#define LC "[TerrainProfileService] "
+
 /***************************************************/
 TerrainProfile::TerrainProfile():
 _spacing( 1.0 )
@@ -218,3 +224,251 @@ void TerrainProfileCalculator::computeTerrainProfile( osgEarth::MapNode* mapNode
         profile.addElevation( spacing * (double)i, hamsl );
     }
 }
+
+
+/***************************************************/
+
+// Pool of ElevationQuery objects; a query is not thread-safe, so each
+// running job checks one out for itself.
+struct TerrainProfileService::QueryPool : public osg::Referenced
+{
+    QueryPool(const Map* map) : _mapf( map, Map::ELEVATION_LAYERS ) { }
+
+    virtual ~QueryPool()
+    {
+        for( std::vector<ElevationQuery*>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+            delete *i;
+    }
+
+    ElevationQuery* checkOut()
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( _idle.empty() )
+            return new ElevationQuery( _mapf );
+        ElevationQuery* query = _idle.back();
+        _idle.pop_back();
+        return query;
+    }
+
+    void checkIn(ElevationQuery* query)
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _idle.push_back( query );
+    }
+
+    // Jobs are queued here as well as in the task service, so the service can
+    // settle the ones that never started when it goes away. Whoever claims a
+    // job first (a worker or the service's destructor) completes it.
+    void queue(Job* job)
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _queued.insert( job );
+    }
+
+    bool claim(Job* job)
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        return _queued.erase( job ) > 0;
+    }
+
+    void claimAll(std::set< osg::ref_ptr<Job> >& out_jobs)
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        out_jobs.swap( _queued );
+    }
+
+    MapFrame                       _mapf;
+    std::vector<ElevationQuery*>   _idle;
+    std::set< osg::ref_ptr<Job> >  _queued;
+    Threading::Mutex               _mutex;
+};
+
+// Task that runs a single job. It holds the pool (not the service) so the
+// service can be released while jobs are still queued.
+struct TerrainProfileService::RunJob : public TaskRequest
+{
+    RunJob(QueryPool* pool, Job* job) : _pool(pool), _job(job) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        if ( _pool->claim(_job.get()) )
+            run( _pool.get(), _job.get() );
+    }
+
+    osg::ref_ptr<QueryPool> _pool;
+    osg::ref_ptr<Job>       _job;
+};
+
+
+TerrainProfileService::Job::Job(const Route& route, double resolution, Callback* callback) :
+_route     ( route ),
+_resolution( resolution ),
+_callback  ( callback ),
+_succeeded ( false ),
+_canceled  ( false )
+{
+}
+
+void
+TerrainProfileService::Job::wait()
+{
+    while( !_done.isSet() )
+        _done.wait();
+}
+
+
+TerrainProfileService::TerrainProfileService(const Map* map, unsigned numThreads)
+{
+    if ( numThreads == 0u )
+        numThreads = (unsigned)osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+
+    _pool    = new QueryPool( map );
+    _service = new TaskService( "TerrainProfileService", numThreads );
+}
+
+TerrainProfileService::~TerrainProfileService()
+{
+    // Settle the jobs that never started, so nobody waits on them forever.
+    std::set< osg::ref_ptr<Job> > abandoned;
+    _pool->claimAll( abandoned );
+
+    for( std::set< osg::ref_ptr<Job> >::iterator i = abandoned.begin(); i != abandoned.end(); ++i )
+    {
+        Job* job = i->get();
+        job->_succeeded = false;
+        job->_canceled  = true;
+        job->_done.set();
+
+        if ( job->_callback.valid() )
+            job->_callback->onComplete( job );
+    }
+}
+
+void
+TerrainProfileService::run(QueryPool* pool, Job* job)
+{
+    ElevationQuery* query = pool->checkOut();
+    job->_succeeded = computeTerrainProfile( *query, pool->_mapf.getProfile(), job->_route, job->_resolution, job->_profile );
+    pool->checkIn( query );
+
+    job->_done.set();
+
+    if ( job->_callback.valid() )
+        job->_callback->onComplete( job );
+}
+
+osg::ref_ptr<TerrainProfileService::Job>
+TerrainProfileService::computeProfile(const Route& route, double resolution, Callback* callback)
+{
+    osg::ref_ptr<Job> job = new Job( route, resolution, callback );
+    _pool->queue( job.get() );
+    _service->add( new RunJob(_pool.get(), job.get()) );
+    return job;
+}
+
+osg::ref_ptr<TerrainProfileService::Job>
+TerrainProfileService::computeProfile(const GeoPoint& start, const GeoPoint& end, double resolution, Callback* callback)
+{
+    Route route;
+    route.push_back( start );
+    route.push_back( end );
+    return computeProfile( route, resolution, callback );
+}
+
+void
+TerrainProfileService::computeProfiles(const std::vector<Route>& routes, double resolution, JobVector& out_jobs, Callback* callback)
+{
+    out_jobs.reserve( out_jobs.size() + routes.size() );
+    for( std::vector<Route>::const_iterator i = routes.begin(); i != routes.end(); ++i )
+    {
+        out_jobs.push_back( computeProfile(*i, resolution, callback) );
+    }
+}
+
+unsigned
+TerrainProfileService::getNumPendingJobs() const
+{
+    return _service->getNumRequests();
+}
+
+bool
+TerrainProfileService::computeTerrainProfile(ElevationQuery&  query,
+                                             const Profile*   mapProfile,
+                                             const Route&     route,
+                                             double           resolution,
+                                             TerrainProfile&  out_profile)
+{
+    out_profile.clear();
+
+    if ( route.size() < 2 || !mapProfile || resolution <= 0.0 )
+        return false;
+
+    const SpatialReference* geoSRS = route[0].getSRS() ? route[0].getSRS()->getGeographicSRS() : 0L;
+    if ( !geoSRS )
+        return false;
+
+    // generate all the sample points up front so the query runs as one batch.
+    std::vector<osg::Vec3d> points;
+    std::vector<double>     distances;
+    double                  total = 0.0;
+
+    GeoPoint prev = route[0].transform( geoSRS );
+    if ( !prev.isValid() )
+        return false;
+
+    // ElevationQuery takes its resolution in map units, not meters:
+    const SpatialReference* mapSRS = mapProfile->getSRS();
+    double queryRes = mapSRS->getECEF()->transformUnits( resolution, mapSRS, prev.y() );
+
+    points.push_back( osg::Vec3d(prev.x(), prev.y(), 0.0) );
+    distances.push_back( 0.0 );
+
+    for( unsigned i = 1; i < route.size(); ++i )
+    {
+        GeoPoint next = route[i].transform( geoSRS );
+        if ( !next.isValid() )
+            return false;
+
+        double lat1 = osg::DegreesToRadians( prev.y() ), lon1 = osg::DegreesToRadians( prev.x() );
+        double lat2 = osg::DegreesToRadians( next.y() ), lon2 = osg::DegreesToRadians( next.x() );
+
+        double length     = GeoMath::distance( lat1, lon1, lat2, lon2 );
+        unsigned numSteps = (unsigned)osg::maximum( ceil(length/resolution), 1.0 );
+
+        // skip the first sample; it's the end of the previous segment.
+        for( unsigned k = 1; k <= numSteps; ++k )
+        {
+            double t = (double)k / (double)numSteps;
+            double lat, lon;
+            if ( k == numSteps )
+            {
+                lat = lat2;
+                lon = lon2;
+            }
+            else
+            {
+                GeoMath::interpolate( lat1, lon1, lat2, lon2, t, lat, lon );
+            }
+            points.push_back( osg::Vec3d(osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), 0.0) );
+            distances.push_back( total + t*length );
+        }
+
+        total += length;
+        prev = next;
+    }
+
+    std::vector<double> elevations;
+    elevations.reserve( points.size() );
+    if ( !query.getElevations(points, geoSRS, elevations, queryRes) || elevations.size() != points.size() )
+    {
+        OE_WARN << LC << "Elevation query failed" << std::endl;
+        return false;
+    }
+
+    for( unsigned i = 0; i < points.size(); ++i )
+    {
+        out_profile.addElevation( distances[i], elevations[i] );
+    }
+
+    return true;
+}
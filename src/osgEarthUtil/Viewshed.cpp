@@ -0,0 +1,485 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <osgEarthUtil/Viewshed>
+#include <osgEarth/ThreadingUtils>
+#include <OpenThreads/Thread>
+#include <cfloat>
+#include <cmath>
+
+#define LC "[Viewshed] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+//------------------------------------------------------------------------
+
+struct Viewshed::SampleRows
+{
+    void execute() { _viewshed->sampleRows( _first, _count, *_query ); }
+
+    Viewshed*       _viewshed;
+    unsigned        _first, _count;
+    ElevationQuery* _query;
+};
+
+struct Viewshed::MarchRays
+{
+    void execute() { _viewshed->marchRays( _first, _count ); }
+
+    Viewshed* _viewshed;
+    unsigned  _first, _count;
+};
+
+struct Viewshed::RasterizeRows
+{
+    void execute() { _viewshed->rasterizeRows( _first, _count ); }
+
+    Viewshed* _viewshed;
+    unsigned  _first, _count;
+};
+
+//------------------------------------------------------------------------
+
+Viewshed::Viewshed( const Map* map, unsigned numThreads ) :
+_mapf           ( map, Map::ELEVATION_LAYERS ),
+_numThreads     ( numThreads > 0u ? numThreads : (unsigned)osg::maximum(OpenThreads::GetNumberOfProcessors(), 1) ),
+_radius         ( 1000.0 ),
+_resolution     ( 30.0 ),
+_targetHeight   ( 0.0 ),
+_numSpokes      ( 20u ),
+_computeGrid    ( true ),
+_cellSize       ( 30.0 ),
+_queryResolution( 0.0 ),
+_eyeZ           ( 0.0 ),
+_halfSize       ( 0u ),
+_gridSize       ( 0u ),
+_numRays        ( 0u ),
+_numSteps       ( 0u ),
+_visibleFraction( 0.0 )
+{
+    if ( _numThreads > 1u )
+    {
+        _service = new TaskService( "Viewshed", _numThreads );
+    }
+
+    // one query (and tile cache) per thread, kept between runs.
+    for( unsigned i = 0; i < _numThreads; ++i )
+    {
+        _queries.push_back( new ElevationQuery(_mapf) );
+    }
+}
+
+Viewshed::~Viewshed()
+{
+    for( std::vector<ElevationQuery*>::iterator i = _queries.begin(); i != _queries.end(); ++i )
+        delete *i;
+}
+
+bool
+Viewshed::compute()
+{
+    _spokes.clear();
+    _visibleFraction = 0.0;
+
+    if ( !_observer.isValid() || !_mapf.getProfile() )
+    {
+        OE_WARN << LC << "Invalid observer or map" << std::endl;
+        return false;
+    }
+
+    const SpatialReference* mapSRS = _mapf.getProfile()->getSRS();
+    GeoPoint observer = _observer.transform( mapSRS );
+
+    // ElevationQuery takes its resolution in map units, not meters:
+    _queryResolution = mapSRS->getECEF()->transformUnits( _resolution, mapSRS, observer.y() );
+
+    // terrain height under the observer:
+    double groundZ = 0.0;
+    if ( !_queries[0]->getElevation(GeoPoint(mapSRS, observer.x(), observer.y(), 0.0, ALTMODE_ABSOLUTE), groundZ, _queryResolution) )
+    {
+        OE_WARN << LC << "No elevation data at the observer location" << std::endl;
+        return false;
+    }
+
+    double eyeAlt = observer.altitudeMode() == ALTMODE_RELATIVE ? groundZ + observer.z() : observer.z();
+
+    // local east/north/up frame at the observer, at zero altitude:
+    GeoPoint origin( mapSRS, observer.x(), observer.y(), 0.0, ALTMODE_ABSOLUTE );
+    if ( !origin.createLocalToWorld(_local2world) )
+        return false;
+    _world2local.invert( _local2world );
+
+    GeoPoint( mapSRS, observer.x(), observer.y(), eyeAlt, ALTMODE_ABSOLUTE ).toWorld( _eyeWorld );
+    _eyeZ = (_eyeWorld * _world2local).z();
+
+    // size the grid so it just covers the radius. Very large grids are coarsened.
+    const unsigned maxHalfSize = 4096u;
+    _halfSize = (unsigned)ceil( _radius / _resolution );
+    if ( _halfSize > maxHalfSize )
+    {
+        OE_WARN << LC << "Radius/resolution ratio is too large; using a resolution of "
+            << _radius/(double)maxHalfSize << " m" << std::endl;
+        _halfSize = maxHalfSize;
+    }
+    _halfSize = osg::maximum( _halfSize, 1u );
+    _gridSize = 2u*_halfSize + 1u;
+    _cellSize = _radius / (double)_halfSize;
+
+    if ( !sampleTerrain() )
+        return false;
+
+    computeSpokes();
+
+    if ( _computeGrid )
+    {
+        // enough rays that neighboring rays are about one cell apart at the rim.
+        _numRays  = osg::maximum( _numSpokes, (unsigned)ceil(2.0*osg::PI*(double)_halfSize) );
+        _numSteps = _halfSize;
+        _rayVisibility.resize( _numRays * _numSteps );
+
+        unsigned raysPerTask = (_numRays + _numThreads - 1u) / _numThreads;
+        if ( _service.valid() )
+        {
+            Threading::MultiEvent done( _numThreads );
+            for( unsigned i = 0; i < _numThreads; ++i )
+            {
+                ParallelTask<MarchRays>* task = new ParallelTask<MarchRays>( &done );
+                task->_viewshed = this;
+                task->_first    = osg::minimum( i*raysPerTask, _numRays );
+                task->_count    = osg::minimum( raysPerTask, _numRays - task->_first );
+                _service->add( task );
+            }
+            done.wait();
+        }
+        else
+        {
+            marchRays( 0u, _numRays );
+        }
+
+        // a new image each time, since the caller may hold on to the last one.
+        _grid = new osg::Image();
+        _grid->allocateImage( _gridSize, _gridSize, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE );
+        _grid->setInternalTextureFormat( GL_LUMINANCE );
+        _visibleCounts.assign( _gridSize, 0u );
+
+        unsigned rowsPerTask = (_gridSize + _numThreads - 1u) / _numThreads;
+        if ( _service.valid() )
+        {
+            Threading::MultiEvent done( _numThreads );
+            for( unsigned i = 0; i < _numThreads; ++i )
+            {
+                ParallelTask<RasterizeRows>* task = new ParallelTask<RasterizeRows>( &done );
+                task->_viewshed = this;
+                task->_first    = osg::minimum( i*rowsPerTask, _gridSize );
+                task->_count    = osg::minimum( rowsPerTask, _gridSize - task->_first );
+                _service->add( task );
+            }
+            done.wait();
+        }
+        else
+        {
+            rasterizeRows( 0u, _gridSize );
+        }
+
+        // count the cells inside the radius (a disc of half-size radius).
+        double visible = 0.0, inside = 0.0;
+        for( unsigned t = 0; t < _gridSize; ++t )
+        {
+            double dy = (double)t - (double)_halfSize;
+            double w  = floor( sqrt((double)(_halfSize*_halfSize) - dy*dy) );
+            inside  += 2.0*w + 1.0;
+            visible += (double)_visibleCounts[t];
+        }
+        _visibleFraction = inside > 0.0 ? visible/inside : 0.0;
+    }
+    else
+    {
+        _grid = 0L;
+    }
+
+    return true;
+}
+
+bool
+Viewshed::sampleTerrain()
+{
+    _heights.resize( _gridSize * _gridSize );
+
+    unsigned numTasks    = osg::minimum( _numThreads, _gridSize );
+    unsigned rowsPerTask = (_gridSize + numTasks - 1u) / numTasks;
+
+    if ( _service.valid() && numTasks > 1u )
+    {
+        Threading::MultiEvent done( numTasks );
+        for( unsigned i = 0; i < numTasks; ++i )
+        {
+            ParallelTask<SampleRows>* task = new ParallelTask<SampleRows>( &done );
+            task->_viewshed = this;
+            task->_first    = osg::minimum( i*rowsPerTask, _gridSize );
+            task->_count    = osg::minimum( rowsPerTask, _gridSize - task->_first );
+            task->_query    = _queries[i];
+            _service->add( task );
+        }
+        done.wait();
+    }
+    else
+    {
+        sampleRows( 0u, _gridSize, *_queries[0] );
+    }
+
+    return true;
+}
+
+void
+Viewshed::sampleRows( unsigned firstRow, unsigned numRows, ElevationQuery& query )
+{
+    const SpatialReference* mapSRS = _mapf.getProfile()->getSRS();
+
+    std::vector<osg::Vec3d> points;
+    std::vector<double>     elevations;
+    points.reserve( _gridSize );
+    elevations.reserve( _gridSize );
+
+    for( unsigned t = firstRow; t < firstRow+numRows; ++t )
+    {
+        double y = ((double)t - (double)_halfSize) * _cellSize;
+
+        // map coordinates of the row's posts:
+        points.clear();
+        for( unsigned s = 0; s < _gridSize; ++s )
+        {
+            double x = ((double)s - (double)_halfSize) * _cellSize;
+            GeoPoint p;
+            p.fromWorld( mapSRS, osg::Vec3d(x, y, 0.0) * _local2world );
+            points.push_back( osg::Vec3d(p.x(), p.y(), 0.0) );
+        }
+
+        elevations.clear();
+        query.getElevations( points, mapSRS, elevations, _queryResolution );
+
+        // convert the terrain heights into the local frame:
+        float* row = &_heights[t*_gridSize];
+        for( unsigned s = 0; s < _gridSize; ++s )
+        {
+            osg::Vec3d world;
+            GeoPoint( mapSRS, points[s].x(), points[s].y(), elevations[s], ALTMODE_ABSOLUTE ).toWorld( world );
+            row[s] = (float)( (world * _world2local).z() );
+        }
+    }
+}
+
+float
+Viewshed::getHeight( double x, double y ) const
+{
+    double u = osg::clampBetween( x/_cellSize + (double)_halfSize, 0.0, (double)(_gridSize-1u) );
+    double v = osg::clampBetween( y/_cellSize + (double)_halfSize, 0.0, (double)(_gridSize-1u) );
+
+    unsigned s0 = osg::minimum( (unsigned)u, _gridSize-2u );
+    unsigned t0 = osg::minimum( (unsigned)v, _gridSize-2u );
+    float    fu = (float)(u - (double)s0);
+    float    fv = (float)(v - (double)t0);
+
+    const float* r0 = &_heights[t0*_gridSize + s0];
+    const float* r1 = r0 + _gridSize;
+
+    float h0 = r0[0] + (r0[1]-r0[0])*fu;
+    float h1 = r1[0] + (r1[1]-r1[0])*fu;
+    return h0 + (h1-h0)*fv;
+}
+
+void
+Viewshed::marchRays( unsigned firstRay, unsigned numRays )
+{
+    for( unsigned r = firstRay; r < firstRay+numRays; ++r )
+    {
+        double angle = 2.0*osg::PI*(double)r/(double)_numRays;
+        double dx    = cos(angle) * _cellSize;
+        double dy    = sin(angle) * _cellSize;
+
+        unsigned char* out = &_rayVisibility[r*_numSteps];
+
+        // a target is visible if the slope to it is at least the steepest
+        // terrain slope between it and the observer.
+        double maxSlope = -DBL_MAX;
+        for( unsigned k = 1; k <= _numSteps; ++k )
+        {
+            double d = (double)k * _cellSize;
+            double z = (double)getHeight( dx*(double)k, dy*(double)k );
+
+            out[k-1] = (z + _targetHeight - _eyeZ)/d >= maxSlope ? 1 : 0;
+            maxSlope = osg::maximum( maxSlope, (z - _eyeZ)/d );
+        }
+    }
+}
+
+void
+Viewshed::rasterizeRows( unsigned firstRow, unsigned numRows )
+{
+    double radius2 = (double)_halfSize * (double)_halfSize;
+    double rayScale = (double)_numRays / (2.0*osg::PI);
+
+    for( unsigned t = firstRow; t < firstRow+numRows; ++t )
+    {
+        unsigned char* row = _grid->data( 0, t );
+        unsigned visible = 0u;
+        double dy = (double)t - (double)_halfSize;
+
+        for( unsigned s = 0; s < _gridSize; ++s )
+        {
+            double dx = (double)s - (double)_halfSize;
+            double d2 = dx*dx + dy*dy;
+
+            if ( d2 > radius2 )
+            {
+                row[s] = CELL_OUTSIDE;
+                continue;
+            }
+
+            bool isVisible = true;
+            if ( d2 > 0.0 )
+            {
+                // look up the nearest ray sample.
+                double angle = atan2( dy, dx );
+                if ( angle < 0.0 ) angle += 2.0*osg::PI;
+                unsigned ray  = (unsigned)( angle*rayScale + 0.5 ) % _numRays;
+                unsigned step = osg::clampBetween( (unsigned)(sqrt(d2) + 0.5), 1u, _numSteps );
+                isVisible = _rayVisibility[ray*_numSteps + step-1u] != 0;
+            }
+
+            row[s] = isVisible ? CELL_VISIBLE : CELL_HIDDEN;
+            if ( isVisible )
+                ++visible;
+        }
+
+        _visibleCounts[t] = visible;
+    }
+}
+
+void
+Viewshed::computeSpokes()
+{
+    // spokes are few, so they run in this thread. Each one is a level line
+    // from the eye, marched at half-cell steps.
+    unsigned numSteps = 2u * _halfSize;
+    double   step     = _radius / (double)numSteps;
+
+    _spokes.resize( _numSpokes );
+    for( unsigned i = 0; i < _numSpokes; ++i )
+    {
+        Spoke& spoke = _spokes[i];
+        spoke._angle  = 2.0*osg::PI*(double)i/(double)_numSpokes;
+        spoke._hasLOS = true;
+
+        double ux = cos(spoke._angle), uy = sin(spoke._angle);
+        spoke._endWorld = osg::Vec3d(ux*_radius, uy*_radius, _eyeZ) * _local2world;
+
+        double prevD = 0.0, prevZ = (double)getHeight( 0.0, 0.0 );
+        for( unsigned k = 1; k <= numSteps; ++k )
+        {
+            double d = (double)k * step;
+            double z = (double)getHeight( ux*d, uy*d );
+            if ( z >= _eyeZ )
+            {
+                // interpolate to where the terrain crosses the sight line.
+                double f = z > prevZ ? osg::clampBetween( (_eyeZ - prevZ)/(z - prevZ), 0.0, 1.0 ) : 0.0;
+                double hitD = prevD + f*(d - prevD);
+                spoke._hasLOS   = false;
+                spoke._hitWorld = osg::Vec3d(ux*hitD, uy*hitD, _eyeZ) * _local2world;
+                break;
+            }
+            prevD = d;
+            prevZ = z;
+        }
+    }
+}
+
+GeoPoint
+Viewshed::getCellLocation( unsigned s, unsigned t ) const
+{
+    if ( !_mapf.getProfile() || _gridSize == 0u )
+        return GeoPoint::INVALID;
+
+    double x = ((double)s - (double)_halfSize) * _cellSize;
+    double y = ((double)t - (double)_halfSize) * _cellSize;
+    double z = s < _gridSize && t < _gridSize ? (double)_heights[t*_gridSize + s] : 0.0;
+
+    GeoPoint p;
+    p.fromWorld( _mapf.getProfile()->getSRS(), osg::Vec3d(x, y, z) * _local2world );
+    return p;
+}
+
+bool
+Viewshed::computeLineOfSight(ElevationQuery&         query,
+                             const SpatialReference* mapSRS,
+                             const osg::Vec3d&       startWorld,
+                             const osg::Vec3d&       endWorld,
+                             double                  resolution,
+                             osg::Vec3d&             out_hitWorld)
+{
+    osg::Vec3d dir = endWorld - startWorld;
+    double length  = dir.length();
+    if ( length <= 0.0 || !mapSRS )
+        return true;
+
+    unsigned numSteps = (unsigned)osg::maximum( ceil(length / osg::maximum(resolution, 0.01)), 1.0 );
+
+    GeoPoint startMap;
+    startMap.fromWorld( mapSRS, startWorld );
+    double queryRes = mapSRS->getECEF()->transformUnits( resolution, mapSRS, startMap.y() );
+
+    // height of the sight line above the terrain at parameter t (negative = under ground).
+    struct Clearance
+    {
+        static bool get( ElevationQuery& query, const SpatialReference* srs, const osg::Vec3d& world, double res, double& out )
+        {
+            GeoPoint p;
+            p.fromWorld( srs, world );
+            double h;
+            if ( !query.getElevation(GeoPoint(srs, p.x(), p.y(), 0.0, ALTMODE_ABSOLUTE), h, res) )
+                return false;
+            out = p.z() - h;
+            return true;
+        }
+    };
+
+    double prevT = 0.0;
+    for( unsigned i = 1; i <= numSteps; ++i )
+    {
+        double t = (double)i / (double)numSteps;
+        double clearance;
+        if ( Clearance::get(query, mapSRS, startWorld + dir*t, queryRes, clearance) && clearance < 0.0 )
+        {
+            // bisect between the last clear sample and this one.
+            double lo = prevT, hi = t;
+            for( unsigned j = 0; j < 8; ++j )
+            {
+                double mid = 0.5*(lo + hi);
+                if ( Clearance::get(query, mapSRS, startWorld + dir*mid, queryRes, clearance) && clearance < 0.0 )
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+            out_hitWorld = startWorld + dir*hi;
+            return false;
+        }
+        prevT = t;
+    }
+
+    return true;
+}